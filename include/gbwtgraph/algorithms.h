@@ -22,6 +22,9 @@ namespace gbwtgraph
 /*
   Return the weakly connected components in the graph. The components are sorted by
   the minimum node id, and the node ids in each component are also sorted.
+
+  The components are determined with a concurrent union-find structure over the node
+  id range, using parallel iteration over the handles of the graph.
 */
 std::vector<std::vector<nid_t>> weakly_connected_components(const HandleGraph& graph);
 
@@ -1,6 +1,13 @@
 #ifndef GBWTGRAPH_CACHED_GBWTGRAPH_H
 #define GBWTGRAPH_CACHED_GBWTGRAPH_H
 
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "gbwtgraph.h"
@@ -14,12 +21,179 @@ namespace gbwtgraph
 
 //------------------------------------------------------------------------------
 
+/*
+  A bounded cache of decompressed GBWT records that can be shared by multiple
+  threads. The cache is split into shards by node identifier, and each shard is
+  protected by its own reader-writer lock. Cache hits only take a shared lock,
+  and inserting a record takes an exclusive lock. Records are decompressed
+  outside the lock and returned as reference-counted pointers, so an evicted
+  record remains valid for threads that are still using it. `visit()` uses a
+  cached record under the shared lock without copying the pointer.
+
+  Each shard holds at most `capacity / SHARDS` records using approximately at
+  most `budget / SHARDS` bytes. When a shard is full, records are evicted using
+  the CLOCK approximation of LRU. Records that would not fit in an empty shard
+  are returned but not cached.
+
+  Path walking with `LF()` only uses the cache for records larger than
+  `min_bytes` bytes in compressed form. Smaller records are faster to use
+  directly. The cache remembers the records that were too large to cache, and
+  `LF()` uses them directly instead of decompressing them again.
+
+  Records for nodes that are not in the GBWT index are not cached; the lookup
+  returns a null pointer for them.
+*/
+
+class SharedRecordCache
+{
+public:
+  typedef std::shared_ptr<const gbwt::DecompressedRecord> record_type;
+
+  // Number of shards. Must be a power of 2.
+  constexpr static size_t SHARDS = 64;
+
+  // Default capacity in records.
+  constexpr static size_t DEFAULT_CAPACITY = 65536;
+
+  // Default memory budget for the decompressed records (1 GiB).
+  constexpr static size_t DEFAULT_BUDGET = size_t(1) << 30;
+
+  // Default compressed size threshold for caching records when walking paths.
+  constexpr static size_t LARGE_RECORD_BYTES = 1024;
+
+  explicit SharedRecordCache(const gbwt::GBWT& index, size_t capacity = DEFAULT_CAPACITY,
+                             size_t budget = DEFAULT_BUDGET, size_t min_bytes = 0);
+
+  SharedRecordCache(const SharedRecordCache&) = delete;
+  SharedRecordCache& operator=(const SharedRecordCache&) = delete;
+
+  const gbwt::GBWT* index;
+
+  // Returns the decompressed record for the node or a null pointer if the node
+  // is not in the index. Thread-safe.
+  record_type record(gbwt::node_type node) const;
+
+  // Calls `f(record)` with the decompressed record for the node and returns
+  // true, or returns false if the node is not in the index. A cached record is
+  // used under a shared lock, so `f` should be short and must not use the cache.
+  // Thread-safe.
+  template<class Function>
+  bool visit(gbwt::node_type node, const Function& f) const;
+
+  // Returns the position following the given position on the same path.
+  // Thread-safe.
+  gbwt::edge_type LF(gbwt::edge_type position) const;
+
+  // Maximum number of cached records.
+  size_t capacity() const { return this->shard_capacity * SHARDS; }
+
+  // Memory budget for the cached records in bytes.
+  size_t budget() const { return this->shard_budget * SHARDS; }
+
+  // Compressed size threshold for using the cache in `LF()`.
+  size_t min_bytes() const { return this->record_threshold; }
+
+  // Current number of cached records / their approximate size in bytes.
+  // Thread-safe but only approximate if the cache is being used concurrently.
+  size_t size() const;
+  size_t bytes() const;
+
+  // Number of lookups answered from the cache / by decompressing the record.
+  size_t hits() const;
+  size_t misses() const;
+
+  // Removes all cached records and resets the statistics. Thread-safe.
+  void clear();
+
+  // Approximate size of a decompressed record in bytes.
+  static size_t record_bytes(const gbwt::DecompressedRecord& record);
+
+private:
+  struct Slot
+  {
+    gbwt::node_type   node = gbwt::ENDMARKER;
+    record_type       record; // Null if the slot is free.
+    size_t            bytes = 0;
+    std::atomic<bool> referenced; // Set by cache hits under a shared lock.
+
+    Slot() : referenced(false) {}
+    Slot(const Slot& source) :
+      node(source.node), record(source.record), bytes(source.bytes),
+      referenced(source.referenced.load(std::memory_order_relaxed))
+    {
+    }
+  };
+
+  struct Shard
+  {
+    std::shared_timed_mutex                     lock;
+    std::unordered_map<gbwt::node_type, size_t> slot_of;
+    std::vector<Slot>                           slots;
+    std::vector<size_t>                         free_slots;
+    size_t                                      bytes = 0;
+    size_t                                      hand = 0; // Next eviction candidate.
+
+    // Nodes with records too large to cache.
+    std::unordered_set<gbwt::node_type> uncachable;
+
+    // Per-shard statistics, so that hits in different shards do not write to
+    // the same cache line.
+    std::atomic<size_t> hits, misses;
+
+    Shard() : hits(0), misses(0) {}
+
+    // Returns the slot for the node or a null pointer if it is not cached.
+    // Marks the slot as recently used. The caller must hold the lock.
+    const Slot* find(gbwt::node_type node)
+    {
+      auto iter = this->slot_of.find(node);
+      if(iter == this->slot_of.end()) { return nullptr; }
+      Slot& slot = this->slots[iter->second];
+      if(!(slot.referenced.load(std::memory_order_relaxed))) { slot.referenced.store(true, std::memory_order_relaxed); }
+      this->hits.fetch_add(1, std::memory_order_relaxed);
+      return &slot;
+    }
+  };
+
+  // Both orientations of a node go to the same shard.
+  static size_t shard_of(gbwt::node_type node) { return (node >> 1) & (SHARDS - 1); }
+
+  // Handles a cache miss by decompressing the record and inserting it into the
+  // shard. Returns a null pointer if the node is not in the index.
+  record_type load(Shard& shard, gbwt::node_type node) const;
+
+  size_t                            shard_capacity, shard_budget, record_threshold;
+  mutable std::array<Shard, SHARDS> shards;
+};
+
+template<class Function>
+bool
+SharedRecordCache::visit(gbwt::node_type node, const Function& f) const
+{
+  Shard& shard = this->shards[shard_of(node)];
+  {
+    std::shared_lock<std::shared_timed_mutex> guard(shard.lock);
+    const Slot* slot = shard.find(node);
+    if(slot != nullptr) { f(*(slot->record)); return true; }
+  }
+
+  record_type result = this->load(shard, node);
+  if(result == nullptr) { return false; }
+  f(*result);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+
 /*
   A variant of GBWTGraph intended for algorithms that repeatedly access the edges
   of a small subgraph. Provides an easy way of using the cached GBWTGraph interface
   in HandleGraph algorithms.
   NOTE: The cache is not thread-safe. Use a separate CachedGBWTGraph for each
-  thread.
+  thread. Threads working on the same region can avoid decompressing the same
+  records independently by constructing their graphs with a SharedRecordCache.
+  The shared cache is used for unidirectional search states and for the edges;
+  bidirectional search still uses the private cache.
   NOTE: For performance reasons, this implementations replicates much of GBWTGraph
   functionality instead of calling it through virtual functions.
 */
@@ -34,12 +208,16 @@ public:
 
   explicit CachedGBWTGraph(const GBWTGraph& graph);
 
+  // The shared cache must be for the same GBWT index and outlive the graph.
+  CachedGBWTGraph(const GBWTGraph& graph, const SharedRecordCache& shared);
+
   void swap(CachedGBWTGraph& another);
   CachedGBWTGraph& operator=(const CachedGBWTGraph& source);
   CachedGBWTGraph& operator=(CachedGBWTGraph&& source);
 
   const GBWTGraph* graph;
   gbwt::CachedGBWT cache;
+  const SharedRecordCache* shared;
 
 //------------------------------------------------------------------------------
 
@@ -145,14 +323,22 @@ public:
 
   // Convert handle_t to gbwt::SearchState.
   // Note that the state may be empty if the handle does not correspond to a real node.
-  gbwt::SearchState get_state(const handle_t& handle) const { return this->cache.find(handle_to_node(handle)); }
+  gbwt::SearchState get_state(const handle_t& handle) const
+  {
+    if(this->shared != nullptr) { return this->graph->get_state(*(this->shared), handle); }
+    return this->cache.find(handle_to_node(handle));
+  }
 
   // Convert handle_t to gbwt::BidirectionalState.
   // Note that the state may be empty if the handle does not correspond to a real node.
   gbwt::BidirectionalState get_bd_state(const handle_t& handle) const { return this->cache.bdFind(handle_to_node(handle)); }
 
   // Get the search state corresponding to the vector of handles.
-  gbwt::SearchState find(const std::vector<handle_t>& path) const { return this->graph->find(this->cache, path); }
+  gbwt::SearchState find(const std::vector<handle_t>& path) const
+  {
+    if(this->shared != nullptr) { return this->graph->find(*(this->shared), path); }
+    return this->graph->find(this->cache, path);
+  }
 
   // Get the bidirectional search state corresponding to the vector of handles.
   gbwt::BidirectionalState bd_find(const std::vector<handle_t>& path) const { return this->graph->bd_find(this->cache, path); }
@@ -162,6 +348,7 @@ public:
   // Note that this does not visit empty successor states.
   bool follow_paths(gbwt::SearchState state, const std::function<bool(const gbwt::SearchState&)>& iteratee) const
   {
+    if(this->shared != nullptr) { return this->graph->follow_paths(*(this->shared), state, iteratee); }
     return this->graph->follow_paths(this->cache, state, iteratee);
   }
 
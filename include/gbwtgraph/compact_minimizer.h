@@ -0,0 +1,695 @@
+#ifndef GBWTGRAPH_COMPACT_MINIMIZER_H
+#define GBWTGRAPH_COMPACT_MINIMIZER_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "minimizer.h"
+
+/*
+  compact_minimizer.h: A frozen minimizer index with a compact representation.
+*/
+
+namespace gbwtgraph
+{
+
+//------------------------------------------------------------------------------
+
+/*
+  An array of bit-packed fields of up to 64 bits. The fields are addressed by
+  their bit offsets, and a field may span two consecutive words.
+*/
+struct PackedBits
+{
+  std::vector<std::uint64_t> words;
+
+  constexpr static size_t WORD_BITS = 64;
+
+  PackedBits() {}
+  explicit PackedBits(size_t bits) : words((bits + WORD_BITS - 1) / WORD_BITS, 0) {}
+
+  std::uint64_t get(size_t bit, size_t width) const
+  {
+    if(width == 0) { return 0; }
+    size_t word = bit / WORD_BITS, offset = bit % WORD_BITS;
+    std::uint64_t result = this->words[word] >> offset;
+    if(offset + width > WORD_BITS) { result |= this->words[word + 1] << (WORD_BITS - offset); }
+    return result & mask(width);
+  }
+
+  void set(size_t bit, size_t width, std::uint64_t value)
+  {
+    if(width == 0) { return; }
+    value &= mask(width);
+    size_t word = bit / WORD_BITS, offset = bit % WORD_BITS;
+    this->words[word] = (this->words[word] & ~(mask(width) << offset)) | (value << offset);
+    if(offset + width > WORD_BITS)
+    {
+      size_t high_bits = offset + width - WORD_BITS;
+      this->words[word + 1] = (this->words[word + 1] & ~mask(high_bits)) | (value >> (WORD_BITS - offset));
+    }
+  }
+
+  size_t bytes() const { return this->words.size() * sizeof(std::uint64_t); }
+
+  bool operator==(const PackedBits& another) const { return (this->words == another.words); }
+  bool operator!=(const PackedBits& another) const { return !(this->operator==(another)); }
+
+  // Mask for the lowest `width` bits.
+  static std::uint64_t mask(size_t width)
+  {
+    return (width >= WORD_BITS ? ~std::uint64_t(0) : (std::uint64_t(1) << width) - 1);
+  }
+
+  // Number of bits required for representing the value.
+  static size_t bit_length(std::uint64_t value)
+  {
+    size_t result = 0;
+    while(value > 0) { result++; value >>= 1; }
+    return result;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+/*
+  A frozen minimizer index built from a finished MinimizerIndex. The index
+  answers the same queries as the source index using much less memory, but
+  find() decodes the occurrences into a caller-provided buffer instead of
+  returning a pointer to the internal representation. The index selects the
+  same minimizers as the source index, including the downweighting of
+  frequent kmers.
+
+  The keys are stored in slots given by a minimal perfect hash function:
+
+    Limasset, Rizk, Chikhi, and Peterlongo: Fast and scalable minimal perfect
+    hashing for massive key sets. SEA 2017.
+
+  The function consists of up to MAX_LEVELS bit vectors. Level i has GAMMA
+  bits for each key that was not placed on the earlier levels. A key is placed
+  on the first level where no other remaining key hashes to the same bit, and
+  its slot is the number of set bits before that bit over all levels. The few
+  keys that cannot be placed on any level are stored in a sorted fallback
+  list, and their slots come after the other keys. With GAMMA = 2, the
+  function uses about 3.7 bits/key.
+
+  Because the function maps any key to some slot, we store the keys in slot
+  order and verify the key found in the slot. The occurrence lists are
+  concatenated in slot order, with the boundaries stored as bit-packed
+  offsets. Each 64-bit word in the value type is bit-packed using the number
+  of bits required for the largest value of that word in the index.
+
+  Building the index is sequential and requires memory for the source index
+  and temporary structures of about 40 bytes/key.
+*/
+template<class KeyType, class ValueType>
+class CompactMinimizerIndex
+{
+public:
+  typedef KeyType key_type;
+  typedef ValueType value_type;
+  typedef Kmer<key_type> minimizer_type;
+  typedef MinimizerIndex<key_type, value_type> source_type;
+  typedef std::pair<const value_type*, size_t> result_type;
+
+  constexpr static size_t GAMMA = 2;
+  constexpr static size_t MAX_LEVELS = 32;
+  constexpr static size_t RANK_BLOCK = 8; // Words per rank sample.
+  constexpr static size_t PREFETCH_DISTANCE = 16;
+  constexpr static size_t VALUE_WORDS = sizeof(value_type) / sizeof(std::uint64_t);
+
+  constexpr static std::uint32_t TAG = 0x31434D51;
+  constexpr static std::uint32_t VERSION = 1;
+
+  static_assert(sizeof(value_type) % sizeof(std::uint64_t) == 0, "CompactMinimizerIndex: The size of the value type must be a multiple of 64 bits");
+
+//------------------------------------------------------------------------------
+
+  CompactMinimizerIndex() :
+    parameters(),
+    placed_keys(0), value_count(0),
+    offset_width(0), value_width(0)
+  {
+    this->field_widths.fill(0);
+    this->level_starts.push_back(0);
+    this->ranks.push_back(0);
+  }
+
+  // Builds the compact index from the source index.
+  explicit CompactMinimizerIndex(const source_type& source) :
+    parameters(source.empty_copy()),
+    placed_keys(0), value_count(source.number_of_values()),
+    offset_width(0), value_width(0)
+  {
+    typedef typename KmerIndex<key_type, value_type>::cell_type cell_type;
+
+    std::vector<key_type> source_keys; source_keys.reserve(source.size());
+    std::vector<result_type> lists; lists.reserve(source.size());
+    source.for_each_minimizer([&](const cell_type& cell) -> bool
+    {
+      key_type key = cell.first; key.clear_pointer();
+      source_keys.push_back(key);
+      lists.push_back(source.occurrences(cell));
+      return true;
+    });
+
+    this->build_hash_function(source_keys);
+
+    // Permute the keys and the lists into slot order.
+    std::vector<size_t> order(source_keys.size());
+    for(size_t i = 0; i < source_keys.size(); i++) { order[this->find_slot(source_keys[i])] = i; }
+    this->keys.resize(source_keys.size());
+    for(size_t slot = 0; slot < order.size(); slot++) { this->keys[slot] = source_keys[order[slot]]; }
+    source_keys = std::vector<key_type>();
+
+    this->build_values(lists, order);
+  }
+
+  void swap(CompactMinimizerIndex& another)
+  {
+    if(&another == this) { return; }
+    this->parameters.swap(another.parameters);
+    this->levels.swap(another.levels);
+    this->level_starts.swap(another.level_starts);
+    this->ranks.swap(another.ranks);
+    this->fallback.swap(another.fallback);
+    std::swap(this->placed_keys, another.placed_keys);
+    this->keys.swap(another.keys);
+    this->offsets.words.swap(another.offsets.words);
+    this->values.words.swap(another.values.words);
+    std::swap(this->value_count, another.value_count);
+    std::swap(this->offset_width, another.offset_width);
+    std::swap(this->field_widths, another.field_widths);
+    std::swap(this->value_width, another.value_width);
+  }
+
+  bool operator==(const CompactMinimizerIndex& another) const
+  {
+    return (this->parameters == another.parameters &&
+      this->levels == another.levels &&
+      this->level_starts == another.level_starts &&
+      this->fallback == another.fallback &&
+      this->keys == another.keys &&
+      this->offsets == another.offsets &&
+      this->values == another.values &&
+      this->value_count == another.value_count &&
+      this->offset_width == another.offset_width &&
+      this->field_widths == another.field_widths);
+  }
+
+  bool operator!=(const CompactMinimizerIndex& another) const { return !(this->operator==(another)); }
+
+  // Serialize the index to the ostream. Returns the number of bytes written and
+  // true if the serialization was successful.
+  // Serialization is only defined when the value type is PositionPayload.
+  std::pair<size_t, bool> serialize(std::ostream& out) const
+  {
+    static_assert(std::is_same<value_type, PositionPayload>::value, "CompactMinimizerIndex serialization is only defined for PositionPayload values");
+    size_t bytes = 0;
+    bool ok = true;
+
+    // The parameters are an empty minimizer index.
+    std::pair<size_t, bool> result = this->parameters.serialize(out);
+    bytes += result.first; ok &= result.second;
+
+    bytes += io::serialize(out, TAG, ok);
+    bytes += io::serialize(out, VERSION, ok);
+    bytes += io::serialize(out, this->value_count, ok);
+    bytes += io::serialize(out, this->offset_width, ok);
+    bytes += io::serialize(out, this->field_widths, ok);
+    bytes += io::serialize_vector(out, this->levels, ok);
+    bytes += io::serialize_vector(out, this->level_starts, ok);
+    bytes += io::serialize_vector(out, this->ranks, ok);
+    bytes += io::serialize_vector(out, this->fallback, ok);
+    bytes += io::serialize_vector(out, this->keys, ok);
+    bytes += io::serialize_vector(out, this->offsets.words, ok);
+    bytes += io::serialize_vector(out, this->values.words, ok);
+
+    if(!ok)
+    {
+      std::cerr << "CompactMinimizerIndex::serialize(): Serialization failed" << std::endl;
+    }
+
+    return std::make_pair(bytes, ok);
+  }
+
+  // Load the index from the istream and return true if successful.
+  // Serialization is only defined when the value type is PositionPayload.
+  bool deserialize(std::istream& in)
+  {
+    static_assert(std::is_same<value_type, PositionPayload>::value, "CompactMinimizerIndex serialization is only defined for PositionPayload values");
+    CompactMinimizerIndex empty;
+    this->swap(empty);
+
+    if(!(this->parameters.deserialize(in))) { return false; }
+
+    std::uint32_t tag = 0, version = 0;
+    bool ok = io::load(in, tag) && io::load(in, version);
+    if(ok && (tag != TAG || version != VERSION))
+    {
+      std::cerr << "CompactMinimizerIndex::deserialize(): Invalid tag or version: " << tag << ", " << version << std::endl;
+      ok = false;
+    }
+    ok = ok && io::load(in, this->value_count) && io::load(in, this->offset_width) && io::load(in, this->field_widths);
+    ok = ok && io::load_vector(in, this->levels) && io::load_vector(in, this->level_starts) && io::load_vector(in, this->ranks);
+    ok = ok && io::load_vector(in, this->fallback) && io::load_vector(in, this->keys);
+    ok = ok && io::load_vector(in, this->offsets.words) && io::load_vector(in, this->values.words);
+
+    // Sanity checks.
+    if(ok)
+    {
+      this->value_width = 0;
+      for(size_t width : this->field_widths) { ok &= (width <= PackedBits::WORD_BITS); this->value_width += width; }
+      ok &= (this->offset_width <= PackedBits::WORD_BITS);
+      ok &= (!(this->level_starts.empty()) && this->level_starts.back() == this->levels.size() * PackedBits::WORD_BITS);
+      ok &= (this->ranks.size() == this->levels.size() / RANK_BLOCK + 1);
+      ok &= (this->offsets.words.size() == PackedBits((this->keys.size() + 1) * this->offset_width).words.size());
+      ok &= (this->values.words.size() == PackedBits(this->value_count * this->value_width).words.size());
+    }
+    if(ok)
+    {
+      this->placed_keys = this->ranks.back() + this->count_ones(this->levels.size() / RANK_BLOCK * RANK_BLOCK, this->levels.size());
+      ok &= (this->placed_keys + this->fallback.size() == this->keys.size());
+    }
+
+    if(!ok)
+    {
+      std::cerr << "CompactMinimizerIndex::deserialize(): Index loading failed" << std::endl;
+      CompactMinimizerIndex empty;
+      this->swap(empty);
+    }
+
+    return ok;
+  }
+
+//------------------------------------------------------------------------------
+
+  /*
+    Finding minimizers. These use the parameters of the source index.
+  */
+
+  std::vector<minimizer_type> minimizers(std::string::const_iterator begin, std::string::const_iterator end) const
+  {
+    return this->parameters.minimizers(begin, end);
+  }
+
+  std::vector<minimizer_type> minimizers(const std::string& str) const
+  {
+    return this->parameters.minimizers(str);
+  }
+
+  std::vector<std::tuple<minimizer_type, size_t, size_t>> minimizer_regions(std::string::const_iterator begin, std::string::const_iterator end) const
+  {
+    return this->parameters.minimizer_regions(begin, end);
+  }
+
+  std::vector<std::tuple<minimizer_type, size_t, size_t>> minimizer_regions(const std::string& str) const
+  {
+    return this->parameters.minimizer_regions(str);
+  }
+
+  std::vector<minimizer_type> syncmers(std::string::const_iterator begin, std::string::const_iterator end) const
+  {
+    return this->parameters.syncmers(begin, end);
+  }
+
+  std::vector<minimizer_type> syncmers(const std::string& str) const
+  {
+    return this->parameters.syncmers(str);
+  }
+
+//------------------------------------------------------------------------------
+
+  /*
+    Queries.
+  */
+
+  /*
+    Decodes the occurrences of the given minimizer into the buffer. Returns a
+    pointer to the occurrences and the number of occurrences, like
+    MinimizerIndex::find(). The pointer is valid until the buffer is modified.
+  */
+  result_type find(const minimizer_type& minimizer, std::vector<value_type>& buffer) const
+  {
+    buffer.clear();
+    size_t slot = this->find_key(minimizer);
+    if(slot >= this->size()) { return result_type(nullptr, 0); }
+    buffer.resize(this->list_end(slot) - this->list_start(slot));
+    this->decode(slot, buffer.data());
+    return result_type(buffer.data(), buffer.size());
+  }
+
+  /*
+    Batched version of find(). Decodes the occurrences of all minimizers into
+    the buffer and sets the results to point to it. The hash function and the
+    slots are prefetched ahead of the lookups, which hides much of the memory
+    latency when the index is large. Empty minimizers have no occurrences.
+  */
+  void find(const std::vector<minimizer_type>& minimizers, std::vector<result_type>& results, std::vector<value_type>& buffer) const
+  {
+    size_t n = minimizers.size();
+    results.resize(n);
+    buffer.clear();
+    if(this->empty())
+    {
+      for(result_type& result : results) { result = result_type(nullptr, 0); }
+      return;
+    }
+
+    // Four-stage pipeline: prefetch the first level of the hash function,
+    // find the slot and prefetch it, verify the key and prefetch the values,
+    // and finally decode the occurrences.
+    constexpr size_t SLOT_DISTANCE = PREFETCH_DISTANCE / 2, VERIFY_DISTANCE = 3 * PREFETCH_DISTANCE / 4;
+    std::array<size_t, PREFETCH_DISTANCE> slots;
+    for(size_t i = 0; i < n + PREFETCH_DISTANCE; i++)
+    {
+      if(i < n && !(minimizers[i].empty()))
+      {
+        size_t word = this->level_bit(minimizers[i].key.hash(), 0) / PackedBits::WORD_BITS;
+        __builtin_prefetch(this->levels.data() + word);
+        __builtin_prefetch(this->ranks.data() + word / RANK_BLOCK);
+      }
+      if(i >= SLOT_DISTANCE && i - SLOT_DISTANCE < n)
+      {
+        size_t j = i - SLOT_DISTANCE;
+        size_t slot = (minimizers[j].empty() ? this->size() : this->find_slot(minimizers[j].key));
+        if(slot < this->size())
+        {
+          __builtin_prefetch(this->keys.data() + slot);
+          __builtin_prefetch(this->offsets.words.data() + slot * this->offset_width / PackedBits::WORD_BITS);
+        }
+        slots[j % PREFETCH_DISTANCE] = slot;
+      }
+      if(i >= VERIFY_DISTANCE && i - VERIFY_DISTANCE < n)
+      {
+        size_t j = i - VERIFY_DISTANCE;
+        size_t& slot = slots[j % PREFETCH_DISTANCE];
+        if(slot < this->size() && this->keys[slot] == minimizers[j].key)
+        {
+          __builtin_prefetch(this->values.words.data() + this->list_start(slot) * this->value_width / PackedBits::WORD_BITS);
+        }
+        else { slot = this->size(); }
+      }
+      if(i >= PREFETCH_DISTANCE)
+      {
+        size_t j = i - PREFETCH_DISTANCE;
+        size_t slot = slots[j % PREFETCH_DISTANCE];
+        results[j].second = 0;
+        if(slot < this->size())
+        {
+          size_t start = buffer.size();
+          buffer.resize(start + this->list_end(slot) - this->list_start(slot));
+          this->decode(slot, buffer.data() + start);
+          results[j].second = buffer.size() - start;
+        }
+      }
+    }
+
+    // Now that the buffer will no longer be reallocated, set the pointers.
+    const value_type* ptr = buffer.data();
+    for(result_type& result : results)
+    {
+      result.first = (result.second > 0 ? ptr : nullptr);
+      ptr += result.second;
+    }
+  }
+
+  // Returns the number of occurrences of the minimizer.
+  size_t count(const minimizer_type& minimizer) const
+  {
+    size_t slot = this->find_key(minimizer);
+    if(slot >= this->size()) { return 0; }
+    return this->list_end(slot) - this->list_start(slot);
+  }
+
+  // Returns true if the index contains the minimizer.
+  bool contains(const minimizer_type& minimizer) const
+  {
+    return (this->find_key(minimizer) < this->size());
+  }
+
+//------------------------------------------------------------------------------
+
+  /*
+    Statistics.
+  */
+
+  size_t k() const { return this->parameters.k(); }
+  size_t w() const { return this->parameters.w(); }
+  size_t s() const { return this->parameters.s(); }
+  bool uses_syncmers() const { return this->parameters.uses_syncmers(); }
+  bool uses_weighted_minimizers() const { return this->parameters.uses_weighted_minimizers(); }
+  size_t window_bp() const { return this->parameters.window_bp(); }
+
+  // Number of keys in the index.
+  size_t size() const { return this->keys.size(); }
+
+  // Is the index empty.
+  bool empty() const { return (this->size() == 0); }
+
+  // Number of values (minimizer occurrences) in the index.
+  size_t number_of_values() const { return this->value_count; }
+
+  // Number of keys that could not be placed by the hash function.
+  size_t fallback_keys() const { return this->fallback.size(); }
+
+  // Number of bits used for each value.
+  size_t bits_per_value() const { return this->value_width; }
+
+  // Approximate size of the index in bytes, excluding the parameters.
+  size_t bytes() const
+  {
+    return this->levels.size() * sizeof(std::uint64_t) +
+      this->level_starts.size() * sizeof(size_t) +
+      this->ranks.size() * sizeof(size_t) +
+      this->fallback.size() * sizeof(key_type) +
+      this->keys.size() * sizeof(key_type) +
+      this->offsets.bytes() + this->values.bytes();
+  }
+
+//------------------------------------------------------------------------------
+
+  /*
+    Internal implementation.
+  */
+
+private:
+  source_type                parameters;   // An empty index with the same parameters.
+
+  // Minimal perfect hash function.
+  std::vector<std::uint64_t> levels;       // Concatenated levels, each a multiple of 64 bits.
+  std::vector<size_t>        level_starts; // Bit offset of each level, and the total length.
+  std::vector<size_t>        ranks;        // Set bits before each block of RANK_BLOCK words.
+  std::vector<key_type>      fallback;     // Sorted keys that could not be placed.
+  size_t                     placed_keys;
+
+  // Keys and occurrences in slot order.
+  std::vector<key_type>      keys;
+  PackedBits                 offsets;
+  PackedBits                 values;
+  size_t                     value_count;
+  size_t                     offset_width;
+  std::array<size_t, VALUE_WORDS> field_widths;
+  size_t                     value_width;
+
+  // Hash value for the key on the given level.
+  static size_t level_hash(size_t key_hash, size_t level)
+  {
+    return (level == 0 ? key_hash : wang_hash_64(key_hash + level * 0x9E3779B97F4A7C15ull));
+  }
+
+  // Maps the hash to [0, size) using the high bits of the hash.
+  static size_t reduce(size_t hash, size_t size)
+  {
+    return (static_cast<unsigned __int128>(hash) * size) >> 64;
+  }
+
+  // Bit offset of the key on the given level.
+  size_t level_bit(size_t key_hash, size_t level) const
+  {
+    size_t start = this->level_starts[level], size = this->level_starts[level + 1] - start;
+    return start + reduce(level_hash(key_hash, level), size);
+  }
+
+  size_t levels_used() const { return this->level_starts.size() - 1; }
+
+  bool get_bit(size_t bit) const
+  {
+    return (this->levels[bit / PackedBits::WORD_BITS] >> (bit % PackedBits::WORD_BITS)) & 1;
+  }
+
+  // Number of set bits in levels[from, to).
+  size_t count_ones(size_t from, size_t to) const
+  {
+    size_t result = 0;
+    for(size_t i = from; i < to; i++) { result += sdsl::bits::cnt(this->levels[i]); }
+    return result;
+  }
+
+  // Number of set bits in levels before the given bit.
+  size_t rank(size_t bit) const
+  {
+    size_t word = bit / PackedBits::WORD_BITS;
+    size_t block_start = word / RANK_BLOCK * RANK_BLOCK;
+    size_t result = this->ranks[word / RANK_BLOCK] + this->count_ones(block_start, word);
+    result += sdsl::bits::cnt(this->levels[word] & PackedBits::mask(bit % PackedBits::WORD_BITS));
+    return result;
+  }
+
+  // Returns the slot the hash function assigns to the key, or size() if the
+  // key is not in the index. The caller must still verify the key in the slot.
+  size_t find_slot(key_type key) const
+  {
+    size_t key_hash = key.hash();
+    for(size_t level = 0; level < this->levels_used(); level++)
+    {
+      size_t bit = this->level_bit(key_hash, level);
+      if(this->get_bit(bit)) { return this->rank(bit); }
+    }
+    auto iter = std::lower_bound(this->fallback.begin(), this->fallback.end(), key);
+    if(iter != this->fallback.end() && *iter == key) { return this->placed_keys + (iter - this->fallback.begin()); }
+    return this->size();
+  }
+
+  // Returns the slot of the minimizer, or size() if the index does not contain it.
+  size_t find_key(const minimizer_type& minimizer) const
+  {
+    if(minimizer.empty() || this->empty()) { return this->size(); }
+    size_t slot = this->find_slot(minimizer.key);
+    if(slot < this->size() && this->keys[slot] == minimizer.key) { return slot; }
+    return this->size();
+  }
+
+  size_t list_start(size_t slot) const { return this->offsets.get(slot * this->offset_width, this->offset_width); }
+  size_t list_end(size_t slot) const { return this->list_start(slot + 1); }
+
+  // Decodes the occurrences in the given slot into the buffer.
+  void decode(size_t slot, value_type* buffer) const
+  {
+    size_t start = this->list_start(slot), limit = this->list_end(slot);
+    for(size_t i = start; i < limit; i++)
+    {
+      std::array<std::uint64_t, VALUE_WORDS> value;
+      size_t bit = i * this->value_width;
+      for(size_t j = 0; j < VALUE_WORDS; j++)
+      {
+        value[j] = this->values.get(bit, this->field_widths[j]);
+        bit += this->field_widths[j];
+      }
+      std::memcpy(buffer + (i - start), value.data(), sizeof(value_type));
+    }
+  }
+
+  void build_hash_function(const std::vector<key_type>& source_keys)
+  {
+    std::vector<size_t> hashes(source_keys.size());
+    for(size_t i = 0; i < source_keys.size(); i++) { hashes[i] = source_keys[i].hash(); }
+    std::vector<size_t> remaining(source_keys.size());
+    for(size_t i = 0; i < remaining.size(); i++) { remaining[i] = i; }
+    this->level_starts = std::vector<size_t>(1, 0);
+
+    for(size_t level = 0; level < MAX_LEVELS && !(remaining.empty()); level++)
+    {
+      size_t words = (GAMMA * remaining.size() + PackedBits::WORD_BITS - 1) / PackedBits::WORD_BITS;
+      size_t size = words * PackedBits::WORD_BITS;
+      std::vector<std::uint64_t> seen(words, 0), collisions(words, 0);
+      for(size_t i : remaining)
+      {
+        size_t bit = reduce(level_hash(hashes[i], level), size);
+        std::uint64_t mask = std::uint64_t(1) << (bit % PackedBits::WORD_BITS);
+        if(seen[bit / PackedBits::WORD_BITS] & mask) { collisions[bit / PackedBits::WORD_BITS] |= mask; }
+        else { seen[bit / PackedBits::WORD_BITS] |= mask; }
+      }
+      std::vector<size_t> next;
+      for(size_t i : remaining)
+      {
+        size_t bit = reduce(level_hash(hashes[i], level), size);
+        if((collisions[bit / PackedBits::WORD_BITS] >> (bit % PackedBits::WORD_BITS)) & 1) { next.push_back(i); }
+      }
+      for(size_t i = 0; i < words; i++) { this->levels.push_back(seen[i] & ~collisions[i]); }
+      this->level_starts.push_back(this->level_starts.back() + size);
+      remaining.swap(next);
+    }
+
+    for(size_t i : remaining) { this->fallback.push_back(source_keys[i]); }
+    std::sort(this->fallback.begin(), this->fallback.end());
+
+    this->ranks = std::vector<size_t>(this->levels.size() / RANK_BLOCK + 1, 0);
+    for(size_t block = 1; block < this->ranks.size(); block++)
+    {
+      this->ranks[block] = this->ranks[block - 1] + this->count_ones((block - 1) * RANK_BLOCK, block * RANK_BLOCK);
+    }
+    this->placed_keys = source_keys.size() - this->fallback.size();
+  }
+
+  void build_values(const std::vector<result_type>& lists, const std::vector<size_t>& order)
+  {
+    // Determine the widths of the fields.
+    std::array<std::uint64_t, VALUE_WORDS> used; used.fill(0);
+    for(const result_type& list : lists)
+    {
+      for(size_t i = 0; i < list.second; i++)
+      {
+        std::array<std::uint64_t, VALUE_WORDS> value;
+        std::memcpy(value.data(), list.first + i, sizeof(value_type));
+        for(size_t j = 0; j < VALUE_WORDS; j++) { used[j] |= value[j]; }
+      }
+    }
+    this->value_width = 0;
+    for(size_t j = 0; j < VALUE_WORDS; j++)
+    {
+      this->field_widths[j] = PackedBits::bit_length(used[j]);
+      this->value_width += this->field_widths[j];
+    }
+    this->offset_width = PackedBits::bit_length(this->value_count);
+
+    // Encode the lists.
+    this->offsets = PackedBits((this->size() + 1) * this->offset_width);
+    this->values = PackedBits(this->value_count * this->value_width);
+    size_t offset = 0;
+    for(size_t slot = 0; slot < order.size(); slot++)
+    {
+      this->offsets.set(slot * this->offset_width, this->offset_width, offset);
+      const result_type& list = lists[order[slot]];
+      for(size_t i = 0; i < list.second; i++, offset++)
+      {
+        std::array<std::uint64_t, VALUE_WORDS> value;
+        std::memcpy(value.data(), list.first + i, sizeof(value_type));
+        size_t bit = offset * this->value_width;
+        for(size_t j = 0; j < VALUE_WORDS; j++)
+        {
+          this->values.set(bit, this->field_widths[j], value[j]);
+          bit += this->field_widths[j];
+        }
+      }
+    }
+    this->offsets.set(order.size() * this->offset_width, this->offset_width, offset);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// Numerical template class constants.
+
+template<class KeyType, class ValueType> constexpr size_t CompactMinimizerIndex<KeyType, ValueType>::GAMMA;
+template<class KeyType, class ValueType> constexpr size_t CompactMinimizerIndex<KeyType, ValueType>::MAX_LEVELS;
+template<class KeyType, class ValueType> constexpr size_t CompactMinimizerIndex<KeyType, ValueType>::RANK_BLOCK;
+template<class KeyType, class ValueType> constexpr size_t CompactMinimizerIndex<KeyType, ValueType>::PREFETCH_DISTANCE;
+template<class KeyType, class ValueType> constexpr size_t CompactMinimizerIndex<KeyType, ValueType>::VALUE_WORDS;
+template<class KeyType, class ValueType> constexpr std::uint32_t CompactMinimizerIndex<KeyType, ValueType>::TAG;
+template<class KeyType, class ValueType> constexpr std::uint32_t CompactMinimizerIndex<KeyType, ValueType>::VERSION;
+
+//------------------------------------------------------------------------------
+
+// Choose the default index type.
+typedef CompactMinimizerIndex<Key64, PositionPayload> DefaultCompactMinimizerIndex;
+
+//------------------------------------------------------------------------------
+
+} // namespace gbwtgraph
+
+#endif // GBWTGRAPH_COMPACT_MINIMIZER_H
@@ -7,6 +7,7 @@
 #include <gbwt/cached_gbwt.h>
 #include <gbwt/metadata.h>
 
+#include "memory.h"
 #include "utils.h"
 
 /*
@@ -16,6 +17,9 @@
 namespace gbwtgraph
 {
 
+// Defined in cached_gbwtgraph.h.
+class SharedRecordCache;
+
 //------------------------------------------------------------------------------
 
 /*
@@ -70,6 +74,11 @@ public:
   // Throws sdsl::simple_sds::InvalidData if the checks fail.
   void sanity_checks();
 
+  // Applies the memory policy to the node sequences and the compressed BWT of
+  // the GBWT index after construction or loading. Returns false if the system
+  // did not accept the request.
+  bool apply_memory_policy(const MemoryPolicy& policy) const;
+
   void swap(GBWTGraph& another);
   GBWTGraph& operator=(const GBWTGraph& source);
   GBWTGraph& operator=(GBWTGraph&& source);
@@ -131,6 +140,9 @@ public:
   // when iterating, we need to remember to skip path numbers in the metadata
   // that are also cached named paths.
 
+  // Optional shared record cache for following paths. Not owned by the graph.
+  const SharedRecordCache* record_cache = nullptr;
+
   constexpr static size_t CHUNK_SIZE = 1024; // For parallel for_each_handle().
 
   // TODO: This should be 0, as in GFA W-lines.
@@ -356,6 +368,18 @@ protected:
     /// sense. Returns false and stops if the iteratee returns false.
     virtual bool for_each_step_of_sense_impl(const handle_t& visited, const PathSense& sense, const std::function<bool(const step_handle_t&)>& iteratee) const;
 
+public:
+
+    /// Returns the GBWT sequence identifiers for all visits in the search state
+    /// in the order of the offsets. This locates the visits in a single pass
+    /// that follows all of them in parallel and decompresses each record only
+    /// once per step.
+    std::vector<gbwt::size_type> locate(const gbwt::SearchState& state) const;
+
+    /// Decompress a record for batched locate() if there are at least this many
+    /// unresolved visits in the same node.
+    constexpr static size_t LOCATE_DECOMPRESS_THRESHOLD = 16;
+
 private:
 
     /// Internal iteration method to find all the GBWT edges and their path
@@ -404,6 +428,11 @@ public:
   // store both GBWT and GBWTGraph and may get moved around.
   void set_gbwt_address(const gbwt::GBWT& gbwt_index);
 
+  // Use the given shared record cache for following paths in the PathHandleGraph
+  // interface, or stop using a cache with `nullptr`. The cache must be for the
+  // same GBWT index and outlive its use. `set_gbwt()` clears the cache.
+  void set_record_cache(const SharedRecordCache* cache) { this->record_cache = cache; }
+
   /// Return a magic number to identify serialized GBWTGraphs.
   virtual uint32_t get_magic_number() const;
 
@@ -468,6 +497,13 @@ public:
     return for_each_link_impl(handlegraph::BoolReturningWrapper<Iteratee>::wrap(iteratee), parallel);
   }
 
+  /// Calls `iteratee` with the inter-segment edges starting from the given segment
+  /// in the same way and in the same order as `for_each_link()`. The segment is
+  /// given by its name and semiopen interval of node ids. Stops early if the call
+  /// returns `false`. Returns false if iteration was stopped, and true otherwise.
+  bool for_each_link_from(const std::string& segment, const std::pair<nid_t, nid_t>& nodes,
+                          const std::function<bool(const edge_t&, const std::string&, const std::string&)>& iteratee) const;
+
 protected:
 
   // Calls `iteratee` with each segment name and the semiopen interval of node ids
@@ -508,8 +544,15 @@ public:
   // Serialize the the graph into the output stream in the simple-sds format.
   void simple_sds_serialize(std::ostream& out) const;
 
+  // As above, but encode the sections of the graph in parallel using up to
+  // `threads` threads. The output is identical.
+  void simple_sds_serialize(std::ostream& out, size_t threads) const;
+
   // Deserialize or decompress the graph from the input stream and set the given
   // GBWT index. Note that the GBWT index is essential for loading the structure.
+  // The serialized graph only stores the forward sequences, and the reverse
+  // complements are built during loading. Peak memory usage is therefore about
+  // 1.5x the size of the loaded sequences.
   void simple_sds_load(std::istream& in, const gbwt::GBWT& gbwt_index);
 
   // Returns the size of the serialized structure in elements.
@@ -620,10 +663,41 @@ public:
   bool cached_follow_edges(const gbwt::CachedGBWT& cache, const handle_t& handle, bool go_left,
                            const std::function<bool(const handle_t&)>& iteratee) const;
 
+//------------------------------------------------------------------------------
+
+  /*
+    Shared cache interface. The same cache can be used by multiple threads.
+  */
+
+  // Convert handle_t to gbwt::SearchState.
+  gbwt::SearchState get_state(const SharedRecordCache& cache, const handle_t& handle) const;
+
+  // Get the search state corresponding to the vector of handles.
+  gbwt::SearchState find(const SharedRecordCache& cache, const std::vector<handle_t>& path) const;
+
+  // Visit all successor states of this state and call iteratee for the state.
+  // Stop and return false if the iteratee returns false.
+  // Note that this does not visit empty successor states.
+  bool follow_paths(const SharedRecordCache& cache, gbwt::SearchState state,
+                    const std::function<bool(const gbwt::SearchState&)>& iteratee) const;
+
+  // Loop over all the handles to next/previous (right/left) nodes. Passes
+  // them to a callback which returns false to stop iterating and true to
+  // continue. Returns true if we finished and false if we stopped early.
+  bool cached_follow_edges(const SharedRecordCache& cache, const handle_t& handle, bool go_left,
+                           const std::function<bool(const handle_t&)>& iteratee) const;
+
 //------------------------------------------------------------------------------
 
 private:
   friend class CachedGBWTGraph;
+  friend class GBZ;
+
+  // Independent sections of the simple-sds serialization in file order.
+  std::vector<std::function<void(std::ostream&)>> simple_sds_sections() const;
+
+  // Follow the path from the position using the record cache if there is one.
+  gbwt::edge_type path_LF(gbwt::edge_type position) const;
 
   // Construction helpers.
   void determine_real_nodes();
@@ -670,6 +744,313 @@ void for_each_nonredundant_window(
 
 //------------------------------------------------------------------------------
 
+/*
+  An allocation-free version of the haplotype window traversal. The traversal is a
+  depth-first search with backtracking over a path buffer and a sequence buffer.
+  The lambda is called as `lambda(traversal, sequence)`, where `traversal` is a
+  `const std::vector<handle_t>&` and `sequence` is a `view_type`. Both refer to the
+  internal buffers and are only valid during the call.
+
+  In parallel mode, each OpenMP task starts the traversal from a range of nodes.
+  When a task has at least `split_threshold` pending extensions, it moves the
+  shallowest ones to a new task that an idle thread can steal. Extensions at the
+  current depth are never moved, so each task always makes progress. The lambda
+  must then be thread-safe.
+
+  The windows are reported in the same order as with std::stack based traversal,
+  where the last successor is extended first.
+*/
+template<class Lambda>
+class HaplotypeWindows
+{
+public:
+  // Default for the number of pending extensions that triggers a split.
+  constexpr static size_t SPLIT_THRESHOLD = 32;
+
+  HaplotypeWindows(const GBWTGraph& graph, size_t window_size, const Lambda& lambda, bool parallel, bool nonredundant,
+                   size_t split_threshold = SPLIT_THRESHOLD) :
+    graph(graph), window_size(window_size), lambda(lambda),
+    parallel(parallel), nonredundant(nonredundant),
+    split_threshold(std::max(split_threshold, size_t(1))),
+    cache(graph.get_cache()),
+    target_length(0), pending(0)
+  {
+  }
+
+  // Traverse all windows in the graph.
+  void run();
+
+  // Traverse the windows starting from both orientations of the given node.
+  void start_from(const handle_t& handle);
+
+private:
+  // Report the current window.
+  void report() const
+  {
+    this->lambda(this->path, view_type(this->sequence.data(), this->sequence.length()));
+  }
+
+  // Extend the current window with the successors of `state`.
+  void extend(const gbwt::SearchState& state);
+
+  // Visit the pending successors at the given depth in reverse order.
+  void visit_successors(size_t depth);
+
+  // Move the shallowest pending successors to a new task.
+  void split();
+
+  // Set the buffers for a stolen task and visit the stolen successors.
+  void resume(const std::vector<handle_t>& prefix, const std::vector<size_t>& prefix_lengths, const std::string& prefix_sequence,
+              const std::vector<gbwt::SearchState>& states, size_t target);
+
+  const GBWTGraph& graph;
+  size_t           window_size;
+  const Lambda&    lambda;
+  bool             parallel, nonredundant;
+  size_t           split_threshold;
+
+  gbwt::CachedGBWT cache;
+  size_t target_length;
+
+  // The current window and the sequence lengths after each node in it.
+  std::vector<handle_t> path;
+  std::vector<size_t>   lengths;
+  std::string           sequence;
+
+  // successors[i] contains the successor states of path[i], and the first
+  // remaining[i] of them have not been visited yet.
+  std::vector<std::vector<gbwt::SearchState>> successors;
+  std::vector<size_t> remaining;
+  size_t pending;
+};
+
+template<class Lambda>
+constexpr size_t HaplotypeWindows<Lambda>::SPLIT_THRESHOLD;
+
+template<class Lambda>
+void
+HaplotypeWindows<Lambda>::run()
+{
+  if(this->window_size == 0) { return; }
+
+  if(!(this->parallel))
+  {
+    this->graph.for_each_handle([&](const handle_t& handle)
+    {
+      this->start_from(handle);
+    });
+    return;
+  }
+
+  const GBWTGraph* graph_ptr = &(this->graph);
+  const Lambda* lambda_ptr = &(this->lambda);
+  size_t window_size = this->window_size, split_threshold = this->split_threshold;
+  bool nonredundant = this->nonredundant;
+  gbwt::node_type first_node = this->graph.index->firstNode(), limit = this->graph.index->sigma();
+  #pragma omp parallel
+  {
+    #pragma omp single
+    {
+      for(gbwt::node_type start = first_node; start < limit; start += 2 * GBWTGraph::CHUNK_SIZE)
+      {
+        #pragma omp task firstprivate(start, graph_ptr, lambda_ptr, window_size, split_threshold, nonredundant)
+        {
+          HaplotypeWindows<Lambda> windows(*graph_ptr, window_size, *lambda_ptr, true, nonredundant, split_threshold);
+          gbwt::node_type end = std::min(start + 2 * GBWTGraph::CHUNK_SIZE, limit);
+          for(gbwt::node_type node = start; node < end; node += 2)
+          {
+            if(!(graph_ptr->has_node(gbwt::Node::id(node)))) { continue; }
+            windows.start_from(GBWTGraph::node_to_handle(node));
+          }
+        }
+      }
+    }
+  }
+}
+
+template<class Lambda>
+void
+HaplotypeWindows<Lambda>::start_from(const handle_t& h)
+{
+  size_t node_length = this->graph.get_length(h);
+  bool long_node = this->nonredundant & (node_length >= this->window_size);
+  this->target_length = (long_node ? 2 * (this->window_size - 1) : node_length + this->window_size - 1);
+
+  // Find the initial states. Long nodes are reported as separate windows.
+  handle_t handles[2];
+  gbwt::SearchState states[2];
+  size_t count = 0;
+  for(bool is_reverse : { false, true })
+  {
+    handle_t handle = (is_reverse ? this->graph.flip(h) : h);
+    gbwt::SearchState state = this->graph.get_state(this->cache, handle);
+    if(state.empty()) { continue; }
+    if(long_node)
+    {
+      view_type view = this->graph.get_sequence_view(handle);
+      this->path.assign(1, handle);
+      this->sequence.assign(view.first, view.second);
+      this->report();
+    }
+    handles[count] = handle; states[count] = state;
+    count++;
+  }
+
+  // Extend the windows, starting from the last orientation.
+  if(this->target_length > 0)
+  {
+    size_t offset = (long_node ? node_length - (this->window_size - 1) : 0);
+    while(count > 0)
+    {
+      count--;
+      view_type view = this->graph.get_sequence_view(handles[count]);
+      this->path.assign(1, handles[count]);
+      this->sequence.assign(view.first + offset, view.second - offset);
+      this->lengths.assign(1, this->sequence.length());
+      this->extend(states[count]);
+    }
+  }
+
+  // Do not let the cache grow without bounds.
+  this->cache.clearCache();
+}
+
+template<class Lambda>
+void
+HaplotypeWindows<Lambda>::extend(const gbwt::SearchState& state)
+{
+  // Report the full window.
+  if(this->sequence.length() >= this->target_length)
+  {
+    this->report();
+    return;
+  }
+
+  // Find the successor states.
+  size_t depth = this->path.size() - 1;
+  if(this->successors.size() <= depth)
+  {
+    this->successors.resize(depth + 1);
+    this->remaining.resize(depth + 1, 0);
+  }
+  std::vector<gbwt::SearchState>& next = this->successors[depth];
+  next.clear();
+  gbwt::size_type cache_index = this->cache.findRecord(state.node);
+  for(gbwt::rank_type outrank = 0; outrank < this->cache.outdegree(cache_index); outrank++)
+  {
+    if(this->cache.successor(cache_index, outrank) == gbwt::ENDMARKER) { continue; }
+    gbwt::SearchState next_state = this->cache.cachedExtend(state, cache_index, outrank);
+    if(!(next_state.empty())) { next.push_back(next_state); }
+  }
+
+  // Report sufficiently long windows that cannot be extended.
+  if(next.empty())
+  {
+    if(this->sequence.length() >= this->window_size) { this->report(); }
+    return;
+  }
+
+  this->remaining[depth] = next.size();
+  this->pending += next.size();
+  this->visit_successors(depth);
+}
+
+template<class Lambda>
+void
+HaplotypeWindows<Lambda>::visit_successors(size_t depth)
+{
+  while(this->remaining[depth] > 0)
+  {
+    // Deeper levels have no pending extensions, so the difference is the
+    // number of extensions that can be moved to another task.
+    if(this->parallel && this->pending >= this->split_threshold && this->pending > this->remaining[depth])
+    {
+      this->split();
+    }
+    this->remaining[depth]--; this->pending--;
+    gbwt::SearchState next_state = this->successors[depth][this->remaining[depth]];
+
+    handle_t next = GBWTGraph::node_to_handle(next_state.node);
+    view_type view = this->graph.get_sequence_view(next);
+    size_t length = std::min(view.second, this->target_length - this->sequence.length());
+    this->path.push_back(next);
+    this->sequence.append(view.first, length);
+    this->lengths.push_back(this->sequence.length());
+    this->extend(next_state);
+    this->path.pop_back();
+    this->lengths.pop_back();
+    this->sequence.resize(this->lengths.back());
+  }
+}
+
+template<class Lambda>
+void
+HaplotypeWindows<Lambda>::split()
+{
+  size_t depth = 0;
+  while(this->remaining[depth] == 0) { depth++; }
+
+  std::vector<handle_t> prefix(this->path.begin(), this->path.begin() + depth + 1);
+  std::vector<size_t> prefix_lengths(this->lengths.begin(), this->lengths.begin() + depth + 1);
+  std::string prefix_sequence(this->sequence, 0, this->lengths[depth]);
+  std::vector<gbwt::SearchState> states(this->successors[depth].begin(), this->successors[depth].begin() + this->remaining[depth]);
+  this->pending -= this->remaining[depth];
+  this->remaining[depth] = 0;
+
+  const GBWTGraph* graph_ptr = &(this->graph);
+  const Lambda* lambda_ptr = &(this->lambda);
+  size_t window_size = this->window_size, target = this->target_length, split_threshold = this->split_threshold;
+  bool nonredundant = this->nonredundant;
+  #pragma omp task firstprivate(prefix, prefix_lengths, prefix_sequence, states, graph_ptr, lambda_ptr, window_size, target, split_threshold, nonredundant)
+  {
+    HaplotypeWindows<Lambda> windows(*graph_ptr, window_size, *lambda_ptr, true, nonredundant, split_threshold);
+    windows.resume(prefix, prefix_lengths, prefix_sequence, states, target);
+  }
+}
+
+template<class Lambda>
+void
+HaplotypeWindows<Lambda>::resume(const std::vector<handle_t>& prefix, const std::vector<size_t>& prefix_lengths, const std::string& prefix_sequence,
+                                 const std::vector<gbwt::SearchState>& states, size_t target)
+{
+  this->target_length = target;
+  this->path = prefix;
+  this->lengths = prefix_lengths;
+  this->sequence = prefix_sequence;
+  size_t depth = prefix.size() - 1;
+  this->successors.resize(depth + 1);
+  this->remaining.resize(depth + 1, 0);
+  this->successors[depth] = states;
+  this->remaining[depth] = states.size();
+  this->pending = states.size();
+  this->visit_successors(depth);
+}
+
+/*
+  Allocation-free versions of `for_each_haplotype_window()` and
+  `for_each_nonredundant_window()`. See `HaplotypeWindows` for details. The split
+  threshold only affects the parallel traversal.
+*/
+template<class Lambda>
+void
+for_each_haplotype_window_view(const GBWTGraph& graph, size_t window_size, const Lambda& lambda, bool parallel,
+                               size_t split_threshold = HaplotypeWindows<Lambda>::SPLIT_THRESHOLD)
+{
+  HaplotypeWindows<Lambda> windows(graph, window_size, lambda, parallel, false, split_threshold);
+  windows.run();
+}
+
+template<class Lambda>
+void
+for_each_nonredundant_window_view(const GBWTGraph& graph, size_t window_size, const Lambda& lambda, bool parallel,
+                                  size_t split_threshold = HaplotypeWindows<Lambda>::SPLIT_THRESHOLD)
+{
+  HaplotypeWindows<Lambda> windows(graph, window_size, lambda, parallel, true, split_threshold);
+  windows.run();
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace gbwtgraph
 
 #endif // GBWTGRAPH_GBWTGRAPH_H
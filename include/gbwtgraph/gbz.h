@@ -93,7 +93,25 @@ public:
   // Serialize the given GBWT and GBWTGraph objects in the GBZ format.
   static void simple_sds_serialize(const gbwt::GBWT& index, const GBWTGraph& graph, std::ostream& out);
 
-  // Deserialize or decompress the GBZ from the input stream.
+  /*
+    As above, but encode the sections of the file (header and tags, GBWT,
+    sequences, translation) in parallel using up to `threads` threads, while
+    the calling thread writes the finished sections in order. The calling
+    thread writes the first `DIRECT_SECTIONS` sections (header and tags, GBWT)
+    directly, and only the graph sections are buffered in memory until they
+    can be written. The output is identical to the single-threaded version.
+  */
+  constexpr static size_t DIRECT_SECTIONS = 2;
+  void simple_sds_serialize(std::ostream& out, size_t threads) const;
+  static void simple_sds_serialize(const gbwt::GBWT& index, const GBWTGraph& graph, std::ostream& out, size_t threads);
+
+  // Serialize the GBZ to the file using up to `threads` threads.
+  // Throws `std::runtime_error` on failure.
+  void serialize_to(const std::string& filename, size_t threads) const;
+
+  // Deserialize or decompress the GBZ from the input stream. The GBWT and the
+  // graph are loaded into memory; see `GBWTGraph::simple_sds_load()` for the
+  // memory overhead.
   void simple_sds_load(std::istream& in);
 
   // Returns the size of the serialized structure in elements.
@@ -7,6 +7,7 @@
 #include <gbwt/dynamic_gbwt.h>
 
 #include "gbwtgraph.h"
+#include "metrics.h"
 
 /*
   gfa.h: Tools for building GBWTGraph from GFA.
@@ -35,8 +36,15 @@ struct GFAParsingParameters
   size_t approximate_num_jobs = APPROXIMATE_NUM_JOBS;
 
   // Try to run this may construction jobs in parallel. Value 0 is interpreted as 1.
+  // GFA validation and segment / link parsing use the same number of threads.
   size_t parallel_jobs = 1;
 
+  // GFA validation splits the file into chunks of at least `chunk_size` bytes at
+  // line boundaries and validates them in parallel. Files smaller than two chunks
+  // are validated using a single thread. Value 0 is interpreted as 1.
+  constexpr static size_t CHUNK_SIZE = 4 * 1048576;
+  size_t chunk_size = CHUNK_SIZE;
+
   // Determine GBWT batch size automatically. If the length of the longest path is `N`
   // segments, batch size will be the maximum of the default (100 million) and
   // `gbwt::DynamicGBWT::MIN_SEQUENCES_PER_BATCH * (N + 1)` but no more than GFA file
@@ -45,8 +53,21 @@ struct GFAParsingParameters
   // much larger than `N`, and hence it may be useful to set the batch size manually.
   bool automatic_batch_size = true;
 
+  // Read the GFA sequentially in blocks of complete lines instead of memory mapping
+  // it. Streaming is always used for standard input (`-`), pipes, and gzip / zstd
+  // compressed files. Blocks are at least `stream_block_size` bytes, unless they
+  // reach the end of the input, and their size is also the lower bound for memory
+  // usage.
+  constexpr static size_t STREAM_BLOCK_SIZE = 64 * 1048576;
+  bool streaming = false;
+  size_t stream_block_size = STREAM_BLOCK_SIZE;
+
   bool show_progress = false;
 
+  // Record the construction phases and statistics with prefix "gfa_to_gbwt/"
+  // if not null. The object must outlive the construction.
+  Metrics* metrics = nullptr;
+
   /*
     To parse path names, we use a string regex and a string listing field types.
 
@@ -96,8 +117,8 @@ struct GFAParsingParameters
 
 struct GFAExtractionParameters
 {
-  // Use this many OpenMP threads for extracting paths and walks. Value 0 is interpreted
-  // as 1.
+  // Use this many OpenMP threads for extracting links, paths, and walks. Value 0 is
+  // interpreted as 1. The output does not depend on the number of threads.
   size_t num_threads = 1;
   size_t threads() const { return std::max(this->num_threads, size_t(1)); }
 
@@ -105,6 +126,11 @@ struct GFAExtractionParameters
   constexpr static size_t LARGE_RECORD_BYTES = 1024;
   size_t large_record_bytes = LARGE_RECORD_BYTES;
 
+  // Memory budget for the cached GBWT records (1 GiB). Records that have not
+  // been used recently are evicted when the budget is exceeded.
+  constexpr static size_t RECORD_CACHE_BYTES = size_t(1) << 30;
+  size_t record_cache_bytes = RECORD_CACHE_BYTES;
+
   enum path_mode
   {
     mode_default,   // Named paths as P-lines, haplotype paths as W-lines.
@@ -143,6 +169,19 @@ struct GFAExtractionParameters
   The construction is done in several passes over a memory-mapped GFA file. The
   function returns the GBWT index and a sequence source for GBWTGraph construction.
 
+  In streaming mode, the construction makes two sequential passes over the input.
+  The first pass parses the segments, the links, and path / walk names and starts,
+  and the second pass encodes the paths / walks. Each job buffers its encoded
+  paths / walks in memory and appends them to a temporary file when the buffer
+  becomes full. The buffers of all jobs use roughly `batch_size` nodes in total.
+  A job is built once, as soon as its last path / walk has been encoded. Building
+  a job uses a buffer of at most `batch_size` nodes and a dynamic GBWT for the
+  job, and up to `parallel_jobs` jobs can be built at the same time. Within each
+  job, paths and walks are ordered as in the file. Compressed files and
+  compressed standard input are decompressed by external `pigz` / `gzip` /
+  `zstd` processes, and standard input and pipes are read once and P/W-lines
+  are spooled into a temporary file for the second pass.
+
   If the GFA file contains both P-lines and W-lines, both will be used. In that
   case, P-lines will be interpreted as generic-sense paths and stored under a
   sample named only `REFERENCE_PATH_SAMPLE_NAME`, with the path name as contig
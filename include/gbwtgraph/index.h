@@ -3,13 +3,19 @@
 
 #include <array>
 #include <cstdlib>
+#include <fstream>
 #include <functional>
 #include <mutex>
+#include <unordered_set>
 
-//#include <omp.h>
+#include <omp.h>
+
+#include <gbwt/dynamic_gbwt.h>
 
 #include "gbwtgraph.h"
+#include "metrics.h"
 #include "minimizer.h"
+#include "sharded_minimizer.h"
 
 /*
   index.h: Minimizer index construction from GBWTGraph.
@@ -20,6 +26,40 @@ namespace gbwtgraph
 
 //------------------------------------------------------------------------------
 
+namespace detail
+{
+
+// Records the statistics of a minimizer index after index_haplotypes().
+// The hash table only grows by doubling, so the number of rehashes can be
+// determined from the initial size.
+template<class IndexType>
+void
+record_index_metrics(Metrics* metrics, const IndexType& index, size_t initial_size,
+                     const std::vector<size_t>& windows, const std::vector<size_t>& occurrences)
+{
+  if(metrics == nullptr) { return; }
+
+  size_t total_windows = 0, total_occurrences = 0;
+  for(size_t count : windows) { total_windows += count; }
+  for(size_t count : occurrences) { total_occurrences += count; }
+  metrics->add_counter("index_haplotypes/windows", total_windows);
+  metrics->add_counter("index_haplotypes/occurrences", total_occurrences);
+  metrics->add_counter("index_haplotypes/keys", index.size());
+  metrics->add_counter("index_haplotypes/values", index.number_of_values());
+  size_t rehashes = 0;
+  for(size_t size = initial_size; size < index.hash_table_size(); size *= 2) { rehashes++; }
+  metrics->add_counter("index_haplotypes/rehashes", rehashes);
+
+  Metrics::Histogram probes;
+  std::vector<size_t> probe_lengths = index.probe_lengths();
+  for(size_t i = 0; i < probe_lengths.size(); i++) { probes.add(i + 1, probe_lengths[i]); }
+  metrics->merge_histogram("index_haplotypes/probe_length", probes);
+}
+
+} // namespace detail
+
+//------------------------------------------------------------------------------
+
 // TODO: These algorithms are basically the same. Is there a clean way of
 // merging the implementations?
 
@@ -27,40 +67,52 @@ namespace gbwtgraph
   Index the haplotypes in the graph. Insert the minimizers into the provided
   index. Function argument get_payload is used to generate the payload for each
   position stored in the index. The number of threads can be set through OpenMP.
+  Function get_payload must be thread-safe.
 
   We do a lot of redundant work by traversing both orientations and finding
   almost the same minimizers in each orientation. If we consider only the
   windows starting in forward (reverse) orientation, we may miss windows that
   cross from a reverse node to a forward node (from a forward node to a reverse
   node).
+
+  If `metrics` is not null, the construction is recorded as phase
+  "index_haplotypes", and the statistics of the index, including rehashes and
+  probe sequence lengths, are recorded under the same prefix.
 */
 template<class KeyType>
 void
 index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, PositionPayload>& index,
-                 const std::function<Payload(const pos_t&)>& get_payload)
+                 const std::function<Payload(const pos_t&)>& get_payload, Metrics* metrics = nullptr)
 {
-  typedef typename MinimizerIndex<KeyType, PositionPayload>::minimizer_type minimizer_type;
+  typedef MinimizerIndex<KeyType, PositionPayload> index_type;
+  typedef typename index_type::minimizer_type minimizer_type;
+  typedef typename index_type::insertion_type insertion_type;
 
-  int threads = 1;//omp_get_max_threads();
+  int threads = omp_get_max_threads();
+  Metrics::Timer timer(metrics, "index_haplotypes");
+  size_t initial_size = index.hash_table_size();
+  std::vector<size_t> windows(threads, 0), occurrences(threads, 0);
 
   // Minimizer caching. We only generate the payloads after we have removed duplicate positions.
+  // The batches are inserted into the index using lock striping.
   std::vector<std::vector<std::pair<minimizer_type, pos_t>>> cache(threads);
+  std::vector<std::vector<insertion_type>> batches(threads);
+  typename index_type::InsertionLocks locks;
   constexpr size_t MINIMIZER_CACHE_SIZE = 1024;
   auto flush_cache = [&](int thread_id)
   {
     auto& current_cache = cache[thread_id];
     gbwt::removeDuplicates(current_cache, false);
-    std::vector<Payload> payload; payload.reserve(current_cache.size());
-    payload.reserve(current_cache.size());
-    for(auto& minimizer : current_cache) { payload.push_back(get_payload(minimizer.second)); }
-    //#pragma omp critical (minimizer_index)
+    occurrences[thread_id] += current_cache.size();
+    auto& batch = batches[thread_id];
+    batch.reserve(current_cache.size());
+    for(auto& minimizer : current_cache)
     {
-      for(size_t i = 0; i < current_cache.size(); i++)
-      {
-        index.insert(current_cache[i].first, { Position::encode(current_cache[i].second), payload[i] });
-      }
+      batch.push_back({ minimizer.first.key, minimizer.first.hash, { Position::encode(minimizer.second), get_payload(minimizer.second) } });
     }
-    cache[thread_id].clear();
+    index.insert(batch, locks);
+    batch.clear();
+    current_cache.clear();
   };
 
   // Minimizer finding.
@@ -69,7 +121,8 @@ index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, PositionPayload
     std::vector<minimizer_type> minimizers = index.minimizers(seq); // Calls syncmers() when appropriate.
     auto iter = traversal.begin();
     size_t node_start = 0;
-    int thread_id = 0;//omp_get_thread_num();
+    int thread_id = omp_get_thread_num();
+    windows[thread_id]++;
     for(minimizer_type& minimizer : minimizers)
     {
       if(minimizer.empty()) { continue; }
@@ -86,7 +139,7 @@ index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, PositionPayload
       if(minimizer.is_reverse) { pos = reverse_base_pos(pos, node_length); }
       if(!Position::valid_offset(pos))
       {
-        //#pragma omp critical (cerr)
+        #pragma omp critical (cerr)
         {
           std::cerr << "index_haplotypes(): Node offset " << offset(pos) << " is too large" << std::endl;
         }
@@ -99,6 +152,9 @@ index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, PositionPayload
 
   for_each_haplotype_window(graph, index.window_bp(), find_minimizers, (threads > 1));
   for(int thread_id = 0; thread_id < threads; thread_id++) { flush_cache(thread_id); }
+  index.compact();
+  timer.stop();
+  detail::record_index_metrics(metrics, index, initial_size, windows, occurrences);
 }
   
 //------------------------------------------------------------------------------
@@ -106,31 +162,41 @@ index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, PositionPayload
 /*
   Index the haplotypes in the graph. Insert the minimizers into the provided
   index. This version is used for minimizer indexes without payloads. The number
-  of threads can be set through OpenMP.
+  of threads can be set through OpenMP. Metrics are recorded as in the version
+  with payloads.
 */
 template<class KeyType>
 void
-index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, Position>& index)
+index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, Position>& index, Metrics* metrics = nullptr)
 {
-  typedef typename MinimizerIndex<KeyType, Position>::minimizer_type minimizer_type;
+  typedef MinimizerIndex<KeyType, Position> index_type;
+  typedef typename index_type::minimizer_type minimizer_type;
+  typedef typename index_type::insertion_type insertion_type;
 
-  int threads = 1;//omp_get_max_threads();
+  int threads = omp_get_max_threads();
+  Metrics::Timer timer(metrics, "index_haplotypes");
+  size_t initial_size = index.hash_table_size();
+  std::vector<size_t> windows(threads, 0), occurrences(threads, 0);
 
-  // Minimizer caching. We only generate the payloads after we have removed duplicate positions.
+  // Minimizer caching. The batches are inserted into the index using lock striping.
   std::vector<std::vector<std::pair<minimizer_type, Position>>> cache(threads);
+  std::vector<std::vector<insertion_type>> batches(threads);
+  typename index_type::InsertionLocks locks;
   constexpr size_t MINIMIZER_CACHE_SIZE = 1024;
   auto flush_cache = [&](int thread_id)
   {
     auto& current_cache = cache[thread_id];
     gbwt::removeDuplicates(current_cache, false);
-    //#pragma omp critical (minimizer_index)
+    occurrences[thread_id] += current_cache.size();
+    auto& batch = batches[thread_id];
+    batch.reserve(current_cache.size());
+    for(auto& minimizer : current_cache)
     {
-      for(auto& minimizer : current_cache)
-      {
-        index.insert(minimizer.first, minimizer.second);
-      }
+      batch.push_back({ minimizer.first.key, minimizer.first.hash, minimizer.second });
     }
-    cache[thread_id].clear();
+    index.insert(batch, locks);
+    batch.clear();
+    current_cache.clear();
   };
 
   // Minimizer finding.
@@ -139,7 +205,8 @@ index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, Position>& inde
     std::vector<minimizer_type> minimizers = index.minimizers(seq); // Calls syncmers() when appropriate.
     auto iter = traversal.begin();
     size_t node_start = 0;
-    int thread_id = 0;//omp_get_thread_num();
+    int thread_id = omp_get_thread_num();
+    windows[thread_id]++;
     for(minimizer_type& minimizer : minimizers)
     {
       if(minimizer.empty()) { continue; }
@@ -156,7 +223,7 @@ index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, Position>& inde
       if(minimizer.is_reverse) { pos = reverse_base_pos(pos, node_length); }
       if(!Position::valid_offset(pos))
       {
-        //#pragma omp critical (cerr)
+        #pragma omp critical (cerr)
         {
           std::cerr << "index_haplotypes(): Node offset " << offset(pos) << " is too large" << std::endl;
         }
@@ -169,6 +236,495 @@ index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, Position>& inde
 
   for_each_haplotype_window(graph, index.window_bp(), find_minimizers, (threads > 1));
   for(int thread_id = 0; thread_id < threads; thread_id++) { flush_cache(thread_id); }
+  index.compact();
+  timer.stop();
+  detail::record_index_metrics(metrics, index, initial_size, windows, occurrences);
+}
+
+//------------------------------------------------------------------------------
+
+/*
+  Collects the minimizer occurrences in the haplotypes for bulk loading into
+  the index. Function make_value converts a graph position into the value
+  stored in the index. It must be thread-safe and it is only called once for
+  each distinct (minimizer, position) pair within a cache of occurrences. The
+  number of threads can be set through OpenMP.
+*/
+template<class IndexType>
+std::vector<typename IndexType::insertion_type>
+collect_minimizers(const GBWTGraph& graph, const IndexType& index,
+                   const std::function<typename IndexType::value_type(const pos_t&)>& make_value)
+{
+  typedef typename IndexType::minimizer_type minimizer_type;
+  typedef typename IndexType::insertion_type insertion_type;
+
+  int threads = omp_get_max_threads();
+
+  // Minimizer caching. Duplicate positions are removed before generating the values.
+  std::vector<std::vector<std::pair<minimizer_type, pos_t>>> cache(threads);
+  std::vector<std::vector<insertion_type>> items(threads);
+  constexpr size_t MINIMIZER_CACHE_SIZE = 1024;
+  auto flush_cache = [&](int thread_id)
+  {
+    auto& current_cache = cache[thread_id];
+    gbwt::removeDuplicates(current_cache, false);
+    for(auto& minimizer : current_cache)
+    {
+      items[thread_id].push_back({ minimizer.first.key, minimizer.first.hash, make_value(minimizer.second) });
+    }
+    current_cache.clear();
+  };
+
+  // Minimizer finding.
+  auto find_minimizers = [&](const std::vector<handle_t>& traversal, const std::string& seq)
+  {
+    std::vector<minimizer_type> minimizers = index.minimizers(seq); // Calls syncmers() when appropriate.
+    auto iter = traversal.begin();
+    size_t node_start = 0;
+    int thread_id = omp_get_thread_num();
+    for(minimizer_type& minimizer : minimizers)
+    {
+      if(minimizer.empty()) { continue; }
+
+      // Find the node covering minimizer starting position.
+      size_t node_length = graph.get_length(*iter);
+      while(node_start + node_length <= minimizer.offset)
+      {
+        node_start += node_length;
+        ++iter;
+        node_length = graph.get_length(*iter);
+      }
+      pos_t pos { graph.get_id(*iter), graph.get_is_reverse(*iter), minimizer.offset - node_start };
+      if(minimizer.is_reverse) { pos = reverse_base_pos(pos, node_length); }
+      if(!Position::valid_offset(pos))
+      {
+        #pragma omp critical (cerr)
+        {
+          std::cerr << "collect_minimizers(): Node offset " << offset(pos) << " is too large" << std::endl;
+        }
+        std::exit(EXIT_FAILURE);
+      }
+      cache[thread_id].emplace_back(minimizer, pos);
+    }
+    if(cache[thread_id].size() >= MINIMIZER_CACHE_SIZE) { flush_cache(thread_id); }
+  };
+
+  for_each_haplotype_window(graph, index.window_bp(), find_minimizers, (threads > 1));
+
+  // Concatenate the per-thread results, releasing the memory as we go.
+  size_t total = 0;
+  for(int thread_id = 0; thread_id < threads; thread_id++)
+  {
+    flush_cache(thread_id);
+    total += items[thread_id].size();
+  }
+  std::vector<insertion_type> result;
+  result.reserve(total);
+  for(int thread_id = 0; thread_id < threads; thread_id++)
+  {
+    result.insert(result.end(), items[thread_id].begin(), items[thread_id].end());
+    std::vector<insertion_type>().swap(items[thread_id]);
+  }
+  return result;
+}
+
+/*
+  Index the haplotypes in the graph using bulk loading. The minimizer
+  occurrences are collected in memory and then inserted into the provided
+  empty index with MinimizerIndex::bulk_load(), which allocates the final hash
+  table once and never rehashes. Function argument get_payload is used to
+  generate the payload for each position stored in the index. It must be
+  thread-safe. The number of threads can be set through OpenMP.
+*/
+template<class KeyType>
+void
+bulk_index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, PositionPayload>& index,
+                      const std::function<Payload(const pos_t&)>& get_payload)
+{
+  auto items = collect_minimizers(graph, index, std::function<PositionPayload(const pos_t&)>([&](const pos_t& pos) -> PositionPayload
+  {
+    return { Position::encode(pos), get_payload(pos) };
+  }));
+  index.bulk_load(items);
+}
+
+/*
+  Index the haplotypes in the graph using bulk loading. This version is used
+  for minimizer indexes without payloads. See the version with payloads for
+  details.
+*/
+template<class KeyType>
+void
+bulk_index_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, Position>& index)
+{
+  auto items = collect_minimizers(graph, index, std::function<Position(const pos_t&)>([](const pos_t& pos) -> Position
+  {
+    return Position::encode(pos);
+  }));
+  index.bulk_load(items);
+}
+
+//------------------------------------------------------------------------------
+
+/*
+  Index the haplotypes in the graph into a sharded minimizer index. Each
+  minimizer is inserted into the shard determined by its hash, and the
+  minimizers belonging to shards that are not loaded are skipped. A shard can
+  hence be built on its own by unloading the other shards first. All loaded
+  shards are built in the same parallel traversal. Function argument
+  get_payload is used to generate the payload for each position stored in the
+  index. It must be thread-safe. The number of threads can be set through
+  OpenMP.
+*/
+template<class KeyType>
+void
+index_haplotypes(const GBWTGraph& graph, ShardedMinimizerIndex<KeyType>& index,
+                 const std::function<Payload(const pos_t&)>& get_payload)
+{
+  typedef typename ShardedMinimizerIndex<KeyType>::index_type index_type;
+  typedef typename index_type::minimizer_type minimizer_type;
+  typedef typename index_type::insertion_type insertion_type;
+
+  int threads = omp_get_max_threads();
+  size_t shards = index.shards();
+  const index_type& parameters = index.parameter_index();
+
+  // Minimizer caching. We only generate the payloads after we have removed duplicate positions.
+  // Each shard has its own insertion locks.
+  std::vector<std::vector<std::pair<minimizer_type, pos_t>>> cache(threads);
+  std::vector<std::vector<std::vector<insertion_type>>> batches(threads, std::vector<std::vector<insertion_type>>(shards));
+  std::vector<typename index_type::InsertionLocks> locks(shards);
+  constexpr size_t MINIMIZER_CACHE_SIZE = 1024;
+  auto flush_cache = [&](int thread_id)
+  {
+    auto& current_cache = cache[thread_id];
+    gbwt::removeDuplicates(current_cache, false);
+    auto& current_batches = batches[thread_id];
+    for(auto& minimizer : current_cache)
+    {
+      current_batches[index.shard(minimizer.first)].push_back({ minimizer.first.key, minimizer.first.hash, { Position::encode(minimizer.second), get_payload(minimizer.second) } });
+    }
+    for(size_t shard = 0; shard < shards; shard++)
+    {
+      if(current_batches[shard].empty()) { continue; }
+      index.shard_index(shard).insert(current_batches[shard], locks[shard]);
+      current_batches[shard].clear();
+    }
+    current_cache.clear();
+  };
+
+  // Minimizer finding.
+  auto find_minimizers = [&](const std::vector<handle_t>& traversal, const std::string& seq)
+  {
+    std::vector<minimizer_type> minimizers = parameters.minimizers(seq); // Calls syncmers() when appropriate.
+    auto iter = traversal.begin();
+    size_t node_start = 0;
+    int thread_id = omp_get_thread_num();
+    for(minimizer_type& minimizer : minimizers)
+    {
+      if(minimizer.empty() || !(index.is_loaded(index.shard(minimizer)))) { continue; }
+
+      // Find the node covering minimizer starting position.
+      size_t node_length = graph.get_length(*iter);
+      while(node_start + node_length <= minimizer.offset)
+      {
+        node_start += node_length;
+        ++iter;
+        node_length = graph.get_length(*iter);
+      }
+      pos_t pos { graph.get_id(*iter), graph.get_is_reverse(*iter), minimizer.offset - node_start };
+      if(minimizer.is_reverse) { pos = reverse_base_pos(pos, node_length); }
+      if(!Position::valid_offset(pos))
+      {
+        #pragma omp critical (cerr)
+        {
+          std::cerr << "index_haplotypes(): Node offset " << offset(pos) << " is too large" << std::endl;
+        }
+        std::exit(EXIT_FAILURE);
+      }
+      cache[thread_id].emplace_back(minimizer, pos);
+    }
+    if(cache[thread_id].size() >= MINIMIZER_CACHE_SIZE) { flush_cache(thread_id); }
+  };
+
+  for_each_haplotype_window(graph, parameters.window_bp(), find_minimizers, (threads > 1));
+  for(int thread_id = 0; thread_id < threads; thread_id++) { flush_cache(thread_id); }
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_t shard = 0; shard < shards; shard++)
+  {
+    if(index.is_loaded(shard)) { index.shard_index(shard).compact(); }
+  }
+}
+
+//------------------------------------------------------------------------------
+
+namespace detail
+{
+
+// Target length of the sequence passed to the lambda in for_each_path_window().
+constexpr size_t PATH_WINDOW_CHUNK = 1 << 20;
+
+// Hash for a sequence of GBWT nodes.
+struct WindowHash
+{
+  size_t operator()(const gbwt::vector_type& window) const
+  {
+    size_t result = 0;
+    for(gbwt::node_type node : window)
+    {
+      result ^= wang_hash_64(node) + 0x9e3779b9 + (result << 6) + (result >> 2);
+    }
+    return result;
+  }
+};
+
+/*
+  Calls `lambda(traversal, seq)` for chunks of the GBWT paths with identifiers
+  `first_path` onwards. Each path is processed in its canonical orientation (see
+  `path_is_canonical()`), and each chunk is a sequence of whole nodes that
+  contains one or more windows of `window_bp` bases. The paths are processed in
+  parallel if `parallel` is true. The lambda must be thread-safe.
+
+  A window is identified by the shortest sequence of nodes containing it. A
+  window is new if the node sequence does not occur in the earlier paths in
+  either orientation. We determine that by building a temporary GBWT of the
+  new paths and comparing the number of occurrences in it to that in the full
+  GBWT. Each new window is guaranteed to be contained in a chunk, and each node
+  sequence is reported from only one of the new paths, even if it occurs in
+  many. Windows that occur in the earlier paths are not reported, except when
+  they happen to be in the same chunk as a new window.
+*/
+template<class Lambda>
+void
+for_each_path_window(const GBWTGraph& graph, gbwt::size_type first_path, size_t window_bp, const Lambda& lambda, bool parallel)
+{
+  gbwt::size_type paths = graph.index->sequences() / 2;
+  if(first_path >= paths || window_bp == 0) { return; }
+
+  // Build a GBWT of the new paths for counting their occurrences.
+  gbwt::GBWT new_paths;
+  {
+    gbwt::size_type node_width = sdsl::bits::length(graph.index->sigma() - 1);
+    gbwt::GBWTBuilder builder(node_width);
+    for(gbwt::size_type path_id = first_path; path_id < paths; path_id++)
+    {
+      gbwt::vector_type path = graph.index->extract(gbwt::Path::encode(path_id, false));
+      if(!(path.empty())) { builder.insert(path, true); }
+    }
+    builder.finish();
+    new_paths = gbwt::GBWT(builder.index);
+  }
+
+  // Node sequences of the windows that have already been reported.
+  std::unordered_set<gbwt::vector_type, WindowHash> reported;
+
+  #pragma omp parallel for schedule(dynamic, 1) if(parallel)
+  for(gbwt::size_type path_id = first_path; path_id < paths; path_id++)
+  {
+    gbwt::vector_type path = graph.index->extract(gbwt::Path::encode(path_id, false));
+    if(!path_is_canonical(path)) { gbwt::reversePath(path); }
+
+    // Node i covers bases [start[i], start[i + 1]) of the path.
+    std::vector<size_t> start(path.size() + 1, 0);
+    for(size_t i = 0; i < path.size(); i++)
+    {
+      start[i + 1] = start[i] + graph.get_length(GBWTGraph::node_to_handle(path[i]));
+    }
+
+    // Mark the nodes of the new windows. A window starting in node `first` ends
+    // at base [start[first] + window_bp - 1, start[first + 1] + window_bp - 1).
+    // If the window ends in node `last`, its node sequence is path[first..last].
+    std::vector<bool> marked(path.size(), false);
+    for(size_t first = 0; first < path.size() && start[first] + window_bp <= start.back(); first++)
+    {
+      size_t low = start[first] + window_bp - 1, high = std::min(start[first + 1] + window_bp - 1, start.back());
+      gbwt::SearchState all_state = graph.index->find(path[first]);
+      gbwt::SearchState new_state = new_paths.find(path[first]);
+      for(size_t last = first; last < path.size() && start[last] < high; last++)
+      {
+        if(last > first)
+        {
+          all_state = graph.index->extend(all_state, path[last]);
+          new_state = new_paths.extend(new_state, path[last]);
+        }
+        if(start[last + 1] <= low || all_state.size() > new_state.size()) { continue; }
+
+        // Report each node sequence only once, regardless of the orientation.
+        gbwt::vector_type window(path.begin() + first, path.begin() + last + 1);
+        gbwt::vector_type reverse;
+        gbwt::reversePath(window, reverse);
+        if(reverse < window) { window.swap(reverse); }
+        bool inserted = false;
+        #pragma omp critical (path_windows)
+        {
+          inserted = reported.insert(std::move(window)).second;
+        }
+        if(inserted)
+        {
+          for(size_t i = first; i <= last; i++) { marked[i] = true; }
+        }
+      }
+    }
+
+    // Process each run of marked nodes in chunks.
+    size_t i = 0;
+    while(i < path.size())
+    {
+      if(!marked[i]) { i++; continue; }
+      size_t run_end = i;
+      while(run_end < path.size() && marked[run_end]) { run_end++; }
+
+      std::vector<handle_t> traversal;
+      std::string seq;
+      while(i < run_end)
+      {
+        // Extend the chunk with at least one new node.
+        size_t chunk_start = i;
+        while(i < run_end && (i == chunk_start || seq.length() < PATH_WINDOW_CHUNK))
+        {
+          handle_t handle = GBWTGraph::node_to_handle(path[i]);
+          view_type view = graph.get_sequence_view(handle);
+          traversal.push_back(handle);
+          seq.append(view.first, view.second);
+          i++;
+        }
+        lambda(traversal, seq);
+        if(i >= run_end) { break; }
+
+        // Keep the shortest suffix of whole nodes with at least `window_bp - 1` bases.
+        size_t keep = 0, suffix_length = 0;
+        while(keep < traversal.size() && suffix_length + 1 < window_bp)
+        {
+          keep++;
+          suffix_length += graph.get_length(traversal[traversal.size() - keep]);
+        }
+        traversal.erase(traversal.begin(), traversal.end() - keep);
+        seq.erase(0, seq.length() - suffix_length);
+      }
+    }
+  }
+}
+
+/*
+  Inserts the minimizers in the GBWT paths with identifiers `first_path` onwards
+  into the index. Function make_value converts a graph position into the value
+  stored in the index. It must be thread-safe. The number of threads can be set
+  through OpenMP.
+*/
+template<class IndexType>
+void
+index_new_paths(const GBWTGraph& graph, IndexType& index, gbwt::size_type first_path,
+                const std::function<typename IndexType::value_type(const pos_t&)>& make_value)
+{
+  typedef typename IndexType::minimizer_type minimizer_type;
+  typedef typename IndexType::insertion_type insertion_type;
+
+  int threads = omp_get_max_threads();
+
+  // Minimizer caching. The batches are inserted into the index using lock striping.
+  std::vector<std::vector<std::pair<minimizer_type, pos_t>>> cache(threads);
+  std::vector<std::vector<insertion_type>> batches(threads);
+  typename IndexType::InsertionLocks locks;
+  constexpr size_t MINIMIZER_CACHE_SIZE = 1024;
+  auto flush_cache = [&](int thread_id)
+  {
+    auto& current_cache = cache[thread_id];
+    gbwt::removeDuplicates(current_cache, false);
+    auto& batch = batches[thread_id];
+    batch.reserve(current_cache.size());
+    for(auto& minimizer : current_cache)
+    {
+      batch.push_back({ minimizer.first.key, minimizer.first.hash, make_value(minimizer.second) });
+    }
+    index.insert(batch, locks);
+    batch.clear();
+    current_cache.clear();
+  };
+
+  // Minimizer finding.
+  auto find_minimizers = [&](const std::vector<handle_t>& traversal, const std::string& seq)
+  {
+    std::vector<minimizer_type> minimizers = index.minimizers(seq); // Calls syncmers() when appropriate.
+    auto iter = traversal.begin();
+    size_t node_start = 0;
+    int thread_id = omp_get_thread_num();
+    for(minimizer_type& minimizer : minimizers)
+    {
+      if(minimizer.empty()) { continue; }
+
+      // Find the node covering minimizer starting position.
+      size_t node_length = graph.get_length(*iter);
+      while(node_start + node_length <= minimizer.offset)
+      {
+        node_start += node_length;
+        ++iter;
+        node_length = graph.get_length(*iter);
+      }
+      pos_t pos { graph.get_id(*iter), graph.get_is_reverse(*iter), minimizer.offset - node_start };
+      if(minimizer.is_reverse) { pos = reverse_base_pos(pos, node_length); }
+      if(!Position::valid_offset(pos))
+      {
+        #pragma omp critical (cerr)
+        {
+          std::cerr << "index_new_haplotypes(): Node offset " << offset(pos) << " is too large" << std::endl;
+        }
+        std::exit(EXIT_FAILURE);
+      }
+      cache[thread_id].emplace_back(minimizer, pos);
+      if(cache[thread_id].size() >= MINIMIZER_CACHE_SIZE) { flush_cache(thread_id); }
+    }
+  };
+
+  for_each_path_window(graph, first_path, index.window_bp(), find_minimizers, (threads > 1));
+  for(int thread_id = 0; thread_id < threads; thread_id++) { flush_cache(thread_id); }
+  index.compact();
+}
+
+} // namespace detail
+
+/*
+  Updates an existing index after new haplotypes have been added to the graph.
+  The paths with identifiers `first_path` onwards are assumed to be new, while
+  the index is assumed to contain the minimizers in the earlier paths. Typically
+  `first_path` is the number of paths in the GBWT used for building the index.
+  Function argument get_payload is used to generate the payload for each new
+  position. It must be thread-safe. The number of threads can be set through
+  OpenMP.
+
+  Any window that is new or haplotype-consistent only in the new graph is a
+  substring of a new path. We therefore find the minimizers along the new paths
+  instead of traversing the entire graph. Windows whose node sequences already
+  occur in the earlier paths are skipped, and each new window is processed
+  only once. Positions that are already in the index are not inserted again.
+  Finding the new windows requires building a temporary GBWT of the new paths
+  and searching for the windows starting at each node of them. The minimizers
+  are only computed for the chunks containing new windows. Removing haplotypes
+  from the graph is not supported.
+*/
+template<class KeyType>
+void
+index_new_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, PositionPayload>& index, gbwt::size_type first_path,
+                     const std::function<Payload(const pos_t&)>& get_payload)
+{
+  detail::index_new_paths(graph, index, first_path, std::function<PositionPayload(const pos_t&)>([&](const pos_t& pos) -> PositionPayload
+  {
+    return { Position::encode(pos), get_payload(pos) };
+  }));
+}
+
+/*
+  Updates an existing index after new haplotypes have been added to the graph.
+  This version is used for minimizer indexes without payloads. See the version
+  with payloads for details.
+*/
+template<class KeyType>
+void
+index_new_haplotypes(const GBWTGraph& graph, MinimizerIndex<KeyType, Position>& index, gbwt::size_type first_path)
+{
+  detail::index_new_paths(graph, index, first_path, std::function<Position(const pos_t&)>([](const pos_t& pos) -> Position
+  {
+    return Position::encode(pos);
+  }));
 }
 
 //------------------------------------------------------------------------------
@@ -228,33 +784,38 @@ canonical_kmers(const std::string& seq, size_t k)
 
 //------------------------------------------------------------------------------
 
+// Default number of kmer indexes in frequent_kmers().
+constexpr size_t DEFAULT_KMER_SHARDS = 4;
+
+namespace detail
+{
+
 /*
-  Index the haplotypes in the graph. Insert the kmers into the provided index
-  if `include(key)` returns `true`. The number of threads can be set through
-  OpenMP.
+  Collects the canonical kmers in the haplotypes and partitions them into
+  `shards` shards. Function `shard_of` determines the shard for each kmer;
+  kmers with a shard outside the range are skipped. Each thread caches the
+  kmers for each shard. When a cache becomes full, duplicate occurrences are
+  removed and the cache is passed to `flush(shard, cache)`, which may be called
+  concurrently for the same shard from multiple threads. The number of threads
+  can be set through OpenMP.
 */
-template<class KeyType, class Predicate>
+template<class KeyType, class ShardFunction, class FlushFunction>
 void
-build_kmer_index(const GBWTGraph& graph, KmerIndex<KeyType, Position>& index, size_t k, const Predicate& include)
+collect_kmer_shards(const GBWTGraph& graph, size_t shards, size_t k, const ShardFunction& shard_of, const FlushFunction& flush)
 {
   typedef KeyType key_type;
   typedef Kmer<key_type> kmer_type;
 
   // Kmer caching.
-  int threads = 1;//omp_get_max_threads();
-  std::vector<std::vector<std::pair<kmer_type, Position>>> cache(threads);
+  int threads = omp_get_max_threads();
+  std::vector<std::vector<std::vector<std::pair<kmer_type, Position>>>> cache(threads, std::vector<std::vector<std::pair<kmer_type, Position>>>(shards));
   constexpr size_t KMER_CACHE_SIZE = 1024;
-  auto flush_cache = [&](int thread_id)
+  auto flush_cache = [&](int thread_id, size_t shard)
   {
-    auto& current_cache = cache[thread_id];
+    auto& current_cache = cache[thread_id][shard];
+    if(current_cache.empty()) { return; }
     gbwt::removeDuplicates(current_cache, false);
-    //#pragma omp critical (kmer_index)
-    {
-      for(auto& kmer : current_cache)
-      {
-        index.insert(kmer.first.key, kmer.second, kmer.first.hash);
-      }
-    }
+    flush(shard, current_cache);
     current_cache.clear();
   };
 
@@ -264,7 +825,7 @@ build_kmer_index(const GBWTGraph& graph, KmerIndex<KeyType, Position>& index, si
     std::vector<kmer_type> kmers = canonical_kmers<key_type>(seq, k);
     auto iter = traversal.begin();
     size_t node_start = 0;
-    int thread_id = 0;//omp_get_thread_num();
+    int thread_id = omp_get_thread_num();
     for(auto kmer : kmers)
     {
       if(kmer.empty()) { continue; }
@@ -279,14 +840,73 @@ build_kmer_index(const GBWTGraph& graph, KmerIndex<KeyType, Position>& index, si
       }
       pos_t pos { graph.get_id(*iter), graph.get_is_reverse(*iter), kmer.offset - node_start };
       if(kmer.is_reverse) { pos = reverse_base_pos(pos, node_length); }
-      if(include(kmer.key)) { cache[thread_id].emplace_back(kmer, Position::encode(pos)); }
+
+      // Insert the kmer into the right shard.
+      size_t shard = shard_of(kmer);
+      if(shard < shards) { cache[thread_id][shard].emplace_back(kmer, Position::encode(pos)); }
+    }
+    for(size_t shard = 0; shard < shards; shard++)
+    {
+      if(cache[thread_id][shard].size() >= KMER_CACHE_SIZE) { flush_cache(thread_id, shard); }
     }
-    if(cache[thread_id].size() >= KMER_CACHE_SIZE) { flush_cache(thread_id); }
   };
 
-  // Count all kmers.
+  // Find all kmers and flush the remaining caches one shard at a time.
   for_each_haplotype_window(graph, k, find_kmers, (threads > 1));
-  for(int thread_id = 0; thread_id < threads; thread_id++) { flush_cache(thread_id); }
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_t shard = 0; shard < shards; shard++)
+  {
+    for(int thread_id = 0; thread_id < threads; thread_id++) { flush_cache(thread_id, shard); }
+  }
+}
+
+/*
+  Inserts the canonical kmers in the haplotypes into `shards` indexes using
+  collect_kmer_shards(). The cached kmers are inserted with
+  KmerIndex::insert_concurrent() using the corresponding locks.
+*/
+template<class KeyType, class ShardFunction>
+void
+build_kmer_shards(const GBWTGraph& graph, KmerIndex<KeyType, Position>* indexes, typename KmerIndex<KeyType, Position>::InsertionLocks* locks,
+                  size_t shards, size_t k, const ShardFunction& shard_of)
+{
+  typedef Kmer<KeyType> kmer_type;
+  typedef typename KmerIndex<KeyType, Position>::Insertion insertion_type;
+
+  std::vector<std::vector<insertion_type>> batches(omp_get_max_threads());
+  collect_kmer_shards<KeyType>(graph, shards, k, shard_of, [&](size_t shard, const std::vector<std::pair<kmer_type, Position>>& cache)
+  {
+    auto& batch = batches[omp_get_thread_num()];
+    batch.reserve(cache.size());
+    for(auto& kmer : cache)
+    {
+      batch.push_back({ kmer.first.key, kmer.first.hash, kmer.second });
+    }
+    indexes[shard].insert_concurrent(batch, locks[shard]);
+    batch.clear();
+  });
+}
+
+} // namespace detail
+
+//------------------------------------------------------------------------------
+
+/*
+  Index the haplotypes in the graph. Insert the kmers into the provided index
+  if `include(key)` returns `true`. The number of threads can be set through
+  OpenMP. Function `include` must be thread-safe.
+*/
+template<class KeyType, class Predicate>
+void
+build_kmer_index(const GBWTGraph& graph, KmerIndex<KeyType, Position>& index, size_t k, const Predicate& include)
+{
+  typedef KmerIndex<KeyType, Position> index_type;
+
+  typename index_type::InsertionLocks locks;
+  detail::build_kmer_shards(graph, &index, &locks, 1, k, [&](const Kmer<KeyType>& kmer) -> size_t
+  {
+    return (include(kmer.key) ? 0 : 1);
+  });
 }
 
 //------------------------------------------------------------------------------
@@ -299,66 +919,38 @@ template<class KeyType>
 void
 build_kmer_indexes(const GBWTGraph& graph, std::array<KmerIndex<KeyType, Position>, 4>& indexes, size_t k)
 {
-  typedef KeyType key_type;
-  typedef Kmer<key_type> kmer_type;
-
-  // Kmer caching.
-  int threads = 1;//omp_get_max_threads();
-  std::array<std::mutex, 4> mutexes;
-  std::vector<std::array<std::vector<std::pair<kmer_type, Position>>, 4>> cache(threads);
-  constexpr size_t KMER_CACHE_SIZE = 1024;
-  auto flush_cache = [&](int thread_id, size_t index)
-  {
-    auto& current_cache = cache[thread_id][index];
-    gbwt::removeDuplicates(current_cache, false);
-    {
-      std::lock_guard<std::mutex> lock(mutexes[index]);
-      for(auto& kmer : current_cache)
-      {
-        indexes[index].insert(kmer.first.key, kmer.second, kmer.first.hash);
-      }
-    }
-    current_cache.clear();
-  };
+  typedef KmerIndex<KeyType, Position> index_type;
 
-  // Kmer finding.
-  auto find_kmers = [&](const std::vector<handle_t>& traversal, const std::string& seq)
+  std::vector<typename index_type::InsertionLocks> locks(indexes.size());
+  detail::build_kmer_shards(graph, indexes.data(), locks.data(), indexes.size(), k, [&](const Kmer<KeyType>& kmer) -> size_t
   {
-    std::vector<kmer_type> kmers = canonical_kmers<key_type>(seq, k);
-    auto iter = traversal.begin();
-    size_t node_start = 0;
-    int thread_id = 0;//omp_get_thread_num();
-    for(auto kmer : kmers)
-    {
-      if(kmer.empty()) { continue; }
-
-      // Find the node covering kmer starting position.
-      size_t node_length = graph.get_length(*iter);
-      while(node_start + node_length <= kmer.offset)
-      {
-        node_start += node_length;
-        ++iter;
-        node_length = graph.get_length(*iter);
-      }
-      pos_t pos { graph.get_id(*iter), graph.get_is_reverse(*iter), kmer.offset - node_start };
-      if(kmer.is_reverse) { pos = reverse_base_pos(pos, node_length); }
+    return kmer.key.access_raw(k, k / 2);
+  });
+}
 
-      // Insert the kmer into the right index.
-      size_t index = kmer.key.access_raw(k, k / 2);
-      if(index < indexes.size()) { cache[thread_id][index].emplace_back(kmer, Position::encode(pos)); }
-    }
-    for(size_t i = 0; i < indexes.size(); i++)
-    {
-      if(cache[thread_id][i].size() >= KMER_CACHE_SIZE) { flush_cache(thread_id, i); }
-    }
-  };
+/*
+  Index the haplotypes in the graph. Partition the kmers by hash value between
+  the provided indexes, which must be non-empty. Each kmer is inserted into the
+  index given by kmer_shard(). The number of threads can be set through OpenMP.
+  Using more shards than threads reduces lock contention.
+*/
+template<class KeyType>
+void
+build_kmer_indexes(const GBWTGraph& graph, std::vector<KmerIndex<KeyType, Position>>& indexes, size_t k)
+{
+  typedef KmerIndex<KeyType, Position> index_type;
 
-  // Count all kmers.
-  for_each_haplotype_window(graph, k, find_kmers, (threads > 1));
-  for(int thread_id = 0; thread_id < threads; thread_id++)
+  if(indexes.empty())
   {
-    for(size_t index = 0; index < indexes.size(); index++) { flush_cache(thread_id, index); }
+    std::cerr << "build_kmer_indexes(): No indexes were provided" << std::endl;
+    return;
   }
+  std::vector<typename index_type::InsertionLocks> locks(indexes.size());
+  size_t shards = indexes.size();
+  detail::build_kmer_shards(graph, indexes.data(), locks.data(), shards, k, [&](const Kmer<KeyType>& kmer) -> size_t
+  {
+    return kmer_shard(kmer.hash, shards);
+  });
 }
 
 //------------------------------------------------------------------------------
@@ -372,9 +964,10 @@ build_kmer_indexes(const GBWTGraph& graph, std::array<KmerIndex<KeyType, Positio
 
   There are two versions of this algorithm:
 
-  * The fast version (default) uses four kmer indexes with the given hash
-    table size and inserts each kmer into the index determined by the
-    middle base. This version uses more memory and parallelizes better.
+  * The fast version (default) partitions the kmers by hash value between
+    `shards` kmer indexes, each with the given hash table size. This version
+    uses more memory and parallelizes better. Using more shards than threads
+    reduces lock contention.
 
   * The space-efficient version does four passes over the graph. In each
     pass, it only considers the kmers with a specific middle base. This
@@ -383,17 +976,17 @@ build_kmer_indexes(const GBWTGraph& graph, std::array<KmerIndex<KeyType, Positio
 */
 template<class KeyType>
 std::vector<KeyType>
-frequent_kmers(const GBWTGraph& graph, size_t k, size_t threshold, bool space_efficient, size_t hash_table_size = KmerIndex<KeyType, Position>::INITIAL_CAPACITY)
+frequent_kmers(const GBWTGraph& graph, size_t k, size_t threshold, bool space_efficient,
+               size_t hash_table_size = KmerIndex<KeyType, Position>::INITIAL_CAPACITY, size_t shards = DEFAULT_KMER_SHARDS)
 {
   typedef KmerIndex<KeyType, Position> index_type;
   typedef typename index_type::cell_type cell_type;
 
-  std::vector<KeyType> result;
-  auto select_frequent = [&](const index_type& index)
+  auto select_frequent = [&](const index_type& index, std::vector<KeyType>& result)
   {
     index.for_each_kmer([&](const cell_type& cell)
     {
-      if(threshold == 0 || (cell.first.is_pointer() && cell.second.pointer->size() > threshold))
+      if(threshold == 0 || (cell.first.is_pointer() && index.occurrences(cell).second > threshold))
       {
         result.push_back(cell.first);
         result.back().clear_pointer();
@@ -401,25 +994,236 @@ frequent_kmers(const GBWTGraph& graph, size_t k, size_t threshold, bool space_ef
     });
   };
 
+  std::vector<KeyType> result;
   if(space_efficient)
   {
     for(char base : { 'A', 'C', 'G', 'T' })
     {
       index_type index(hash_table_size);
       build_kmer_index(graph, index, k, [&](KeyType key) -> bool { return (key.access(k, k / 2) == base); });
-      select_frequent(index);
+      select_frequent(index, result);
     }
   }
   else
   {
-    std::array<index_type, 4> indexes
-    {
-      index_type(hash_table_size), index_type(hash_table_size), index_type(hash_table_size), index_type(hash_table_size),
-    };
+    std::vector<index_type> indexes(std::max(shards, size_t(1)), index_type(hash_table_size));
     build_kmer_indexes(graph, indexes, k);
-    for(auto& index : indexes) { select_frequent(index); }
+    std::vector<std::vector<KeyType>> selected(indexes.size());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_t shard = 0; shard < indexes.size(); shard++)
+    {
+      select_frequent(indexes[shard], selected[shard]);
+      index_type().swap(indexes[shard]);
+    }
+    for(auto& kmers : selected)
+    {
+      result.insert(result.end(), kmers.begin(), kmers.end());
+      std::vector<KeyType>().swap(kmers);
+    }
+  }
+
+  gbwt::parallelQuickSort(result.begin(), result.end());
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+// Default parameters for external-memory kmer counting.
+constexpr size_t DEFAULT_KMER_BUCKETS = 256;
+constexpr size_t DEFAULT_KMER_MEMORY = size_t(4) << 30; // Bytes.
+
+namespace detail
+{
+
+/*
+  A set of temporary files storing (kmer, position) records. Writing to a
+  bucket is thread-safe. The files are removed when the object is destroyed.
+*/
+template<class KeyType>
+struct KmerBuckets
+{
+  typedef std::pair<KeyType, Position> record_type;
+
+  std::vector<std::string>   names;
+  std::vector<std::ofstream> files;
+  std::vector<std::mutex>    mutexes;
+  std::vector<size_t>        sizes; // In records.
+
+  explicit KmerBuckets(size_t buckets) :
+    names(buckets), files(buckets), mutexes(buckets), sizes(buckets, 0)
+  {
+    for(size_t bucket = 0; bucket < buckets; bucket++)
+    {
+      this->names[bucket] = gbwt::TempFile::getName("kmers");
+      this->files[bucket].open(this->names[bucket], std::ios_base::binary);
+      if(!(this->files[bucket]))
+      {
+        ABSL_LOG(FATAL) << "KmerBuckets: Cannot open temporary file " << this->names[bucket];
+      }
+    }
+  }
+
+  ~KmerBuckets()
+  {
+    for(std::string& name : this->names)
+    {
+      if(!(name.empty())) { gbwt::TempFile::remove(name); }
+    }
+  }
+
+  size_t size() const { return this->names.size(); }
+
+  void write(size_t bucket, const record_type* records, size_t n)
+  {
+    std::lock_guard<std::mutex> lock(this->mutexes[bucket]);
+    this->files[bucket].write(reinterpret_cast<const char*>(records), n * sizeof(record_type));
+    this->sizes[bucket] += n;
+  }
+
+  void close()
+  {
+    for(size_t bucket = 0; bucket < this->size(); bucket++)
+    {
+      this->files[bucket].close();
+      if(this->files[bucket].fail())
+      {
+        ABSL_LOG(FATAL) << "KmerBuckets: Cannot write temporary file " << this->names[bucket];
+      }
+    }
+  }
+};
+
+// Number of bucket levels, including the initial partitioning.
+constexpr size_t KMER_BUCKET_LEVELS = 3;
+
+// Number of records read at once when repartitioning a bucket.
+constexpr size_t KMER_BUCKET_BUFFER = 1 << 20;
+
+/*
+  Counts the kmers in the given bucket file and removes the file. If the bucket
+  is larger than the memory budget, it is first repartitioned into `buckets`
+  smaller buckets using lower bits of the hash.
+*/
+template<class KeyType>
+void
+count_kmer_bucket(std::string& name, size_t records, size_t level, size_t buckets, size_t memory_budget,
+                  const std::function<void(KeyType, size_t)>& callback)
+{
+  typedef std::pair<KeyType, Position> record_type;
+
+  std::ifstream in(name, std::ios_base::binary);
+  if(!in) { ABSL_LOG(FATAL) << "count_kmers_external(): Cannot open temporary file " << name; }
+
+  if(records * sizeof(record_type) > memory_budget && level < KMER_BUCKET_LEVELS)
+  {
+    KmerBuckets<KeyType> partition(buckets);
+    std::vector<record_type> buffer(std::min(records, KMER_BUCKET_BUFFER));
+    for(size_t offset = 0; offset < records; offset += buffer.size())
+    {
+      size_t n = std::min(buffer.size(), records - offset);
+      in.read(reinterpret_cast<char*>(buffer.data()), n * sizeof(record_type));
+      if(!in) { ABSL_LOG(FATAL) << "count_kmers_external(): Cannot read temporary file " << name; }
+      for(size_t i = 0; i < n; i++)
+      {
+        size_t bucket = kmer_shard(buffer[i].first.hash() << (16 * level), buckets);
+        partition.files[bucket].write(reinterpret_cast<const char*>(buffer.data() + i), sizeof(record_type));
+        partition.sizes[bucket]++;
+      }
+    }
+    in.close();
+    gbwt::TempFile::remove(name);
+    std::vector<record_type>().swap(buffer);
+    partition.close();
+    for(size_t bucket = 0; bucket < partition.size(); bucket++)
+    {
+      count_kmer_bucket(partition.names[bucket], partition.sizes[bucket], level + 1, buckets, memory_budget, callback);
+    }
+    return;
+  }
+
+  // Load and sort the bucket. Different threads may have found the same occurrence.
+  std::vector<record_type> data(records);
+  in.read(reinterpret_cast<char*>(data.data()), records * sizeof(record_type));
+  if(!in) { ABSL_LOG(FATAL) << "count_kmers_external(): Cannot read temporary file " << name; }
+  in.close();
+  gbwt::TempFile::remove(name);
+  gbwt::parallelQuickSort(data.begin(), data.end());
+
+  for(size_t i = 0; i < data.size(); )
+  {
+    size_t hits = 1, j = i + 1;
+    while(j < data.size() && data[j].first == data[i].first)
+    {
+      if(data[j].second != data[j - 1].second) { hits++; }
+      j++;
+    }
+    callback(data[i].first, hits);
+    i = j;
   }
+}
+
+} // namespace detail
 
+/*
+  Counts the canonical kmers in the haplotypes using external memory. Calls
+  `callback(key, hits)` for each distinct kmer, where `hits` is the number of
+  distinct graph positions. The callback is called from a single thread, and the
+  kmers are in no particular order. The number of threads can be set through
+  OpenMP.
+
+  The kmer occurrences are partitioned by hash value into `buckets` temporary
+  files created with gbwt::TempFile. The buckets are then counted one at a time.
+  A bucket larger than `memory_budget` bytes is first repartitioned into smaller
+  buckets. The budget does not include the per-thread kmer caches used during
+  the traversal.
+*/
+template<class KeyType>
+void
+count_kmers_external(const GBWTGraph& graph, size_t k, const std::function<void(KeyType, size_t)>& callback,
+                     size_t memory_budget = DEFAULT_KMER_MEMORY, size_t buckets = DEFAULT_KMER_BUCKETS)
+{
+  typedef Kmer<KeyType> kmer_type;
+  typedef std::pair<KeyType, Position> record_type;
+
+  buckets = std::max(buckets, size_t(1));
+  detail::KmerBuckets<KeyType> spill(buckets);
+  std::vector<std::vector<record_type>> buffers(omp_get_max_threads());
+  detail::collect_kmer_shards<KeyType>(graph, buckets, k, [&](const kmer_type& kmer) -> size_t
+  {
+    return kmer_shard(kmer.hash, buckets);
+  },
+  [&](size_t bucket, const std::vector<std::pair<kmer_type, Position>>& cache)
+  {
+    auto& buffer = buffers[omp_get_thread_num()];
+    buffer.reserve(cache.size());
+    for(auto& kmer : cache) { buffer.emplace_back(kmer.first.key, kmer.second); }
+    spill.write(bucket, buffer.data(), buffer.size());
+    buffer.clear();
+  });
+  std::vector<std::vector<record_type>>().swap(buffers);
+  spill.close();
+
+  for(size_t bucket = 0; bucket < spill.size(); bucket++)
+  {
+    detail::count_kmer_bucket(spill.names[bucket], spill.sizes[bucket], 1, buckets, memory_budget, callback);
+  }
+}
+
+/*
+  Returns all kmers in the haplotypes with more than `threshold` hits in the
+  graph in sorted order, using external memory. See count_kmers_external()
+  for details. The result is the same as with frequent_kmers().
+*/
+template<class KeyType>
+std::vector<KeyType>
+frequent_kmers_external(const GBWTGraph& graph, size_t k, size_t threshold,
+                        size_t memory_budget = DEFAULT_KMER_MEMORY, size_t buckets = DEFAULT_KMER_BUCKETS)
+{
+  std::vector<KeyType> result;
+  count_kmers_external<KeyType>(graph, k, [&](KeyType key, size_t hits)
+  {
+    if(hits > threshold) { result.push_back(key); }
+  }, memory_budget, buckets);
   gbwt::parallelQuickSort(result.begin(), result.end());
   return result;
 }
@@ -1,8 +1,11 @@
 #ifndef GBWTGRAPH_INTERNAL_H
 #define GBWTGRAPH_INTERNAL_H
 
+#include "cached_gbwtgraph.h"
 #include "gbz.h"
 
+#include <algorithm>
+#include <functional>
 #include <iostream>
 #include <string>
 #include <unordered_map>
@@ -298,28 +301,95 @@ public:
 
 /*
   A cache that stores GBWT records larger than `bytes` bytes as `DecompressedRecord`
-  and supports faster path extraction from the index.
+  and supports faster path extraction from the index. The records are decompressed
+  on demand and stored in a `SharedRecordCache` with a memory budget of `budget`
+  bytes. The cache can be used from multiple threads.
 */
 struct LargeRecordCache
 {
-  LargeRecordCache(const gbwt::GBWT& index, size_t bytes);
+  LargeRecordCache(const gbwt::GBWT& index, size_t bytes, size_t budget = SharedRecordCache::DEFAULT_BUDGET);
 
   size_t size() const { return this->cache.size(); }
+  size_t bytes() const { return this->cache.bytes(); }
   gbwt::size_type sequences() const { return this->index.sequences(); }
 
   gbwt::vector_type extract(gbwt::size_type sequence) const;
 
   const gbwt::GBWT& index;
-  std::unordered_map<gbwt::node_type, gbwt::DecompressedRecord> cache;
+  SharedRecordCache cache;
 };
 
 //------------------------------------------------------------------------------
 
+/*
+  Maps a set of node ids to ranks [0, size()) in sorted order. Uses a dense
+  lookup table over the node id range if the range is not much larger than the
+  number of nodes, and binary search otherwise.
+*/
+struct NodeRanks
+{
+  NodeRanks() = default;
+
+  // Sorts the ids and removes duplicates if necessary.
+  explicit NodeRanks(std::vector<nid_t> nodes);
+
+  size_t size() const { return this->ids.size(); }
+  bool empty() const { return this->ids.empty(); }
+
+  // Returns the rank of the node or `size()` if the node is not in the set.
+  size_t find(nid_t id) const
+  {
+    if(!(this->dense.empty()))
+    {
+      if(id < this->first_id || static_cast<size_t>(id - this->first_id) >= this->dense.size()) { return this->size(); }
+      size_t rank = this->dense[id - this->first_id];
+      return (rank > 0 ? rank - 1 : this->size());
+    }
+    auto iter = std::lower_bound(this->ids.begin(), this->ids.end(), id);
+    return (iter != this->ids.end() && *iter == id ? iter - this->ids.begin() : this->size());
+  }
+
+  // Use the dense table if the id range is at most this many times the number of nodes.
+  constexpr static size_t MAX_SPARSITY = 4;
+
+  std::vector<nid_t> ids; // Sorted and unique.
+
+  // Rank + 1 for each id in [first_id, first_id + dense.size()), or 0.
+  nid_t first_id = 0;
+  std::vector<size_t> dense;
+};
+
+//------------------------------------------------------------------------------
+
+/*
+  Writes the sections of a file to the output stream in order. With multiple
+  threads, the calling thread writes the first `direct` sections (at least one)
+  directly to the output, while up to `threads - 1` worker threads encode the
+  later sections into memory buffers. The calling thread then writes each buffer
+  as soon as the preceding sections have been written, or writes the section
+  directly if no worker has started it yet. The output is identical to calling
+  the sections one after another, but the buffers may use as much memory as the
+  later sections. Large sections at the start of the file should therefore be
+  written directly. Exceptions from the sections or the stream are rethrown in
+  the calling thread after the workers have finished.
+*/
+void serialize_sections(std::ostream& out, const std::vector<std::function<void(std::ostream&)>>& sections, size_t threads, size_t direct = 1);
+
+//------------------------------------------------------------------------------
+
 // Sample (sequence offset, GBWT position) at the start of a node approximately
 // every `sample_interval` bp, with the first sample at offset 0.
 // If `length` is not nullptr, it will be set to the length of the path.
 std::vector<std::pair<size_t, gbwt::edge_type>> sample_path_positions(const GBZ& gbz, path_handle_t path, size_t sample_interval, size_t* length = nullptr);
 
+// Returns a longest common subsequence of the two node sequences as pairs
+// (offset in path, offset in reference) in increasing order. The result is the
+// same as the standard traceback of the quadratic dynamic programming table,
+// which prefers matches, then moving up in the path if that does not decrease
+// the LCS length, and then moving left in the reference. This uses the
+// bit-parallel LCS algorithm and stores one bit per table cell.
+std::vector<std::pair<size_t, size_t>> longest_common_subsequence(const gbwt::vector_type& reference, const gbwt::vector_type& path);
+
 //------------------------------------------------------------------------------
 
 } // namespace gbwtgraph
@@ -61,9 +61,9 @@ load_size(std::istream& in, Container& c)
 }
 
 // Serialize a vector of simple elements in blocks.
-template<typename Element>
+template<typename Element, class Allocator>
 size_t
-serialize_vector(std::ostream& out, const std::vector<Element>& v, bool& ok)
+serialize_vector(std::ostream& out, const std::vector<Element, Allocator>& v, bool& ok)
 {
   size_t bytes = 0;
 
@@ -83,9 +83,9 @@ serialize_vector(std::ostream& out, const std::vector<Element>& v, bool& ok)
 }
 
 // Load a serialized vector of simple elements.
-template<typename Element>
+template<typename Element, class Allocator>
 bool
-load_vector(std::istream& in, std::vector<Element>& v)
+load_vector(std::istream& in, std::vector<Element, Allocator>& v)
 {
   if(!load_size(in, v)) { return false; }
 
@@ -101,24 +101,46 @@ load_vector(std::istream& in, std::vector<Element>& v)
   return true;
 }
 
+// Load a serialized vector of simple elements and append it to the given vector.
+template<typename Element, class Allocator>
+bool
+append_vector(std::istream& in, std::vector<Element, Allocator>& v)
+{
+  size_t size = 0;
+  if(!load(in, size)) { return false; }
+  size_t start = v.size();
+  v.resize(start + size);
+
+  // Data in blocks of BLOCK_SIZE elements.
+  for(size_t i = 0; i < size; i += BLOCK_SIZE)
+  {
+    size_t block_size = std::min(size - i, BLOCK_SIZE);
+    size_t byte_size = block_size * sizeof(Element);
+    in.read(reinterpret_cast<char*>(v.data() + start + i), byte_size);
+    if(static_cast<size_t>(in.gcount()) != byte_size) { return false; }
+  }
+
+  return true;
+}
+
 // Serialize a hash table, replacing pointers with empty values.
 // The hash table can be loaded with load_vector().
 template<class CellType, class ValueType>
 size_t
-serialize_hash_table(std::ostream& out, const std::vector<CellType>& hash_table,
+serialize_hash_table(std::ostream& out, const CellType* hash_table, size_t size,
                      const ValueType NO_VALUE, bool& ok)
 {
   size_t bytes = 0;
 
-  bytes += serialize_size(out, hash_table, ok);
+  bytes += serialize(out, size, ok);
 
   // Data in blocks of BLOCK_SIZE elements. Replace pointers with NO_VALUE to ensure
   // that the file contents are deterministic.
-  for(size_t i = 0; i < hash_table.size(); i += BLOCK_SIZE)
+  for(size_t i = 0; i < size; i += BLOCK_SIZE)
   {
-    size_t block_size = std::min(hash_table.size() - i, BLOCK_SIZE);
+    size_t block_size = std::min(size - i, BLOCK_SIZE);
     size_t byte_size = block_size * sizeof(CellType);
-    std::vector<CellType> buffer(hash_table.begin() + i, hash_table.begin() + i + block_size);
+    std::vector<CellType> buffer(hash_table + i, hash_table + i + block_size);
     for(size_t j = 0; j < buffer.size(); j++)
     {
       if(buffer[j].first.is_pointer()) { buffer[j].second.value = NO_VALUE; }
@@ -131,6 +153,38 @@ serialize_hash_table(std::ostream& out, const std::vector<CellType>& hash_table,
   return bytes;
 }
 
+// Serialize a hash table, replacing pointers with empty values.
+template<class CellType, class Allocator, class ValueType>
+size_t
+serialize_hash_table(std::ostream& out, const std::vector<CellType, Allocator>& hash_table,
+                     const ValueType NO_VALUE, bool& ok)
+{
+  return serialize_hash_table(out, hash_table.data(), hash_table.size(), NO_VALUE, ok);
+}
+
+// Serialize an array of simple elements as a vector.
+// The array can be loaded with load_vector().
+template<typename Element>
+size_t
+serialize_array(std::ostream& out, const Element* data, size_t size, bool& ok)
+{
+  size_t bytes = 0;
+
+  bytes += serialize(out, size, ok);
+
+  // Data in blocks of BLOCK_SIZE elements.
+  for(size_t i = 0; i < size; i += BLOCK_SIZE)
+  {
+    size_t block_size = std::min(size - i, BLOCK_SIZE);
+    size_t byte_size = block_size * sizeof(Element);
+    out.write(reinterpret_cast<const char*>(data + i), byte_size);
+    if(out.fail()) { ok = false; return bytes; }
+    bytes += byte_size;
+  }
+
+  return bytes;
+}
+
 } // namespace io
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,207 @@
+#ifndef GBWTGRAPH_MEMORY_H
+#define GBWTGRAPH_MEMORY_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+/*
+  memory.h: Huge page and NUMA placement policies for large index structures.
+*/
+
+namespace gbwtgraph
+{
+
+//------------------------------------------------------------------------------
+
+/*
+  A placement policy for large allocations. Allocations of at least `min_bytes`
+  bytes made with `PolicyAllocator` are memory mapped directly, and the policy
+  determines their page size and NUMA placement:
+
+  * Transparent huge pages use `madvise(MADV_HUGEPAGE)` on a 2 MiB aligned
+    mapping. Explicit 2 MiB / 1 GiB pages use `MAP_HUGETLB`, which requires
+    pages reserved by the administrator. If there are no such pages, the
+    allocation falls back to transparent huge pages.
+
+  * NUMA interleave spreads the pages over all online nodes. Preferring a node
+    places the pages on that node if possible.
+
+  Placement is advisory: if the system does not support it, the allocation
+  succeeds with default placement.
+
+  The policy for the current thread is the innermost `ScopedMemoryPolicy` or
+  the global policy set with `set_global()`. The default global policy does
+  nothing, and the allocator then behaves like `std::allocator`.
+*/
+struct MemoryPolicy
+{
+  enum page_type { pages_default, pages_transparent, pages_2m, pages_1g };
+  enum numa_type { numa_default, numa_interleave, numa_prefer };
+
+  page_type pages = pages_default;
+  numa_type numa = numa_default;
+  int       node = 0; // Preferred node with `numa_prefer`.
+
+  // Smaller allocations use the default allocator.
+  constexpr static size_t MIN_BYTES = 2 * 1048576;
+  size_t min_bytes = MIN_BYTES;
+
+  bool is_default() const { return (this->pages == pages_default && this->numa == numa_default); }
+  bool applies_to(size_t bytes) const { return (!(this->is_default()) && bytes >= this->min_bytes); }
+
+  // Returns the policy for allocations in the current thread.
+  static const MemoryPolicy& current();
+
+  // Sets the global policy. This should be done before building or loading
+  // the indexes and while no other threads are allocating memory.
+  static void set_global(const MemoryPolicy& policy);
+
+  /*
+    Parses a policy from a comma-separated list of page sizes (`default`,
+    `thp`, `2m`, `1g`) and NUMA placements (`interleave`, `node=N`).
+    Returns false if the string is invalid.
+  */
+  static bool parse(const std::string& str, MemoryPolicy& policy);
+
+  std::string to_string() const;
+};
+
+/*
+  Uses the given policy for allocations in the current thread until the object
+  is destroyed. Scopes can be nested.
+*/
+class ScopedMemoryPolicy
+{
+public:
+  explicit ScopedMemoryPolicy(const MemoryPolicy& policy);
+  ~ScopedMemoryPolicy();
+
+  ScopedMemoryPolicy(const ScopedMemoryPolicy&) = delete;
+  ScopedMemoryPolicy& operator=(const ScopedMemoryPolicy&) = delete;
+
+private:
+  MemoryPolicy        policy;
+  const MemoryPolicy* previous;
+};
+
+//------------------------------------------------------------------------------
+
+// Returns the online NUMA nodes, or { 0 } if the information is not available.
+std::vector<int> numa_nodes();
+
+// Returns the NUMA node the current thread is running on, or -1 if unknown.
+int current_numa_node();
+
+/*
+  Maps at least `bytes` bytes of zero-initialized memory using the policy.
+  Returns nullptr on failure. The memory must be released with
+  `release_memory()`.
+*/
+void* allocate_memory(size_t bytes, const MemoryPolicy& policy);
+
+// Releases memory allocated with `allocate_memory()`. Returns false if the
+// pointer was not allocated with it.
+bool release_memory(void* ptr);
+
+/*
+  Applies the policy to existing memory that was not allocated with the policy,
+  such as structures owned by other libraries. Huge pages are requested for
+  the aligned 2 MiB regions within the range, and the pages are migrated to
+  the NUMA placement. Returns false if the system did not accept the request.
+*/
+bool apply_memory_policy(const void* ptr, size_t bytes, const MemoryPolicy& policy);
+
+//------------------------------------------------------------------------------
+
+/*
+  A stateless allocator that uses the current memory policy for large
+  allocations. Standard containers using it can be swapped and moved freely,
+  as the memory remembers how it was allocated.
+*/
+template<class T>
+struct PolicyAllocator
+{
+  typedef T value_type;
+
+  PolicyAllocator() = default;
+  template<class U> PolicyAllocator(const PolicyAllocator<U>&) {}
+
+  T* allocate(size_t n)
+  {
+    size_t bytes = n * sizeof(T);
+    const MemoryPolicy& policy = MemoryPolicy::current();
+    if(policy.applies_to(bytes))
+    {
+      void* ptr = allocate_memory(bytes, policy);
+      if(ptr == nullptr) { throw std::bad_alloc(); }
+      return static_cast<T*>(ptr);
+    }
+    return static_cast<T*>(::operator new(bytes));
+  }
+
+  void deallocate(T* ptr, size_t)
+  {
+    if(!release_memory(ptr)) { ::operator delete(ptr); }
+  }
+};
+
+template<class T, class U>
+bool operator==(const PolicyAllocator<T>&, const PolicyAllocator<U>&) { return true; }
+
+template<class T, class U>
+bool operator!=(const PolicyAllocator<T>&, const PolicyAllocator<U>&) { return false; }
+
+//------------------------------------------------------------------------------
+
+/*
+  Per-NUMA-node replicas of a read-only structure. Each replica is a copy of
+  the source made while allocations are placed on that node, so the structure
+  should use `PolicyAllocator` for its large arrays. A query thread should use
+  `local()` to access the replica on the node it is running on.
+*/
+template<class T>
+class NUMAReplicas
+{
+public:
+  explicit NUMAReplicas(const T& source, const MemoryPolicy& policy = MemoryPolicy::current())
+  {
+    for(int node : numa_nodes())
+    {
+      MemoryPolicy node_policy = policy;
+      node_policy.numa = MemoryPolicy::numa_prefer;
+      node_policy.node = node;
+      ScopedMemoryPolicy scope(node_policy);
+      this->nodes.push_back(node);
+      this->replicas.emplace_back(new T(source));
+    }
+  }
+
+  size_t size() const { return this->replicas.size(); }
+
+  // Returns the replica for the i-th online node.
+  const T& operator[](size_t i) const { return *(this->replicas[i]); }
+
+  // Returns the replica on the current node, or the first replica if the node is unknown.
+  const T& local() const
+  {
+    int node = current_numa_node();
+    for(size_t i = 0; i < this->nodes.size(); i++)
+    {
+      if(this->nodes[i] == node) { return *(this->replicas[i]); }
+    }
+    return *(this->replicas.front());
+  }
+
+private:
+  std::vector<int>                nodes;
+  std::vector<std::unique_ptr<T>> replicas;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace gbwtgraph
+
+#endif // GBWTGRAPH_MEMORY_H
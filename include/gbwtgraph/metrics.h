@@ -0,0 +1,135 @@
+#ifndef GBWTGRAPH_METRICS_H
+#define GBWTGRAPH_METRICS_H
+
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+  metrics.h: Performance instrumentation for construction and query pipelines.
+*/
+
+namespace gbwtgraph
+{
+
+//------------------------------------------------------------------------------
+
+/*
+  A thread-safe collection of performance metrics. Functions that support
+  instrumentation take a `Metrics*` argument (or a parameter object with a
+  `metrics` field). A null pointer disables instrumentation, and the functions
+  then skip all measurements.
+
+  Metrics are identified by names such as "gfa_to_gbwt/segments". There are
+  three kinds of metrics:
+
+  * Phases aggregate the number of executions, wall-clock time, and CPU time
+    of a part of the computation. CPU time is measured for the entire process
+    and includes all threads. Peak memory is the peak resident set size of the
+    process at the end of the latest execution.
+
+  * Counters are sums of non-negative integers.
+
+  * Histograms count values in buckets by their bit length. Bucket 0 contains
+    value 0 and bucket i > 0 contains values in [2^(i - 1), 2^i).
+
+  The functions lock a mutex, so they should not be called in tight loops.
+  Hot loops should aggregate the values locally and report them at the end.
+*/
+class Metrics
+{
+public:
+  struct Phase
+  {
+    size_t count = 0;
+    double seconds = 0.0;
+    double cpu_seconds = 0.0;
+    size_t peak_memory = 0;
+  };
+
+  struct Histogram
+  {
+    std::vector<size_t> buckets;
+    size_t count = 0, sum = 0, max = 0;
+
+    void add(size_t value, size_t n = 1);
+    void merge(const Histogram& another);
+
+    // Returns the bucket for the given value.
+    static size_t bucket(size_t value);
+  };
+
+  /*
+    Measures a phase from construction to destruction or until stop() is
+    called. Does nothing if the metrics object is null. The name must remain
+    valid while the timer is running.
+  */
+  class Timer
+  {
+  public:
+    Timer(Metrics* metrics, const char* name);
+    ~Timer() { this->stop(); }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    // Records the phase. Subsequent calls do nothing.
+    void stop();
+
+  private:
+    Metrics*    metrics;
+    const char* name;
+    double      start, cpu_start;
+  };
+
+  Metrics() = default;
+
+  Metrics(const Metrics&) = delete;
+  Metrics& operator=(const Metrics&) = delete;
+
+  // Records an execution of the phase.
+  void add_phase(const std::string& name, double seconds, double cpu_seconds);
+
+  // Adds the value to the counter.
+  void add_counter(const std::string& name, size_t value = 1);
+
+  // Adds `n` occurrences of the value to the histogram.
+  void add_to_histogram(const std::string& name, size_t value, size_t n = 1);
+
+  // Merges the histogram into the one with the given name.
+  void merge_histogram(const std::string& name, const Histogram& histogram);
+
+  // Returns the current state of the phase / counter / histogram.
+  // Missing metrics are reported as empty.
+  Phase phase(const std::string& name) const;
+  size_t counter(const std::string& name) const;
+  Histogram histogram(const std::string& name) const;
+
+  // Is the object empty?
+  bool empty() const;
+
+  // Removes all metrics.
+  void clear();
+
+  // Writes the metrics as a JSON object with fields "phases", "counters", and
+  // "histograms". Each of them is an object keyed by metric name.
+  void write_json(std::ostream& out) const;
+  std::string to_json() const;
+
+  // Returns the CPU time used by the process in seconds.
+  static double cpu_time();
+
+private:
+  mutable std::mutex               mtx;
+  std::map<std::string, Phase>     phases;
+  std::map<std::string, size_t>    counters;
+  std::map<std::string, Histogram> histograms;
+};
+
+//------------------------------------------------------------------------------
+
+} // namespace gbwtgraph
+
+#endif // GBWTGRAPH_METRICS_H
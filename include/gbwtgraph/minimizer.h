@@ -3,18 +3,25 @@
 
 #include "absl/log/absl_log.h"
 #include <algorithm>
+#include <array>
 #include <cstdint>
 #include <functional>
 #include <iostream>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_set>
 #include <utility>
 #include <type_traits>
 #include <vector>
 
+#include <sys/mman.h>
+
 #include <gbwt/utils.h>
 
 #include "io.h"
+#include "memory.h"
 #include "utils.h"
 
 /*
@@ -205,6 +212,10 @@ public:
   // hash function.
   size_t hash() const { return wang_hash_64(this->key & KEY_MASK); }
 
+  // Computes hashes[i] = keys[i].hash() for all i < n. Uses AVX2 or NEON when
+  // available.
+  static void hash_batch(const Key64* keys, size_t n, size_t* hashes);
+
   // Move the kmer forward, with c as the next character. Update the key, assuming that
   // it encodes the kmer in forward orientation.
   void forward(size_t k, unsigned char c, size_t& valid_chars)
@@ -320,6 +331,9 @@ public:
     return result;
   }
 
+  // Computes hashes[i] = keys[i].hash() for all i < n.
+  static void hash_batch(const Key128* keys, size_t n, size_t* hashes);
+
   // Move the kmer forward, with c as the next character. Update the key, assuming that
   // it encodes the kmer in forward orientation.
   void forward(size_t k, unsigned char c, size_t& valid_chars)
@@ -455,6 +469,17 @@ operator<<(std::ostream& out, const Kmer<KeyType>& kmer)
   return out;
 }
 
+/*
+  Returns the shard in [0, shards) for a kmer with the given hash value. The
+  shard is determined by the high bits of the hash, as the low bits determine
+  the initial probe position in the hash table.
+*/
+inline size_t
+kmer_shard(size_t hash, size_t shards)
+{
+  return ((hash >> 32) * shards) >> 32;
+}
+
 //------------------------------------------------------------------------------
 
 class MinimizerHeader;
@@ -470,13 +495,27 @@ class MinimizerIndex;
 
   The kmers are stored in a hash table of size 2^n that uses quadratic probing.
   If a kmer is associated with a single value, it is stored directly within the
-  hash table. When there are multiple values, the hash table stores a pointer
-  to a sorted vector of values.
+  hash table. When there are multiple values, the hash table stores the
+  identifier of a sorted occurrence list. All occurrence lists are stored in a
+  single value arena. A list that runs out of space is moved to the end of the
+  arena with twice the capacity, and the arena is compacted when more than half
+  of it is unused.
+
+  Multiple threads can insert batches of kmers concurrently with
+  insert_concurrent(). The hash table is then divided into LOCK_STRIPES ranges
+  of consecutive cells, and each key is inserted under the lock for the range
+  containing its initial probe position. When all kmers are known in advance,
+  bulk_load() builds the index with a single allocation of the hash table.
+
+  A MinimizerIndex can also be memory-mapped from a file. The hash table and
+  the occurrence lists are then used directly from the read-only mapping.
 
   Limitations:
 
   * The index does not support serialization.
 
+  * A memory-mapped index cannot be modified.
+
   * Any key not equal to KeyType::no_key() can be inserted into the index.
     There are no guarantees that all kmers have the same length.
 */
@@ -494,13 +533,52 @@ public:
   union Values
   {
     value_type value;
-    std::vector<value_type>* pointer;
+    size_t     list; // Occurrence list identifier if key.is_pointer().
   };
 
   typedef std::pair<key_type, Values> cell_type;
 
+  // The hash table and the value arena use the current memory policy.
+  typedef std::vector<cell_type, PolicyAllocator<cell_type>>   cell_vector;
+  typedef std::vector<value_type, PolicyAllocator<value_type>> value_vector;
+
   constexpr static cell_type empty_cell() { return cell_type(key_type::no_key(), { value_type::no_value() }); }
 
+  // A (key, value) pair with a precomputed hash value for batch insertion.
+  struct Insertion
+  {
+    key_type   key;
+    size_t     hash;
+    value_type value;
+  };
+
+  // Number of kmers between prefetching a hash table cell and probing it in
+  // batched find().
+  constexpr static size_t PREFETCH_DISTANCE = 16;
+
+  // Number of lock stripes for concurrent insertion. Must be a power of 2 and
+  // no larger than INITIAL_CAPACITY.
+  constexpr static size_t LOCK_STRIPES = 256;
+
+  /*
+    Synchronization for insert_concurrent(). The table lock is held in shared
+    mode while inserting into the stripes and in exclusive mode when rehashing
+    or when inserting keys whose probe sequence leaves the stripe. Statistics
+    are only updated while holding the counter lock or the exclusive table lock.
+    The arena lock is held in shared mode while adding values to occurrence
+    lists with spare capacity, which only touches the lists of the current
+    stripe, and in exclusive mode when creating or growing a list. The object
+    must outlive all concurrent insertions into the index.
+  */
+  struct InsertionLocks
+  {
+    std::shared_timed_mutex              table;
+    std::array<std::mutex, LOCK_STRIPES> stripes;
+    std::mutex                           counters;
+    std::shared_timed_mutex              arena;
+    size_t                               reserved = 0; // Keys that may be added by active batches.
+  };
+
   // Returns the size of the smallest hash table that can hold this many keys.
   static size_t minimum_size(size_t keys)
   {
@@ -520,6 +598,7 @@ public:
     keys(0), max_keys(INITIAL_CAPACITY * MAX_LOAD_FACTOR),
     values(0), unique(0),
     hash_table(INITIAL_CAPACITY, empty_cell()),
+    lists(), arena(), unused(0),
     downweight(0), frequent_kmers()
   {
 
@@ -528,6 +607,7 @@ public:
   // Hash table size must be a power of 2 and at least INITIAL_CAPACITY.
   explicit KmerIndex(size_t hash_table_size) :
     keys(0), values(0), unique(0),
+    lists(), arena(), unused(0),
     downweight(0), frequent_kmers()
   {
     if(sdsl::bits::cnt(hash_table_size) != 1)
@@ -541,7 +621,7 @@ public:
       hash_table_size = INITIAL_CAPACITY;
     }
     this->max_keys = hash_table_size * MAX_LOAD_FACTOR;
-    this->hash_table = std::vector<cell_type>(hash_table_size, empty_cell());
+    this->hash_table = cell_vector(hash_table_size, empty_cell());
   }
 
   KmerIndex(const KmerIndex& source)
@@ -556,7 +636,6 @@ public:
 
   ~KmerIndex()
   {
-    this->clear();
   }
 
   void swap(KmerIndex& another)
@@ -567,6 +646,10 @@ public:
     std::swap(this->values, another.values);
     std::swap(this->unique, another.unique);
     this->hash_table.swap(another.hash_table);
+    this->lists.swap(another.lists);
+    this->arena.swap(another.arena);
+    std::swap(this->unused, another.unused);
+    std::swap(this->mapped, another.mapped);
     std::swap(this->downweight, another.downweight);
     this->frequent_kmers.swap(another.frequent_kmers);
   }
@@ -586,6 +669,10 @@ public:
       this->values = std::move(source.values);
       this->unique = std::move(source.unique);
       this->hash_table = std::move(source.hash_table);
+      this->lists = std::move(source.lists);
+      this->arena = std::move(source.arena);
+      this->unused = std::move(source.unused);
+      this->mapped = std::move(source.mapped);
       this->downweight = std::move(source.downweight);
       this->frequent_kmers = std::move(source.frequent_kmers);
     }
@@ -600,15 +687,17 @@ public:
     if(this->values != another.values) { return false; }
     if(this->unique != another.unique) { return false; }
 
-    if(this->hash_table.size() != another.hash_table.size()) { return false; }
-    for(size_t i = 0; i < this->hash_table.size(); i++)
+    if(this->hash_table_size() != another.hash_table_size()) { return false; }
+    for(size_t i = 0; i < this->hash_table_size(); i++)
     {
-      cell_type a = this->hash_table[i], b = another.hash_table[i];
+      cell_type a = this->cells()[i], b = another.cells()[i];
       if(a.first != b.first) { return false; }
       if(a.first.is_pointer() != b.first.is_pointer()) { return false; }
       if(a.first.is_pointer())
       {
-        if(*(a.second.pointer) != *(b.second.pointer)) { return false; }
+        auto a_occs = this->occurrences(i), b_occs = another.occurrences(i);
+        if(a_occs.second != b_occs.second) { return false; }
+        if(!std::equal(a_occs.first, a_occs.first + a_occs.second, b_occs.first)) { return false; }
       }
       else
       {
@@ -640,7 +729,7 @@ public:
   size_t number_of_values() const { return this->values; }
 
   // Size of the hash table.
-  size_t hash_table_size() const { return this->hash_table.size(); }
+  size_t hash_table_size() const { return (this->is_mapped() ? this->mapped.size : this->hash_table.size()); }
 
   // Number of keys that can fit into the hash table. Exceeding it will initiate rehashing.
   size_t capacity() const { return this->max_keys; }
@@ -651,11 +740,22 @@ public:
   // Number of kmers with a single occurrence.
   size_t unique_keys() const { return this->unique; }
 
+  // Is the hash table in a read-only memory mapping?
+  bool is_mapped() const { return (this->mapped.cells != nullptr); }
+
+  // Returns the sorted list of occurrences and the number of occurrences for
+  // a cell reported by for_each_kmer().
+  std::pair<const value_type*, size_t> occurrences(const cell_type& cell) const
+  {
+    return this->occurrences(static_cast<size_t>(&cell - this->cells()));
+  }
+
   // Call `callback` for every non-empty hash table cell.
   void for_each_kmer(const std::function<void(const cell_type&)>& callback) const
   {
-    for(const cell_type& cell : this->hash_table)
+    for(size_t i = 0; i < this->hash_table_size(); i++)
     {
+      const cell_type& cell = this->cells()[i];
       if(cell.first != key_type::no_key()) { callback(cell); }
     }
   }
@@ -665,8 +765,9 @@ public:
   // Returns false if the iteration stopped early, true otherwise.
   bool for_each_kmer(const std::function<bool(const cell_type&)>& callback) const
   {
-    for(const cell_type& cell : this->hash_table)
+    for(size_t i = 0; i < this->hash_table_size(); i++)
     {
+      const cell_type& cell = this->cells()[i];
       if(cell.first != key_type::no_key()) 
       { 
           if(!callback(cell)) 
@@ -678,6 +779,29 @@ public:
     return true;
   }
 
+  // Returns a histogram of probe sequence lengths: result[i] is the number of
+  // keys found after i + 1 probes.
+  std::vector<size_t> probe_lengths() const
+  {
+    std::vector<size_t> result;
+    const cell_type* table = this->cells();
+    size_t size = this->hash_table_size();
+    for(size_t i = 0; i < size; i++)
+    {
+      if(table[i].first == key_type::no_key()) { continue; }
+      size_t offset = this->hash(table[i].first) & (size - 1);
+      size_t attempt = 0;
+      while(offset != i && attempt < size)
+      {
+        offset = (offset + attempt + 1) & (size - 1);
+        attempt++;
+      }
+      if(attempt >= result.size()) { result.resize(attempt + 1, 0); }
+      result[attempt]++;
+    }
+    return result;
+  }
+
 //------------------------------------------------------------------------------
 
   /*
@@ -714,6 +838,177 @@ public:
     }
   }
 
+  /*
+    Inserts a batch of (key, value) pairs into the index using the precomputed
+    hash values. This is safe to call from multiple threads, as long as all
+    threads use the same locks and there are no other concurrent operations on
+    the index. The batch will be reordered by lock stripe. Does not insert keys
+    equal to key_type::no_key() or values equal to value_type::no_value().
+  */
+  void insert_concurrent(std::vector<Insertion>& batch, InsertionLocks& locks)
+  {
+    if(batch.empty()) { return; }
+    std::vector<Insertion> deferred;
+
+    while(true)
+    {
+      // Reserve space for the batch so that we cannot run out of empty cells.
+      std::shared_lock<std::shared_timed_mutex> shared(locks.table);
+      bool reserved = false;
+      {
+        std::lock_guard<std::mutex> guard(locks.counters);
+        if(this->size() + locks.reserved + batch.size() <= this->capacity())
+        {
+          locks.reserved += batch.size(); reserved = true;
+        }
+      }
+      if(reserved)
+      {
+        this->insert_stripes(batch, locks, deferred);
+        break;
+      }
+
+      // Nobody else is inserting while we hold the exclusive lock.
+      shared.unlock();
+      std::unique_lock<std::shared_timed_mutex> exclusive(locks.table);
+      while(this->size() + batch.size() > this->capacity()) { this->rehash(); }
+    }
+
+    // Insert the keys that did not fit into their stripes.
+    if(!deferred.empty())
+    {
+      std::unique_lock<std::shared_timed_mutex> exclusive(locks.table);
+      for(const Insertion& insertion : deferred) { this->insert(insertion.key, insertion.value, insertion.hash); }
+    }
+  }
+
+  /*
+    Inserts all (key, value) pairs into an empty index using the precomputed
+    hash values. The items are first sorted by key and value in order to count
+    the distinct keys. The hash table is then allocated once with the final
+    size and filled in parallel without rehashing. The number of threads can be
+    set through OpenMP. The items will be reordered. If the index is not empty,
+    the items are inserted one at a time. Does not insert keys equal to
+    key_type::no_key() or values equal to value_type::no_value().
+  */
+  void bulk_load(std::vector<Insertion>& items)
+  {
+    if(!this->empty())
+    {
+      for(const Insertion& item : items) { this->insert(item.key, item.value, item.hash); }
+      return;
+    }
+
+    // Sort the items, remove the invalid ones and the duplicates, and find the distinct keys.
+    auto new_end = std::remove_if(items.begin(), items.end(), [](const Insertion& item) -> bool
+    {
+      return (item.key == key_type::no_key() || item.value == value_type::no_value());
+    });
+    items.erase(new_end, items.end());
+    if(items.empty()) { return; }
+    gbwt::parallelQuickSort(items.begin(), items.end(), [](const Insertion& a, const Insertion& b) -> bool
+    {
+      return (a.key < b.key || (a.key == b.key && a.value < b.value));
+    });
+    new_end = std::unique(items.begin(), items.end(), [](const Insertion& a, const Insertion& b) -> bool
+    {
+      return (a.key == b.key && !(a.value < b.value) && !(b.value < a.value));
+    });
+    items.erase(new_end, items.end());
+
+    // Allocate the occurrence lists for keys with multiple values.
+    std::vector<size_t> runs; // Start of the run of items for each distinct key.
+    std::vector<size_t> run_lists; // Occurrence list for each run.
+    for(size_t i = 0; i < items.size(); i++)
+    {
+      if(i == 0 || items[i].key != items[i - 1].key) { runs.push_back(i); }
+    }
+    size_t distinct = runs.size();
+    runs.push_back(items.size());
+    run_lists.resize(distinct);
+    size_t arena_size = 0;
+    for(size_t run = 0; run < distinct; run++)
+    {
+      size_t count = runs[run + 1] - runs[run];
+      if(count > 1)
+      {
+        run_lists[run] = this->lists.size();
+        this->lists.push_back({ arena_size, count, count });
+        arena_size += count;
+      }
+    }
+    this->arena.resize(arena_size);
+
+    // Allocate the hash table once.
+    size_t table_size = std::max(this->hash_table_size(), minimum_size(distinct));
+    this->hash_table = cell_vector(table_size, empty_cell());
+    this->max_keys = table_size * MAX_LOAD_FACTOR;
+
+    // Order the keys by their initial offsets.
+    size_t mask = table_size - 1;
+    std::vector<std::pair<size_t, size_t>> order(distinct); // (initial offset, run)
+    #pragma omp parallel for schedule(static)
+    for(size_t run = 0; run < distinct; run++)
+    {
+      order[run] = std::make_pair(items[runs[run]].hash & mask, run);
+    }
+    gbwt::parallelQuickSort(order.begin(), order.end());
+
+    // Fill the stripes in parallel. Keys whose probe sequence leaves the stripe
+    // are inserted afterwards.
+    size_t shift = sdsl::bits::length(table_size / LOCK_STRIPES) - 1;
+    std::vector<size_t> stripe_start(LOCK_STRIPES + 1);
+    for(size_t stripe = 0; stripe <= LOCK_STRIPES; stripe++)
+    {
+      stripe_start[stripe] = std::lower_bound(order.begin(), order.end(), std::make_pair(stripe << shift, size_t(0))) - order.begin();
+    }
+    std::vector<std::vector<size_t>> deferred(LOCK_STRIPES);
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_t stripe = 0; stripe < LOCK_STRIPES; stripe++)
+    {
+      for(size_t i = stripe_start[stripe]; i < stripe_start[stripe + 1]; i++)
+      {
+        size_t offset = order[i].first, run = order[i].second;
+        bool done = false;
+        for(size_t attempt = 0; attempt < table_size && (offset >> shift) == stripe; attempt++)
+        {
+          if(this->hash_table[offset].first == key_type::no_key())
+          {
+            this->bulk_insert(items, runs[run], runs[run + 1], run_lists[run], offset);
+            done = true; break;
+          }
+          // Quadratic probing with triangular numbers.
+          offset = (offset + attempt + 1) & mask;
+        }
+        if(!done) { deferred[stripe].push_back(run); }
+      }
+    }
+    for(size_t stripe = 0; stripe < LOCK_STRIPES; stripe++)
+    {
+      for(size_t run : deferred[stripe])
+      {
+        const Insertion& first = items[runs[run]];
+        size_t offset = this->find_offset(first.key, first.hash);
+        this->bulk_insert(items, runs[run], runs[run + 1], run_lists[run], offset);
+      }
+    }
+
+    this->keys = distinct;
+    this->values = items.size();
+    this->unique = distinct - this->lists.size();
+  }
+
+  /*
+    Releases the unused space in the occurrence lists. This is useful when no
+    further insertions are expected.
+  */
+  void compact()
+  {
+    if(this->is_mapped()) { return; }
+    this->compact_arena(true);
+    this->arena.shrink_to_fit();
+  }
+
   // Returns the occurrence count for the kmer.
   size_t count(key_type key) const
   {
@@ -725,11 +1020,7 @@ public:
   {
     if(key == key_type::no_key()) { return 0; }
     size_t offset = this->find_offset(key, hash);
-    const cell_type& cell = this->hash_table[offset];
-    if(cell.first == key)
-    {
-      return (cell.first.is_pointer() ? cell.second.pointer->size() : 1);
-    }
+    if(this->cells()[offset].first == key) { return this->occurrences(offset).second; }
     return 0;
   }
 
@@ -754,20 +1045,33 @@ public:
     if(key == key_type::no_key()) { return result; }
 
     size_t offset = this->find_offset(key, hash);
-    if(this->hash_table[offset].first == key)
+    if(this->cells()[offset].first == key) { result = this->occurrences(offset); }
+    return result;
+  }
+
+  /*
+    Finds the occurrences for kmers[0, n) using the hash values stored in the
+    kmers and writes the results to results[0, n). The initial probe positions
+    are prefetched PREFETCH_DISTANCE kmers ahead, which hides much of the memory
+    latency when the hash table does not fit in the cache. Empty kmers have no
+    occurrences. Any insertions into the index may invalidate the returned
+    pointers.
+  */
+  void find(const Kmer<key_type>* kmers, size_t n, std::pair<const value_type*, size_t>* results) const
+  {
+    const cell_type* table = this->cells();
+    size_t mask = this->hash_table_size() - 1;
+    auto prefetch = [&](size_t i)
     {
-      const cell_type& cell = this->hash_table[offset];
-      if(cell.first.is_pointer())
-      {
-        result.first = cell.second.pointer->data();
-        result.second = cell.second.pointer->size();
-      }
-      else
-      {
-        result.first = &(cell.second.value); result.second = 1;
-      }
+      if(!kmers[i].empty()) { __builtin_prefetch(table + (kmers[i].hash & mask)); }
+    };
+
+    for(size_t i = 0; i < std::min(n, PREFETCH_DISTANCE); i++) { prefetch(i); }
+    for(size_t i = 0; i < n; i++)
+    {
+      if(i + PREFETCH_DISTANCE < n) { prefetch(i + PREFETCH_DISTANCE); }
+      results[i] = this->find(kmers[i].key, kmers[i].hash);
     }
-    return result;
   }
 
 //------------------------------------------------------------------------------
@@ -779,7 +1083,36 @@ public:
 private:
   size_t keys, max_keys;
   size_t values, unique;
-  std::vector<cell_type> hash_table;
+  cell_vector hash_table;
+
+  // Occurrence lists for keys with multiple values. List i is stored in
+  // arena[lists[i].offset, lists[i].offset + lists[i].count), followed by
+  // lists[i].capacity - lists[i].count unused values.
+  struct OccurrenceList
+  {
+    size_t offset, count, capacity;
+  };
+  std::vector<OccurrenceList> lists;
+  value_vector                arena;
+  size_t                      unused; // Arena values no longer in any list.
+
+  /*
+    A read-only hash table in a memory-mapped MinimizerIndex file. The
+    occurrence lists are stored in the order of the cells, each as the number
+    of values followed by the values. The file stores the offset of the first
+    list at or after every MAPPED_BLOCK_SIZE cells, followed by the total size
+    of the lists. All of them are used directly from the mapping.
+  */
+  struct MappedTable
+  {
+    std::shared_ptr<const MappedFile> file;
+    const cell_type*                  cells = nullptr;
+    size_t                            size = 0;
+    const char*                       lists = nullptr;
+    const size_t*                     blocks = nullptr;
+  };
+  constexpr static size_t MAPPED_BLOCK_SIZE = 8;
+  MappedTable mapped;
 
   // Downweight hashes for frequent kmers.
   size_t downweight;
@@ -797,44 +1130,46 @@ private:
     this->values = source.values;
     this->unique = source.unique;
 
-    // First make a shallow copy and then copy the occurrence lists.
+    // A memory mapping is shared with the source.
     this->hash_table = source.hash_table;
-    for(cell_type& cell : this->hash_table)
-    {
-      if(cell.first.is_pointer())
-      {
-        cell.second.pointer = new std::vector<value_type>(*cell.second.pointer);
-      }
-    }
+    this->lists = source.lists;
+    this->arena = source.arena;
+    this->unused = source.unused;
+    this->mapped = source.mapped;
 
     this->downweight = source.downweight;
     this->frequent_kmers = source.frequent_kmers;
   }
 
-  // Delete all pointers in the hash table.
+  // Delete the occurrence lists and release the memory mapping.
   void clear()
   {
+    this->mapped = MappedTable();
     for(cell_type& cell : this->hash_table)
     {
       if(cell.first.is_pointer())
       {
-        delete cell.second.pointer;
         cell.second.value = value_type::no_value();
         cell.first.clear_pointer();
       }
     }
+    this->lists = std::vector<OccurrenceList>();
+    this->arena = value_vector();
+    this->unused = 0;
   }
 
   // Find the hash table offset for the key with the given hash value.
   size_t find_offset(key_type key, size_t hash) const
   {
-    size_t offset = hash & (this->hash_table.size() - 1);
-    for(size_t attempt = 0; attempt < this->hash_table.size(); attempt++)
+    const cell_type* table = this->cells();
+    size_t size = this->hash_table_size();
+    size_t offset = hash & (size - 1);
+    for(size_t attempt = 0; attempt < size; attempt++)
     {
-      if(this->hash_table[offset].first == key_type::no_key() || this->hash_table[offset].first == key) { return offset; }
+      if(table[offset].first == key_type::no_key() || table[offset].first == key) { return offset; }
 
       // Quadratic probing with triangular numbers.
-      offset = (offset + attempt + 1) & (this->hash_table.size() - 1);
+      offset = (offset + attempt + 1) & (size - 1);
     }
 
     // This should not happen.
@@ -843,6 +1178,62 @@ private:
     return 0;
   }
 
+  // Returns the cells of the hash table.
+  const cell_type* cells() const
+  {
+    return (this->is_mapped() ? this->mapped.cells : this->hash_table.data());
+  }
+
+  // Returns the number of bytes in the serialized occurrence list.
+  static size_t list_bytes(const char* list)
+  {
+    return sizeof(size_t) + *reinterpret_cast<const size_t*>(list) * sizeof(value_type);
+  }
+
+  // Number of list offset samples for a hash table of the given size.
+  static size_t list_sample_count(size_t cells)
+  {
+    return (cells + MAPPED_BLOCK_SIZE - 1) / MAPPED_BLOCK_SIZE + 1;
+  }
+
+  // Returns the offset of the first serialized occurrence list at or after
+  // every MAPPED_BLOCK_SIZE cells, followed by the total size of the lists.
+  std::vector<size_t> list_samples() const
+  {
+    const cell_type* table = this->cells();
+    std::vector<size_t> result;
+    result.reserve(list_sample_count(this->hash_table_size()));
+    size_t bytes = 0;
+    for(size_t i = 0; i < this->hash_table_size(); i++)
+    {
+      if(i % MAPPED_BLOCK_SIZE == 0) { result.push_back(bytes); }
+      if(table[i].first.is_pointer()) { bytes += sizeof(size_t) + this->occurrences(i).second * sizeof(value_type); }
+    }
+    result.push_back(bytes);
+    return result;
+  }
+
+  // Returns the occurrences of the key at the given non-empty offset.
+  std::pair<const value_type*, size_t> occurrences(size_t offset) const
+  {
+    const cell_type& cell = this->cells()[offset];
+    if(!cell.first.is_pointer()) { return std::pair<const value_type*, size_t>(&(cell.second.value), 1); }
+    if(!this->is_mapped())
+    {
+      const OccurrenceList& list = this->lists[cell.second.list];
+      return std::pair<const value_type*, size_t>(this->arena.data() + list.offset, list.count);
+    }
+
+    // Skip the lists for the earlier cells in the same block.
+    size_t block = offset / MAPPED_BLOCK_SIZE;
+    const char* list = this->mapped.lists + this->mapped.blocks[block];
+    for(size_t i = block * MAPPED_BLOCK_SIZE; i < offset; i++)
+    {
+      if(this->mapped.cells[i].first.is_pointer()) { list += list_bytes(list); }
+    }
+    return std::pair<const value_type*, size_t>(reinterpret_cast<const value_type*>(list + sizeof(size_t)), *reinterpret_cast<const size_t*>(list));
+  }
+
   // Insert (key, value) into hash_table[offset], which is assumed to be empty.
   // Rehashing may be necessary.
   void insert_new(key_type key, value_type value, size_t offset)
@@ -858,32 +1249,209 @@ private:
 
   // Add the value to the list of occurrences at hash_table[offset].
   void append(value_type value, size_t offset)
+  {
+    size_t values_added = 0, unique_removed = 0;
+    this->append_value(value, offset, values_added, unique_removed);
+    this->values += values_added;
+    this->unique -= unique_removed;
+  }
+
+  // Add the value to the list of occurrences at hash_table[offset] without
+  // updating the statistics. Instead, increments the given counters.
+  void append_value(value_type value, size_t offset, size_t& values_added, size_t& unique_removed)
   {
     if(this->contains(offset, value)) { return; }
 
     cell_type& cell = this->hash_table[offset];
     if(cell.first.is_pointer())
     {
-      std::vector<value_type>* occs = cell.second.pointer;
-      occs->push_back(value);
-      size_t offset = occs->size() - 1;
-      while(offset > 0 && occs->at(offset - 1) > occs->at(offset))
+      this->list_insert(cell.second.list, value);
+    }
+    else
+    {
+      size_t list = this->new_list(2);
+      this->list_insert(list, cell.second.value);
+      this->list_insert(list, value);
+      cell.second.list = list;
+      cell.first.set_pointer();
+      unique_removed++;
+    }
+    values_added++;
+  }
+
+  // Add the value to the existing occurrence list at hash_table[offset] if the
+  // list has spare capacity, incrementing the counter. Returns false if a list
+  // must be created or grown. Because this does not reallocate the arena or
+  // the lists, it can be called concurrently for different cells.
+  bool append_in_place(value_type value, size_t offset, size_t& values_added)
+  {
+    if(this->contains(offset, value)) { return true; }
+
+    const cell_type& cell = this->hash_table[offset];
+    if(!(cell.first.is_pointer())) { return false; }
+    const OccurrenceList& list = this->lists[cell.second.list];
+    if(list.count == list.capacity) { return false; }
+    this->list_insert(cell.second.list, value);
+    values_added++;
+    return true;
+  }
+
+  // Creates an empty occurrence list with the given capacity and returns its identifier.
+  size_t new_list(size_t capacity)
+  {
+    this->lists.push_back({ this->arena.size(), 0, capacity });
+    this->arena.resize(this->arena.size() + capacity, value_type::no_value());
+    return this->lists.size() - 1;
+  }
+
+  // Inserts the value into the sorted occurrence list. The value must not be
+  // in the list already.
+  void list_insert(size_t id, value_type value)
+  {
+    if(this->lists[id].count == this->lists[id].capacity) { this->grow_list(id); }
+    OccurrenceList& list = this->lists[id];
+    auto begin = this->arena.begin() + list.offset;
+    auto end = begin + list.count;
+    auto iter = std::upper_bound(begin, end, value);
+    std::move_backward(iter, end, end + 1);
+    *iter = value;
+    list.count++;
+  }
+
+  // Doubles the capacity of the list. If the list is not at the end of the
+  // arena, it is moved there.
+  void grow_list(size_t id)
+  {
+    OccurrenceList& list = this->lists[id];
+    size_t old_end = list.offset + list.capacity;
+    if(old_end != this->arena.size())
+    {
+      size_t new_offset = this->arena.size();
+      this->arena.resize(new_offset + list.capacity, value_type::no_value());
+      std::copy(this->arena.begin() + list.offset, this->arena.begin() + list.offset + list.count, this->arena.begin() + new_offset);
+      this->unused += list.capacity;
+      list.offset = new_offset;
+    }
+    this->arena.resize(this->arena.size() + list.capacity, value_type::no_value());
+    list.capacity *= 2;
+    if(this->unused > this->arena.size() / 2) { this->compact_arena(false); }
+  }
+
+  // Moves the occurrence lists to the beginning of the arena in the order of
+  // their offsets, leaving no space between them. If tight is false, the lists
+  // keep their unused capacity. The memory used by the arena is not released.
+  void compact_arena(bool tight)
+  {
+    std::vector<size_t> by_offset(this->lists.size());
+    for(size_t i = 0; i < by_offset.size(); i++) { by_offset[i] = i; }
+    std::sort(by_offset.begin(), by_offset.end(), [&](size_t a, size_t b) -> bool
+    {
+      return (this->lists[a].offset < this->lists[b].offset);
+    });
+    size_t tail = 0;
+    for(size_t id : by_offset)
+    {
+      OccurrenceList& list = this->lists[id];
+      if(list.offset != tail)
+      {
+        std::copy(this->arena.begin() + list.offset, this->arena.begin() + list.offset + list.count, this->arena.begin() + tail);
+        list.offset = tail;
+      }
+      if(tight) { list.capacity = list.count; }
+      tail += list.capacity;
+    }
+    this->arena.resize(tail);
+    this->unused = 0;
+  }
+
+  /*
+    Insert the batch into the hash table while holding the shared table lock
+    and the space reservation for the batch. Each key is inserted under the
+    lock for the stripe containing its initial offset. If the probe sequence
+    leaves the stripe before we find the key or an empty cell, the insertion is
+    deferred. Because cells never become empty without rehashing, an empty cell
+    within the stripe means that the key is not elsewhere in the table.
+  */
+  void insert_stripes(std::vector<Insertion>& batch, InsertionLocks& locks, std::vector<Insertion>& deferred)
+  {
+    size_t mask = this->hash_table.size() - 1;
+    size_t shift = sdsl::bits::length(this->hash_table.size() / LOCK_STRIPES) - 1;
+    auto stripe = [&](size_t offset) -> size_t { return (offset & mask) >> shift; };
+    std::sort(batch.begin(), batch.end(), [&](const Insertion& a, const Insertion& b) -> bool
+    {
+      return (stripe(a.hash) < stripe(b.hash));
+    });
+
+    size_t keys_added = 0, values_added = 0, unique_removed = 0;
+    auto iter = batch.begin();
+    while(iter != batch.end())
+    {
+      size_t current = stripe(iter->hash);
+      std::lock_guard<std::mutex> guard(locks.stripes[current]);
+      for(; iter != batch.end() && stripe(iter->hash) == current; ++iter)
       {
-        std::swap(occs->at(offset - 1), occs->at(offset));
-        offset--;
+        if(iter->key == key_type::no_key() || iter->value == value_type::no_value()) { continue; }
+        size_t offset = iter->hash & mask;
+        bool done = false;
+        for(size_t attempt = 0; attempt < this->hash_table.size() && stripe(offset) == current; attempt++)
+        {
+          cell_type& cell = this->hash_table[offset];
+          if(cell.first == key_type::no_key())
+          {
+            cell.first = iter->key;
+            cell.second.value = iter->value;
+            keys_added++; values_added++;
+            done = true; break;
+          }
+          if(cell.first == iter->key)
+          {
+            bool appended = false;
+            {
+              std::shared_lock<std::shared_timed_mutex> arena_guard(locks.arena);
+              appended = this->append_in_place(iter->value, offset, values_added);
+            }
+            if(!appended)
+            {
+              std::lock_guard<std::shared_timed_mutex> arena_guard(locks.arena);
+              this->append_value(iter->value, offset, values_added, unique_removed);
+            }
+            done = true; break;
+          }
+          // Quadratic probing with triangular numbers.
+          offset = (offset + attempt + 1) & mask;
+        }
+        if(!done) { deferred.push_back(*iter); }
       }
     }
+
+    std::lock_guard<std::mutex> guard(locks.counters);
+    this->keys += keys_added;
+    this->values += values_added;
+    this->unique += keys_added; this->unique -= unique_removed;
+    locks.reserved -= batch.size();
+  }
+
+  /*
+    Store the sorted run items[start, limit) of distinct items with the same
+    key in the empty cell hash_table[offset] without updating the statistics.
+    If there are multiple items, they are copied to the preallocated occurrence
+    list with the given identifier.
+  */
+  void bulk_insert(const std::vector<Insertion>& items, size_t start, size_t limit, size_t list, size_t offset)
+  {
+    cell_type& cell = this->hash_table[offset];
+    cell.first = items[start].key;
+    if(limit - start == 1)
+    {
+      cell.second.value = items[start].value;
+    }
     else
     {
-      std::vector<value_type>* occs = new std::vector<value_type>(2);
-      occs->at(0) = cell.second.value;
-      occs->at(1) = value;
-      if(occs->at(0) > occs->at(1)) { std::swap(occs->at(0), occs->at(1)); }
-      cell.second.pointer = occs;
+      auto iter = this->arena.begin() + this->lists[list].offset;
+      for(size_t i = start; i < limit; i++, ++iter) { *iter = items[i].value; }
+      cell.second.list = list;
       cell.first.set_pointer();
-      this->unique--;
     }
-    this->values++;
   }
 
   // Does the list of occurrences at hash_table[offset] contain the value?
@@ -892,8 +1460,9 @@ private:
     const cell_type& cell = this->hash_table[offset];
     if(cell.first.is_pointer())
     {
-      const std::vector<value_type>* occs = cell.second.pointer;
-      return std::binary_search(occs->begin(), occs->end(), value);
+      const OccurrenceList& list = this->lists[cell.second.list];
+      auto begin = this->arena.begin() + list.offset;
+      return std::binary_search(begin, begin + list.count, value);
     }
     else
     {
@@ -930,11 +1499,22 @@ private:
     return h;
   }
 
+  // Computes hashes[i] = hash(keys[i]) for all i < n. Uses the vectorized
+  // key_type::hash_batch() when downweighting is not in use.
+  void hash(const key_type* keys, size_t n, size_t* hashes) const
+  {
+    if(this->frequent_kmers.empty()) { key_type::hash_batch(keys, n, hashes); }
+    else
+    {
+      for(size_t i = 0; i < n; i++) { hashes[i] = this->hash(keys[i]); }
+    }
+  }
+
   // Double the size of the hash table.
   void rehash()
   {
     // Reinitialize with a larger hash table.
-    std::vector<cell_type> old_hash_table(2 * this->hash_table.size(), empty_cell());
+    cell_vector old_hash_table(2 * this->hash_table.size(), empty_cell());
     this->hash_table.swap(old_hash_table);
     this->max_keys = this->hash_table.size() * MAX_LOAD_FACTOR;
 
@@ -998,6 +1578,7 @@ struct MinimizerHeader
   // For older compatible versions.
   constexpr static std::uint32_t V8_VERSION   = 8;
   constexpr static std::uint64_t V8_FLAG_MASK = 0x1FFF;
+  constexpr static std::uint32_t V9_VERSION   = 9; // No list offset samples.
 
   MinimizerHeader();
   MinimizerHeader(size_t kmer_length, size_t window_length, size_t key_bits);
@@ -1116,6 +1697,8 @@ public:
   typedef KeyType key_type;
   typedef ValueType value_type;
   typedef Kmer<key_type> minimizer_type;
+  typedef typename KmerIndex<key_type, value_type>::Insertion insertion_type;
+  typedef typename KmerIndex<key_type, value_type>::InsertionLocks InsertionLocks;
 
   const static std::string EXTENSION; // ".min"
 
@@ -1170,6 +1753,17 @@ public:
     return *this;
   }
 
+  // Returns an empty index with the same parameters and frequent kmers. The
+  // result selects the same minimizers as this index.
+  MinimizerIndex empty_copy() const
+  {
+    MinimizerIndex result;
+    result.header = this->header;
+    result.index.frequent_kmers = this->index.frequent_kmers;
+    result.index.downweight = this->index.downweight;
+    return result;
+  }
+
   // Serialize the index to the ostream. Returns the number of bytes written and
   // true if the serialization was successful.
   // Serialization is only defined when the value type is PositionPayload.
@@ -1184,13 +1778,16 @@ public:
     copy.set_statistics(this->index);
     bytes += io::serialize(out, copy, ok);
 
-    // Serialize the hash table and the occurrence lists.
-    bytes += io::serialize_hash_table(out, this->index.hash_table, value_type::no_value(), ok);
-    for(auto& cell : this->index.hash_table)
+    // Serialize the hash table, the list offset samples, and the occurrence lists.
+    const auto* cells = this->index.cells();
+    bytes += io::serialize_hash_table(out, cells, this->index.hash_table_size(), value_type::no_value(), ok);
+    bytes += io::serialize_vector(out, this->index.list_samples(), ok);
+    for(size_t i = 0; i < this->index.hash_table_size(); i++)
     {
-      if(cell.first.is_pointer())
+      if(cells[i].first.is_pointer())
       {
-        bytes += io::serialize_vector(out, *(cell.second.pointer), ok);
+        auto occs = this->index.occurrences(i);
+        bytes += io::serialize_array(out, occs.first, occs.second, ok);
       }
     }
 
@@ -1229,19 +1826,31 @@ public:
       return false;
     }
     bool has_frequent_kmers = (header.version != MinimizerHeader::V8_VERSION);
+    bool has_list_samples = (header.version > MinimizerHeader::V9_VERSION);
     this->header.update_version();
     this->header.fill_statistics(this->index);
 
-    // Load the hash table and the occurrence lists.
+    // Load the hash table and the occurrence lists into the arena. The list
+    // offset samples are only needed for memory mapping.
     if(ok) { ok &= io::load_vector(in, this->index.hash_table); }
+    if(ok && has_list_samples)
+    {
+      std::vector<size_t> samples;
+      ok &= io::load_vector(in, samples);
+    }
+    if(ok && this->index.values > this->index.unique) { this->index.arena.reserve(this->index.values - this->index.unique); }
     if(ok)
     {
       for(auto& cell : this->index.hash_table)
       {
         if(cell.first.is_pointer())
         {
-          cell.second.pointer = new std::vector<value_type>();
-          ok &= io::load_vector(in, *(cell.second.pointer));
+          size_t offset = this->index.arena.size();
+          ok &= io::append_vector(in, this->index.arena);
+          if(!ok) { break; }
+          size_t count = this->index.arena.size() - offset;
+          cell.second.list = this->index.lists.size();
+          this->index.lists.push_back({ offset, count, count });
         }
       }
     }
@@ -1260,6 +1869,104 @@ public:
     return ok;
   }
 
+  /*
+    Memory-maps the index from the file and returns true if successful. The
+    hash table and the occurrence lists are then used directly from the
+    read-only mapping, which is shared with other processes mapping the same
+    file. The file stores sampled offsets of the occurrence lists, so loading
+    only reads the header, the sample count, and the frequent kmers. The index
+    cannot be modified while it is mapped. Files older than v10 cannot be
+    mapped, but they can be loaded with deserialize() and written again.
+    Memory mapping is only defined when the value type is PositionPayload,
+    as with serialization.
+  */
+  bool load_mapped(const std::string& filename)
+  {
+    static_assert(std::is_same<value_type, PositionPayload>::value, "MinimizerIndex memory mapping is only defined for PositionPayload values");
+    typedef typename KmerIndex<key_type, value_type>::cell_type cell_type;
+    typedef KmerIndex<key_type, value_type> kmer_index_type;
+
+    // Get rid of the existing pointers in the hash table.
+    this->index.clear();
+    this->index.hash_table.clear();
+    this->index.hash_table.shrink_to_fit();
+
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(filename);
+    if(!file->is_open()) { return false; }
+    file->advise(MADV_RANDOM); // Hash table lookups do not benefit from readahead.
+    const char* ptr = file->data();
+    const char* limit = ptr + file->size();
+    auto fail = [&](const std::string& msg) -> bool
+    {
+      std::cerr << "MinimizerIndex::load_mapped(): " << msg << std::endl;
+      this->index.clear();
+      return false;
+    };
+    auto read_size = [&](size_t& result) -> bool
+    {
+      if(static_cast<size_t>(limit - ptr) < sizeof(size_t)) { return false; }
+      result = *reinterpret_cast<const size_t*>(ptr); ptr += sizeof(size_t);
+      return true;
+    };
+
+    // Load and check the header and fill in the statistics in the kmer index.
+    if(static_cast<size_t>(limit - ptr) < sizeof(MinimizerHeader)) { return fail("File " + filename + " is too short"); }
+    std::copy(ptr, ptr + sizeof(MinimizerHeader), reinterpret_cast<char*>(&(this->header)));
+    ptr += sizeof(MinimizerHeader);
+    try { this->header.check(); }
+    catch(const std::runtime_error& e)
+    {
+      return fail(e.what());
+    }
+    if(this->header.key_bits() != KeyType::KEY_BITS)
+    {
+      return fail("Expected " + std::to_string(KeyType::KEY_BITS) + "-bit keys, got " + std::to_string(this->header.key_bits()) + "-bit keys");
+    }
+    if(this->header.version <= MinimizerHeader::V9_VERSION)
+    {
+      return fail("Cannot map a v" + std::to_string(this->header.version) + " index; load and serialize it again to upgrade it");
+    }
+    this->header.update_version();
+    this->header.fill_statistics(this->index);
+
+    // Use the hash table and the list offset samples directly.
+    size_t cells = 0;
+    if(!read_size(cells) || sdsl::bits::cnt(cells) != 1 || static_cast<size_t>(limit - ptr) / sizeof(cell_type) < cells)
+    {
+      return fail("Invalid hash table");
+    }
+    auto& mapped = this->index.mapped;
+    mapped.cells = reinterpret_cast<const cell_type*>(ptr);
+    mapped.size = cells;
+    ptr += cells * sizeof(cell_type);
+    size_t samples = 0;
+    if(!read_size(samples) || samples != kmer_index_type::list_sample_count(cells) || static_cast<size_t>(limit - ptr) / sizeof(size_t) < samples)
+    {
+      return fail("Invalid list offset samples");
+    }
+    mapped.blocks = reinterpret_cast<const size_t*>(ptr);
+    ptr += samples * sizeof(size_t);
+    mapped.lists = ptr;
+    size_t list_bytes = mapped.blocks[samples - 1];
+    if(static_cast<size_t>(limit - ptr) < list_bytes) { return fail("Invalid occurrence lists"); }
+    ptr += list_bytes;
+
+    // Load the frequent kmers.
+    size_t frequent = 0;
+    if(!read_size(frequent) || static_cast<size_t>(limit - ptr) / sizeof(key_type) < frequent)
+    {
+      return fail("Invalid frequent kmers");
+    }
+    const key_type* kmers = reinterpret_cast<const key_type*>(ptr);
+    this->index.frequent_kmers.assign(kmers, kmers + frequent);
+
+    mapped.file = file;
+    return true;
+  }
+
+  // Is the index memory-mapped from a file?
+  bool is_mapped() const { return this->index.is_mapped(); }
+
   // For testing.
   bool operator==(const MinimizerIndex& another) const
   {
@@ -1305,9 +2012,14 @@ public:
 
     // Advance to the next offset (pos) with a valid kmer.
     void advance(offset_type pos, key_type forward_key, key_type reverse_key)
+    {
+      this->advance(pos, forward_key, this->parent.hash(forward_key), reverse_key, this->parent.hash(reverse_key));
+    }
+
+    // Advance to the next offset (pos) with a valid kmer with precomputed hashes.
+    void advance(offset_type pos, key_type forward_key, size_t forward_hash, key_type reverse_key, size_t reverse_hash)
     {
       if(!(this->empty()) && this->front().offset + this->w <= pos) { this->head++; }
-      size_t forward_hash = this->parent.hash(forward_key), reverse_hash = this->parent.hash(reverse_key);
       size_t hash = std::min(forward_hash, reverse_hash);
       while(!(this->empty()) && this->back().hash > hash) { this->tail--; }
       this->tail++;
@@ -1322,6 +2034,56 @@ public:
     }
   };
 
+  /*
+    Forward and reverse keys for a block of consecutive sequence positions, with
+    the hashes computed in a batch. Position i in the block corresponds to the
+    kmers ending at that position, and valid_chars[i] is the number of valid
+    characters at the end of the kmers. Keys with valid_chars[i] < k are not
+    meaningful and their hashes may not have been computed.
+  */
+  struct KmerBlock
+  {
+    constexpr static size_t BLOCK_SIZE = 64;
+
+    key_type forward_key[BLOCK_SIZE], reverse_key[BLOCK_SIZE];
+    size_t forward_hash[BLOCK_SIZE], reverse_hash[BLOCK_SIZE];
+    size_t valid_chars[BLOCK_SIZE];
+    size_t k, size;
+
+    KmerBlock(size_t k) : k(k), size(0) {}
+
+    bool valid(size_t i) const { return (this->valid_chars[i] >= this->k); }
+
+    // Advance the buffer to the next offset (pos) with the kmers at position i.
+    void advance(CircularBuffer& buffer, offset_type pos, size_t i) const
+    {
+      if(this->valid(i))
+      {
+        buffer.advance(pos, this->forward_key[i], this->forward_hash[i], this->reverse_key[i], this->reverse_hash[i]);
+      }
+      else { buffer.advance(pos); }
+    }
+
+    // Roll the keys over the next min(BLOCK_SIZE, end - iter) characters and
+    // compute their hashes. The key and valid_chars arguments carry the state
+    // from one block to the next.
+    void fill(const KmerIndex<key_type, value_type>& parent,
+              std::string::const_iterator iter, std::string::const_iterator end,
+              key_type& forward, key_type& reverse, size_t& valid_chars)
+    {
+      this->size = std::min(BLOCK_SIZE, static_cast<size_t>(end - iter));
+      for(size_t i = 0; i < this->size; i++, ++iter)
+      {
+        forward.forward(this->k, *iter, valid_chars);
+        reverse.reverse(this->k, *iter);
+        this->forward_key[i] = forward; this->reverse_key[i] = reverse;
+        this->valid_chars[i] = valid_chars;
+      }
+      parent.hash(this->forward_key, this->size, this->forward_hash);
+      parent.hash(this->reverse_key, this->size, this->reverse_hash);
+    }
+  };
+
 //------------------------------------------------------------------------------
 
   /*
@@ -1348,13 +2110,12 @@ public:
     size_t valid_chars = 0, start_pos = 0;
     size_t next_read_offset = 0;  // The first read offset that may contain a new minimizer.
     key_type forward_key, reverse_key;
+    KmerBlock block(this->k());
     std::string::const_iterator iter = begin;
-    while(iter != end)
+    for(size_t i = 0; iter != end; i++)
     {
-      forward_key.forward(this->k(), *iter, valid_chars);
-      reverse_key.reverse(this->k(), *iter);
-      if(valid_chars >= this->k()) { buffer.advance(start_pos, forward_key, reverse_key); }
-      else                         { buffer.advance(start_pos); }
+      if(i >= block.size) { block.fill(this->index, iter, end, forward_key, reverse_key, valid_chars); i = 0; }
+      block.advance(buffer, start_pos, i);
       ++iter;
       if(static_cast<size_t>(iter - begin) >= this->k()) { start_pos++; }
       // We have a full window with a minimizer.
@@ -1433,16 +2194,15 @@ public:
     // All results after are current winning minimizers of the current window.
     size_t finished_through = 0; 
     key_type forward_key, reverse_key;
+    KmerBlock block(this->k());
     std::string::const_iterator iter = begin;
-    while(iter != end)
+    for(size_t i = 0; iter != end; i++)
     {
-      // Get the forward and reverse strand minimizer candidates
-      forward_key.forward(this->k(), *iter, valid_chars);
-      reverse_key.reverse(this->k(), *iter);
+      // Get the forward and reverse strand minimizer candidates for the next block.
+      if(i >= block.size) { block.fill(this->index, iter, end, forward_key, reverse_key, valid_chars); i = 0; }
       // If they don't have any Ns or anything in them, throw them into the sliding window tracked by buffer.
       // Otherwise just slide it along.
-      if(valid_chars >= this->k()) { buffer.advance(start_pos, forward_key, reverse_key); }
-      else                         { buffer.advance(start_pos); }
+      block.advance(buffer, start_pos, i);
       ++iter;
       if(static_cast<size_t>(iter - begin) >= this->k()) { start_pos++; }
       
@@ -1558,19 +2318,18 @@ public:
     CircularBuffer buffer(this->index, this->k() + 1 - this->s());
     size_t processed_chars = 0, dummy_valid_chars = 0, valid_chars = 0, smer_start = 0;
     key_type forward_smer, reverse_smer, forward_kmer, reverse_kmer;
+    KmerBlock block(this->s());
     std::string::const_iterator iter = begin;
-    while(iter != end)
+    for(size_t i = 0; iter != end; i++)
     {
-      forward_smer.forward(this->s(), *iter, valid_chars);
-      reverse_smer.reverse(this->s(), *iter);
+      if(i >= block.size) { block.fill(this->index, iter, end, forward_smer, reverse_smer, valid_chars); i = 0; }
       forward_kmer.forward(this->k(), *iter, dummy_valid_chars);
       reverse_kmer.reverse(this->k(), *iter);
-      if(valid_chars >= this->s()) { buffer.advance(smer_start, forward_smer, reverse_smer); }
-      else                         { buffer.advance(smer_start); }
+      block.advance(buffer, smer_start, i);
       ++iter; processed_chars++;
       if(processed_chars >= this->s()) { smer_start++; }
       // We have a full kmer with a closed syncmer.
-      if(valid_chars >= this->k())
+      if(block.valid_chars[i] >= this->k())
       {
         // Insert the kmer if the first or the last smer is among the smallest, i.e. if
         // 1) the first smer in the buffer is at the start of the kmer;
@@ -1675,9 +2434,40 @@ public:
   */
   void insert(const minimizer_type& minimizer, value_type value)
   {
+    this->check_writable("insert");
     this->index.insert(minimizer.key, value, minimizer.hash);
   }
 
+  /*
+    Inserts a batch of values into the index, using the hashes stored in the
+    batch. This is safe to call from multiple threads if they all use the same
+    locks and there are no other concurrent operations on the index. See
+    KmerIndex::insert_concurrent() for details.
+  */
+  void insert(std::vector<insertion_type>& batch, InsertionLocks& locks)
+  {
+    this->check_writable("insert");
+    this->index.insert_concurrent(batch, locks);
+  }
+
+  /*
+    Inserts all values into an empty index, using the hashes stored in the
+    items. The hash table is allocated once with the final size and filled in
+    parallel. The number of threads can be set through OpenMP. See
+    KmerIndex::bulk_load() for details.
+  */
+  void bulk_load(std::vector<insertion_type>& items)
+  {
+    this->check_writable("bulk_load");
+    this->index.bulk_load(items);
+  }
+
+  // Releases the unused space in the occurrence lists. See KmerIndex::compact().
+  void compact()
+  {
+    this->index.compact();
+  }
+
   /*
     Returns the occurrence count of the minimizer.
     Use minimizer() or minimizers() to get the minimizer.
@@ -1701,6 +2491,28 @@ public:
     return this->index.find(minimizer.key, minimizer.hash);
   }
 
+  /*
+    Batched version of find() for minimizers[0, n), such as the output of
+    minimizers(). Writes the results to the caller-provided buffer
+    results[0, n). The hash table cells are prefetched ahead of the lookups,
+    which is faster than calling find() for each minimizer when the index is
+    large. Empty minimizers have no occurrences.
+  */
+  void find(const minimizer_type* minimizers, size_t n, std::pair<const value_type*, size_t>* results) const
+  {
+    this->index.find(minimizers, n, results);
+  }
+
+  /*
+    Batched version of find() for a vector of minimizers. Resizes the results
+    to match the minimizers.
+  */
+  void find(const std::vector<minimizer_type>& minimizers, std::vector<std::pair<const value_type*, size_t>>& results) const
+  {
+    results.resize(minimizers.size());
+    this->find(minimizers.data(), minimizers.size(), results.data());
+  }
+
 //------------------------------------------------------------------------------
 
   /*
@@ -1750,6 +2562,10 @@ public:
   // Number of minimizers with a single occurrence.
   size_t unique_keys() const { return this->index.unique_keys(); }
 
+  // Histogram of probe sequence lengths: result[i] is the number of keys
+  // found after i + 1 probes.
+  std::vector<size_t> probe_lengths() const { return this->index.probe_lengths(); }
+
   // Call `callback` for every non-empty hash table cell in index.
   // If callback returns false, then stop iterating.
   // Returns false if the iteration stopped early, true otherwise.
@@ -1758,6 +2574,13 @@ public:
       return this->index.for_each_kmer(callback);
   }
 
+  // Returns the sorted list of occurrences and the number of occurrences for
+  // a cell reported by for_each_minimizer().
+  std::pair<const value_type*, size_t> occurrences(const typename KmerIndex<KeyType, ValueType>::cell_type& cell) const
+  {
+    return this->index.occurrences(cell);
+  }
+
 //------------------------------------------------------------------------------
 
   /*
@@ -1773,6 +2596,14 @@ private:
     this->header = source.header;
     this->index = source.index;
   }
+
+  void check_writable(const char* operation) const
+  {
+    if(this->is_mapped())
+    {
+      ABSL_LOG(FATAL) << "MinimizerIndex::" << operation << "(): Cannot modify a memory-mapped index";
+    }
+  }
 };
 
 //------------------------------------------------------------------------------
@@ -1800,6 +2631,78 @@ void hits_in_subgraph(size_t hit_count, const PositionPayload* hits, const std::
 
 //------------------------------------------------------------------------------
 
+/*
+  A set of node identifiers for filtering minimizer hits in batches. If the
+  identifiers are dense enough, the set is stored as a bitmap over the range
+  [first node, last node]. Otherwise it is stored as sorted maximal runs of
+  consecutive identifiers. The bitmap is used if it takes at most as much
+  space as the runs.
+*/
+class SubgraphFilter
+{
+public:
+  // Bits used for storing a run of identifiers.
+  constexpr static size_t RUN_BITS = 2 * 64;
+
+  SubgraphFilter();
+
+  // Builds the filter from node identifiers in sorted order.
+  explicit SubgraphFilter(const std::vector<nid_t>& subgraph);
+
+  // Builds the filter from an unordered set of node identifiers.
+  explicit SubgraphFilter(const std::unordered_set<nid_t>& subgraph);
+
+  // Number of nodes in the set.
+  size_t size() const { return this->nodes; }
+
+  // Is the set empty?
+  bool empty() const { return (this->size() == 0); }
+
+  // Is the set stored as a bitmap?
+  bool is_bitmap() const { return !(this->bitmap.empty()); }
+
+  // Does the set contain the node?
+  bool contains(nid_t node) const
+  {
+    if(this->is_bitmap())
+    {
+      size_t offset = node - this->first;
+      return (offset < this->universe && ((this->bitmap[offset / 64] >> (offset % 64)) & 1));
+    }
+    auto iter = std::upper_bound(this->runs.begin(), this->runs.end(), std::make_pair(node, std::numeric_limits<nid_t>::max()));
+    return (iter != this->runs.begin() && node < (iter - 1)->second);
+  }
+
+  // First node identifier and the length of the identifier range covered by the bitmap.
+  nid_t                                first;
+  size_t                               universe;
+  size_t                               nodes;
+
+  // Bitmap over the identifier range or runs of identifiers [start, end).
+  std::vector<std::uint64_t>           bitmap;
+  std::vector<std::pair<nid_t, nid_t>> runs;
+};
+
+/*
+  Decode the subsets of minimizer hits and their payloads in the given subgraph.
+  This version processes the hits for all minimizers of a read at once. The hit
+  lists are in the format reported by batched MinimizerIndex::find(), and each
+  list must be in sorted order.
+
+  The surviving hits are written to `output` in list order, replacing its
+  contents. The hits for list i are in output[boundaries[i], boundaries[i + 1]).
+  If the minimizer is in reverse orientation, use reverse_base_pos() to reverse
+  the reported occurrences.
+
+  With a bitmap, the node identifiers are filtered four at a time using AVX2
+  gathers and compares when available. With runs, the hit lists are merged
+  with the runs using exponential search.
+*/
+void hits_in_subgraph(const std::vector<std::pair<const PositionPayload*, size_t>>& hits, const SubgraphFilter& subgraph,
+                      std::vector<std::pair<pos_t, Payload>>& output, std::vector<size_t>& boundaries);
+
+//------------------------------------------------------------------------------
+
 // Choose the default index type.
 typedef MinimizerIndex<Key64, PositionPayload> DefaultMinimizerIndex;
 
@@ -1809,6 +2712,8 @@ typedef MinimizerIndex<Key64, PositionPayload> DefaultMinimizerIndex;
 
 template<class KeyType, class ValueType> constexpr size_t KmerIndex<KeyType, ValueType>::INITIAL_CAPACITY;
 template<class KeyType, class ValueType> constexpr double KmerIndex<KeyType, ValueType>::MAX_LOAD_FACTOR;
+template<class KeyType, class ValueType> constexpr size_t KmerIndex<KeyType, ValueType>::LOCK_STRIPES;
+template<class KeyType, class ValueType> constexpr size_t MinimizerIndex<KeyType, ValueType>::KmerBlock::BLOCK_SIZE;
 
 // Other template class variables.
 
@@ -4,6 +4,7 @@
 #include <gbwt/dynamic_gbwt.h>
 
 #include "gbwtgraph.h"
+#include "metrics.h"
 
 /*
   path_cover.h: Build GBWT from a path cover of a HandleGraph.
@@ -84,6 +85,10 @@ struct PathCoverParameters
 
   // Show progress information.
   bool show_progress = false;
+
+  // Record the construction phases and statistics with prefix "path_cover/"
+  // if not null. The object must outlive the construction.
+  Metrics* metrics = nullptr;
 };
 
 //------------------------------------------------------------------------------
@@ -165,9 +170,10 @@ gbwt::GBWT local_haplotypes(
   metadata contains sample/contig names, the path cover will use names path_cover_i and
   component_i. Returns the number of components that received a path cover.
 
-  This algorithm is effectively a single construction job, as it takes an existing
-  dynamic index. We further assume that most components are already covered by the GBWT
-  and we only need to augment a few small ones.
+  The components are split into at most `parallel_jobs` contiguous jobs. The first job
+  inserts the paths into the existing dynamic index, while the other jobs build partial
+  indexes that are merged into it afterwards. We assume that most components are already
+  covered by the GBWT and we only need to augment a few small ones.
 */
 size_t augment_gbwt(
   const HandleGraph& graph,
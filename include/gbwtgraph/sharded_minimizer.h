@@ -0,0 +1,456 @@
+#ifndef GBWTGRAPH_SHARDED_MINIMIZER_H
+#define GBWTGRAPH_SHARDED_MINIMIZER_H
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "minimizer.h"
+
+/*
+  sharded_minimizer.h: A minimizer index partitioned into independent shards.
+*/
+
+namespace gbwtgraph
+{
+
+//------------------------------------------------------------------------------
+
+/*
+  A minimizer index partitioned into shards by key hash. Key `key` belongs to
+  shard kmer_shard(key.hash(), shards()). Each shard is an ordinary
+  MinimizerIndex with the same parameters and frequent kmers, and it is stored
+  in a separate file that can be loaded on its own.
+
+  The manifest file `prefix.shards` starts with TAG and VERSION. It then stores
+  the parameters as an empty MinimizerIndex, the number of shards, and the
+  number of keys and values in each shard. Shard `i` is stored in file
+  `prefix.i.min`. A process can load the manifest and only some of the shards.
+  It can then use shard() to route the remaining queries to the processes
+  serving the other shards.
+
+  Serialization is only defined when the value type is PositionPayload.
+*/
+template<class KeyType>
+class ShardedMinimizerIndex
+{
+public:
+  typedef KeyType key_type;
+  typedef PositionPayload value_type;
+  typedef MinimizerIndex<key_type, value_type> index_type;
+  typedef typename index_type::minimizer_type minimizer_type;
+
+  constexpr static std::uint32_t TAG = 0x31534D51;
+  constexpr static std::uint32_t VERSION = 1;
+
+  const static std::string MANIFEST_EXTENSION; // ".shards"
+
+//------------------------------------------------------------------------------
+
+  ShardedMinimizerIndex() {}
+
+  // Creates empty shards with the same parameters and frequent kmers as the
+  // given index.
+  ShardedMinimizerIndex(const index_type& source, size_t shards) :
+    parameters(source.empty_copy()),
+    indexes(std::max(shards, size_t(1)), this->parameters),
+    loaded(indexes.size(), true),
+    shard_keys(indexes.size(), 0), shard_values(indexes.size(), 0)
+  {
+  }
+
+  void swap(ShardedMinimizerIndex& another)
+  {
+    if(&another == this) { return; }
+    this->parameters.swap(another.parameters);
+    this->indexes.swap(another.indexes);
+    this->loaded.swap(another.loaded);
+    this->shard_keys.swap(another.shard_keys);
+    this->shard_values.swap(another.shard_values);
+  }
+
+  // Number of shards.
+  size_t shards() const { return this->indexes.size(); }
+
+  // Returns the shard for the key.
+  size_t shard(key_type key) const { return kmer_shard(key.hash(), this->shards()); }
+
+  // Returns the shard for the minimizer.
+  size_t shard(const minimizer_type& minimizer) const { return kmer_shard(minimizer.hash, this->shards()); }
+
+  // Returns true if the shard is in memory.
+  bool is_loaded(size_t shard) const { return this->loaded[shard]; }
+
+  // Returns the index for the shard. The shard is empty if it is not loaded.
+  index_type& shard_index(size_t shard) { return this->indexes[shard]; }
+  const index_type& shard_index(size_t shard) const { return this->indexes[shard]; }
+
+  // Returns an empty index with the parameters and the frequent kmers.
+  const index_type& parameter_index() const { return this->parameters; }
+
+  /*
+    Number of keys and values in each shard. For shards that are in memory,
+    these are the statistics of the index. For other shards, these are the
+    statistics stored in the manifest.
+  */
+  size_t keys(size_t shard) const { return (this->loaded[shard] ? this->indexes[shard].size() : this->shard_keys[shard]); }
+  size_t values(size_t shard) const { return (this->loaded[shard] ? this->indexes[shard].number_of_values() : this->shard_values[shard]); }
+
+  // Total number of keys in the index.
+  size_t size() const
+  {
+    size_t result = 0;
+    for(size_t shard = 0; shard < this->shards(); shard++) { result += this->keys(shard); }
+    return result;
+  }
+
+  // Total number of values in the index.
+  size_t number_of_values() const
+  {
+    size_t result = 0;
+    for(size_t shard = 0; shard < this->shards(); shard++) { result += this->values(shard); }
+    return result;
+  }
+
+//------------------------------------------------------------------------------
+
+  /*
+    Finding minimizers and their occurrences. The minimizers are the same as in
+    each shard.
+  */
+
+  std::vector<minimizer_type> minimizers(std::string::const_iterator begin, std::string::const_iterator end) const
+  {
+    return this->parameters.minimizers(begin, end);
+  }
+
+  std::vector<minimizer_type> minimizers(const std::string& str) const
+  {
+    return this->parameters.minimizers(str);
+  }
+
+  // Returns the occurrences of the minimizer in the responsible shard. The
+  // result is empty if the shard is not loaded. Use the checked version or
+  // is_loaded(shard(minimizer)) to distinguish that from a minimizer with no
+  // occurrences.
+  std::pair<const value_type*, size_t> find(const minimizer_type& minimizer) const
+  {
+    std::pair<const value_type*, size_t> result(nullptr, 0);
+    this->find(minimizer, result);
+    return result;
+  }
+
+  // Checked version of find(). Stores the occurrences of the minimizer in
+  // `result` and returns true if the responsible shard is loaded. Otherwise
+  // sets `result` to empty and returns false.
+  bool find(const minimizer_type& minimizer, std::pair<const value_type*, size_t>& result) const
+  {
+    size_t shard = this->shard(minimizer);
+    if(!(this->loaded[shard]))
+    {
+      result = std::pair<const value_type*, size_t>(nullptr, 0);
+      return false;
+    }
+    result = this->indexes[shard].find(minimizer);
+    return true;
+  }
+
+  // Batched version of find(). Resizes the results to match the minimizers.
+  // Returns true if the shards for all minimizers are loaded. The results for
+  // minimizers in other shards are empty.
+  bool find(const std::vector<minimizer_type>& minimizers, std::vector<std::pair<const value_type*, size_t>>& results) const
+  {
+    bool ok = true;
+    results.resize(minimizers.size());
+    for(size_t i = 0; i < minimizers.size(); i++) { ok &= this->find(minimizers[i], results[i]); }
+    return ok;
+  }
+
+//------------------------------------------------------------------------------
+
+  /*
+    Serialization. The names of the files are determined by the prefix.
+  */
+
+  static std::string manifest_name(const std::string& prefix)
+  {
+    return prefix + MANIFEST_EXTENSION;
+  }
+
+  static std::string shard_name(const std::string& prefix, size_t shard)
+  {
+    return prefix + "." + std::to_string(shard) + index_type::EXTENSION;
+  }
+
+  // Returns the prefix corresponding to the manifest file, or an empty string
+  // if the file name does not end with MANIFEST_EXTENSION.
+  static std::string prefix_of(const std::string& manifest)
+  {
+    if(manifest.length() <= MANIFEST_EXTENSION.length() ||
+       manifest.compare(manifest.length() - MANIFEST_EXTENSION.length(), MANIFEST_EXTENSION.length(), MANIFEST_EXTENSION) != 0)
+    {
+      return std::string();
+    }
+    return manifest.substr(0, manifest.length() - MANIFEST_EXTENSION.length());
+  }
+
+  // Serializes the manifest to the ostream. Shards that are not loaded use the
+  // statistics from the manifest they were loaded from. Returns the number of
+  // bytes written and true if the serialization was successful.
+  std::pair<size_t, bool> serialize_manifest(std::ostream& out) const
+  {
+    size_t bytes = 0;
+    bool ok = true;
+
+    bytes += io::serialize(out, TAG, ok);
+    bytes += io::serialize(out, VERSION, ok);
+
+    std::pair<size_t, bool> result = this->parameters.serialize(out);
+    bytes += result.first; ok &= result.second;
+
+    std::vector<std::uint64_t> keys(this->shards()), values(this->shards());
+    for(size_t shard = 0; shard < this->shards(); shard++)
+    {
+      keys[shard] = this->keys(shard); values[shard] = this->values(shard);
+    }
+    bytes += io::serialize_vector(out, keys, ok);
+    bytes += io::serialize_vector(out, values, ok);
+
+    if(!ok)
+    {
+      std::cerr << "ShardedMinimizerIndex::serialize_manifest(): Serialization failed" << std::endl;
+    }
+
+    return std::make_pair(bytes, ok);
+  }
+
+  // Writes the manifest to file `prefix.shards`. Returns true if successful.
+  bool write_manifest(const std::string& prefix) const
+  {
+    std::string filename = manifest_name(prefix);
+    std::ofstream out(filename, std::ios_base::binary);
+    if(!out)
+    {
+      std::cerr << "ShardedMinimizerIndex::write_manifest(): Cannot open " << filename << " for writing" << std::endl;
+      return false;
+    }
+    return this->serialize_manifest(out).second;
+  }
+
+  // Writes the shard to file `prefix.shard.min`. The shard must be loaded.
+  // Returns true if successful.
+  bool write_shard(const std::string& prefix, size_t shard) const
+  {
+    if(!(this->loaded[shard]))
+    {
+      std::cerr << "ShardedMinimizerIndex::write_shard(): Shard " << shard << " is not loaded" << std::endl;
+      return false;
+    }
+    std::string filename = shard_name(prefix, shard);
+    std::ofstream out(filename, std::ios_base::binary);
+    if(!out)
+    {
+      std::cerr << "ShardedMinimizerIndex::write_shard(): Cannot open " << filename << " for writing" << std::endl;
+      return false;
+    }
+    return this->indexes[shard].serialize(out).second;
+  }
+
+  // Writes the manifest and all loaded shards. Returns true if successful.
+  bool write(const std::string& prefix) const
+  {
+    bool ok = this->write_manifest(prefix);
+    for(size_t shard = 0; ok && shard < this->shards(); shard++)
+    {
+      if(this->loaded[shard]) { ok &= this->write_shard(prefix, shard); }
+    }
+    return ok;
+  }
+
+  // Loads the manifest from the istream and returns true if successful. All
+  // shards are then empty and not loaded.
+  bool deserialize_manifest(std::istream& in)
+  {
+    ShardedMinimizerIndex empty;
+    this->swap(empty);
+
+    std::uint32_t tag = 0, version = 0;
+    bool ok = io::load(in, tag) && io::load(in, version);
+    if(ok && (tag != TAG || version != VERSION))
+    {
+      std::cerr << "ShardedMinimizerIndex::deserialize_manifest(): Invalid tag or version: " << tag << ", " << version << std::endl;
+      ok = false;
+    }
+    ok = ok && this->parameters.deserialize(in);
+    std::vector<std::uint64_t> keys, values;
+    ok = ok && io::load_vector(in, keys) && io::load_vector(in, values);
+    ok = ok && !(keys.empty()) && keys.size() == values.size() && this->parameters.size() == 0;
+
+    if(!ok)
+    {
+      std::cerr << "ShardedMinimizerIndex::deserialize_manifest(): Manifest loading failed" << std::endl;
+      ShardedMinimizerIndex empty;
+      this->swap(empty);
+      return false;
+    }
+
+    this->indexes = std::vector<index_type>(keys.size(), this->parameters);
+    this->loaded = std::vector<bool>(keys.size(), false);
+    this->shard_keys = std::vector<size_t>(keys.begin(), keys.end());
+    this->shard_values = std::vector<size_t>(values.begin(), values.end());
+    return true;
+  }
+
+  // Loads the manifest from file `prefix.shards` and returns true if successful.
+  bool read_manifest(const std::string& prefix)
+  {
+    std::string filename = manifest_name(prefix);
+    std::ifstream in(filename, std::ios_base::binary);
+    if(!in)
+    {
+      std::cerr << "ShardedMinimizerIndex::read_manifest(): Cannot open " << filename << std::endl;
+      return false;
+    }
+    return this->deserialize_manifest(in);
+  }
+
+  /*
+    Loads the shard from file `prefix.shard.min` and returns true if successful.
+    If `mapped` is true, the shard is memory-mapped instead. The shard must have
+    the same parameters and statistics as in the manifest.
+  */
+  bool read_shard(const std::string& prefix, size_t shard, bool mapped = false)
+  {
+    if(shard >= this->shards())
+    {
+      std::cerr << "ShardedMinimizerIndex::read_shard(): Invalid shard " << shard << " (the index has " << this->shards() << " shards)" << std::endl;
+      return false;
+    }
+
+    std::string filename = shard_name(prefix, shard);
+    index_type index;
+    if(mapped)
+    {
+      if(!(index.load_mapped(filename))) { return false; }
+    }
+    else
+    {
+      std::ifstream in(filename, std::ios_base::binary);
+      if(!in)
+      {
+        std::cerr << "ShardedMinimizerIndex::read_shard(): Cannot open " << filename << std::endl;
+        return false;
+      }
+      if(!(index.deserialize(in))) { return false; }
+    }
+
+    if(index.empty_copy() != this->parameters)
+    {
+      std::cerr << "ShardedMinimizerIndex::read_shard(): Parameters in " << filename << " do not match the manifest" << std::endl;
+      return false;
+    }
+    if(index.size() != this->shard_keys[shard] || index.number_of_values() != this->shard_values[shard])
+    {
+      std::cerr << "ShardedMinimizerIndex::read_shard(): Statistics in " << filename << " do not match the manifest" << std::endl;
+      return false;
+    }
+
+    this->indexes[shard].swap(index);
+    this->loaded[shard] = true;
+    return true;
+  }
+
+  /*
+    Initializes the index from existing shard files `prefix.i.min` for i in
+    [0, shards) without loading them. Each shard is memory-mapped temporarily
+    to check the parameters and to determine the statistics. This can be used
+    for writing the manifest after the shards have been built separately.
+    Returns true if successful.
+  */
+  bool scan_shards(const std::string& prefix, size_t shards)
+  {
+    ShardedMinimizerIndex empty;
+    this->swap(empty);
+    if(shards == 0)
+    {
+      std::cerr << "ShardedMinimizerIndex::scan_shards(): The number of shards must be positive" << std::endl;
+      return false;
+    }
+
+    this->shard_keys = std::vector<size_t>(shards, 0);
+    this->shard_values = std::vector<size_t>(shards, 0);
+    for(size_t shard = 0; shard < shards; shard++)
+    {
+      std::string filename = shard_name(prefix, shard);
+      index_type index;
+      if(!(index.load_mapped(filename)))
+      {
+        ShardedMinimizerIndex empty;
+        this->swap(empty);
+        return false;
+      }
+      index_type parameters = index.empty_copy();
+      if(shard == 0) { this->parameters = parameters; }
+      else if(parameters != this->parameters)
+      {
+        std::cerr << "ShardedMinimizerIndex::scan_shards(): Parameters in " << filename << " do not match the first shard" << std::endl;
+        ShardedMinimizerIndex empty;
+        this->swap(empty);
+        return false;
+      }
+      this->shard_keys[shard] = index.size();
+      this->shard_values[shard] = index.number_of_values();
+    }
+
+    this->indexes = std::vector<index_type>(shards, this->parameters);
+    this->loaded = std::vector<bool>(shards, false);
+    return true;
+  }
+
+  // Releases the memory used by the shard.
+  void unload_shard(size_t shard)
+  {
+    if(!(this->loaded[shard])) { return; }
+    this->shard_keys[shard] = this->indexes[shard].size();
+    this->shard_values[shard] = this->indexes[shard].number_of_values();
+    index_type empty = this->parameters;
+    this->indexes[shard].swap(empty);
+    this->loaded[shard] = false;
+  }
+
+  // Loads the manifest and all shards. Returns true if successful.
+  bool read(const std::string& prefix, bool mapped = false)
+  {
+    bool ok = this->read_manifest(prefix);
+    for(size_t shard = 0; ok && shard < this->shards(); shard++)
+    {
+      ok &= this->read_shard(prefix, shard, mapped);
+    }
+    return ok;
+  }
+
+//------------------------------------------------------------------------------
+
+private:
+  index_type parameters;
+  std::vector<index_type> indexes;
+  std::vector<bool> loaded;
+
+  // Statistics for the shards that are not loaded.
+  std::vector<size_t> shard_keys, shard_values;
+};
+
+//------------------------------------------------------------------------------
+
+template<class KeyType> constexpr std::uint32_t ShardedMinimizerIndex<KeyType>::TAG;
+template<class KeyType> constexpr std::uint32_t ShardedMinimizerIndex<KeyType>::VERSION;
+template<class KeyType> const std::string ShardedMinimizerIndex<KeyType>::MANIFEST_EXTENSION = ".shards";
+
+//------------------------------------------------------------------------------
+
+} // namespace gbwtgraph
+
+#endif // GBWTGRAPH_SHARDED_MINIMIZER_H
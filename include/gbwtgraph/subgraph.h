@@ -2,6 +2,7 @@
 #define GBWTGRAPH_SUBGRAPH_H
 
 #include "gbz.h"
+#include "metrics.h"
 
 #include <sdsl/sd_vector.hpp>
 
@@ -27,6 +28,18 @@ namespace gbwtgraph
   The index relies on the fact that path handles for generic / reference paths
   in a GBWTGraph are integers in the range [0, n), where n is the number of such
   paths in the graph.
+
+  The index can be stored in the simple-sds format as a sidecar file next to the
+  GBZ file. The serialization format is:
+
+    1. Header
+    2. Sequence positions for each path as sd_vector
+    3. GBWT positions for all paths as a vector of (node, offset) words
+    4. Number of GBWT positions for each path as a vector
+
+  Path index file format versions:
+
+    1  The initial version.
 */
 class PathIndex
 {
@@ -38,6 +51,9 @@ public:
   // The work is parallelized over the paths using OpenMP threads.
   explicit PathIndex(const GBZ& gbz, size_t sample_interval = DEFAULT_SAMPLE_INTERVAL);
 
+  // An empty index, mostly for loading a serialized index.
+  PathIndex();
+
   PathIndex(const PathIndex& source) = default;
   PathIndex(PathIndex&& source) = default;
   PathIndex& operator=(const PathIndex& source) = default;
@@ -56,6 +72,53 @@ public:
   // as a pair (sequence offset, GBWT position). If there is no such path,
   // returns (0, gbwt::invalid_edge()).
   std::pair<size_t, gbwt::edge_type> sampled_position(path_handle_t handle, size_t offset) const;
+
+//------------------------------------------------------------------------------
+
+  struct Header
+  {
+    std::uint32_t tag, version;
+    std::uint64_t paths, sample_interval;
+    std::uint64_t checksum; // `PathIndex::checksum()` of the graph.
+    std::uint64_t flags;
+
+    constexpr static std::uint32_t TAG = 0x58444950; // "PIDX"
+    constexpr static std::uint32_t VERSION = Version::PATH_INDEX_VERSION;
+
+    constexpr static std::uint64_t FLAG_MASK = 0x0000;
+
+    Header();
+
+    // Throws `sdsl::simple_sds::InvalidData` if the header is invalid.
+    void check() const;
+
+    bool operator==(const Header& another) const;
+    bool operator!=(const Header& another) const { return !(this->operator==(another)); }
+  };
+
+  Header header;
+
+  const static std::string EXTENSION; // ".pathindex"
+
+  // Serialize the index into the output stream in the simple-sds format.
+  void simple_sds_serialize(std::ostream& out) const;
+
+  // Load the index from the input stream in the simple-sds format.
+  // Throws `sdsl::simple_sds::InvalidData` if sanity checks fail.
+  void simple_sds_load(std::istream& in);
+
+  // Returns the size of the serialized index in elements.
+  size_t simple_sds_size() const;
+
+  // Returns true if the index appears to be built for the given graph with the
+  // given sample interval. This compares the checksum, the number of paths, and
+  // the first position and the length of each path.
+  bool compatible(const GBZ& gbz, size_t sample_interval = DEFAULT_SAMPLE_INTERVAL) const;
+
+  // Returns a checksum of the graph statistics and the named paths, including
+  // their GBWT positions and lengths in nodes. This is not a checksum of the
+  // GBZ file, but any change to the named paths changes it.
+  static std::uint64_t checksum(const GBZ& gbz);
 };
 
 //------------------------------------------------------------------------------
@@ -126,8 +189,9 @@ class Subgraph
 public:
   // Build a subgraph from the given query.
   // If the query is based on a path, a path index must be provided.
+  // If `metrics` is not null, the query is recorded with prefix "subgraph/".
   // Throws `std::runtime_error` on error.
-  Subgraph(const GBZ& gbz, const PathIndex* path_index, const SubgraphQuery& query);
+  Subgraph(const GBZ& gbz, const PathIndex* path_index, const SubgraphQuery& query, Metrics* metrics = nullptr);
 
   Subgraph(const Subgraph& source) = default;
   Subgraph(Subgraph&& source) = default;
@@ -166,9 +230,14 @@ public:
   gbwt::FullPathName reference_path_name(const GBZ& gbz) const;
 
   const std::string* cigar(size_t path_id) const;
+
+  // Sorted nodes of the subgraph with their decompressed records.
+  // Only used in the constructor.
+  struct LocalGraph;
+
 private:
   // Extract the paths within the subgraph and determine reference path information.
-  void extract_paths(const GBZ& gbz, const SubgraphQuery& query, const std::pair<pos_t, gbwt::edge_type>& ref_pos);
+  void extract_paths(const GBZ& gbz, const LocalGraph& subgraph, const SubgraphQuery& query, const std::pair<pos_t, gbwt::edge_type>& ref_pos);
 
   // Update the paths according to query type.
   void update_paths(const SubgraphQuery& query);
@@ -114,7 +114,8 @@ struct Version
 
   constexpr static size_t GBZ_VERSION       = 1;
   constexpr static size_t GRAPH_VERSION     = 3;
-  constexpr static size_t MINIMIZER_VERSION = 9;
+  constexpr static size_t MINIMIZER_VERSION = 10;
+  constexpr static size_t PATH_INDEX_VERSION = 2;
 
   const static std::string SOURCE_KEY; // source
   const static std::string SOURCE_VALUE; // jltsiren/gbwtgraph
@@ -339,6 +340,35 @@ bool path_is_canonical(const gbwt::vector_type& path);
 
 //------------------------------------------------------------------------------
 
+/*
+  A read-only memory mapping of a file. The pages are loaded on demand and
+  shared with other processes mapping the same file. If the file cannot be
+  opened or mapped, an error message is printed and is_open() returns false.
+*/
+class MappedFile
+{
+public:
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool is_open() const { return (this->ptr != nullptr); }
+  const char* data() const { return this->ptr; }
+  size_t size() const { return this->file_size; }
+
+  // Passes the access pattern (e.g. MADV_RANDOM) to madvise().
+  void advise(int advice) const;
+
+private:
+  int    fd;
+  size_t file_size;
+  char*  ptr;
+};
+
+//------------------------------------------------------------------------------
+
 /*
   An intermediate representation for building GBWTGraph from GFA. This class maps
   node ids to sequences and stores the translation from segment names to (ranges of)
@@ -1,5 +1,8 @@
 #include <gbwtgraph/algorithms.h>
+#include <gbwtgraph/internal.h>
 
+#include <algorithm>
+#include <atomic>
 #include <limits>
 #include <stack>
 #include <unordered_map>
@@ -9,63 +12,94 @@ namespace gbwtgraph
 
 //------------------------------------------------------------------------------
 
-// A quick-and-dirty union-find data structure using path splitting and
-// union by rank.
+// A concurrent union-find data structure over a dense range of node ids. Union
+// links the root with the larger index under the root with the smaller index
+// using compare-and-swap, and find uses path halving. Because parents never
+// have larger indexes than their children, there are no cycles, and the root
+// of each set is its smallest element.
 struct DisjointSets
 {
-  std::vector<size_t> parent;
-  std::vector<std::uint8_t> rank; // Rank is at most ~log(size).
-  nid_t offset;                   // Node i is stored at [i - offset].
+  std::vector<std::atomic<size_t>> parent;
+  nid_t offset;                             // Node i is stored at [i - offset].
 
   DisjointSets(size_t n, nid_t offset) :
-    parent(n, 0), rank(n, 0), offset(offset)
+    parent(n), offset(offset)
   {
-    for(size_t i = 0; i < this->size(); i++) { this->parent[i] = i; }
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < n; i++) { this->parent[i].store(i, std::memory_order_relaxed); }
   }
 
   size_t size() const { return this->parent.size(); }
 
-  void clear()
+  size_t find_element(size_t element)
   {
-    this->parent = std::vector<size_t>();
-    this->rank = std::vector<std::uint8_t>();
-  }
-
-  size_t find(nid_t node)
-  {
-    size_t element = node - this->offset;
-    while(this->parent[element] != element)
+    while(true)
     {
-      size_t next = this->parent[element];
-      this->parent[element] = this->parent[next];
-      element = next;
+      size_t next = this->parent[element].load(std::memory_order_relaxed);
+      if(next == element) { return element; }
+      size_t grandparent = this->parent[next].load(std::memory_order_relaxed);
+      if(grandparent != next)
+      {
+        // Failure means that another thread already moved the element upwards.
+        this->parent[element].compare_exchange_weak(next, grandparent, std::memory_order_relaxed);
+      }
+      element = grandparent;
     }
-    return element;
   }
 
+  size_t find(nid_t node) { return this->find_element(node - this->offset); }
+
   void set_union(nid_t node_a, nid_t node_b)
   {
-    size_t a = this->find(node_a), b = this->find(node_b);
-    if(a == b) { return; }
-    if(this->rank[a] < this->rank[b]) { std::swap(a, b); }
-    this->parent[b] = a;
-    if(this->rank[b] == this->rank[a]) { this->rank[a]++; }
+    size_t a = node_a - this->offset, b = node_b - this->offset;
+    while(true)
+    {
+      a = this->find_element(a); b = this->find_element(b);
+      if(a == b) { return; }
+      if(a < b) { std::swap(a, b); }
+      size_t expected = a;
+      if(this->parent[a].compare_exchange_strong(expected, b)) { return; }
+    }
   }
 
+  // Returns the sets containing the included nodes, sorted by the smallest
+  // element and with the elements in sorted order. This reuses the parent
+  // array and destroys the structure. Sets whose smallest element is not
+  // included are not reported.
   std::vector<std::vector<nid_t>> sets(const std::function<bool(nid_t)>& include_node)
   {
-    std::vector<std::vector<nid_t>> result;
-    std::unordered_map<size_t, size_t> root_to_set;
-    for(nid_t node = this->offset; node < static_cast<nid_t>(this->offset + this->size()); node++)
+    // Point each element directly to its root in parallel. Then mark the
+    // elements that are not included.
+    size_t n = this->size();
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < n; i++) { this->parent[i].store(this->find_element(i), std::memory_order_relaxed); }
+    #pragma omp parallel for schedule(static)
+    for(size_t i = 0; i < n; i++)
     {
-      if(!include_node(node)) { continue; }
-      size_t root = this->find(node);
-      if(root_to_set.find(root) == root_to_set.end())
-      {
-        root_to_set[root] = result.size();
-        result.emplace_back();
-      }
-      result[root_to_set[root]].push_back(node);
+      if(!include_node(this->offset + i)) { this->parent[i].store(n, std::memory_order_relaxed); }
+    }
+
+    // Each root is the smallest element in its set, so we find the roots in
+    // the order of the sets. A root is replaced with n + 1 + set identifier,
+    // and the other elements copy the value from the root.
+    std::vector<size_t> set_sizes;
+    for(size_t i = 0; i < n; i++)
+    {
+      size_t root = this->parent[i].load(std::memory_order_relaxed);
+      if(root == n) { continue; }
+      size_t value = n + 1 + set_sizes.size();
+      if(root == i) { set_sizes.push_back(0); }
+      else { value = this->parent[root].load(std::memory_order_relaxed); }
+      this->parent[i].store(value, std::memory_order_relaxed);
+      if(value > n) { set_sizes[value - n - 1]++; }
+    }
+
+    std::vector<std::vector<nid_t>> result(set_sizes.size());
+    for(size_t i = 0; i < result.size(); i++) { result[i].reserve(set_sizes[i]); }
+    for(size_t i = 0; i < n; i++)
+    {
+      size_t value = this->parent[i].load(std::memory_order_relaxed);
+      if(value > n) { result[value - n - 1].push_back(this->offset + i); }
     }
     return result;
   }
@@ -78,29 +112,20 @@ weakly_connected_components(const HandleGraph& graph)
 {
   nid_t min_id = graph.min_node_id(), max_id = graph.max_node_id();
 
-  sdsl::bit_vector found(max_id + 1 - min_id, 0);
+  // Merge the endpoints of each edge in parallel. Each edge is seen from both
+  // endpoints, so we only handle it at the endpoint with the smaller id.
   DisjointSets components(max_id + 1 - min_id, min_id);
   graph.for_each_handle([&](const handle_t& handle)
   {
-    nid_t start_id = graph.get_id(handle);
-    if(found[start_id - min_id]) { return; }
-    std::stack<handle_t> handles;
-    handles.push(handle);
-    while(!(handles.empty()))
+    nid_t id = graph.get_id(handle);
+    auto handle_edge = [&](const handle_t& next)
     {
-      handle_t h = handles.top(); handles.pop();
-      nid_t id = graph.get_id(h);
-      if(found[id - min_id]) { continue; }
-      found[id - min_id] = true;
-      auto handle_edge = [&](const handle_t& next)
-      {
-        components.set_union(id, graph.get_id(next));
-        handles.push(next);
-      };
-      graph.follow_edges(h, false, handle_edge);
-      graph.follow_edges(h, true, handle_edge);
-    }
-  }, false);
+      nid_t next_id = graph.get_id(next);
+      if(id <= next_id) { components.set_union(id, next_id); }
+    };
+    graph.follow_edges(handle, false, handle_edge);
+    graph.follow_edges(handle, true, handle_edge);
+  }, true);
 
   return components.sets([&](nid_t node) -> bool { return graph.has_node(node); });
 }
@@ -114,7 +139,9 @@ is_nice_and_acyclic(const HandleGraph& graph, const std::vector<nid_t>& componen
   if(component.empty()) { return head_nodes; }
 
   constexpr size_t NOT_SEEN = std::numeric_limits<size_t>::max();
-  std::unordered_map<nid_t, std::pair<size_t, bool>> nodes; // (remaining indegree, orientation)
+  NodeRanks ranks(component);
+  std::vector<size_t> remaining(ranks.size(), NOT_SEEN); // Remaining indegree by node rank.
+  std::vector<bool> orientation(ranks.size(), false);
   std::stack<handle_t> active;
   size_t found = 0; // Number of nodes that have become head nodes.
 
@@ -127,15 +154,11 @@ is_nice_and_acyclic(const HandleGraph& graph, const std::vector<nid_t>& componen
     size_t indegree = graph.get_degree(handle, true);
     if(indegree == 0)
     {
-      nodes[node] = std::make_pair(indegree, false);
+      remaining[ranks.find(node)] = indegree;
       head_nodes.push_back(node);
       active.push(handle);
       found++;
     }
-    else
-    {
-      nodes[node] = std::make_pair(NOT_SEEN, false);
-    }
   }
 
   // Active nodes are the current head nodes. Process the successors, determine their
@@ -147,20 +170,20 @@ is_nice_and_acyclic(const HandleGraph& graph, const std::vector<nid_t>& componen
     handle_t curr = active.top(); active.pop();
     graph.follow_edges(curr, false, [&](const handle_t& next) -> bool
     {
-      nid_t next_id = graph.get_id(next);
+      size_t rank = ranks.find(graph.get_id(next));
+      if(rank >= ranks.size()) { return true; }
       bool next_orientation = graph.get_is_reverse(next);
-      auto iter = nodes.find(next_id);
-      if(iter->second.first == NOT_SEEN) // First visit to the node.
+      if(remaining[rank] == NOT_SEEN) // First visit to the node.
       {
-        iter->second.first = graph.get_degree(next, true);
-        iter->second.second = next_orientation;
+        remaining[rank] = graph.get_degree(next, true);
+        orientation[rank] = next_orientation;
       }
-      else if(next_orientation != iter->second.second) // Already visited, wrong orientation.
+      else if(next_orientation != orientation[rank]) // Already visited, wrong orientation.
       {
         ok = false; return false;
       }
-      iter->second.first--;
-      if(iter->second.first == 0)
+      remaining[rank]--;
+      if(remaining[rank] == 0)
       {
         active.push(next);
         found++;
@@ -374,7 +397,7 @@ insert_paths(
 {
   if(show_progress && paths.size() > 0)
   {
-    //#pragma omp critical
+    #pragma omp critical
     {
       std::cerr << "Job " << job_id << ": Inserting " << paths.size() << " paths" << std::endl;
     }
@@ -0,0 +1,567 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <gbwtgraph/cached_gbwtgraph.h>
+#include <gbwtgraph/gbz.h>
+#include <gbwtgraph/gfa.h>
+#include <gbwtgraph/index.h>
+#include <gbwtgraph/subgraph.h>
+
+using namespace gbwtgraph;
+
+//------------------------------------------------------------------------------
+
+/*
+  A benchmark suite for the hot paths of the library. Each input graph is
+  either a GFA file or a synthetic graph with a chain of SNP bubbles and random
+  haplotypes. The results are written to stdout as tab-separated lines with a
+  header. Each benchmark reports the number of items processed, the total
+  time, the throughput, latency percentiles for individual operations, and
+  the peak memory usage of the process so far.
+*/
+
+const std::string tool_name = "GBWTGraph benchmark suite";
+
+struct Config
+{
+  Config(int argc, char** argv);
+
+  constexpr static size_t DEFAULT_BUBBLES = 100000;
+  constexpr static size_t DEFAULT_HAPLOTYPES = 16;
+  constexpr static size_t DEFAULT_READS = 10000;
+  constexpr static size_t DEFAULT_READ_LENGTH = 150;
+  constexpr static size_t DEFAULT_ROUNDS = 3;
+  constexpr static size_t DEFAULT_WALK_LENGTH = 100;
+  constexpr static size_t DEFAULT_CONTEXT = 100;
+  constexpr static size_t DEFAULT_KMERS = 1000000;
+
+  size_t bubbles = DEFAULT_BUBBLES;
+  size_t haplotypes = DEFAULT_HAPLOTYPES;
+  size_t reads = DEFAULT_READS;
+  size_t read_length = DEFAULT_READ_LENGTH;
+  size_t rounds = DEFAULT_ROUNDS;
+  size_t walk_length = DEFAULT_WALK_LENGTH;
+  size_t context = DEFAULT_CONTEXT;
+  size_t kmers = DEFAULT_KMERS;
+  size_t seed = 0xACDC;
+  bool synthetic = false;
+
+  std::vector<std::string> inputs;
+};
+
+// Results for a single benchmark. Samples are latencies of individual
+// operations in seconds.
+struct Measurement
+{
+  std::string benchmark, input;
+  size_t items = 0;
+  double seconds = 0.0;
+  std::vector<double> samples;
+
+  static void print_header(std::ostream& out);
+  void print(std::ostream& out) const;
+};
+
+std::string synthetic_gfa(const Config& config, std::mt19937_64& rng);
+std::string random_sequence(size_t length, std::mt19937_64& rng);
+
+void run_suite(const std::string& filename, const std::string& input_name, const Config& config, std::mt19937_64& rng);
+
+//------------------------------------------------------------------------------
+
+int
+main(int argc, char** argv)
+{
+  double start = gbwt::readTimer();
+  Config config(argc, argv);
+  Version::print(std::cerr, tool_name);
+  std::mt19937_64 rng(config.seed);
+
+  Measurement::print_header(std::cout);
+  if(config.synthetic)
+  {
+    std::string input_name = "synthetic-" + std::to_string(config.bubbles) + "x" + std::to_string(config.haplotypes);
+    std::cerr << "Generating a synthetic graph with " << config.bubbles << " bubbles and " << config.haplotypes << " haplotypes" << std::endl;
+    std::string filename = synthetic_gfa(config, rng);
+    run_suite(filename, input_name, config, rng);
+    gbwt::TempFile::remove(filename);
+  }
+  for(const std::string& filename : config.inputs)
+  {
+    run_suite(filename, filename, config, rng);
+  }
+
+  double seconds = gbwt::readTimer() - start;
+  std::cerr << "Used " << seconds << " seconds, " << gbwt::inGigabytes(gbwt::memoryUsage()) << " GiB" << std::endl;
+  std::cerr << std::endl;
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+printUsage(int exit_code)
+{
+  Version::print(std::cerr, tool_name);
+
+  std::cerr << "Usage: bench_suite [options] [graph1.gfa [graph2.gfa ...]]" << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "Options:" << std::endl;
+  std::cerr << "  -S, --synthetic      benchmark a synthetic graph" << std::endl;
+  std::cerr << "  -b, --bubbles N      use N bubbles in the synthetic graph (default: " << Config::DEFAULT_BUBBLES << ")" << std::endl;
+  std::cerr << "  -H, --haplotypes N   use N haplotypes in the synthetic graph (default: " << Config::DEFAULT_HAPLOTYPES << ")" << std::endl;
+  std::cerr << "  -n, --reads N        query with N reads (default: " << Config::DEFAULT_READS << ")" << std::endl;
+  std::cerr << "  -r, --read-length N  use reads of length N (default: " << Config::DEFAULT_READ_LENGTH << ")" << std::endl;
+  std::cerr << "  -R, --rounds N       repeat construction benchmarks N times (default: " << Config::DEFAULT_ROUNDS << ")" << std::endl;
+  std::cerr << "  -w, --walk-length N  take N steps in traversal benchmarks (default: " << Config::DEFAULT_WALK_LENGTH << ")" << std::endl;
+  std::cerr << "  -c, --context N      use N bp context in subgraph queries (default: " << Config::DEFAULT_CONTEXT << ")" << std::endl;
+  std::cerr << "  -k, --kmers N        insert N random kmers into a kmer index (default: " << Config::DEFAULT_KMERS << ")" << std::endl;
+  std::cerr << "  -s, --seed N         use random seed N" << std::endl;
+  std::cerr << "  -h, --help           print this help" << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "The results are written to stdout as tab-separated values." << std::endl;
+  std::cerr << std::endl;
+
+  std::exit(exit_code);
+}
+
+//------------------------------------------------------------------------------
+
+size_t
+parse_size(const char* arg, const std::string& what)
+{
+  try { return std::stoul(arg); }
+  catch(const std::invalid_argument&)
+  {
+    std::cerr << "bench_suite: Invalid " << what << ": " << arg << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+Config::Config(int argc, char** argv)
+{
+  if(argc < 2) { printUsage(EXIT_SUCCESS); }
+
+  // Data for `getopt_long()`.
+  int c = 0, option_index = 0;
+  option long_options[] =
+  {
+    { "synthetic", no_argument, 0, 'S' },
+    { "bubbles", required_argument, 0, 'b' },
+    { "haplotypes", required_argument, 0, 'H' },
+    { "reads", required_argument, 0, 'n' },
+    { "read-length", required_argument, 0, 'r' },
+    { "rounds", required_argument, 0, 'R' },
+    { "walk-length", required_argument, 0, 'w' },
+    { "context", required_argument, 0, 'c' },
+    { "kmers", required_argument, 0, 'k' },
+    { "seed", required_argument, 0, 's' },
+    { "help", no_argument, 0, 'h' },
+    { 0, 0, 0, 0 }
+  };
+
+  // Process options.
+  while((c = getopt_long(argc, argv, "Sb:H:n:r:R:w:c:k:s:h", long_options, &option_index)) != -1)
+  {
+    switch(c)
+    {
+    case 'S':
+      this->synthetic = true;
+      break;
+    case 'b':
+      this->bubbles = parse_size(optarg, "number of bubbles");
+      break;
+    case 'H':
+      this->haplotypes = parse_size(optarg, "number of haplotypes");
+      break;
+    case 'n':
+      this->reads = parse_size(optarg, "number of reads");
+      break;
+    case 'r':
+      this->read_length = parse_size(optarg, "read length");
+      break;
+    case 'R':
+      this->rounds = parse_size(optarg, "number of rounds");
+      break;
+    case 'w':
+      this->walk_length = parse_size(optarg, "walk length");
+      break;
+    case 'c':
+      this->context = parse_size(optarg, "context length");
+      break;
+    case 'k':
+      this->kmers = parse_size(optarg, "number of kmers");
+      break;
+    case 's':
+      this->seed = parse_size(optarg, "random seed");
+      break;
+    case 'h':
+      printUsage(EXIT_SUCCESS);
+      break;
+
+    case '?':
+      std::exit(EXIT_FAILURE);
+    default:
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  for(int i = optind; i < argc; i++) { this->inputs.push_back(argv[i]); }
+
+  // Sanity checks.
+  if(!(this->synthetic) && this->inputs.empty())
+  {
+    std::cerr << "bench_suite: No input graphs" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  if(this->bubbles == 0 || this->haplotypes == 0)
+  {
+    std::cerr << "bench_suite: The synthetic graph must have at least one bubble and one haplotype" << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  if(this->rounds == 0) { this->rounds = 1; }
+}
+
+//------------------------------------------------------------------------------
+
+void
+Measurement::print_header(std::ostream& out)
+{
+  out << "benchmark\tinput\titems\tseconds\titems_per_second\tp50_us\tp90_us\tp99_us\tpeak_rss_mib" << std::endl;
+}
+
+void
+Measurement::print(std::ostream& out) const
+{
+  std::vector<double> sorted = this->samples;
+  std::sort(sorted.begin(), sorted.end());
+  auto percentile = [&](double fraction) -> double
+  {
+    if(sorted.empty()) { return 0.0; }
+    size_t rank = std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()));
+    return sorted[rank] * 1e6;
+  };
+  double throughput = (this->seconds > 0.0 ? this->items / this->seconds : 0.0);
+
+  out << this->benchmark << "\t" << this->input << "\t" << this->items << "\t" << this->seconds << "\t" << throughput
+      << "\t" << percentile(0.5) << "\t" << percentile(0.9) << "\t" << percentile(0.99)
+      << "\t" << gbwt::inMegabytes(gbwt::memoryUsage()) << std::endl;
+}
+
+//------------------------------------------------------------------------------
+
+std::string
+random_sequence(size_t length, std::mt19937_64& rng)
+{
+  std::string result(length, 'A');
+  for(size_t i = 0; i < length; i++) { result[i] = "ACGT"[rng() & 3]; }
+  return result;
+}
+
+/*
+  Writes a synthetic graph to a temporary GFA file and returns the file name.
+  The graph is a chain of SNP bubbles separated by shared segments. Each
+  haplotype is a walk that chooses one allele in each bubble. Haplotypes copy
+  most choices from the previous haplotype, so that there are long shared
+  subpaths as in real pangenomes.
+*/
+std::string
+synthetic_gfa(const Config& config, std::mt19937_64& rng)
+{
+  constexpr size_t SHARED_LENGTH = 24;
+  constexpr size_t SWITCH_PROBABILITY = 16; // 1 / N
+
+  std::string filename = gbwt::TempFile::getName("bench-suite");
+  std::ofstream out(filename, std::ios_base::binary);
+  if(!out)
+  {
+    std::cerr << "bench_suite: Cannot open temporary file " << filename << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+  out << "H\tVN:Z:1.1" << std::endl;
+
+  // Segment 3i + 1 is shared, while segments 3i + 2 and 3i + 3 are the alleles.
+  size_t last = 3 * config.bubbles + 1;
+  for(size_t i = 0; i < config.bubbles; i++)
+  {
+    std::string shared = random_sequence(SHARED_LENGTH, rng);
+    size_t ref = rng() & 3, alt = (ref + 1 + rng() % 3) & 3;
+    out << "S\t" << (3 * i + 1) << "\t" << shared << std::endl;
+    out << "S\t" << (3 * i + 2) << "\t" << "ACGT"[ref] << std::endl;
+    out << "S\t" << (3 * i + 3) << "\t" << "ACGT"[alt] << std::endl;
+  }
+  out << "S\t" << last << "\t" << random_sequence(SHARED_LENGTH, rng) << std::endl;
+  for(size_t i = 0; i < config.bubbles; i++)
+  {
+    for(size_t allele : { 3 * i + 2, 3 * i + 3 })
+    {
+      out << "L\t" << (3 * i + 1) << "\t+\t" << allele << "\t+\t0M" << std::endl;
+      out << "L\t" << allele << "\t+\t" << (3 * i + 4) << "\t+\t0M" << std::endl;
+    }
+  }
+
+  // Haplotypes as walks.
+  std::vector<bool> choices(config.bubbles, false);
+  size_t length = config.bubbles * (SHARED_LENGTH + 1) + SHARED_LENGTH;
+  for(size_t haplotype = 0; haplotype < config.haplotypes; haplotype++)
+  {
+    for(size_t i = 0; i < config.bubbles; i++)
+    {
+      if(haplotype == 0 || rng() % SWITCH_PROBABILITY == 0) { choices[i] = rng() & 1; }
+    }
+    out << "W\tsample" << haplotype << "\t1\tchr\t0\t" << length << "\t";
+    for(size_t i = 0; i < config.bubbles; i++)
+    {
+      out << ">" << (3 * i + 1) << ">" << (3 * i + 2 + choices[i]);
+    }
+    out << ">" << last << std::endl;
+  }
+
+  out.close();
+  return filename;
+}
+
+//------------------------------------------------------------------------------
+
+// Returns the sequences of all haplotypes in forward orientation.
+std::vector<std::string>
+haplotype_sequences(const GBWTGraph& graph)
+{
+  std::vector<std::string> result;
+  for(gbwt::size_type sequence = 0; sequence < graph.index->sequences(); sequence += 2)
+  {
+    gbwt::vector_type path = graph.index->extract(sequence);
+    std::string seq;
+    for(gbwt::node_type node : path)
+    {
+      view_type view = graph.get_sequence_view(GBWTGraph::node_to_handle(node));
+      seq.append(view.first, view.second);
+    }
+    if(!(seq.empty())) { result.push_back(seq); }
+  }
+  return result;
+}
+
+// Samples random substrings of the haplotypes.
+std::vector<std::string>
+sample_reads(const std::vector<std::string>& haplotypes, const Config& config, std::mt19937_64& rng)
+{
+  std::vector<std::string> result;
+  if(haplotypes.empty()) { return result; }
+  result.reserve(config.reads);
+  for(size_t i = 0; i < config.reads; i++)
+  {
+    const std::string& haplotype = haplotypes[rng() % haplotypes.size()];
+    size_t length = std::min(config.read_length, haplotype.length());
+    size_t start = rng() % (haplotype.length() - length + 1);
+    result.push_back(haplotype.substr(start, length));
+  }
+  return result;
+}
+
+// Runs the operation `rounds` times and records each round as a sample.
+template<class Operation>
+Measurement
+measure_rounds(const std::string& benchmark, const std::string& input, size_t rounds, const Operation& operation)
+{
+  Measurement result;
+  result.benchmark = benchmark; result.input = input;
+  for(size_t round = 0; round < rounds; round++)
+  {
+    double start = gbwt::readTimer();
+    result.items += operation();
+    double seconds = gbwt::readTimer() - start;
+    result.seconds += seconds;
+    result.samples.push_back(seconds);
+  }
+  return result;
+}
+
+// Runs the operation once for each query and records each query as a sample.
+template<class Query, class Operation>
+Measurement
+measure_queries(const std::string& benchmark, const std::string& input, const std::vector<Query>& queries, const Operation& operation)
+{
+  Measurement result;
+  result.benchmark = benchmark; result.input = input;
+  result.samples.reserve(queries.size());
+  for(const Query& query : queries)
+  {
+    double start = gbwt::readTimer();
+    result.items += operation(query);
+    double seconds = gbwt::readTimer() - start;
+    result.seconds += seconds;
+    result.samples.push_back(seconds);
+  }
+  return result;
+}
+
+// Takes a haplotype-consistent walk of at most `steps` steps and returns the
+// number of steps taken.
+template<class GraphType>
+size_t
+haplotype_walk(const GraphType& graph, handle_t start, size_t steps, std::mt19937_64& rng)
+{
+  gbwt::SearchState state = graph.get_state(start);
+  size_t taken = 0;
+  std::vector<gbwt::SearchState> next;
+  while(taken < steps && !(state.empty()))
+  {
+    next.clear();
+    graph.follow_paths(state, [&](const gbwt::SearchState& successor) -> bool
+    {
+      next.push_back(successor);
+      return true;
+    });
+    if(next.empty()) { break; }
+    state = next[rng() % next.size()];
+    taken++;
+  }
+  return taken;
+}
+
+//------------------------------------------------------------------------------
+
+void
+run_suite(const std::string& filename, const std::string& input_name, const Config& config, std::mt19937_64& rng)
+{
+  typedef MinimizerIndex<Key64, PositionPayload> index_type;
+  typedef index_type::minimizer_type minimizer_type;
+
+  std::cerr << "Benchmarking " << input_name << std::endl;
+
+  // GFA parsing.
+  std::unique_ptr<gbwt::GBWT> index;
+  std::unique_ptr<SequenceSource> source;
+  size_t gfa_bytes = 0;
+  {
+    std::ifstream in(filename, std::ios_base::binary | std::ios_base::ate);
+    if(in) { gfa_bytes = in.tellg(); }
+  }
+  Measurement parse = measure_rounds("gfa_parse", input_name, config.rounds, [&]() -> size_t
+  {
+    auto result = gfa_to_gbwt(filename);
+    index = std::move(result.first); source = std::move(result.second);
+    return gfa_bytes;
+  });
+  if(index == nullptr || source == nullptr)
+  {
+    std::cerr << "bench_suite: Could not parse " << filename << "; skipping" << std::endl;
+    return;
+  }
+  parse.print(std::cout);
+  GBZ gbz(index, source);
+  const GBWTGraph& graph = gbz.graph;
+
+  // GFA extraction.
+  measure_rounds("gbwt_to_gfa", input_name, config.rounds, [&]() -> size_t
+  {
+    std::ostringstream out;
+    gbwt_to_gfa(graph, out);
+    return out.str().length();
+  }).print(std::cout);
+
+  // Haplotype windows.
+  index_type minimizer_index;
+  measure_rounds("haplotype_windows", input_name, config.rounds, [&]() -> size_t
+  {
+    size_t windows = 0;
+    for_each_haplotype_window(graph, minimizer_index.window_bp(), [&](const std::vector<handle_t>&, const std::string&)
+    {
+      windows++;
+    }, false);
+    return windows;
+  }).print(std::cout);
+
+  // Minimizer index construction.
+  auto get_payload = [](const pos_t& pos) -> Payload { return Payload::create(hash(pos)); };
+  measure_rounds("index_haplotypes", input_name, config.rounds, [&]() -> size_t
+  {
+    index_type built;
+    index_haplotypes(graph, built, get_payload);
+    minimizer_index.swap(built);
+    return minimizer_index.number_of_values();
+  }).print(std::cout);
+
+  // Minimizers, syncmers, and find() for reads sampled from the haplotypes.
+  std::vector<std::string> reads = sample_reads(haplotype_sequences(graph), config, rng);
+  measure_queries("minimizers", input_name, reads, [&](const std::string& read) -> size_t
+  {
+    return minimizer_index.minimizers(read).size();
+  }).print(std::cout);
+  index_type syncmer_index(minimizer_index.k(), minimizer_index.k() / 2 - 1, true);
+  measure_queries("syncmers", input_name, reads, [&](const std::string& read) -> size_t
+  {
+    return syncmer_index.syncmers(read).size();
+  }).print(std::cout);
+  std::vector<std::vector<minimizer_type>> queries;
+  queries.reserve(reads.size());
+  for(const std::string& read : reads) { queries.push_back(minimizer_index.minimizers(read)); }
+  std::vector<std::pair<const PositionPayload*, size_t>> results;
+  measure_queries("find", input_name, queries, [&](const std::vector<minimizer_type>& minimizers) -> size_t
+  {
+    minimizer_index.find(minimizers, results);
+    return minimizers.size();
+  }).print(std::cout);
+
+  // Kmer index insertion with rehashing.
+  measure_rounds("kmer_insert", input_name, config.rounds, [&]() -> size_t
+  {
+    KmerIndex<Key64, Position> kmer_index;
+    std::mt19937_64 kmer_rng(config.seed);
+    for(size_t i = 0; i < config.kmers; i++)
+    {
+      Key64 key(kmer_rng() & 0x3FFFFFFFFFFFFFFF);
+      kmer_index.insert(key, Position::encode(make_pos_t(1 + (i & 0xFFFF), false, 0)), key.hash());
+    }
+    return config.kmers;
+  }).print(std::cout);
+
+  // Haplotype-consistent traversal with and without a cache.
+  std::vector<handle_t> starts;
+  graph.for_each_handle([&](const handle_t& handle)
+  {
+    starts.push_back(handle);
+    starts.push_back(graph.flip(handle));
+  });
+  std::shuffle(starts.begin(), starts.end(), rng);
+  starts.resize(std::min(starts.size(), config.reads));
+  size_t walk_seed = rng();
+  {
+    std::mt19937_64 walk_rng(walk_seed);
+    measure_queries("traversal_gbwtgraph", input_name, starts, [&](const handle_t& start) -> size_t
+    {
+      return haplotype_walk(graph, start, config.walk_length, walk_rng);
+    }).print(std::cout);
+  }
+  {
+    std::mt19937_64 walk_rng(walk_seed);
+    CachedGBWTGraph cached(graph);
+    measure_queries("traversal_cached", input_name, starts, [&](const handle_t& start) -> size_t
+    {
+      return haplotype_walk(cached, start, config.walk_length, walk_rng);
+    }).print(std::cout);
+  }
+
+  // Subgraph queries around random nodes.
+  std::vector<nid_t> nodes;
+  for(handle_t handle : starts) { nodes.push_back(graph.get_id(handle)); }
+  measure_queries("subgraph_node", input_name, nodes, [&](nid_t node) -> size_t
+  {
+    Subgraph subgraph(gbz, nullptr, SubgraphQuery::node(node, config.context, SubgraphQuery::all_haplotypes));
+    return 1;
+  }).print(std::cout);
+
+  std::cerr << std::endl;
+}
+
+//------------------------------------------------------------------------------
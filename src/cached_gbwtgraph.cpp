@@ -7,8 +7,173 @@ namespace gbwtgraph
 
 //------------------------------------------------------------------------------
 
+constexpr size_t SharedRecordCache::SHARDS;
+constexpr size_t SharedRecordCache::DEFAULT_CAPACITY;
+constexpr size_t SharedRecordCache::DEFAULT_BUDGET;
+constexpr size_t SharedRecordCache::LARGE_RECORD_BYTES;
+
+//------------------------------------------------------------------------------
+
+SharedRecordCache::SharedRecordCache(const gbwt::GBWT& index, size_t capacity, size_t budget, size_t min_bytes) :
+  index(&index),
+  shard_capacity(std::max((capacity + SHARDS - 1) / SHARDS, size_t(1))), shard_budget(budget / SHARDS),
+  record_threshold(min_bytes)
+{
+}
+
+size_t
+SharedRecordCache::record_bytes(const gbwt::DecompressedRecord& record)
+{
+  return sizeof(gbwt::DecompressedRecord) + (record.size() + record.outdegree()) * sizeof(gbwt::edge_type);
+}
+
+SharedRecordCache::record_type
+SharedRecordCache::record(gbwt::node_type node) const
+{
+  Shard& shard = this->shards[shard_of(node)];
+  {
+    std::shared_lock<std::shared_timed_mutex> guard(shard.lock);
+    const Slot* slot = shard.find(node);
+    if(slot != nullptr) { return slot->record; }
+  }
+  return this->load(shard, node);
+}
+
+SharedRecordCache::record_type
+SharedRecordCache::load(Shard& shard, gbwt::node_type node) const
+{
+  // Decompress the record without holding the lock.
+  shard.misses.fetch_add(1, std::memory_order_relaxed);
+  if(!(this->index->contains(node))) { return record_type(); }
+  record_type result = std::make_shared<const gbwt::DecompressedRecord>(this->index->record(node));
+  size_t bytes = record_bytes(*result);
+  if(bytes > this->shard_budget)
+  {
+    std::lock_guard<std::shared_timed_mutex> guard(shard.lock);
+    shard.uncachable.insert(node);
+    return result;
+  }
+
+  // Another thread may have inserted the record in the meantime. Evicted
+  // records are released after releasing the lock.
+  std::vector<record_type> evicted;
+  {
+    std::lock_guard<std::shared_timed_mutex> guard(shard.lock);
+    auto iter = shard.slot_of.find(node);
+    if(iter != shard.slot_of.end()) { return shard.slots[iter->second].record; }
+    while(shard.slot_of.size() >= this->shard_capacity || shard.bytes + bytes > this->shard_budget)
+    {
+      Slot& slot = shard.slots[shard.hand];
+      if(slot.record != nullptr)
+      {
+        if(slot.referenced.load(std::memory_order_relaxed)) { slot.referenced.store(false, std::memory_order_relaxed); }
+        else
+        {
+          shard.slot_of.erase(slot.node);
+          shard.bytes -= slot.bytes;
+          evicted.push_back(std::move(slot.record));
+          slot.record = nullptr;
+          shard.free_slots.push_back(shard.hand);
+        }
+      }
+      shard.hand = (shard.hand + 1) % shard.slots.size();
+    }
+    size_t offset = shard.slots.size();
+    if(shard.free_slots.empty()) { shard.slots.emplace_back(); }
+    else { offset = shard.free_slots.back(); shard.free_slots.pop_back(); }
+    Slot& slot = shard.slots[offset];
+    slot.node = node; slot.record = result; slot.bytes = bytes;
+    slot.referenced.store(false, std::memory_order_relaxed);
+    shard.slot_of[node] = offset;
+    shard.bytes += bytes;
+  }
+
+  return result;
+}
+
+gbwt::edge_type
+SharedRecordCache::LF(gbwt::edge_type position) const
+{
+  if(this->record_threshold > 0)
+  {
+    std::pair<gbwt::size_type, gbwt::size_type> range = this->index->bwt.getRange(this->index->toComp(position.first));
+    if(range.second - range.first <= this->record_threshold) { return this->index->LF(position); }
+  }
+  if(this->shard_budget == 0) { return this->index->LF(position); }
+
+  Shard& shard = this->shards[shard_of(position.first)];
+  {
+    std::shared_lock<std::shared_timed_mutex> guard(shard.lock);
+    const Slot* slot = shard.find(position.first);
+    if(slot != nullptr) { return slot->record->LF(position.second); }
+    if(shard.uncachable.find(position.first) != shard.uncachable.end()) { return this->index->LF(position); }
+  }
+  record_type result = this->load(shard, position.first);
+  if(result == nullptr) { return this->index->LF(position); }
+  return result->LF(position.second);
+}
+
+size_t
+SharedRecordCache::size() const
+{
+  size_t result = 0;
+  for(Shard& shard : this->shards)
+  {
+    std::shared_lock<std::shared_timed_mutex> guard(shard.lock);
+    result += shard.slot_of.size();
+  }
+  return result;
+}
+
+size_t
+SharedRecordCache::hits() const
+{
+  size_t result = 0;
+  for(const Shard& shard : this->shards) { result += shard.hits.load(std::memory_order_relaxed); }
+  return result;
+}
+
+size_t
+SharedRecordCache::misses() const
+{
+  size_t result = 0;
+  for(const Shard& shard : this->shards) { result += shard.misses.load(std::memory_order_relaxed); }
+  return result;
+}
+
+size_t
+SharedRecordCache::bytes() const
+{
+  size_t result = 0;
+  for(Shard& shard : this->shards)
+  {
+    std::shared_lock<std::shared_timed_mutex> guard(shard.lock);
+    result += shard.bytes;
+  }
+  return result;
+}
+
+void
+SharedRecordCache::clear()
+{
+  for(Shard& shard : this->shards)
+  {
+    std::lock_guard<std::shared_timed_mutex> guard(shard.lock);
+    shard.slot_of.clear();
+    shard.slots.clear();
+    shard.free_slots.clear();
+    shard.uncachable.clear();
+    shard.bytes = 0;
+    shard.hand = 0;
+    shard.hits.store(0, std::memory_order_relaxed);
+    shard.misses.store(0, std::memory_order_relaxed);
+  }
+}
+
+//------------------------------------------------------------------------------
+
 CachedGBWTGraph::CachedGBWTGraph() :
-  graph(nullptr), cache()
+  graph(nullptr), cache(), shared(nullptr)
 {
 }
 
@@ -33,6 +198,7 @@ CachedGBWTGraph::swap(CachedGBWTGraph& another)
 
   std::swap(this->graph, another.graph);
   this->cache.swap(another.cache);
+  std::swap(this->shared, another.shared);
 }
 
 CachedGBWTGraph&
@@ -49,6 +215,7 @@ CachedGBWTGraph::operator=(CachedGBWTGraph&& source)
   {
     this->graph = std::move(source.graph);
     this->cache = std::move(source.cache);
+    this->shared = std::move(source.shared);
   }
   return *this;
 }
@@ -58,12 +225,18 @@ CachedGBWTGraph::copy(const CachedGBWTGraph& source)
 {
   this->graph = source.graph;
   this->cache = source.cache;
+  this->shared = source.shared;
 }
 
 //------------------------------------------------------------------------------
 
 CachedGBWTGraph::CachedGBWTGraph(const GBWTGraph& graph) :
-  graph(&graph), cache(this->graph->get_cache())
+  graph(&graph), cache(this->graph->get_cache()), shared(nullptr)
+{
+}
+
+CachedGBWTGraph::CachedGBWTGraph(const GBWTGraph& graph, const SharedRecordCache& shared) :
+  graph(&graph), cache(this->graph->get_cache()), shared(&shared)
 {
 }
 
@@ -154,6 +327,7 @@ CachedGBWTGraph::max_node_id() const
 bool
 CachedGBWTGraph::follow_edges_impl(const handle_t& handle, bool go_left, const std::function<bool(const handle_t&)>& iteratee) const
 {
+  if(this->shared != nullptr) { return this->graph->cached_follow_edges(*(this->shared), handle, go_left, iteratee); }
   return this->graph->cached_follow_edges(this->cache, handle, go_left, iteratee);
 }
 
@@ -170,6 +344,16 @@ CachedGBWTGraph::get_degree(const handle_t& handle, bool go_left) const
   // Cache the node.
   gbwt::node_type curr = handle_to_node(handle);
   if(go_left) { curr = gbwt::Node::reverse(curr); }
+  if(this->shared != nullptr)
+  {
+    size_t result = 0;
+    this->shared->visit(curr, [&](const gbwt::DecompressedRecord& record)
+    {
+      result = record.outdegree();
+      if(result > 0 && record.successor(0) == gbwt::ENDMARKER) { result--; }
+    });
+    return result;
+  }
   gbwt::size_type cache_index = this->cache.findRecord(curr);
 
   // The outdegree reported by GBWT might account for the endmarker, which is
@@ -184,6 +368,18 @@ CachedGBWTGraph::has_edge(const handle_t& left, const handle_t& right) const
 {
   // Cache the node.
   gbwt::node_type curr = handle_to_node(left);
+  if(this->shared != nullptr)
+  {
+    bool found = false;
+    this->shared->visit(curr, [&](const gbwt::DecompressedRecord& record)
+    {
+      for(gbwt::rank_type outrank = 0; outrank < record.outdegree(); outrank++)
+      {
+        if(node_to_handle(record.successor(outrank)) == right) { found = true; break; }
+      }
+    });
+    return found;
+  }
   gbwt::size_type cache_index = this->cache.findRecord(curr);
 
   for(gbwt::rank_type outrank = 0; outrank < this->cache.outdegree(cache_index); outrank++)
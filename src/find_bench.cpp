@@ -0,0 +1,268 @@
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <getopt.h>
+#include <unistd.h>
+
+#include <gbwtgraph/compact_minimizer.h>
+#include <gbwtgraph/memory.h>
+
+using namespace gbwtgraph;
+
+//------------------------------------------------------------------------------
+
+/*
+  A microbenchmark for MinimizerIndex::find(). We index the minimizers in a
+  random sequence and then query with the minimizers in random reads, some of
+  which are substrings of the indexed sequence. The queries are answered with
+  one find() call per minimizer and with batched find(). We also answer the
+  queries with batched find() in a CompactMinimizerIndex built from the index.
+*/
+
+const std::string tool_name = "MinimizerIndex::find() benchmark";
+
+struct Config
+{
+  Config(int argc, char** argv);
+
+  constexpr static size_t DEFAULT_LENGTH = 24;
+  constexpr static size_t DEFAULT_READS = 1000000;
+  constexpr static size_t DEFAULT_READ_LENGTH = 150;
+  constexpr static size_t DEFAULT_ROUNDS = 3;
+
+  size_t sequence_length = size_t(1) << DEFAULT_LENGTH;
+  size_t reads = DEFAULT_READS;
+  size_t read_length = DEFAULT_READ_LENGTH;
+  size_t rounds = DEFAULT_ROUNDS;
+  size_t seed = 0xACDC;
+  MemoryPolicy memory_policy;
+};
+
+typedef MinimizerIndex<Key64, PositionPayload> index_type;
+typedef CompactMinimizerIndex<Key64, PositionPayload> compact_type;
+typedef index_type::minimizer_type minimizer_type;
+typedef std::pair<const PositionPayload*, size_t> result_type;
+
+std::string random_sequence(size_t length, std::mt19937_64& rng);
+
+//------------------------------------------------------------------------------
+
+int
+main(int argc, char** argv)
+{
+  double start = gbwt::readTimer();
+  Config config(argc, argv);
+  Version::print(std::cerr, tool_name);
+  std::mt19937_64 rng(config.seed);
+  MemoryPolicy::set_global(config.memory_policy);
+  if(!(config.memory_policy.is_default()))
+  {
+    std::cerr << "Memory policy: " << config.memory_policy.to_string() << " (" << numa_nodes().size() << " NUMA nodes)" << std::endl;
+  }
+
+  // Build the index.
+  std::cerr << "Indexing a random sequence of length " << config.sequence_length << std::endl;
+  double checkpoint = gbwt::readTimer();
+  std::string sequence = random_sequence(config.sequence_length, rng);
+  index_type index;
+  for(const minimizer_type& minimizer : index.minimizers(sequence))
+  {
+    pos_t pos = make_pos_t(1 + minimizer.offset / 1024, false, minimizer.offset % 1024);
+    index.insert(minimizer, { Position::encode(pos), Payload::create(minimizer.offset) });
+  }
+  index.compact();
+  double seconds = gbwt::readTimer() - checkpoint;
+  std::cerr << "Indexed " << index.size() << " minimizers with " << index.number_of_values() << " occurrences in " << seconds << " seconds" << std::endl;
+  std::cerr << "Hash table: " << index.hash_table_size() << " cells" << std::endl;
+  checkpoint = gbwt::readTimer();
+  compact_type compact(index);
+  seconds = gbwt::readTimer() - checkpoint;
+  size_t index_bytes = index.hash_table_size() * sizeof(std::pair<Key64, PositionPayload>) + (index.number_of_values() - index.unique_keys()) * sizeof(PositionPayload);
+  std::cerr << "Built a compact index in " << seconds << " seconds: " << gbwt::inMegabytes(compact.bytes()) << " MiB (vs. " << gbwt::inMegabytes(index_bytes) << " MiB)" << std::endl;
+
+  // Extract the query minimizers. Half of the reads come from the sequence.
+  std::vector<std::vector<minimizer_type>> queries(config.reads);
+  size_t total_minimizers = 0;
+  {
+    std::uniform_int_distribution<size_t> start_dist(0, config.sequence_length - config.read_length);
+    for(size_t i = 0; i < config.reads; i++)
+    {
+      std::string read = (i & 1 ? random_sequence(config.read_length, rng) : sequence.substr(start_dist(rng), config.read_length));
+      queries[i] = index.minimizers(read);
+      total_minimizers += queries[i].size();
+    }
+  }
+  std::cerr << "Generated " << config.reads << " reads with " << total_minimizers << " minimizers" << std::endl;
+  std::cerr << std::endl;
+
+  // Run the benchmark.
+  std::vector<result_type> results;
+  std::vector<PositionPayload> buffer;
+  for(size_t round = 0; round < config.rounds; round++)
+  {
+    size_t scalar_hits = 0, batched_hits = 0, compact_hits = 0;
+    checkpoint = gbwt::readTimer();
+    for(const std::vector<minimizer_type>& minimizers : queries)
+    {
+      results.resize(minimizers.size());
+      for(size_t i = 0; i < minimizers.size(); i++) { results[i] = index.find(minimizers[i]); }
+      for(const result_type& result : results) { scalar_hits += result.second; }
+    }
+    double scalar_seconds = gbwt::readTimer() - checkpoint;
+
+    checkpoint = gbwt::readTimer();
+    for(const std::vector<minimizer_type>& minimizers : queries)
+    {
+      index.find(minimizers, results);
+      for(const result_type& result : results) { batched_hits += result.second; }
+    }
+    double batched_seconds = gbwt::readTimer() - checkpoint;
+
+    checkpoint = gbwt::readTimer();
+    for(const std::vector<minimizer_type>& minimizers : queries)
+    {
+      compact.find(minimizers, results, buffer);
+      for(const result_type& result : results) { compact_hits += result.second; }
+    }
+    double compact_seconds = gbwt::readTimer() - checkpoint;
+
+    if(scalar_hits != batched_hits || scalar_hits != compact_hits)
+    {
+      std::cerr << "find_bench: Scalar, batched, and compact find() found " << scalar_hits << ", " << batched_hits << ", and " << compact_hits << " hits" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    double scalar_ns = scalar_seconds * 1e9 / total_minimizers, batched_ns = batched_seconds * 1e9 / total_minimizers;
+    double compact_ns = compact_seconds * 1e9 / total_minimizers;
+    std::cout << "Round " << (round + 1) << ": scalar " << scalar_ns << " ns/minimizer, batched " << batched_ns << " ns/minimizer, speedup " << (scalar_seconds / batched_seconds) << "x, compact " << compact_ns << " ns/minimizer" << std::endl;
+  }
+  std::cout << std::endl;
+
+  seconds = gbwt::readTimer() - start;
+  std::cerr << "Used " << seconds << " seconds, " << gbwt::inGigabytes(gbwt::memoryUsage()) << " GiB" << std::endl;
+  std::cerr << std::endl;
+
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void
+printUsage(int exit_code)
+{
+  Version::print(std::cerr, tool_name);
+
+  std::cerr << "Usage: find_bench [options]" << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "Options:" << std::endl;
+  std::cerr << "  -l, --length N       index a random sequence of length 2^N (default: " << Config::DEFAULT_LENGTH << ")" << std::endl;
+  std::cerr << "  -n, --reads N        query with N reads (default: " << Config::DEFAULT_READS << ")" << std::endl;
+  std::cerr << "  -r, --read-length N  use reads of length N (default: " << Config::DEFAULT_READ_LENGTH << ")" << std::endl;
+  std::cerr << "  -R, --rounds N       repeat the benchmark N times (default: " << Config::DEFAULT_ROUNDS << ")" << std::endl;
+  std::cerr << "  -s, --seed N         use random seed N" << std::endl;
+  std::cerr << "  -m, --memory-policy X" << std::endl;
+  std::cerr << "                       allocate the index with policy X: comma-separated list" << std::endl;
+  std::cerr << "                       of thp, 2m, 1g, interleave, node=N" << std::endl;
+  std::cerr << "  -h, --help           print this help" << std::endl;
+  std::cerr << std::endl;
+
+  std::exit(exit_code);
+}
+
+//------------------------------------------------------------------------------
+
+size_t
+parse_size(const char* arg, const std::string& what)
+{
+  try { return std::stoul(arg); }
+  catch(const std::invalid_argument&)
+  {
+    std::cerr << "find_bench: Invalid " << what << ": " << arg << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+Config::Config(int argc, char** argv)
+{
+  size_t min_width = 10, max_width = 34;
+
+  // Data for `getopt_long()`.
+  int c = 0, option_index = 0;
+  option long_options[] =
+  {
+    { "length", required_argument, 0, 'l' },
+    { "reads", required_argument, 0, 'n' },
+    { "read-length", required_argument, 0, 'r' },
+    { "rounds", required_argument, 0, 'R' },
+    { "seed", required_argument, 0, 's' },
+    { "memory-policy", required_argument, 0, 'm' },
+    { "help", no_argument, 0, 'h' },
+    { 0, 0, 0, 0 }
+  };
+
+  // Process options.
+  while((c = getopt_long(argc, argv, "l:n:r:R:s:m:h", long_options, &option_index)) != -1)
+  {
+    switch(c)
+    {
+    case 'l':
+      {
+        size_t width = parse_size(optarg, "sequence length");
+        if(width < min_width || width > max_width)
+        {
+          std::cerr << "find_bench: Invalid sequence length: 2^" << width << " (must be from 2^" << min_width << " to 2^" << max_width << ")" << std::endl;
+          std::exit(EXIT_FAILURE);
+        }
+        this->sequence_length = size_t(1) << width;
+      }
+      break;
+    case 'n':
+      this->reads = parse_size(optarg, "number of reads");
+      break;
+    case 'r':
+      this->read_length = parse_size(optarg, "read length");
+      break;
+    case 'R':
+      this->rounds = parse_size(optarg, "number of rounds");
+      break;
+    case 's':
+      this->seed = parse_size(optarg, "random seed");
+      break;
+    case 'm':
+      if(!MemoryPolicy::parse(optarg, this->memory_policy))
+      {
+        std::cerr << "find_bench: Invalid memory policy: " << optarg << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+    case 'h':
+      printUsage(EXIT_SUCCESS);
+      break;
+
+    case '?':
+      std::exit(EXIT_FAILURE);
+    default:
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  // Sanity checks.
+  if(this->read_length == 0 || this->read_length > this->sequence_length)
+  {
+    std::cerr << "find_bench: Invalid read length: " << this->read_length << std::endl;
+    std::exit(EXIT_FAILURE);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+std::string
+random_sequence(size_t length, std::mt19937_64& rng)
+{
+  std::string result(length, 'A');
+  for(size_t i = 0; i < length; i++) { result[i] = "ACGT"[rng() & 3]; }
+  return result;
+}
+
+//------------------------------------------------------------------------------
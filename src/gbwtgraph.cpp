@@ -1,15 +1,16 @@
 #include "absl/log/absl_log.h"
 #include <gbwtgraph/gbwtgraph.h>
+#include <gbwtgraph/cached_gbwtgraph.h>
+#include <gbwtgraph/internal.h>
 
 #include <algorithm>
 #include <queue>
-#include <stack>
 #include <string>
 #include <utility>
 
 #include <arpa/inet.h>
 
-//#include <omp.h>
+#include <omp.h>
 
 namespace gbwtgraph
 {
@@ -19,6 +20,7 @@ namespace gbwtgraph
 // Numerical class constants.
 
 constexpr size_t GBWTGraph::CHUNK_SIZE;
+constexpr size_t GBWTGraph::LOCATE_DECOMPRESS_THRESHOLD;
 
 constexpr std::uint32_t GBWTGraph::Header::TAG;
 constexpr std::uint32_t GBWTGraph::Header::VERSION;
@@ -122,6 +124,7 @@ GBWTGraph::swap(GBWTGraph& another)
   this->name_to_path.swap(another.name_to_path);
   this->id_to_path.swap(another.id_to_path);
   this->reference_samples.swap(another.reference_samples);
+  std::swap(this->record_cache, another.record_cache);
 }
 
 GBWTGraph&
@@ -146,6 +149,7 @@ GBWTGraph::operator=(GBWTGraph&& source)
     this->name_to_path = std::move(source.name_to_path);
     this->id_to_path = std::move(source.id_to_path);
     this->reference_samples = std::move(source.reference_samples);
+    this->record_cache = std::move(source.record_cache);
   }
   return *this;
 }
@@ -163,6 +167,7 @@ GBWTGraph::copy(const GBWTGraph& source)
   this->name_to_path = source.name_to_path;
   this->id_to_path = source.id_to_path;
   this->reference_samples = source.reference_samples;
+  this->record_cache = source.record_cache;
 }
 
 void
@@ -195,6 +200,22 @@ GBWTGraph::sanity_checks()
   }
 }
 
+bool
+GBWTGraph::apply_memory_policy(const MemoryPolicy& policy) const
+{
+  bool ok = true;
+  if(!(this->sequences.empty()))
+  {
+    ok &= gbwtgraph::apply_memory_policy(this->sequences.view(0).first, this->sequences.length(), policy);
+  }
+  // The compressed BWT is accessed in every LF() step.
+  if(this->index != nullptr && !(this->index->bwt.data.empty()))
+  {
+    ok &= gbwtgraph::apply_memory_policy(this->index->bwt.data.data(), this->index->bwt.data.size(), policy);
+  }
+  return ok;
+}
+
 std::pair<gbwt::StringArray, sdsl::sd_vector<>>
 GBWTGraph::copy_translation(const NamedNodeBackTranslation& translation) const
 {
@@ -477,14 +498,25 @@ GBWTGraph::determine_real_nodes()
 
   size_t potential_nodes = this->index->sigma() - this->index->firstNode();
   this->real_nodes = sdsl::bit_vector(potential_nodes / 2, 0);
-  for(gbwt::node_type node = this->index->firstNode(); node < this->index->sigma(); node += 2)
+
+  // Threads process disjoint words of the bitvector.
+  size_t words = (this->real_nodes.size() + gbwt::WORD_BITS - 1) / gbwt::WORD_BITS;
+  size_t total = 0;
+  #pragma omp parallel for schedule(dynamic, 256) reduction(+:total)
+  for(size_t word = 0; word < words; word++)
   {
-    if(!(this->index->empty(node)))
+    size_t limit = std::min((word + 1) * gbwt::WORD_BITS, size_t(this->real_nodes.size()));
+    for(size_t i = word * gbwt::WORD_BITS; i < limit; i++)
     {
-      this->real_nodes[this->node_offset(node) / 2] = 1;
-      this->header.nodes++;
+      gbwt::node_type node = this->index->firstNode() + 2 * i;
+      if(!(this->index->empty(node)))
+      {
+        this->real_nodes[i] = 1;
+        total++;
+      }
     }
   }
+  this->header.nodes = total;
 }
 
 void
@@ -538,8 +570,11 @@ GBWTGraph::cache_named_paths()
      ABSL_LOG(FATAL) << "GBWTGraph: Named path names are not unique";
   }
 
-  // Cache named path information we get from traversing the paths.
-  //#pragma omp parallel for schedule(dynamic, 1)
+  // Cache named path information we get from traversing the paths. The paths
+  // are independent, so we traverse them in parallel. Large records are
+  // decompressed once for all threads.
+  SharedRecordCache record_cache(*(this->index), SharedRecordCache::DEFAULT_CAPACITY, SharedRecordCache::DEFAULT_BUDGET, SharedRecordCache::LARGE_RECORD_BYTES);
+  #pragma omp parallel for schedule(dynamic, 1) if(this->named_paths.size() > 1)
   for(size_t i = 0; i < this->named_paths.size(); i++)
   {
     NamedPath& path = this->named_paths[i];
@@ -551,7 +586,7 @@ GBWTGraph::cache_named_paths()
     {
       path.to = curr;
       path.length++;
-      curr = this->index->LF(curr);
+      curr = record_cache.LF(curr);
     }
   }
 }
@@ -651,7 +686,7 @@ GBWTGraph::for_each_handle_impl(const std::function<bool(const handle_t&)>& iter
 {
   if(parallel)
   {
-    //#pragma omp parallel for schedule(dynamic, CHUNK_SIZE)
+    #pragma omp parallel for schedule(dynamic, CHUNK_SIZE)
     for(gbwt::node_type node = this->index->firstNode(); node < this->index->sigma(); node += 2)
     {
       if(!(this->real_nodes[this->node_offset(node) / 2])) { continue; }
@@ -983,7 +1018,7 @@ GBWTGraph::path_back(const path_handle_t& path_handle) const {
       // Remember that ranges are inclusive at both ends.
       for(to.second = node_state.range.first; to.second <= node_state.range.second; ++to.second)
       {
-        gbwt::edge_type next_edge = this->index->LF(to);
+        gbwt::edge_type next_edge = this->path_LF(to);
         if(next_edge.first != gbwt::ENDMARKER)
         {
           // We're only interested in final visits, which we can ID before
@@ -1063,7 +1098,7 @@ GBWTGraph::get_next_step(const step_handle_t& step_handle) const {
 
   // Follow it, and get either a real edge, or an edge where the node is
   // gbwt::ENDMARKER.
-  here = this->index->LF(here);
+  here = this->path_LF(here);
 
   if(here.first == gbwt::ENDMARKER)
   {
@@ -1500,6 +1535,9 @@ GBWTGraph::for_each_edge_and_path_on_handle(const handle_t& handle, const std::f
     // Look up the GBWT node
     gbwt::SearchState node_state = get_state(oriented_handle);
 
+    // Locate all visits to the node at once.
+    std::vector<gbwt::size_type> sequence_numbers = this->locate(node_state);
+
     gbwt::edge_type candidate_edge;
     candidate_edge.first = node_state.node;
     for(candidate_edge.second = node_state.range.first;
@@ -1509,8 +1547,7 @@ GBWTGraph::for_each_edge_and_path_on_handle(const handle_t& handle, const std::f
       // Get the edge for each haplotype in the start-and-end-inclusive range
 
       // Get the sequence number the edge is on.
-      // TODO: We could have a version of locate() that decompresses the entire DA for the node.
-      auto sequence_number = this->index->locate(candidate_edge);
+      auto sequence_number = sequence_numbers[candidate_edge.second - node_state.range.first];
 
       if(gbwt::Path::is_reverse(sequence_number))
       {
@@ -1538,6 +1575,74 @@ GBWTGraph::for_each_edge_and_path_on_handle(const handle_t& handle, const std::f
 
 }
 
+std::vector<gbwt::size_type>
+GBWTGraph::locate(const gbwt::SearchState& state) const
+{
+  std::vector<gbwt::size_type> result;
+  if(state.empty()) { return result; }
+  result.resize(state.size(), gbwt::invalid_sequence());
+  if(state.node == gbwt::ENDMARKER) { return result; }
+
+  // Unresolved visits as (GBWT position, offset in the result). We keep them
+  // sorted by position, so that the visits to the same node are consecutive.
+  std::vector<std::pair<gbwt::edge_type, size_t>> active;
+  active.reserve(state.size());
+  for(size_t i = 0; i < state.size(); i++)
+  {
+    active.push_back({ gbwt::edge_type(state.node, state.range.first + i), i });
+  }
+
+  while(!(active.empty()))
+  {
+    size_t tail = 0, start = 0;
+    while(start < active.size())
+    {
+      gbwt::node_type node = active[start].first.first;
+      size_t limit = start + 1;
+      while(limit < active.size() && active[limit].first.first == node) { limit++; }
+
+      // Resolve the sampled visits first, so that we know whether the record is needed.
+      size_t group_tail = tail;
+      for(size_t i = start; i < limit; i++)
+      {
+        gbwt::size_type sequence = this->index->tryLocate(node, active[i].first.second);
+        if(sequence != gbwt::invalid_sequence()) { result[active[i].second] = sequence; }
+        else { active[group_tail] = active[i]; group_tail++; }
+      }
+
+      // Follow the remaining visits to the next node. The last visit of each
+      // sequence should be sampled, but if we reach the endmarker anyway, the
+      // sequence cannot be located and we drop the visit.
+      if(group_tail > tail)
+      {
+        gbwt::CompressedRecord record = this->index->record(node);
+        if(group_tail - tail >= LOCATE_DECOMPRESS_THRESHOLD)
+        {
+          gbwt::DecompressedRecord decompressed(record);
+          for(size_t i = tail; i < group_tail; i++) { active[i].first = decompressed.LF(active[i].first.second); }
+        }
+        else
+        {
+          for(size_t i = tail; i < group_tail; i++) { active[i].first = record.LF(active[i].first.second); }
+        }
+        size_t next_tail = tail;
+        for(size_t i = tail; i < group_tail; i++)
+        {
+          if(active[i].first.first == gbwt::ENDMARKER) { continue; }
+          active[next_tail] = active[i]; next_tail++;
+        }
+        group_tail = next_tail;
+      }
+      tail = group_tail;
+      start = limit;
+    }
+    active.resize(tail);
+    std::sort(active.begin(), active.end());
+  }
+
+  return result;
+}
+
 gbwt::size_type
 GBWTGraph::handle_to_path(const path_handle_t& handle) const
 {
@@ -1709,38 +1814,45 @@ GBWTGraph::for_each_link_impl(const std::function<bool(const edge_t&, const std:
 
   return this->for_each_segment([&](const std::string& from_segment, std::pair<nid_t, nid_t> nodes) -> bool
   {
-    bool keep_going = true;
-    // Right edges from forward orientation are canonical if the destination node
-    // has a greater id or if the edge is a self-loop.
-    handle_t last = this->get_handle(nodes.second - 1, false);
-    keep_going = this->follow_edges(last, false, [&](const handle_t& next) -> bool
+    return this->for_each_link_from(from_segment, nodes, iteratee);
+  }, parallel);
+}
+
+bool
+GBWTGraph::for_each_link_from(const std::string& from_segment, const std::pair<nid_t, nid_t>& nodes,
+                              const std::function<bool(const edge_t&, const std::string&, const std::string&)>& iteratee) const
+{
+  bool keep_going = true;
+  // Right edges from forward orientation are canonical if the destination node
+  // has a greater id or if the edge is a self-loop.
+  handle_t last = this->get_handle(nodes.second - 1, false);
+  keep_going = this->follow_edges(last, false, [&](const handle_t& next) -> bool
+  {
+    nid_t next_id = this->get_id(next);
+    if(next_id >= nodes.second - 1)
     {
-      nid_t next_id = this->get_id(next);
-      if(next_id >= nodes.second - 1)
-      {
-        std::string to_segment = this->get_segment_name(next);
-        if(!iteratee(edge_t(last, next), from_segment, to_segment)) { return false; }
-      }
-      return true;
-    });
-    if(!keep_going) { return false; }
+      std::string to_segment = this->get_segment_name(next);
+      if(!iteratee(edge_t(last, next), from_segment, to_segment)) { return false; }
+    }
+    return true;
+  });
+  if(!keep_going) { return false; }
 
-    // Right edges from reverse orientation are canonical if the destination node
-    // has a greater id or if the edge is a self-loop to forward orientation of
-    // this node.
-    handle_t first = this->get_handle(nodes.first, true);
-    keep_going = this->follow_edges(first, false, [&](const handle_t& next) -> bool
+  // Right edges from reverse orientation are canonical if the destination node
+  // has a greater id or if the edge is a self-loop to forward orientation of
+  // this node.
+  handle_t first = this->get_handle(nodes.first, true);
+  keep_going = this->follow_edges(first, false, [&](const handle_t& next) -> bool
+  {
+    nid_t next_id = this->get_id(next);
+    if(next_id > nodes.first || (next_id == nodes.first && !(this->get_is_reverse(next))))
     {
-      nid_t next_id = this->get_id(next);
-      if(next_id > nodes.first || (next_id == nodes.first && !(this->get_is_reverse(next))))
-      {
-        std::string to_segment = this->get_segment_name(next);
-        if(!iteratee(edge_t(first, next), from_segment, to_segment)) { return false; }
-      }
-      return true;
-    });
-    return keep_going;
-  }, parallel);
+      std::string to_segment = this->get_segment_name(next);
+      if(!iteratee(edge_t(first, next), from_segment, to_segment)) { return false; }
+    }
+    return true;
+  });
+  return keep_going;
 }
 
 //------------------------------------------------------------------------------
@@ -1827,18 +1939,24 @@ GBWTGraph::deserialize_members(std::istream& in)
       ABSL_LOG(FATAL) << "GBWTGraph: A GBWT index is required for loading simple-sds format";
     }
     {
+      // Forward sequences are copied directly from the loaded array. Reverse
+      // complements are built in a reusable buffer, as the StringArray copies
+      // each sequence before asking for the next one.
       gbwt::StringArray forward_only;
       forward_only.simple_sds_load(in);
+      std::string buffer;
       this->sequences = gbwt::StringArray(2 * forward_only.size(),
       [&](size_t offset) -> size_t
       {
         return forward_only.length(offset / 2);
       },
-      [&](size_t offset) -> std::string
+      [&](size_t offset) -> view_type
       {
-        std::string result = forward_only.str(offset / 2);
-        if(offset & 1) { reverse_complement_in_place(result); }
-        return result;
+        view_type forward = forward_only.view(offset / 2);
+        if(!(offset & 1)) { return forward; }
+        buffer.assign(forward.first, forward.second);
+        reverse_complement_in_place(buffer);
+        return str_to_view(buffer);
       });
     }
     this->determine_real_nodes();
@@ -1873,6 +1991,7 @@ void
 GBWTGraph::set_gbwt(const gbwt::GBWT& gbwt_index)
 {
   this->index = &gbwt_index;
+  this->record_cache = nullptr;
 
   if(!(this->index->bidirectional()))
   {
@@ -1889,18 +2008,40 @@ GBWTGraph::set_gbwt_address(const gbwt::GBWT& gbwt_index)
   this->index = &gbwt_index;
 }
 
+gbwt::edge_type
+GBWTGraph::path_LF(gbwt::edge_type position) const
+{
+  if(this->record_cache != nullptr) { return this->record_cache->LF(position); }
+  return this->index->LF(position);
+}
+
 //------------------------------------------------------------------------------
 
 void
 GBWTGraph::simple_sds_serialize(std::ostream& out) const
 {
-  // Serialize the header.
-  Header copy = this->header;
-  copy.set(Header::FLAG_SIMPLE_SDS); // We only set this flag in the serialized header.
-  sdsl::simple_sds::serialize_value(copy, out);
+  serialize_sections(out, this->simple_sds_sections(), 1);
+}
 
-  // Compress the sequences. `real_nodes` can be rebuilt from the GBWT.
+void
+GBWTGraph::simple_sds_serialize(std::ostream& out, size_t threads) const
+{
+  serialize_sections(out, this->simple_sds_sections(), threads);
+}
+
+std::vector<std::function<void(std::ostream&)>>
+GBWTGraph::simple_sds_sections() const
+{
+  std::vector<std::function<void(std::ostream&)>> sections;
+
+  // Serialize the header and compress the sequences. `real_nodes` can be
+  // rebuilt from the GBWT.
+  sections.push_back([this](std::ostream& out)
   {
+    Header copy = this->header;
+    copy.set(Header::FLAG_SIMPLE_SDS); // We only set this flag in the serialized header.
+    sdsl::simple_sds::serialize_value(copy, out);
+
     gbwt::StringArray forward_only(this->sequences.size() / 2,
     [&](size_t offset) -> size_t
     {
@@ -1911,11 +2052,13 @@ GBWTGraph::simple_sds_serialize(std::ostream& out) const
       return this->sequences.view(2 * offset);
     });
     forward_only.simple_sds_serialize(out);
-  }
+  });
 
   // Compress the translation.
-  this->segments.simple_sds_serialize(out);
-  this->node_to_segment.simple_sds_serialize(out);
+  sections.push_back([this](std::ostream& out) { this->segments.simple_sds_serialize(out); });
+  sections.push_back([this](std::ostream& out) { this->node_to_segment.simple_sds_serialize(out); });
+
+  return sections;
 }
 
 void
@@ -2088,124 +2231,85 @@ GBWTGraph::cached_follow_edges(const gbwt::CachedGBWT& cache, const handle_t& ha
 
 //------------------------------------------------------------------------------
 
-/*
-  Haplotype-consistent traversal of the graph and the corresponding sequence.
-  The traversal always starts at the beginning of a node, but it may end in the
-  middle of a node.
-*/
-
-struct GBWTTraversal
+gbwt::SearchState
+GBWTGraph::get_state(const SharedRecordCache& cache, const handle_t& handle) const
 {
-  std::vector<handle_t> traversal;
-  size_t length;
-  size_t offset; // In the initial node.
-  gbwt::SearchState state; // GBWT search state at the end of the traversal.
-
-  std::string get_sequence(const HandleGraph& graph) const
+  gbwt::node_type node = handle_to_node(handle);
+  gbwt::SearchState result;
+  cache.visit(node, [&](const gbwt::DecompressedRecord& record)
   {
-    std::string result;
-    result.reserve(this->length);
-    for(size_t i = 0; i < this->traversal.size(); i++)
-    {
-      handle_t handle = this->traversal[i];
-      if(i == 0) { result.append(graph.get_sequence(handle), this->offset, this->length - result.length()); }
-      else { result.append(graph.get_sequence(handle), 0, this->length - result.length()); }
-    }
-    return result;
-  }
+    if(record.size() > 0) { result = gbwt::SearchState(node, 0, record.size() - 1); }
+  });
+  return result;
+}
 
-  std::string get_sequence(const GBWTGraph& graph) const
+gbwt::SearchState
+GBWTGraph::find(const SharedRecordCache& cache, const std::vector<handle_t>& path) const
+{
+  if(path.empty()) { return gbwt::SearchState(); }
+  gbwt::SearchState result = this->get_state(cache, path[0]);
+  for(size_t i = 1; i < path.size() && !result.empty(); i++)
   {
-    std::string result;
-    result.reserve(this->length);
-    for(size_t i = 0; i < this->traversal.size(); i++)
+    gbwt::node_type next = handle_to_node(path[i]);
+    gbwt::SearchState next_state;
+    cache.visit(result.node, [&](const gbwt::DecompressedRecord& record)
     {
-      handle_t handle = this->traversal[i];
-      auto view = graph.get_sequence_view(handle);
-      if(i == 0) { result.append(view.first + this->offset, view.second - this->offset); }
-      else { result.append(view.first, std::min(view.second, this->length - result.length())); }
-    }
-    return result;
+      if(record.edgeTo(next) < record.outdegree()) { next_state = gbwt::SearchState(next, record.LF(result.range, next)); }
+    });
+    result = next_state;
   }
-};
+  return result;
+}
 
-void
-for_each_haplotype_window_impl(
-  const GBWTGraph& graph, size_t window_size,
-  const std::function<void(const std::vector<handle_t>&, const std::string&)>& lambda,
-  bool parallel, bool nonredundant)
+bool
+GBWTGraph::follow_paths(const SharedRecordCache& cache, gbwt::SearchState state,
+                        const std::function<bool(const gbwt::SearchState&)>& iteratee) const
 {
-  if(window_size == 0) { return; }
-
-  // Traverse all starting nodes in parallel.
-  graph.for_each_handle([&](const handle_t& h) -> bool
+  SharedRecordCache::record_type record = cache.record(state.node);
+  if(record == nullptr) { return true; }
+  for(gbwt::rank_type outrank = 0; outrank < record->outdegree(); outrank++)
   {
-    // Get a GBWT cache.
-    gbwt::CachedGBWT cache = graph.get_cache();
-
-    // Initialize the stack with both orientations.
-    std::stack<GBWTTraversal> windows;
-    size_t node_length = graph.get_length(h);
-    bool long_node = nonredundant & (node_length >= window_size);
-    for(bool is_reverse : { false, true })
-    {
-      handle_t handle = (is_reverse ? graph.flip(h) : h);
-      gbwt::SearchState state = graph.get_state(cache, handle);
-      if(state.empty()) { continue; }
-      GBWTTraversal window { { handle }, node_length, 0, state };
-      if(long_node)
-      {
-        lambda(window.traversal, window.get_sequence(graph));
-        window.length = window_size - 1;
-        window.offset = node_length - (window_size - 1);
-      }
-      windows.push(window);
-    }
+    gbwt::node_type next = record->successor(outrank);
+    if(next == gbwt::ENDMARKER) { continue; }
+    gbwt::SearchState next_state(next, record->LF(state.range, next));
+    if(next_state.empty()) { continue; }
+    if(!iteratee(next_state)) { return false; }
+  }
 
-    // Extend the windows.
-    size_t target_length = (long_node ? 2 * (window_size - 1) : node_length + window_size - 1);
-    if(target_length == 0) { return true; }
-    while(!windows.empty())
-    {
-      GBWTTraversal window = windows.top(); windows.pop();
-      // Report the full window.
-      if(window.length >= target_length)
-      {
-        lambda(window.traversal, window.get_sequence(graph));
-        continue;
-      }
+  return true;
+}
 
-      // Try to extend the window to all successor nodes.
-      bool extend_success = false;
-      graph.follow_paths(cache, window.state, [&](const gbwt::SearchState& next_state) -> bool
-      {
-        handle_t next_handle = GBWTGraph::node_to_handle(next_state.node);
-        GBWTTraversal next_window = window;
-        next_window.traversal.push_back(next_handle);
-        next_window.length += std::min(graph.get_length(next_handle), target_length - window.length);
-        next_window.state = next_state;
-        windows.push(next_window);
-        extend_success = true;
-        return true;
-      });
+bool
+GBWTGraph::cached_follow_edges(const SharedRecordCache& cache, const handle_t& handle, bool go_left,
+                               const std::function<bool(const handle_t&)>& iteratee) const
+{
+  gbwt::node_type curr = handle_to_node(handle);
+  if(go_left) { curr = gbwt::Node::reverse(curr); }
 
-      // Report sufficiently long kmers that cannot be extended.
-      if(!extend_success && window.length >= window_size)
-      {
-        lambda(window.traversal, window.get_sequence(graph));
-      }
-    }
+  SharedRecordCache::record_type record = cache.record(curr);
+  if(record == nullptr) { return true; }
+  for(gbwt::rank_type outrank = 0; outrank < record->outdegree(); outrank++)
+  {
+    gbwt::node_type next = record->successor(outrank);
+    if(next == gbwt::ENDMARKER) { continue; }
+    if(go_left) { next = gbwt::Node::reverse(next); }
+    if(!iteratee(node_to_handle(next))) { return false; }
+  }
 
-    return true;
-  }, parallel);
+  return true;
 }
 
+//------------------------------------------------------------------------------
+
 void
 for_each_haplotype_window(const GBWTGraph& graph, size_t window_size,
                           const std::function<void(const std::vector<handle_t>&, const std::string&)>& lambda,
                           bool parallel)
 {
-  for_each_haplotype_window_impl(graph, window_size, lambda, parallel, false);
+  for_each_haplotype_window_view(graph, window_size, [&](const std::vector<handle_t>& traversal, view_type sequence)
+  {
+    lambda(traversal, std::string(sequence.first, sequence.second));
+  }, parallel);
 }
 
 void
@@ -2214,7 +2318,10 @@ for_each_nonredundant_window(
   const std::function<void(const std::vector<handle_t>&, const std::string&)>& lambda,
   bool parallel)
 {
-  for_each_haplotype_window_impl(graph, window_size, lambda, parallel, true);
+  for_each_nonredundant_window_view(graph, window_size, [&](const std::vector<handle_t>& traversal, view_type sequence)
+  {
+    lambda(traversal, std::string(sequence.first, sequence.second));
+  }, parallel);
 }
 
 //------------------------------------------------------------------------------
@@ -1,5 +1,9 @@
 #include "absl/log/absl_log.h"
 #include <gbwtgraph/gbz.h>
+#include <gbwtgraph/internal.h>
+
+#include <fstream>
+#include <stdexcept>
 
 namespace gbwtgraph
 {
@@ -13,6 +17,8 @@ constexpr std::uint32_t GBZ::Header::VERSION;
 
 constexpr std::uint64_t GBZ::Header::FLAG_MASK;
 
+constexpr size_t GBZ::DIRECT_SECTIONS;
+
 //------------------------------------------------------------------------------
 
 // Other class variables.
@@ -200,20 +206,58 @@ GBZ::set_gbwt_address()
 void
 GBZ::simple_sds_serialize(std::ostream& out) const
 {
-  sdsl::simple_sds::serialize_value(this->header, out);
-  this->tags.simple_sds_serialize(out);
-  this->index.simple_sds_serialize(out);
-  this->graph.simple_sds_serialize(out);
+  this->simple_sds_serialize(out, 1);
 }
 
 void
 GBZ::simple_sds_serialize(const gbwt::GBWT& index, const GBWTGraph& graph, std::ostream& out)
+{
+  simple_sds_serialize(index, graph, out, 1);
+}
+
+void
+GBZ::simple_sds_serialize(std::ostream& out, size_t threads) const
+{
+  std::vector<std::function<void(std::ostream&)>> sections;
+  sections.push_back([this](std::ostream& out)
+  {
+    sdsl::simple_sds::serialize_value(this->header, out);
+    this->tags.simple_sds_serialize(out);
+  });
+  sections.push_back([this](std::ostream& out) { this->index.simple_sds_serialize(out); });
+  for(auto& section : this->graph.simple_sds_sections()) { sections.push_back(std::move(section)); }
+  serialize_sections(out, sections, threads, GBZ::DIRECT_SECTIONS);
+}
+
+void
+GBZ::simple_sds_serialize(const gbwt::GBWT& index, const GBWTGraph& graph, std::ostream& out, size_t threads)
 {
   GBZ empty;
-  sdsl::simple_sds::serialize_value(empty.header, out);
-  empty.tags.simple_sds_serialize(out);
-  index.simple_sds_serialize(out);
-  graph.simple_sds_serialize(out);
+  std::vector<std::function<void(std::ostream&)>> sections;
+  sections.push_back([&empty](std::ostream& out)
+  {
+    sdsl::simple_sds::serialize_value(empty.header, out);
+    empty.tags.simple_sds_serialize(out);
+  });
+  sections.push_back([&index](std::ostream& out) { index.simple_sds_serialize(out); });
+  for(auto& section : graph.simple_sds_sections()) { sections.push_back(std::move(section)); }
+  serialize_sections(out, sections, threads, GBZ::DIRECT_SECTIONS);
+}
+
+void
+GBZ::serialize_to(const std::string& filename, size_t threads) const
+{
+  std::ofstream out(filename, std::ios_base::binary);
+  if(!out)
+  {
+    throw std::runtime_error("GBZ::serialize_to(): Cannot open file " + filename + " for writing");
+  }
+  this->simple_sds_serialize(out, threads);
+  out.close();
+  if(out.fail())
+  {
+    throw std::runtime_error("GBZ::serialize_to(): Cannot write to file " + filename);
+  }
 }
 
 void
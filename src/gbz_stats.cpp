@@ -1,9 +1,15 @@
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <map>
+#include <random>
+#include <unordered_set>
 
 #include <getopt.h>
+#include <omp.h>
 #include <unistd.h>
 
 #include <gbwtgraph/gbz.h>
@@ -30,10 +36,80 @@ struct Config
   bool record_bytes = false;
   bool record_runs = false;
 
+  size_t threads = omp_get_max_threads();
+  size_t sample_size = 0; // Use all nodes / records.
+  size_t seed = 0xACDC;
+
   std::string filename;
 };
 
-void print_distribution(const std::map<size_t, size_t>& distribution, const std::string& header1, const std::string& header2);
+//------------------------------------------------------------------------------
+
+/*
+  The items the statistics are computed from: either all items in [0, population)
+  or a uniform random sample of them without replacement. With a sample, totals
+  and distributions are scaled to the population and reported with the
+  half-width of the approximate 95% confidence interval.
+*/
+struct Sample
+{
+  Sample(size_t population, const Config& config);
+
+  size_t population;
+  std::vector<size_t> items; // Empty if all items are used.
+
+  bool exact() const { return (this->items.empty()); }
+  size_t size() const { return (this->exact() ? this->population : this->items.size()); }
+  size_t operator[](size_t i) const { return (this->exact() ? i : this->items[i]); }
+
+  // Estimated population total and its error bound from the sample sum and
+  // the sum of squares.
+  std::pair<double, double> estimate(double sum, double sum_of_squares) const;
+};
+
+// Per-thread accumulators for a total, merged after the parallel loop.
+struct Total
+{
+  double sum = 0.0, sum_of_squares = 0.0;
+
+  void add(double value) { this->sum += value; this->sum_of_squares += value * value; }
+  void merge(const Total& another) { this->sum += another.sum; this->sum_of_squares += another.sum_of_squares; }
+};
+
+typedef std::map<size_t, size_t> distribution_type;
+
+// Calls `f(item, thread)` for each item in the sample in parallel.
+template<class Function>
+void
+for_each_item(const Sample& sample, const Function& f)
+{
+  constexpr size_t CHUNK_SIZE = 1024;
+  #pragma omp parallel for schedule(dynamic, CHUNK_SIZE)
+  for(size_t i = 0; i < sample.size(); i++)
+  {
+    f(sample[i], static_cast<size_t>(omp_get_thread_num()));
+  }
+}
+
+// Computes a distribution in parallel from the values `f(item)` in the sample.
+template<class Function>
+distribution_type
+parallel_distribution(const Sample& sample, const Function& f)
+{
+  std::vector<distribution_type> distributions(omp_get_max_threads());
+  for_each_item(sample, [&](size_t item, size_t thread)
+  {
+    distributions[thread][f(item)]++;
+  });
+  for(size_t thread = 1; thread < distributions.size(); thread++)
+  {
+    for(auto value : distributions[thread]) { distributions.front()[value.first] += value.second; }
+  }
+  return distributions.front();
+}
+
+void print_total(const Sample& sample, const std::string& header, const Total& total);
+void print_distribution(const Sample& sample, const distribution_type& distribution, const std::string& header1, const std::string& header2);
 
 //------------------------------------------------------------------------------
 
@@ -41,19 +117,59 @@ int
 main(int argc, char** argv)
 {
   Config config(argc, argv);
+  omp_set_num_threads(config.threads);
   GBZ gbz;
   sdsl::simple_sds::load_from(gbz, config.filename);
 
+  // Forward GBWT nodes and all GBWT nodes. Node ranks are offsets from the
+  // first node, and forward nodes have even offsets.
+  size_t node_range = gbz.index.sigma() - gbz.index.firstNode();
+  Sample nodes(node_range / 2, config), records(node_range, config);
+  if(!(nodes.exact()))
+  {
+    std::cerr << "Sampled " << nodes.size() << " of " << nodes.population << " nodes and " << records.size() << " of " << records.population << " records" << std::endl;
+  }
+  auto get_handle = [&](size_t item, handle_t& handle) -> bool
+  {
+    nid_t id = gbwt::Node::id(gbz.index.firstNode() + 2 * item);
+    if(!(gbz.graph.has_node(id))) { return false; }
+    handle = gbz.graph.get_handle(id, false);
+    return true;
+  };
+
   if(config.graph)
   {
-    std::cout << "Nodes\t" << gbz.graph.get_node_count() << std::endl;
-    std::cout << "Edges\t" << gbz.graph.get_edge_count() << std::endl;
-    size_t total_length = 0;
-    gbz.graph.for_each_handle([&](const handle_t& handle)
+    // We count each edge once at the node with the lower id. Self-loops are
+    // counted on the right side, except for reversing self-loops on the left.
+    std::vector<Total> lengths(omp_get_max_threads()), edges(omp_get_max_threads());
+    for_each_item(nodes, [&](size_t item, size_t thread)
     {
-      total_length += gbz.graph.get_length(handle);
+      handle_t handle;
+      size_t length = 0, edge_count = 0;
+      if(get_handle(item, handle))
+      {
+        nid_t id = gbz.graph.get_id(handle);
+        length = gbz.graph.get_length(handle);
+        gbz.graph.follow_edges(handle, false, [&](const handle_t& next)
+        {
+          if(id <= gbz.graph.get_id(next)) { edge_count++; }
+        });
+        gbz.graph.follow_edges(handle, true, [&](const handle_t& prev)
+        {
+          nid_t prev_id = gbz.graph.get_id(prev);
+          if(id < prev_id || (id == prev_id && gbz.graph.get_is_reverse(prev))) { edge_count++; }
+        });
+      }
+      lengths[thread].add(length); edges[thread].add(edge_count);
     });
-    std::cout << "Sequence\t" << total_length << std::endl;
+    for(size_t thread = 1; thread < lengths.size(); thread++)
+    {
+      lengths.front().merge(lengths[thread]); edges.front().merge(edges[thread]);
+    }
+
+    std::cout << "Nodes\t" << gbz.graph.get_node_count() << std::endl;
+    print_total(nodes, "Edges", edges.front());
+    print_total(nodes, "Sequence", lengths.front());
   }
 
   if(config.gbwt)
@@ -77,44 +193,46 @@ main(int argc, char** argv)
 
   if(config.node_degrees)
   {
-    std::map<size_t, size_t> distribution;
-    gbz.graph.for_each_handle([&](const handle_t& handle)
+    // Missing nodes are not included in the distribution, but they are part of
+    // the population for the estimates.
+    constexpr size_t NO_NODE = std::numeric_limits<size_t>::max();
+    distribution_type distribution = parallel_distribution(nodes, [&](size_t item) -> size_t
     {
-      size_t degree = gbz.graph.get_degree(handle, false) + gbz.graph.get_degree(handle, true);
-      distribution[degree]++;
+      handle_t handle;
+      if(!get_handle(item, handle)) { return NO_NODE; }
+      return gbz.graph.get_degree(handle, false) + gbz.graph.get_degree(handle, true);
     });
-    print_distribution(distribution, "Degree", "Nodes");
+    distribution.erase(NO_NODE);
+    print_distribution(nodes, distribution, "Degree", "Nodes");
   }
 
   if(config.node_visits)
   {
-    std::map<size_t, size_t> distribution;
-    for(gbwt::node_type node = gbz.index.firstNode(); node < gbz.index.sigma(); node += 2)
+    distribution_type distribution = parallel_distribution(nodes, [&](size_t item) -> size_t
     {
-      distribution[gbz.index.nodeSize(node)]++;
-    }
-    print_distribution(distribution, "Visits", "Nodes");
+      return gbz.index.nodeSize(gbz.index.firstNode() + 2 * item);
+    });
+    print_distribution(nodes, distribution, "Visits", "Nodes");
   }
 
   if(config.record_bytes)
   {
-    std::map<size_t, size_t> distribution;
-    for(gbwt::node_type node = gbz.index.firstNode(); node < gbz.index.sigma(); node++)
+    distribution_type distribution = parallel_distribution(records, [&](size_t item) -> size_t
     {
+      gbwt::node_type node = gbz.index.firstNode() + item;
       std::pair<gbwt::size_type, gbwt::size_type> range = gbz.index.bwt.getRange(gbz.index.toComp(node));
-      distribution[range.second - range.first]++;
-    }
-    print_distribution(distribution, "Bytes", "Records");
+      return range.second - range.first;
+    });
+    print_distribution(records, distribution, "Bytes", "Records");
   }
 
   if(config.record_runs)
   {
-    std::map<size_t, size_t> distribution;
-    for(gbwt::node_type node = gbz.index.firstNode(); node < gbz.index.sigma(); node++)
+    distribution_type distribution = parallel_distribution(records, [&](size_t item) -> size_t
     {
-      distribution[gbz.index.record(node).runs().first]++;
-    }
-    print_distribution(distribution, "Runs", "Records");
+      return gbz.index.record(gbz.index.firstNode() + item).runs().first;
+    });
+    print_distribution(records, distribution, "Runs", "Records");
   }
 
   return 0;
@@ -143,6 +261,12 @@ printUsage(int exit_code)
   std::cerr << "  -b, --record-bytes  Record size distribution" << std::endl;
   std::cerr << "  -r, --record-runs   Run count distribution" << std::endl;
   std::cerr << std::endl;
+  std::cerr << "Other options:" << std::endl;
+  std::cerr << "  -s, --sample N      Estimate node and record statistics from N random nodes" << std::endl;
+  std::cerr << "                      and N random records with 95% error bounds" << std::endl;
+  std::cerr << "      --seed N        Random seed for sampling" << std::endl;
+  std::cerr << "  -t, --threads N     Use N parallel threads (default: " << omp_get_max_threads() << ")" << std::endl;
+  std::cerr << std::endl;
 
   std::exit(exit_code);
 }
@@ -154,6 +278,8 @@ Config::Config(int argc, char** argv)
   if(argc < 2) { printUsage(EXIT_SUCCESS); }
 
   constexpr int OPT_NONREDUNDANT = 1000;
+  constexpr int OPT_SEED = 1001;
+  size_t max_threads = omp_get_max_threads();
 
   // Data for `getopt_long()`.
   int c = 0, option_index = 0;
@@ -167,11 +293,14 @@ Config::Config(int argc, char** argv)
     { "node-visits", no_argument, 0, 'v' },
     { "record-bytes", no_argument, 0, 'b' },
     { "record-runs", no_argument, 0, 'r' },
+    { "sample", required_argument, 0, 's' },
+    { "seed", required_argument, 0, OPT_SEED },
+    { "threads", required_argument, 0, 't' },
     { 0, 0, 0, 0 }
   };
 
   // Process options.
-  while((c = getopt_long(argc, argv, "giw:dvbr", long_options, &option_index)) != -1)
+  while((c = getopt_long(argc, argv, "giw:dvbrs:t:", long_options, &option_index)) != -1)
   {
     switch(c)
     {
@@ -207,6 +336,41 @@ Config::Config(int argc, char** argv)
       this->record_runs = true;
       break;
 
+    case 's':
+      try { this->sample_size = std::stoul(optarg); }
+      catch(std::exception& e)
+      {
+        std::cerr << "gbz_stats: Invalid sample size: " << optarg << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      if(this->sample_size == 0)
+      {
+        std::cerr << "gbz_stats: Sample size must be positive" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+    case OPT_SEED:
+      try { this->seed = std::stoul(optarg); }
+      catch(std::exception& e)
+      {
+        std::cerr << "gbz_stats: Invalid random seed: " << optarg << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+    case 't':
+      try { this->threads = std::stoul(optarg); }
+      catch(std::exception& e)
+      {
+        std::cerr << "gbz_stats: Invalid number of threads: " << optarg << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      if(this->threads == 0 || this->threads > max_threads)
+      {
+        std::cerr << "gbz_stats: Invalid number of threads: " << this->threads << " (must be from 1 to " << max_threads << ")" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+
     case '?':
       std::exit(EXIT_FAILURE);
     default:
@@ -221,13 +385,62 @@ Config::Config(int argc, char** argv)
 
 //------------------------------------------------------------------------------
 
+Sample::Sample(size_t population, const Config& config) :
+  population(population)
+{
+  if(config.sample_size == 0 || config.sample_size >= population) { return; }
+
+  // Floyd's algorithm for a sample without replacement. The items are sorted
+  // for better memory locality.
+  std::mt19937_64 rng(config.seed ^ population);
+  std::unordered_set<size_t> selected;
+  for(size_t i = population - config.sample_size; i < population; i++)
+  {
+    size_t item = std::uniform_int_distribution<size_t>(0, i)(rng);
+    if(!(selected.insert(item).second)) { selected.insert(i); }
+  }
+  this->items.assign(selected.begin(), selected.end());
+  std::sort(this->items.begin(), this->items.end());
+}
+
+std::pair<double, double>
+Sample::estimate(double sum, double sum_of_squares) const
+{
+  if(this->exact()) { return std::make_pair(sum, 0.0); }
+
+  // Normal approximation with the finite population correction.
+  constexpr double Z = 1.96;
+  double n = this->size(), N = this->population;
+  double mean = sum / n;
+  double variance = (n > 1 ? std::max(sum_of_squares - n * mean * mean, 0.0) / (n - 1) : 0.0);
+  double error = Z * N * std::sqrt(variance / n * (N - n) / (N - 1));
+  return std::make_pair(N * mean, error);
+}
+
+//------------------------------------------------------------------------------
+
+void
+print_total(const Sample& sample, const std::string& header, const Total& total)
+{
+  std::pair<double, double> estimate = sample.estimate(total.sum, total.sum_of_squares);
+  std::cout << header << "\t" << std::llround(estimate.first);
+  if(!(sample.exact())) { std::cout << "\t" << std::llround(estimate.second); }
+  std::cout << std::endl;
+}
+
 void
-print_distribution(const std::map<size_t, size_t>& distribution, const std::string& header1, const std::string& header2)
+print_distribution(const Sample& sample, const distribution_type& distribution, const std::string& header1, const std::string& header2)
 {
-  std::cout << header1 << "\t" << header2 << std::endl;
+  std::cout << header1 << "\t" << header2;
+  if(!(sample.exact())) { std::cout << "\tError"; }
+  std::cout << std::endl;
   for(auto iter = distribution.begin(); iter != distribution.end(); ++iter)
   {
-    std::cout << iter->first << "\t" << iter->second << std::endl;
+    // For an indicator variable, the sum of squares is the same as the sum.
+    std::pair<double, double> estimate = sample.estimate(iter->second, iter->second);
+    std::cout << iter->first << "\t" << std::llround(estimate.first);
+    if(!(sample.exact())) { std::cout << "\t" << std::llround(estimate.second); }
+    std::cout << std::endl;
   }
 }
 
@@ -4,15 +4,22 @@
 #include <gbwtgraph/internal.h>
 
 #include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <limits>
 #include <string>
 #include <utility>
 
 #include <fcntl.h>
+#include <omp.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 namespace gbwtgraph
 {
@@ -26,6 +33,8 @@ const std::string GFA_EXTENSION = ".gfa";
 // Class constants.
 
 constexpr size_t GFAParsingParameters::APPROXIMATE_NUM_JOBS;
+constexpr size_t GFAParsingParameters::CHUNK_SIZE;
+constexpr size_t GFAParsingParameters::STREAM_BLOCK_SIZE;
 const std::string GFAParsingParameters::DEFAULT_REGEX = ".*";
 const std::string GFAParsingParameters::DEFAULT_FIELDS = "C";
 const PathSense GFAParsingParameters::DEFAULT_SENSE = PathSense::GENERIC;
@@ -34,6 +43,7 @@ const std::string GFAParsingParameters::PAN_SN_FIELDS = "XSHC";
 const PathSense GFAParsingParameters::PAN_SN_SENSE = PathSense::HAPLOTYPE;
 
 constexpr size_t GFAExtractionParameters::LARGE_RECORD_BYTES;
+constexpr size_t GFAExtractionParameters::RECORD_CACHE_BYTES;
 
 //------------------------------------------------------------------------------
 
@@ -62,6 +72,9 @@ struct GFAFile
   size_t file_size;
   char*  ptr;
 
+  // Minimum size of a chunk for parallel validation.
+  size_t chunk_size;
+
   // GFA information.
   bool translate_segment_ids;
   size_t max_segment_length, max_path_length;
@@ -126,11 +139,36 @@ struct GFAFile
     view_type tag_value_view() const { return view_type(this->begin + 5, this->end - (this->begin + 5)); }
   };
 
+  // Line starts and statistics for a chunk of the file.
+  struct chunk_type
+  {
+    const char* h_line = nullptr;
+    size_t h_line_num = 0;
+    std::vector<const char*> h_tags;
+    std::vector<const char*> s_lines;
+    std::vector<const char*> l_lines;
+    std::vector<const char*> p_lines;
+    std::vector<const char*> w_lines;
+    bool translate_segment_ids = false;
+    size_t max_segment_length = 0, max_path_length = 0;
+  };
+
+  // Files are split into chunks of at least `chunk_size` bytes and up to
+  // `CHUNKS_PER_THREAD` chunks per thread at line boundaries.
+  constexpr static size_t CHUNKS_PER_THREAD = 4;
+
   // Memory map and validate a GFA file. The constructor checks that all mandatory
   // fields used for GBWTGraph construction exist and are nonempty.
   // There are no checks for duplicates.
+  // The file is validated in parallel using `omp_get_max_threads()` threads.
   // Throws `std::runtime_error` on failure.
-  GFAFile(const std::string& filename, bool show_progress);
+  GFAFile(const std::string& filename, bool show_progress, size_t chunk_size = GFAParsingParameters::CHUNK_SIZE);
+
+  // Validate a block of complete GFA lines in memory without taking ownership.
+  // The first line in the block is line `first_line` in the input. This is used
+  // for streaming input, where each block must remain valid while the object
+  // is in use.
+  GFAFile(const char* data, size_t size, size_t first_line, size_t chunk_size = GFAParsingParameters::CHUNK_SIZE);
 
   ~GFAFile();
 
@@ -140,30 +178,53 @@ struct GFAFile
   size_t links() const { return this->l_lines.size(); }
   size_t paths() const { return this->p_lines.size(); }
   size_t walks() const { return this->w_lines.size(); }
+  bool has_header() const { return (this->h_line != nullptr); }
+
+  // Returns the line starting at the given position, excluding the newline.
+  view_type line(const char* line_start) const
+  {
+    const char* limit = line_start;
+    while(limit != this->end() && *limit != '\n') { ++limit; }
+    return view_type(line_start, limit - line_start);
+  }
 
 private:
+  // Mark the field separators and preprocess and validate the lines.
+  void scan(size_t line_offset);
+
+  // Split the file into at most `max_chunks` chunks at line boundaries. Returns
+  // the chunk boundaries, starting with `begin()` and ending with `end()`.
+  std::vector<const char*> chunk_boundaries(size_t max_chunks) const;
+
+  // Preprocess and validate the lines in the given range, which must start at
+  // a line boundary. The first line in the range is line `line_num`.
+  void scan_chunk(const char* iter, const char* limit, size_t line_num, chunk_type& chunk) const;
+
+  // Merge the per-chunk results into this object in chunk order.
+  void merge_chunks(std::vector<chunk_type>& chunks);
+
   // Preprocess a new H-line. Returns an iterator at the start of the next line or
   // throws `std::runtime_error` if the parse failed.
-  const char* add_h_line(const char* iter, size_t line_num);
+  const char* add_h_line(const char* iter, size_t line_num, chunk_type& chunk) const;
   
   // Preprocess a new S-line. Returns an iterator at the start of the next line or
   // throws `std::runtime_error` if the parse failed.
-  const char* add_s_line(const char* iter, size_t line_num);
+  const char* add_s_line(const char* iter, size_t line_num, chunk_type& chunk) const;
 
   // Preprocess a new S-line. Returns an iterator at the start of the next line or
   // throws `std::runtime_error` if the parse failed.
-  const char* add_l_line(const char* iter, size_t line_num);
+  const char* add_l_line(const char* iter, size_t line_num, chunk_type& chunk) const;
 
   // Preprocess a new P-line. Returns an iterator at the start of the next line or
   // throws `std::runtime_error` if the parse failed.
-  const char* add_p_line(const char* iter, size_t line_num);
+  const char* add_p_line(const char* iter, size_t line_num, chunk_type& chunk) const;
 
   // Preprocess a new W-line. Returns an iterator at the start of the next line or
   // throws `std::runtime_error` if the parse failed.
-  const char* add_w_line(const char* iter, size_t line_num);
+  const char* add_w_line(const char* iter, size_t line_num, chunk_type& chunk) const;
 
   // Throws `std::runtime_error` if the field is invalid.
-  void check_field(const field_type& field, const std::string& field_name, bool should_have_next);
+  void check_field(const field_type& field, const std::string& field_name, bool should_have_next) const;
 
   const char* begin() const { return this->ptr; }
   const char* end() const { return this->ptr + this->size(); }
@@ -253,14 +314,20 @@ public:
   void for_each_header_tag(const std::function<void(const std::string& name, char type, view_type value)>& header_tag) const;
   
   /*
-    Iterate over the S-lines, calling segment() for all segments.
+    Iterate over the S-lines, calling segment() for all segments. If a semiopen
+    range of segment ranks is given, only the segments in that range are used.
+    Different ranges can be iterated over in parallel.
   */
-  void for_each_segment(const std::function<void(const std::string& name, view_type sequence)>& segment) const;
+  void for_each_segment(const std::function<void(const std::string& name, view_type sequence)>& segment,
+                        size_t first = 0, size_t last = std::numeric_limits<size_t>::max()) const;
 
   /*
-    Iterate over the L-lines, calling link() for all segments.
+    Iterate over the L-lines, calling link() for all segments. If a semiopen
+    range of link ranks is given, only the links in that range are used.
+    Different ranges can be iterated over in parallel.
   */
- void for_each_link(const std::function<void(const std::string& from, bool from_is_reverse, const std::string& to, bool to_is_reverse)>& link) const;
+ void for_each_link(const std::function<void(const std::string& from, bool from_is_reverse, const std::string& to, bool to_is_reverse)>& link,
+                    size_t first = 0, size_t last = std::numeric_limits<size_t>::max()) const;
 
   /*
     Iterate over the file, calling path_start() for each path.
@@ -306,8 +373,8 @@ public:
 
 //------------------------------------------------------------------------------
 
-GFAFile::GFAFile(const std::string& filename, bool show_progress) :
-  fd(-1), file_size(0), ptr(nullptr),
+GFAFile::GFAFile(const std::string& filename, bool show_progress, size_t chunk_size) :
+  fd(-1), file_size(0), ptr(nullptr), chunk_size(std::max(chunk_size, size_t(1))),
   translate_segment_ids(false),
   max_segment_length(0), max_path_length(0),
   h_line(nullptr)
@@ -340,6 +407,32 @@ GFAFile::GFAFile(const std::string& filename, bool show_progress) :
   ::madvise(temp_ptr, file_size, MADV_SEQUENTIAL); // We will be making sequential passes over the data.
   this->ptr = static_cast<char*>(temp_ptr);
 
+  double start = gbwt::readTimer();
+  if(show_progress)
+  {
+    std::cerr << "Validating GFA file " << filename << std::endl;
+  }
+  this->scan(0);
+
+  if(show_progress)
+  {
+    double seconds = gbwt::readTimer() - start;
+    std::cerr << "Found " << this->segments() << " segments, " << this->links() << " links, " << this->paths() << " paths, and " << this->walks() << " walks in " << seconds << " seconds" << std::endl;
+  }
+}
+
+GFAFile::GFAFile(const char* data, size_t size, size_t first_line, size_t chunk_size) :
+  fd(-1), file_size(size), ptr(const_cast<char*>(data)), chunk_size(std::max(chunk_size, size_t(1))),
+  translate_segment_ids(false),
+  max_segment_length(0), max_path_length(0),
+  h_line(nullptr)
+{
+  this->scan(first_line);
+}
+
+void
+GFAFile::scan(size_t line_offset)
+{
   // Mark characters indicating field/subfield end. This could depend on the GFA version.
   // TODO: If that happens, we need variables for field/subfield separators.
   this->field_end[0] = 0; this->field_end[1] = 0;
@@ -353,72 +446,148 @@ GFAFile::GFAFile(const std::string& filename, bool show_progress) :
   this->add_walk_subfield_end('\n'); this->add_walk_subfield_end('\t');
   this->add_walk_subfield_end('<'); this->add_walk_subfield_end('>');
 
-  // Preprocess and validate the file.
-  double start = gbwt::readTimer();
-  if(show_progress)
+  // Preprocess and validate the file. Large files are split into chunks that
+  // are scanned in parallel.
+  size_t threads = omp_get_max_threads();
+  std::vector<const char*> boundaries = this->chunk_boundaries(threads * CHUNKS_PER_THREAD);
+  std::vector<chunk_type> chunks(boundaries.size() - 1);
+
+  // Determine the line number at the start of each chunk.
+  std::vector<size_t> first_line(chunks.size() + 1, 0);
+  first_line[0] = line_offset;
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_t i = 0; i < chunks.size(); i++)
   {
-    std::cerr << "Validating GFA file " << filename << std::endl;
+    first_line[i + 1] = std::count(boundaries[i], boundaries[i + 1], '\n');
+  }
+  for(size_t i = 1; i < first_line.size(); i++) { first_line[i] += first_line[i - 1]; }
+
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_t i = 0; i < chunks.size(); i++)
+  {
+    this->scan_chunk(boundaries[i], boundaries[i + 1], first_line[i], chunks[i]);
+  }
+  this->merge_chunks(chunks);
+}
+
+GFAFile::~GFAFile()
+{
+  // Only memory mapped files have a file descriptor.
+  if(this->fd >= 0 && this->ptr != nullptr)
+  {
+    ::munmap(static_cast<void*>(this->ptr), this->file_size);
+    this->file_size = 0;
+    this->ptr = nullptr;
+  }
+  if(this->fd >= 0)
+  {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+}
+
+std::vector<const char*>
+GFAFile::chunk_boundaries(size_t max_chunks) const
+{
+  size_t chunks = std::max(std::min(max_chunks, this->size() / this->chunk_size), size_t(1));
+  std::vector<const char*> result;
+  result.reserve(chunks + 1);
+  result.push_back(this->begin());
+  for(size_t i = 1; i < chunks; i++)
+  {
+    const char* iter = std::max(this->begin() + i * (this->size() / chunks), result.back());
+    if(iter != this->begin() && iter[-1] != '\n') { iter = this->next_line(iter); }
+    if(iter != result.back()) { result.push_back(iter); }
   }
-  const char* iter = this->begin();
-  size_t line_num = 0;
-  while(iter != this->end())
+  if(result.size() == 1 || result.back() != this->end()) { result.push_back(this->end()); }
+  return result;
+}
+
+void
+GFAFile::scan_chunk(const char* iter, const char* limit, size_t line_num, chunk_type& chunk) const
+{
+  while(iter != limit)
   {
     switch(*iter)
     {
     case 'H':
-      iter = this->add_h_line(iter, line_num);
+      iter = this->add_h_line(iter, line_num, chunk);
       break;
     case 'S':
-      iter = this->add_s_line(iter, line_num);
+      iter = this->add_s_line(iter, line_num, chunk);
       break;
     case 'L':
-      iter = this->add_l_line(iter, line_num);
+      iter = this->add_l_line(iter, line_num, chunk);
       break;
     case 'P':
-      iter = this->add_p_line(iter, line_num);
+      iter = this->add_p_line(iter, line_num, chunk);
       break;
     case 'W':
-      iter = this->add_w_line(iter, line_num);
+      iter = this->add_w_line(iter, line_num, chunk);
       break;
     default:
       iter = this->next_line(iter);
       break;
     }
-    if(iter == nullptr) { return; }
     line_num++;
   }
+}
 
-  if(show_progress)
+void
+GFAFile::merge_chunks(std::vector<chunk_type>& chunks)
+{
+  size_t s_total = 0, l_total = 0, p_total = 0, w_total = 0;
+  for(chunk_type& chunk : chunks)
   {
-    double seconds = gbwt::readTimer() - start;
-    std::cerr << "Found " << this->segments() << " segments, " << this->links() << " links, " << this->paths() << " paths, and " << this->walks() << " walks in " << seconds << " seconds" << std::endl;
+    if(chunk.h_line != nullptr)
+    {
+      if(this->h_line != nullptr)
+      {
+        // We can have only one H line in a file.
+        ABSL_LOG(FATAL) << "GFAFile: duplicate header at line " + std::to_string(chunk.h_line_num);
+      }
+      this->h_line = chunk.h_line;
+      this->h_tags.swap(chunk.h_tags);
+    }
+    s_total += chunk.s_lines.size(); l_total += chunk.l_lines.size();
+    p_total += chunk.p_lines.size(); w_total += chunk.w_lines.size();
+    this->translate_segment_ids |= chunk.translate_segment_ids;
+    this->max_segment_length = std::max(this->max_segment_length, chunk.max_segment_length);
+    this->max_path_length = std::max(this->max_path_length, chunk.max_path_length);
   }
-}
 
-GFAFile::~GFAFile()
-{
-  if(this->ptr != nullptr)
+  // With a single chunk, we can avoid copying the line starts.
+  if(chunks.size() == 1)
   {
-    ::munmap(static_cast<void*>(this->ptr), this->file_size);
-    this->file_size = 0;
-    this->ptr = nullptr;
+    this->s_lines.swap(chunks.front().s_lines); this->l_lines.swap(chunks.front().l_lines);
+    this->p_lines.swap(chunks.front().p_lines); this->w_lines.swap(chunks.front().w_lines);
+    return;
   }
-  if(this->fd >= 0)
+
+  this->s_lines.reserve(s_total); this->l_lines.reserve(l_total);
+  this->p_lines.reserve(p_total); this->w_lines.reserve(w_total);
+  for(chunk_type& chunk : chunks)
   {
-    ::close(this->fd);
-    this->fd = -1;
+    this->s_lines.insert(this->s_lines.end(), chunk.s_lines.begin(), chunk.s_lines.end());
+    this->l_lines.insert(this->l_lines.end(), chunk.l_lines.begin(), chunk.l_lines.end());
+    this->p_lines.insert(this->p_lines.end(), chunk.p_lines.begin(), chunk.p_lines.end());
+    this->w_lines.insert(this->w_lines.end(), chunk.w_lines.begin(), chunk.w_lines.end());
+    chunk = chunk_type();
   }
 }
 
+//------------------------------------------------------------------------------
+
 const char*
-GFAFile::add_h_line(const char* iter, size_t line_num)
+GFAFile::add_h_line(const char* iter, size_t line_num, chunk_type& chunk) const
 {
-  if(this->h_line != nullptr)
+  if(chunk.h_line != nullptr)
   {
     // We can have only one H line in a file.
     ABSL_LOG(FATAL) << "GFAFile: duplicate header at line " + std::to_string(line_num); 
   }
-  this->h_line = iter;
+  chunk.h_line = iter;
+  chunk.h_line_num = line_num;
   
   // Skip the record type field.
   field_type field = this->first_field(iter, line_num);
@@ -433,16 +602,16 @@ GFAFile::add_h_line(const char* iter, size_t line_num)
       ABSL_LOG(FATAL) << "GFAFile: Invalid header tag " + field.str() + " on line " + std::to_string(line_num);
     }
     // Save them all.
-    h_tags.push_back(field.begin);
+    chunk.h_tags.push_back(field.begin);
   }
   
   return this->next_line(field.end);
 }
 
 const char*
-GFAFile::add_s_line(const char* iter, size_t line_num)
+GFAFile::add_s_line(const char* iter, size_t line_num, chunk_type& chunk) const
 {
-  this->s_lines.push_back(iter);
+  chunk.s_lines.push_back(iter);
 
   // Skip the record type field.
   field_type field = this->first_field(iter, line_num);
@@ -452,28 +621,28 @@ GFAFile::add_s_line(const char* iter, size_t line_num)
   field = this->next_field(field);
   this->check_field(field, "segment name", true);
   std::string name = field.str();
-  if(!(this->translate_segment_ids))
+  if(!(chunk.translate_segment_ids))
   {
     try
     {
       nid_t id = std::stoul(name);
-      if (id == 0) { this->translate_segment_ids = true; }
+      if (id == 0) { chunk.translate_segment_ids = true; }
     }
-    catch(const std::invalid_argument&) { this->translate_segment_ids = true; }
+    catch(const std::invalid_argument&) { chunk.translate_segment_ids = true; }
   }
 
   // Sequence field.
   field = this->next_field(field);
   this->check_field(field, "sequence", false);
-  this->max_segment_length = std::max(this->max_segment_length, field.size());
+  chunk.max_segment_length = std::max(chunk.max_segment_length, field.size());
 
   return this->next_line(field.end);
 }
 
 const char*
-GFAFile::add_l_line(const char* iter, size_t line_num)
+GFAFile::add_l_line(const char* iter, size_t line_num, chunk_type& chunk) const
 {
-  this->l_lines.push_back(iter);
+  chunk.l_lines.push_back(iter);
 
   // Skip the record type field.
   field_type field = this->first_field(iter, line_num);
@@ -507,9 +676,9 @@ GFAFile::add_l_line(const char* iter, size_t line_num)
 }
 
 const char*
-GFAFile::add_p_line(const char* iter, size_t line_num)
+GFAFile::add_p_line(const char* iter, size_t line_num, chunk_type& chunk) const
 {
-  this->p_lines.push_back(iter);
+  chunk.p_lines.push_back(iter);
 
   // Skip the record type field.
   field_type field = this->first_field(iter, line_num);
@@ -535,15 +704,15 @@ GFAFile::add_p_line(const char* iter, size_t line_num)
   {
     ABSL_LOG(FATAL) << "GFAFile: The path on line " + std::to_string(line_num) + " is empty";
   }
-  this->max_path_length = std::max(this->max_path_length, path_length);
+  chunk.max_path_length = std::max(chunk.max_path_length, path_length);
 
   return this->next_line(field.end);
 }
 
 const char*
-GFAFile::add_w_line(const char* iter, size_t line_num)
+GFAFile::add_w_line(const char* iter, size_t line_num, chunk_type& chunk) const
 {
-  this->w_lines.push_back(iter);
+  chunk.w_lines.push_back(iter);
 
   // Skip the record type field.
   field_type field = this->first_field(iter, line_num);
@@ -586,13 +755,13 @@ GFAFile::add_w_line(const char* iter, size_t line_num)
   {
     ABSL_LOG(FATAL) << "GFAFile: The walk on line " + std::to_string(line_num) + " is empty";
   }
-  this->max_path_length = std::max(this->max_path_length, path_length);
+  chunk.max_path_length = std::max(chunk.max_path_length, path_length);
 
   return this->next_line(field.end);
 }
 
 void
-GFAFile::check_field(const field_type& field, const std::string& field_name, bool should_have_next)
+GFAFile::check_field(const field_type& field, const std::string& field_name, bool should_have_next) const
 {
   if(field.empty())
   {
@@ -620,10 +789,13 @@ GFAFile::for_each_header_tag(const std::function<void(const std::string& name, c
 }
 
 void
-GFAFile::for_each_segment(const std::function<void(const std::string& name, view_type sequence)>& segment) const
+GFAFile::for_each_segment(const std::function<void(const std::string& name, view_type sequence)>& segment,
+                          size_t first, size_t last) const
 {
-  for(const char* iter : this->s_lines)
+  last = std::min(last, this->s_lines.size());
+  for(size_t i = first; i < last; i++)
   {
+    const char* iter = this->s_lines[i];
     // Skip the record type field.
     field_type field = this->first_field(iter);
 
@@ -639,10 +811,13 @@ GFAFile::for_each_segment(const std::function<void(const std::string& name, view
 }
 
 void
-GFAFile::for_each_link(const std::function<void(const std::string& from, bool from_is_reverse, const std::string& to, bool to_is_reverse)>& link) const
+GFAFile::for_each_link(const std::function<void(const std::string& from, bool from_is_reverse, const std::string& to, bool to_is_reverse)>& link,
+                       size_t first, size_t last) const
 {
-  for(const char* iter : this->l_lines)
+  last = std::min(last, this->l_lines.size());
+  for(size_t i = first; i < last; i++)
   {
+    const char* iter = this->l_lines[i];
     // Skip the record type field.
     field_type field = this->first_field(iter);
 
@@ -831,35 +1006,304 @@ GFAFile::for_these_walks(const std::vector<const char*>& selected_walks,
 
 //------------------------------------------------------------------------------
 
+/*
+  A sequential reader for GFA input that is not memory mapped. The input can be
+  a regular file, standard input (`-`), a pipe, or a file compressed with gzip or
+  zstd. Compressed input is decompressed by a child process (multithreaded
+  `pigz` if available, `gzip` otherwise, or `zstd`) in parallel with parsing.
+  For standard input, the compression type is determined from the first bytes,
+  which are then passed to the child process before the rest of the input.
+  The input is returned in blocks of complete lines.
+*/
+class GFAStream
+{
+public:
+  enum compression_type { uncompressed, gzip, zstd };
+
+  // Opens the input. Uses up to `threads` threads for decompression.
+  GFAStream(const std::string& filename, size_t threads, size_t block_size);
+  ~GFAStream();
+
+  GFAStream(const GFAStream&) = delete;
+  GFAStream& operator=(const GFAStream&) = delete;
+
+  // Reads the next block of complete lines into the buffer. The block is longer
+  // than the block size only if it ends with a long line. Returns false at the
+  // end of the input.
+  bool next_block(std::vector<char>& block);
+
+  size_t bytes() const { return this->bytes_read; }
+
+  // Returns true if the input is a regular file.
+  static bool is_regular_file(const std::string& filename);
+
+  // Determines the compression type of a regular file from its magic number.
+  static compression_type compression(const std::string& filename);
+
+  // Determines the compression type from the first bytes of the input.
+  static compression_type compression(const unsigned char* magic, size_t n);
+
+  const static std::string STDIN_NAME; // "-"
+
+private:
+  std::string filename;
+  FILE*       file;
+  bool        is_pipe, eof;
+  size_t      block_size, bytes_read;
+  std::vector<char> carry;
+
+  // Starts decompressing the input with a shell command.
+  void open_pipe(const std::string& command);
+
+  // Appends at most `n` bytes to the block.
+  void read(std::vector<char>& block, size_t n);
+
+  // Closes the input and checks the exit status of the decompressor.
+  void close();
+};
+
+const std::string GFAStream::STDIN_NAME = "-";
+
+// Quote the string for the shell.
+std::string
+shell_quote(const std::string& str)
+{
+  std::string result = "'";
+  for(char c : str)
+  {
+    if(c == '\'') { result += "'\\''"; }
+    else { result.push_back(c); }
+  }
+  result.push_back('\'');
+  return result;
+}
+
+// Returns a shell command that decompresses the file, or standard input if the
+// file name is empty.
+std::string
+decompression_command(GFAStream::compression_type type, const std::string& filename, size_t threads)
+{
+  std::string input = (filename.empty() ? std::string() : " -- " + shell_quote(filename));
+  if(type == GFAStream::gzip)
+  {
+    return "if command -v pigz >/dev/null 2>&1; then exec pigz -dc -p " + std::to_string(std::max(threads, size_t(1))) + input + "; "
+           "else exec gzip -dc" + input + "; fi";
+  }
+  return "exec zstd -dcq" + input;
+}
+
+GFAStream::GFAStream(const std::string& filename, size_t threads, size_t block_size) :
+  filename(filename), file(nullptr), is_pipe(false), eof(false),
+  block_size(std::max(block_size, size_t(1))), bytes_read(0)
+{
+  if(filename == STDIN_NAME)
+  {
+    // Read the magic number directly from the file descriptor, before stdio
+    // buffers any input.
+    unsigned char magic[4] = { 0, 0, 0, 0 };
+    size_t n = 0;
+    while(n < sizeof(magic))
+    {
+      ssize_t found = ::read(STDIN_FILENO, magic + n, sizeof(magic) - n);
+      if(found < 0 && errno == EINTR) { continue; }
+      if(found < 0)
+      {
+        ABSL_LOG(FATAL) << "GFAStream: Error reading " + filename;
+      }
+      if(found == 0) { break; }
+      n += found;
+    }
+    compression_type type = compression(magic, n);
+    if(type == uncompressed)
+    {
+      this->file = stdin;
+      this->carry.assign(magic, magic + n);
+      return;
+    }
+
+    // The decompressor inherits standard input, and the bytes we have read
+    // are passed to it first.
+    std::string prefix = "printf '";
+    for(size_t i = 0; i < n; i++)
+    {
+      char octal[5];
+      std::snprintf(octal, sizeof(octal), "\\%03o", static_cast<unsigned>(magic[i]));
+      prefix += octal;
+    }
+    prefix += "'";
+    this->open_pipe("{ " + prefix + "; exec cat; } | " + decompression_command(type, std::string(), threads));
+    return;
+  }
+
+  compression_type type = compression(filename);
+  if(type == uncompressed)
+  {
+    this->file = std::fopen(filename.c_str(), "rb");
+    if(this->file == nullptr)
+    {
+      ABSL_LOG(FATAL) << "GFAStream: Cannot open file " + filename;
+    }
+    return;
+  }
+  this->open_pipe(decompression_command(type, filename, threads));
+}
+
+void
+GFAStream::open_pipe(const std::string& command)
+{
+  this->file = ::popen(command.c_str(), "r");
+  if(this->file == nullptr)
+  {
+    ABSL_LOG(FATAL) << "GFAStream: Cannot start decompressing " + this->filename;
+  }
+  this->is_pipe = true;
+}
+
+GFAStream::~GFAStream()
+{
+  // We may stop reading before the end, so the exit status no longer matters.
+  if(this->file != nullptr && this->file != stdin)
+  {
+    if(this->is_pipe) { ::pclose(this->file); }
+    else { std::fclose(this->file); }
+  }
+  this->file = nullptr;
+}
+
+bool
+GFAStream::is_regular_file(const std::string& filename)
+{
+  if(filename == STDIN_NAME) { return false; }
+  struct stat st;
+  return (::stat(filename.c_str(), &st) == 0 && S_ISREG(st.st_mode));
+}
+
+GFAStream::compression_type
+GFAStream::compression(const std::string& filename)
+{
+  if(!is_regular_file(filename)) { return uncompressed; }
+  unsigned char magic[4] = { 0, 0, 0, 0 };
+  FILE* temp = std::fopen(filename.c_str(), "rb");
+  if(temp == nullptr) { return uncompressed; }
+  size_t n = std::fread(magic, 1, sizeof(magic), temp);
+  std::fclose(temp);
+  return compression(magic, n);
+}
+
+GFAStream::compression_type
+GFAStream::compression(const unsigned char* magic, size_t n)
+{
+  if(n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) { return gzip; }
+  if(n >= 4 && magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD) { return zstd; }
+  return uncompressed;
+}
+
+void
+GFAStream::read(std::vector<char>& block, size_t n)
+{
+  size_t old_size = block.size();
+  block.resize(old_size + n);
+  size_t found = std::fread(block.data() + old_size, 1, n, this->file);
+  block.resize(old_size + found);
+  if(found < n)
+  {
+    if(std::ferror(this->file))
+    {
+      ABSL_LOG(FATAL) << "GFAStream: Error reading " + this->filename;
+    }
+    this->close();
+  }
+}
+
+void
+GFAStream::close()
+{
+  this->eof = true;
+  if(this->file == nullptr || this->file == stdin) { return; }
+  if(this->is_pipe)
+  {
+    int status = ::pclose(this->file);
+    this->file = nullptr;
+    if(status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+      ABSL_LOG(FATAL) << "GFAStream: Decompression failed for " + this->filename;
+    }
+  }
+  else
+  {
+    std::fclose(this->file);
+    this->file = nullptr;
+  }
+}
+
+bool
+GFAStream::next_block(std::vector<char>& block)
+{
+  block.swap(this->carry);
+  this->carry.clear();
+  if(!(this->eof) && block.size() < this->block_size)
+  {
+    this->read(block, this->block_size - block.size());
+  }
+
+  // Move the partial line at the end to the next block. If there is no line
+  // break, keep reading until we find one.
+  size_t scanned = 0;
+  while(!(this->eof))
+  {
+    size_t i = block.size();
+    while(i > scanned && block[i - 1] != '\n') { i--; }
+    if(i > scanned)
+    {
+      this->carry.assign(block.begin() + i, block.end());
+      block.resize(i);
+      break;
+    }
+    scanned = block.size();
+    this->read(block, this->block_size);
+  }
+
+  this->bytes_read += block.size();
+  return !(block.empty());
+}
+
+//------------------------------------------------------------------------------
+
 void
-check_gfa_file(const GFAFile& gfa_file, const GFAParsingParameters& parameters)
+check_gfa_file(size_t segments, size_t paths, size_t walks, const GFAParsingParameters& parameters)
 {
-  if(gfa_file.segments() == 0)
+  if(segments == 0)
   {
     ABSL_LOG(FATAL) << "No segments in the GFA file";
   }
-  if(gfa_file.paths() > 0)
+  if(paths > 0)
   {
     if(parameters.show_progress)
     {
       std::cerr << "Storing generic named paths as sample " << REFERENCE_PATH_SAMPLE_NAME << std::endl;
     }
   }
-  if(gfa_file.paths() == 0 && gfa_file.walks() == 0)
+  if(paths == 0 && walks == 0)
   {
     ABSL_LOG(FATAL) << "No paths or walks in the GFA file";
   }
 }
 
+void
+check_gfa_file(const GFAFile& gfa_file, const GFAParsingParameters& parameters)
+{
+  check_gfa_file(gfa_file.segments(), gfa_file.paths(), gfa_file.walks(), parameters);
+}
+
 gbwt::size_type
-determine_batch_size(const GFAFile& gfa_file, const GFAParsingParameters& parameters)
+determine_batch_size(size_t max_path_length, size_t input_size, const GFAParsingParameters& parameters)
 {
   gbwt::size_type batch_size = parameters.batch_size;
   if(parameters.automatic_batch_size)
   {
-    gbwt::size_type min_size = gbwt::DynamicGBWT::MIN_SEQUENCES_PER_BATCH * (gfa_file.max_path_length + 1);
+    gbwt::size_type min_size = gbwt::DynamicGBWT::MIN_SEQUENCES_PER_BATCH * (max_path_length + 1);
     batch_size = std::max(min_size, batch_size);
-    batch_size = std::min(static_cast<gbwt::size_type>(gfa_file.size()), batch_size);
+    batch_size = std::min(static_cast<gbwt::size_type>(input_size), batch_size);
   }
   if(parameters.show_progress)
   {
@@ -868,6 +1312,12 @@ determine_batch_size(const GFAFile& gfa_file, const GFAParsingParameters& parame
   return batch_size;
 }
 
+gbwt::size_type
+determine_batch_size(const GFAFile& gfa_file, const GFAParsingParameters& parameters)
+{
+  return determine_batch_size(gfa_file.max_path_length, gfa_file.size(), parameters);
+}
+
 struct ConstructionJob
 {
   size_t num_nodes;
@@ -884,6 +1334,11 @@ struct ConstructionJob
 
 //------------------------------------------------------------------------------
 
+// Segments and links are parsed in batches of this many lines, and each batch
+// is split into blocks of this many lines for parallel processing.
+constexpr size_t GFA_PARSING_BATCH_SIZE = 1048576;
+constexpr size_t GFA_PARSING_BLOCK_SIZE = 1024;
+
 std::pair<std::unique_ptr<SequenceSource>, std::unique_ptr<EmptyGraph>>
 parse_segments(const GFAFile& gfa_file, const GFAParsingParameters& parameters)
 {
@@ -913,24 +1368,76 @@ parse_segments(const GFAFile& gfa_file, const GFAParsingParameters& parameters)
     }
   }
 
+  // Segments are processed in batches. We first parse the segments in parallel,
+  // then assign nodes and sequence offsets sequentially, and finally copy the
+  // sequences in parallel.
   std::pair<std::unique_ptr<SequenceSource>, std::unique_ptr<EmptyGraph>> result(new SequenceSource(), new EmptyGraph());
-  gfa_file.for_each_segment([&](const std::string& name, view_type sequence)
-  {
-    if(translate)
+  SequenceSource& source = *(result.first);
+  EmptyGraph& graph = *(result.second);
+  source.nodes.reserve(gfa_file.segments());
+  graph.nodes.reserve(gfa_file.segments());
+  if(translate) { source.segment_translation.reserve(gfa_file.segments()); }
+  std::vector<std::string> names;
+  std::vector<nid_t> ids;
+  std::vector<view_type> sequences;
+  std::vector<std::pair<size_t, size_t>> copies; // (batch offset, sequence offset)
+  for(size_t batch_start = 0; batch_start < gfa_file.segments(); batch_start += GFA_PARSING_BATCH_SIZE)
+  {
+    size_t batch_size = std::min(gfa_file.segments() - batch_start, GFA_PARSING_BATCH_SIZE);
+    if(translate) { names.resize(batch_size); }
+    else { ids.resize(batch_size); }
+    sequences.resize(batch_size);
+    size_t blocks = (batch_size + GFA_PARSING_BLOCK_SIZE - 1) / GFA_PARSING_BLOCK_SIZE;
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_t block = 0; block < blocks; block++)
     {
-      std::pair<nid_t, nid_t> translation = result.first->translate_segment(name, sequence, max_node_length);
-      for(nid_t id = translation.first; id < translation.second; id++)
+      size_t i = block * GFA_PARSING_BLOCK_SIZE;
+      gfa_file.for_each_segment([&](const std::string& name, view_type sequence)
+      {
+        if(translate) { names[i] = name; }
+        else { ids[i] = stoul_unsafe(name); }
+        sequences[i] = sequence;
+        i++;
+      }, batch_start + i, batch_start + std::min(i + GFA_PARSING_BLOCK_SIZE, batch_size));
+    }
+
+    // This mirrors `SequenceSource::translate_segment()` and `SequenceSource::add_node()`.
+    copies.clear();
+    size_t offset = source.sequences.size();
+    for(size_t i = 0; i < batch_size; i++)
+    {
+      size_t length = sequences[i].second;
+      if(translate)
+      {
+        if(length == 0 || source.segment_translation.find(names[i]) != source.segment_translation.end()) { continue; }
+        std::pair<nid_t, nid_t> translation(source.next_id, source.next_id + (length + max_node_length - 1) / max_node_length);
+        for(nid_t id = translation.first; id < translation.second; id++)
+        {
+          size_t node_offset = (id - translation.first) * max_node_length;
+          source.nodes[id] = std::pair<size_t, size_t>(offset + node_offset, std::min(max_node_length, length - node_offset));
+          graph.create_node(id);
+        }
+        source.segment_translation[names[i]] = translation;
+        source.next_id = translation.second;
+      }
+      else
       {
-        result.second->create_node(id);
+        graph.create_node(ids[i]);
+        if(length == 0 || source.nodes.find(ids[i]) != source.nodes.end()) { continue; }
+        source.nodes[ids[i]] = std::pair<size_t, size_t>(offset, length);
       }
+      copies.emplace_back(i, offset);
+      offset += length;
     }
-    else
+
+    source.sequences.resize(offset);
+    #pragma omp parallel for schedule(dynamic, GFA_PARSING_BLOCK_SIZE)
+    for(size_t i = 0; i < copies.size(); i++)
     {
-      nid_t id = stoul_unsafe(name);
-      result.first->add_node(id, sequence);
-      result.second->create_node(id);
+      view_type sequence = sequences[copies[i].first];
+      std::copy(sequence.first, sequence.first + sequence.second, source.sequences.data() + copies[i].second);
     }
-  });
+  }
 
   if(parameters.show_progress)
   {
@@ -940,6 +1447,27 @@ parse_segments(const GFAFile& gfa_file, const GFAParsingParameters& parameters)
   return result;
 }
 
+// Adds edges inside segments if necessary and removes duplicate edges if the
+// GFA graph had them. Returns the number of new edges inside segments.
+size_t
+add_segment_edges(const SequenceSource& source, EmptyGraph& graph)
+{
+  size_t edge_count = 0;
+  if(source.uses_translation())
+  {
+    for(auto iter = source.segment_translation.begin(); iter != source.segment_translation.end(); ++iter)
+    {
+      for(nid_t id = iter->second.first; id + 1 < iter->second.second; id++)
+      {
+        graph.create_edge(graph.get_handle(id, false), graph.get_handle(id + 1, false));
+        edge_count++;
+      }
+    }
+  }
+  graph.remove_duplicate_edges();
+  return edge_count;
+}
+
 void
 parse_links(const GFAFile& gfa_file, const SequenceSource& source, EmptyGraph& graph, const GFAParsingParameters& parameters)
 {
@@ -949,40 +1477,45 @@ parse_links(const GFAFile& gfa_file, const SequenceSource& source, EmptyGraph& g
     std::cerr << "Parsing links" << std::endl;
   }
 
+  // Links are processed in batches. We first parse the links and translate the
+  // segment names in parallel and then create the edges sequentially.
   size_t edge_count = 0;
-  gfa_file.for_each_link([&](const std::string& from, bool from_is_reverse, const std::string& to, bool to_is_reverse)
-  {
-    std::pair<nid_t, nid_t> from_nodes = source.force_translate(from);
-    if(from_nodes == SequenceSource::invalid_translation())
+  std::vector<std::pair<handle_t, handle_t>> edges;
+  for(size_t batch_start = 0; batch_start < gfa_file.links(); batch_start += GFA_PARSING_BATCH_SIZE)
+  {
+    size_t batch_size = std::min(gfa_file.links() - batch_start, GFA_PARSING_BATCH_SIZE);
+    edges.resize(batch_size);
+    size_t blocks = (batch_size + GFA_PARSING_BLOCK_SIZE - 1) / GFA_PARSING_BLOCK_SIZE;
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_t block = 0; block < blocks; block++)
     {
-      ABSL_LOG(FATAL) << "Invalid source segment " + from;
-    }
-    std::pair<nid_t, nid_t> to_nodes = source.force_translate(to);
-    if(to_nodes == SequenceSource::invalid_translation())
-    {
-      ABSL_LOG(FATAL) << "Invalid destination segment " + to;
+      size_t i = block * GFA_PARSING_BLOCK_SIZE;
+      gfa_file.for_each_link([&](const std::string& from, bool from_is_reverse, const std::string& to, bool to_is_reverse)
+      {
+        std::pair<nid_t, nid_t> from_nodes = source.force_translate(from);
+        if(from_nodes == SequenceSource::invalid_translation())
+        {
+          ABSL_LOG(FATAL) << "Invalid source segment " + from;
+        }
+        std::pair<nid_t, nid_t> to_nodes = source.force_translate(to);
+        if(to_nodes == SequenceSource::invalid_translation())
+        {
+          ABSL_LOG(FATAL) << "Invalid destination segment " + to;
+        }
+        nid_t from_node = (from_is_reverse ? from_nodes.first : from_nodes.second - 1);
+        nid_t to_node = (to_is_reverse ? to_nodes.second - 1 : to_nodes.first);
+        edges[i] = std::make_pair(graph.get_handle(from_node, from_is_reverse), graph.get_handle(to_node, to_is_reverse));
+        i++;
+      }, batch_start + i, batch_start + std::min(i + GFA_PARSING_BLOCK_SIZE, batch_size));
     }
-    nid_t from_node = (from_is_reverse ? from_nodes.first : from_nodes.second - 1);
-    nid_t to_node = (to_is_reverse ? to_nodes.second - 1 : to_nodes.first);
-    graph.create_edge(graph.get_handle(from_node, from_is_reverse), graph.get_handle(to_node, to_is_reverse));
-    edge_count++;
-  });
-
-  // Add edges inside segments if necessary.
-  if(source.uses_translation())
-  {
-    for(auto iter = source.segment_translation.begin(); iter != source.segment_translation.end(); ++iter)
+    for(const std::pair<handle_t, handle_t>& edge : edges)
     {
-      for(nid_t id = iter->second.first; id + 1 < iter->second.second; id++)
-      {
-        graph.create_edge(graph.get_handle(id, false), graph.get_handle(id + 1, false));
-        edge_count++;
-      }
+      graph.create_edge(edge.first, edge.second);
     }
+    edge_count += edges.size();
   }
 
-  // Get rid of duplicate edges if the GFA graph had them.
-  graph.remove_duplicate_edges();
+  edge_count += add_segment_edges(source, graph);
 
   if(parameters.show_progress)
   {
@@ -1065,8 +1598,33 @@ parse_metadata(const GFAFile& gfa_file, const std::vector<ConstructionJob>& jobs
   return result;
 }
 
-std::unique_ptr<gbwt::GBWT>
-parse_paths(const GFAFile& gfa_file, const std::vector<ConstructionJob>& jobs, const SequenceSource& source, const GFAParsingParameters& parameters, gbwt::size_type node_width, gbwt::size_type batch_size)
+// Appends the nodes corresponding to the oriented segment to the path.
+void
+append_segment(const SequenceSource& source, const std::string& name, bool is_reverse, gbwt::vector_type& current_path)
+{
+  std::pair<nid_t, nid_t> range = source.force_translate(name);
+  if(range == SequenceSource::invalid_translation())
+  {
+    ABSL_LOG(FATAL) << "Invalid segment " + name;
+  }
+  if(is_reverse)
+  {
+    for(nid_t id = range.second; id > range.first; id--)
+    {
+      current_path.push_back(gbwt::Node::encode(id - 1, is_reverse));
+    }
+  }
+  else
+  {
+    for(nid_t id = range.first; id < range.second; id++)
+    {
+      current_path.push_back(gbwt::Node::encode(id, is_reverse));
+    }
+  }
+}
+
+std::unique_ptr<gbwt::GBWT>
+parse_paths(const GFAFile& gfa_file, const std::vector<ConstructionJob>& jobs, const SequenceSource& source, const GFAParsingParameters& parameters, gbwt::size_type node_width, gbwt::size_type batch_size)
 {
   double start = gbwt::readTimer();
   if(parameters.show_progress)
@@ -1076,50 +1634,33 @@ parse_paths(const GFAFile& gfa_file, const std::vector<ConstructionJob>& jobs, c
 
   // Prepare for GBWT construction.
   gbwt::Verbosity::set(gbwt::Verbosity::SILENT);
-  size_t parallel_jobs = size_t(1); //std::max(parameters.parallel_jobs, size_t(1));
-  //omp_set_num_threads(parallel_jobs);
+  // At most parallel_jobs dynamic GBWTs are in memory at the same time. The
+  // finished partial indexes are compressed until they are merged.
+  size_t parallel_jobs = std::max(parameters.parallel_jobs, size_t(1));
+  omp_set_num_threads(parallel_jobs);
   std::vector<gbwt::GBWT> partial_indexes(jobs.size());
   std::vector<gbwt::vector_type> current_paths(parallel_jobs);
 
   auto add_segment = [&](const std::string& name, bool is_reverse)
   {
-    std::pair<nid_t, nid_t> range = source.force_translate(name);
-    if(range == SequenceSource::invalid_translation())
-    {
-      ABSL_LOG(FATAL) << "Invalid segment " + name;
-    }
-    size_t thread_id = 0;//omp_get_thread_num();
-    gbwt::vector_type& current_path = current_paths[thread_id];
-    if(is_reverse)
-    {
-      for(nid_t id = range.second; id > range.first; id--)
-      {
-        current_path.push_back(gbwt::Node::encode(id - 1, is_reverse));
-      }
-    }
-    else
-    {
-      for(nid_t id = range.first; id < range.second; id++)
-      {
-        current_path.push_back(gbwt::Node::encode(id, is_reverse));
-      }
-    }
+    size_t thread_id = omp_get_thread_num();
+    append_segment(source, name, is_reverse, current_paths[thread_id]);
   };
 
   // Build the partial indexes in parallel.
-  //#pragma omp parallel for schedule(dynamic, 1)
+  #pragma omp parallel for schedule(dynamic, 1)
   for(size_t i = 0; i < jobs.size(); i++)
   {
     double job_start = gbwt::readTimer();
     if(parameters.show_progress)
     {
-      //#pragma omp critical
+      #pragma omp critical
       {
         std::cerr << "Starting job " << i << " (" << jobs[i].num_nodes << " nodes, " << jobs[i].p_lines.size() << " paths, " << jobs[i].w_lines.size() << " walks)" << std::endl;
       }
     }
     gbwt::GBWTBuilder builder(node_width, batch_size, parameters.sample_interval);
-    size_t thread_num = 0;//omp_get_thread_num();
+    size_t thread_num = omp_get_thread_num();
     try
     {
       gfa_file.for_these_paths(jobs[i].p_lines, [&](const std::string&) {}, add_segment, [&]()
@@ -1135,7 +1676,10 @@ parse_paths(const GFAFile& gfa_file, const std::vector<ConstructionJob>& jobs, c
     }
     catch(const std::runtime_error& e)
     {
-      std::cerr << "Error: " << "" << std::endl;
+      #pragma omp critical
+      {
+        std::cerr << "Error: " << e.what() << std::endl;
+      }
       std::exit(EXIT_FAILURE);
     }
     builder.finish();
@@ -1143,10 +1687,16 @@ parse_paths(const GFAFile& gfa_file, const std::vector<ConstructionJob>& jobs, c
     partial_indexes[jobs[i].id] = gbwt::GBWT(builder.index);
     // Deleting a dynamic GBWT is a bit expensive, so we do it manually to include it in the measured time.
     builder.index = gbwt::DynamicGBWT();
+    if(parameters.metrics != nullptr)
+    {
+      // CPU time is not meaningful for a single job, as it includes all threads.
+      parameters.metrics->add_phase("gfa_to_gbwt/job", gbwt::readTimer() - job_start, 0.0);
+      parameters.metrics->add_to_histogram("gfa_to_gbwt/job_nodes", jobs[i].num_nodes);
+    }
     if(parameters.show_progress)
     {
       double seconds = gbwt::readTimer() - job_start;
-      //#pragma omp critical
+      #pragma omp critical
       {
         std::cerr << "Finished job " << i << " in " << seconds << " seconds" << std::endl;
       }
@@ -1158,7 +1708,9 @@ parse_paths(const GFAFile& gfa_file, const std::vector<ConstructionJob>& jobs, c
   {
     std::cerr << "Merging partial indexes" << std::endl;
   }
+  Metrics::Timer merge_timer(parameters.metrics, "gfa_to_gbwt/merge");
   std::unique_ptr<gbwt::GBWT> result(new gbwt::GBWT(partial_indexes));
+  merge_timer.stop();
   if(parameters.show_progress)
   {
     double seconds = gbwt::readTimer() - start;
@@ -1233,6 +1785,770 @@ determine_jobs(const GFAFile& gfa_file, const SequenceSource& source, std::uniqu
 
 //------------------------------------------------------------------------------
 
+/*
+  Segment names in a compact form for streaming construction. Canonical
+  positive integers are stored as their values. Other names are stored as
+  offsets to a buffer of null-terminated strings with the high bit set.
+*/
+struct SegmentNames
+{
+  constexpr static std::uint64_t STRING_FLAG = std::uint64_t(1) << 63;
+  constexpr static size_t MAX_NUMBER_LENGTH = 18;
+
+  std::vector<char> buffer;
+
+  std::uint64_t encode(const std::string& name)
+  {
+    bool number = (!(name.empty()) && name.length() <= MAX_NUMBER_LENGTH && name.front() != '0');
+    for(size_t i = 0; number && i < name.length(); i++) { number = (name[i] >= '0' && name[i] <= '9'); }
+    if(number) { return stoul_unsafe(name); }
+    std::uint64_t result = this->buffer.size() | STRING_FLAG;
+    this->buffer.insert(this->buffer.end(), name.begin(), name.end());
+    this->buffer.push_back('\0');
+    return result;
+  }
+
+  static bool is_number(std::uint64_t code) { return !(code & STRING_FLAG); }
+
+  std::string decode(std::uint64_t code) const
+  {
+    if(is_number(code)) { return std::to_string(code); }
+    return std::string(this->buffer.data() + (code & ~STRING_FLAG));
+  }
+
+  // Equivalent to `source.force_translate(this->decode(code))`.
+  std::pair<nid_t, nid_t> translate(const SequenceSource& source, std::uint64_t code) const
+  {
+    if(is_number(code) && !(source.uses_translation())) { return std::pair<nid_t, nid_t>(code, code + 1); }
+    return source.force_translate(this->decode(code));
+  }
+};
+
+constexpr std::uint64_t SegmentNames::STRING_FLAG;
+constexpr size_t SegmentNames::MAX_NUMBER_LENGTH;
+
+/*
+  The information collected in the first pass over streaming GFA input.
+*/
+struct StreamedGFA
+{
+  struct link_type
+  {
+    std::uint64_t from, to;
+    bool from_is_reverse, to_is_reverse;
+  };
+
+  // A P-line or a W-line. The name is an index to `path_names` or `walk_names`,
+  // and the length is in segments.
+  struct path_type
+  {
+    std::uint64_t first_segment;
+    size_t name, length;
+    bool is_walk;
+  };
+
+  // Statistics.
+  size_t bytes = 0, lines = 0, blocks = 0;
+  size_t walks = 0;
+  bool translate_segment_ids = false;
+  size_t max_segment_length = 0, max_path_length = 0;
+  bool has_header = false;
+  std::unordered_map<std::string, std::string> header_tags;
+
+  // Segments as (offset, length) in `sequences`.
+  SegmentNames names;
+  std::vector<std::uint64_t> segment_names;
+  std::vector<std::pair<size_t, size_t>> segment_sequences;
+  std::vector<char> sequences;
+
+  std::vector<link_type> links;
+
+  // P-lines and W-lines in file order.
+  std::vector<path_type> path_lines;
+  std::vector<std::string> path_names;
+  std::vector<std::array<std::string, 4>> walk_names;
+
+  // Spooled P-lines and W-lines for input that cannot be read again.
+  std::string spool_name;
+
+  size_t segments() const { return this->segment_names.size(); }
+  size_t paths() const { return this->path_lines.size() - this->walks; }
+};
+
+// Returns the P-lines and W-lines in the block in file order as (line start, is walk).
+std::vector<std::pair<const char*, bool>>
+path_lines_in_order(const GFAFile& block)
+{
+  std::vector<std::pair<const char*, bool>> result;
+  result.reserve(block.paths() + block.walks());
+  size_t p = 0, w = 0;
+  while(p < block.paths() || w < block.walks())
+  {
+    if(w >= block.walks() || (p < block.paths() && block.p_lines[p] < block.w_lines[w]))
+    {
+      result.emplace_back(block.p_lines[p], false); p++;
+    }
+    else
+    {
+      result.emplace_back(block.w_lines[w], true); w++;
+    }
+  }
+  return result;
+}
+
+std::unordered_map<std::string, std::string> parse_header_tags(const GFAFile& gfa_file, const GFAParsingParameters& parameters);
+
+// The first pass: validate the input and collect everything except the paths.
+void
+scan_gfa_stream(const std::string& filename, StreamedGFA& gfa, const GFAParsingParameters& parameters)
+{
+  double start = gbwt::readTimer();
+  if(parameters.show_progress)
+  {
+    std::cerr << "Validating GFA stream " << filename << std::endl;
+  }
+
+  GFAStream stream(filename, omp_get_max_threads(), parameters.stream_block_size);
+  std::ofstream spool;
+  if(!GFAStream::is_regular_file(filename))
+  {
+    gfa.spool_name = gbwt::TempFile::getName("gfa-paths");
+    spool.open(gfa.spool_name, std::ios_base::binary);
+    if(!spool)
+    {
+      ABSL_LOG(FATAL) << "Cannot open temporary file " + gfa.spool_name;
+    }
+    if(parameters.show_progress)
+    {
+      std::cerr << "Spooling P-lines and W-lines to " << gfa.spool_name << std::endl;
+    }
+  }
+
+  std::vector<char> buffer;
+  while(stream.next_block(buffer))
+  {
+    GFAFile block(buffer.data(), buffer.size(), gfa.lines, parameters.chunk_size);
+    gfa.lines += std::count(buffer.begin(), buffer.end(), '\n');
+    gfa.blocks++;
+
+    if(block.has_header())
+    {
+      if(gfa.has_header)
+      {
+        ABSL_LOG(FATAL) << "GFAStream: duplicate header in " + filename;
+      }
+      gfa.has_header = true;
+      gfa.header_tags = parse_header_tags(block, parameters);
+    }
+    gfa.translate_segment_ids |= block.translate_segment_ids;
+    gfa.max_segment_length = std::max(gfa.max_segment_length, block.max_segment_length);
+    gfa.max_path_length = std::max(gfa.max_path_length, block.max_path_length);
+
+    block.for_each_segment([&](const std::string& name, view_type sequence)
+    {
+      gfa.segment_names.push_back(gfa.names.encode(name));
+      gfa.segment_sequences.emplace_back(gfa.sequences.size(), sequence.second);
+      gfa.sequences.insert(gfa.sequences.end(), sequence.first, sequence.first + sequence.second);
+    });
+    block.for_each_link([&](const std::string& from, bool from_is_reverse, const std::string& to, bool to_is_reverse)
+    {
+      gfa.links.push_back({ gfa.names.encode(from), gfa.names.encode(to), from_is_reverse, to_is_reverse });
+    });
+
+    std::vector<const char*> line(1);
+    for(std::pair<const char*, bool> path_line : path_lines_in_order(block))
+    {
+      line[0] = path_line.first;
+      StreamedGFA::path_type path { 0, 0, 0, path_line.second };
+      auto path_segment = [&](const std::string& name, bool)
+      {
+        if(path.length == 0) { path.first_segment = gfa.names.encode(name); }
+        path.length++;
+      };
+      if(path_line.second)
+      {
+        path.name = gfa.walk_names.size();
+        block.for_these_walks(line, [&](const std::string& sample, const std::string& haplotype, const std::string& contig, const std::string& start)
+        {
+          gfa.walk_names.push_back({ sample, haplotype, contig, start });
+        }, path_segment, []() {});
+        gfa.walks++;
+      }
+      else
+      {
+        path.name = gfa.path_names.size();
+        block.for_these_paths(line, [&](const std::string& name)
+        {
+          gfa.path_names.push_back(name);
+        }, path_segment, []() {});
+      }
+      gfa.path_lines.push_back(path);
+      if(spool.is_open())
+      {
+        view_type text = block.line(path_line.first);
+        spool.write(text.first, text.second);
+        spool.put('\n');
+      }
+    }
+  }
+  gfa.bytes = stream.bytes();
+  if(spool.is_open())
+  {
+    spool.close();
+    if(!spool)
+    {
+      ABSL_LOG(FATAL) << "Cannot write temporary file " + gfa.spool_name;
+    }
+  }
+
+  if(parameters.show_progress)
+  {
+    double seconds = gbwt::readTimer() - start;
+    std::cerr << "Found " << gfa.segments() << " segments, " << gfa.links.size() << " links, " << gfa.paths() << " paths, and " << gfa.walks << " walks in " << seconds << " seconds" << std::endl;
+  }
+}
+
+// This mirrors `parse_segments()`, but the sequences are already in a buffer
+// that becomes the sequence buffer of the source.
+std::pair<std::unique_ptr<SequenceSource>, std::unique_ptr<EmptyGraph>>
+parse_streamed_segments(StreamedGFA& gfa, const GFAParsingParameters& parameters)
+{
+  double start = gbwt::readTimer();
+  if(parameters.show_progress)
+  {
+    std::cerr << "Parsing segments" << std::endl;
+  }
+
+  // Determine if we need translation.
+  bool translate = false;
+  size_t max_node_length = (parameters.max_node_length == 0 ? std::numeric_limits<size_t>::max() : parameters.max_node_length);
+  if(gfa.max_segment_length > max_node_length)
+  {
+    translate = true;
+    if(parameters.show_progress)
+    {
+      std::cerr << "Breaking segments into " << max_node_length << " bp nodes" << std::endl;
+    }
+  }
+  else if(gfa.translate_segment_ids)
+  {
+    translate = true;
+    if(parameters.show_progress)
+    {
+      std::cerr << "Translating segment ids into valid node ids" << std::endl;
+    }
+  }
+
+  std::pair<std::unique_ptr<SequenceSource>, std::unique_ptr<EmptyGraph>> result(new SequenceSource(), new EmptyGraph());
+  SequenceSource& source = *(result.first);
+  EmptyGraph& graph = *(result.second);
+  source.nodes.reserve(gfa.segments());
+  graph.nodes.reserve(gfa.segments());
+  if(translate) { source.segment_translation.reserve(gfa.segments()); }
+
+  // Sequences of duplicate segments are dropped by moving the remaining
+  // sequences towards the start of the buffer.
+  size_t offset = 0;
+  for(size_t i = 0; i < gfa.segments(); i++)
+  {
+    size_t sequence_offset = gfa.segment_sequences[i].first;
+    size_t length = gfa.segment_sequences[i].second;
+    if(translate)
+    {
+      std::string name = gfa.names.decode(gfa.segment_names[i]);
+      if(length == 0 || source.segment_translation.find(name) != source.segment_translation.end()) { continue; }
+      std::pair<nid_t, nid_t> translation(source.next_id, source.next_id + (length + max_node_length - 1) / max_node_length);
+      for(nid_t id = translation.first; id < translation.second; id++)
+      {
+        size_t node_offset = (id - translation.first) * max_node_length;
+        source.nodes[id] = std::pair<size_t, size_t>(offset + node_offset, std::min(max_node_length, length - node_offset));
+        graph.create_node(id);
+      }
+      source.segment_translation[name] = translation;
+      source.next_id = translation.second;
+    }
+    else
+    {
+      std::uint64_t code = gfa.segment_names[i];
+      nid_t id = (SegmentNames::is_number(code) ? code : stoul_unsafe(gfa.names.decode(code)));
+      graph.create_node(id);
+      if(length == 0 || source.nodes.find(id) != source.nodes.end()) { continue; }
+      source.nodes[id] = std::pair<size_t, size_t>(offset, length);
+    }
+    if(offset != sequence_offset)
+    {
+      std::memmove(gfa.sequences.data() + offset, gfa.sequences.data() + sequence_offset, length);
+    }
+    offset += length;
+  }
+  gfa.sequences.resize(offset);
+  source.sequences.swap(gfa.sequences);
+  gfa.segment_sequences = std::vector<std::pair<size_t, size_t>>();
+  gfa.segment_names = std::vector<std::uint64_t>();
+
+  if(parameters.show_progress)
+  {
+    double seconds = gbwt::readTimer() - start;
+    std::cerr << "Parsed " << result.first->get_node_count() << " nodes in " << seconds << " seconds" << std::endl;
+  }
+  return result;
+}
+
+void
+parse_streamed_links(StreamedGFA& gfa, const SequenceSource& source, EmptyGraph& graph, const GFAParsingParameters& parameters)
+{
+  double start = gbwt::readTimer();
+  if(parameters.show_progress)
+  {
+    std::cerr << "Parsing links" << std::endl;
+  }
+
+  size_t edge_count = 0;
+  std::vector<std::pair<handle_t, handle_t>> edges;
+  for(size_t batch_start = 0; batch_start < gfa.links.size(); batch_start += GFA_PARSING_BATCH_SIZE)
+  {
+    size_t batch_size = std::min(gfa.links.size() - batch_start, GFA_PARSING_BATCH_SIZE);
+    edges.resize(batch_size);
+    #pragma omp parallel for schedule(dynamic, GFA_PARSING_BLOCK_SIZE)
+    for(size_t i = 0; i < batch_size; i++)
+    {
+      const StreamedGFA::link_type& link = gfa.links[batch_start + i];
+      std::pair<nid_t, nid_t> from_nodes = gfa.names.translate(source, link.from);
+      if(from_nodes == SequenceSource::invalid_translation())
+      {
+        ABSL_LOG(FATAL) << "Invalid source segment " + gfa.names.decode(link.from);
+      }
+      std::pair<nid_t, nid_t> to_nodes = gfa.names.translate(source, link.to);
+      if(to_nodes == SequenceSource::invalid_translation())
+      {
+        ABSL_LOG(FATAL) << "Invalid destination segment " + gfa.names.decode(link.to);
+      }
+      nid_t from_node = (link.from_is_reverse ? from_nodes.first : from_nodes.second - 1);
+      nid_t to_node = (link.to_is_reverse ? to_nodes.second - 1 : to_nodes.first);
+      edges[i] = std::make_pair(graph.get_handle(from_node, link.from_is_reverse), graph.get_handle(to_node, link.to_is_reverse));
+    }
+    for(const std::pair<handle_t, handle_t>& edge : edges)
+    {
+      graph.create_edge(edge.first, edge.second);
+    }
+    edge_count += edges.size();
+  }
+  gfa.links = std::vector<StreamedGFA::link_type>();
+  edge_count += add_segment_edges(source, graph);
+
+  if(parameters.show_progress)
+  {
+    double seconds = gbwt::readTimer() - start;
+    std::cerr << "Parsed " << edge_count << " edges in " << seconds << " seconds" << std::endl;
+  }
+}
+
+struct StreamedJob
+{
+  size_t num_nodes;
+
+  // Number of P-lines and W-lines and the last one of them in file order.
+  size_t paths, walks;
+  size_t last_line;
+};
+
+// Graph will be cleared, as we do not need graph topology after this.
+// Returns the jobs and the job for each P/W-line.
+std::pair<std::vector<StreamedJob>, std::vector<size_t>>
+determine_streamed_jobs(const StreamedGFA& gfa, const SequenceSource& source, std::unique_ptr<EmptyGraph>& graph, const GFAParsingParameters& parameters)
+{
+  double start = gbwt::readTimer();
+  if(parameters.show_progress)
+  {
+    std::cerr << "Creating jobs" << std::endl;
+  }
+
+  // Determine the jobs.
+  size_t target_size = graph->get_node_count() / std::max(size_t(1), parameters.approximate_num_jobs);
+  ConstructionJobs jobs = gbwt_construction_jobs(*graph, target_size);
+  std::pair<std::vector<StreamedJob>, std::vector<size_t>> result;
+  for(size_t i = 0; i < jobs.size(); i++)
+  {
+    result.first.push_back({ jobs.job_size(i), 0, 0, 0 });
+  }
+
+  // Assign P-lines and W-lines to jobs.
+  result.second.reserve(gfa.path_lines.size());
+  for(size_t i = 0; i < gfa.path_lines.size(); i++)
+  {
+    const StreamedGFA::path_type& path = gfa.path_lines[i];
+    nid_t node_id = gfa.names.translate(source, path.first_segment).first; // 0 on failure.
+    size_t job_id = jobs.job(node_id);
+    if(job_id >= jobs.size())
+    {
+      ABSL_LOG(FATAL) << "Invalid " + std::string(path.is_walk ? "walk" : "path") + " segment " + gfa.names.decode(path.first_segment);
+    }
+    StreamedJob& job = result.first[job_id];
+    if(path.is_walk) { job.walks++; }
+    else { job.paths++; }
+    job.last_line = i;
+    result.second.push_back(job_id);
+  }
+
+  // Delete temporary structures before reporting time, as some structures are a bit complex.
+  size_t num_components = jobs.components();
+  jobs.clear(); graph.reset();
+  if(parameters.show_progress)
+  {
+    double seconds = gbwt::readTimer() - start;
+    std::cerr << "Created " << result.first.size() << " jobs for " << num_components << " components in " << seconds << " seconds" << std::endl;
+  }
+  return result;
+}
+
+gbwt::Metadata
+parse_streamed_metadata(const StreamedGFA& gfa, const std::vector<size_t>& line_jobs, MetadataBuilder& metadata, const GFAParsingParameters& parameters)
+{
+  double start = gbwt::readTimer();
+  if(parameters.show_progress)
+  {
+    std::cerr << "Parsing metadata" << std::endl;
+  }
+
+  // The paths in each job are inserted in file order.
+  for(size_t i = 0; i < gfa.path_lines.size(); i++)
+  {
+    const StreamedGFA::path_type& path = gfa.path_lines[i];
+    if(path.is_walk)
+    {
+      const std::array<std::string, 4>& name = gfa.walk_names[path.name];
+      metadata.add_walk(name[0], name[1], name[2], name[3], line_jobs[i]);
+    }
+    else
+    {
+      metadata.add_path(gfa.path_names[path.name], line_jobs[i]);
+    }
+  }
+
+  gbwt::Metadata result = metadata.get_metadata();
+  if(parameters.show_progress)
+  {
+    double seconds = gbwt::readTimer() - start;
+    std::cerr << "Metadata: "; gbwt::operator<<(std::cerr, result) << std::endl;
+    std::cerr << "Parsed metadata in " << seconds << " seconds" << std::endl;
+  }
+  return result;
+}
+
+// Encoded paths of a job in the second pass of streaming construction.
+struct StreamedJobState
+{
+  // Paths are buffered in memory until the buffer reaches the spill limit.
+  // Then they are appended to a temporary file.
+  std::vector<gbwt::vector_type> pending;
+  gbwt::size_type pending_nodes = 0;
+
+  std::string spill_name;
+  gbwt::size_type spilled_nodes = 0;
+
+  bool finished = false;
+  double start = 0.0;
+};
+
+/*
+  The second pass: encode the paths and build the partial index of each job.
+
+  Each job buffers its encoded paths until the buffer reaches `batch_size /
+  jobs.size()` nodes. Then the buffer is appended to a temporary file for the
+  job. Once the last path of a job has been encoded, the job reads its paths
+  from the file and the buffer and builds its partial index in a single pass.
+  Jobs are hence built only once, regardless of how their paths are interleaved
+  in the file.
+
+  The buffers use at most `batch_size` nodes in total, plus one path per job.
+  Building a job uses a buffer of at most `batch_size` nodes and a dynamic GBWT
+  for the job, and up to `parallel_jobs` jobs can be built at the same time.
+*/
+std::unique_ptr<gbwt::GBWT>
+parse_streamed_paths(const std::string& filename, const StreamedGFA& gfa,
+                     const std::vector<StreamedJob>& jobs, const std::vector<size_t>& line_jobs,
+                     const SequenceSource& source, const GFAParsingParameters& parameters,
+                     gbwt::size_type node_width, gbwt::size_type batch_size)
+{
+  double start = gbwt::readTimer();
+  if(parameters.show_progress)
+  {
+    std::cerr << "Indexing paths/walks" << std::endl;
+  }
+
+  gbwt::Verbosity::set(gbwt::Verbosity::SILENT);
+  omp_set_num_threads(std::max(parameters.parallel_jobs, size_t(1)));
+  batch_size = std::max(batch_size, gbwt::size_type(1));
+  gbwt::size_type spill_limit = std::max(batch_size / std::max(jobs.size(), size_t(1)), gbwt::size_type(1));
+  std::vector<StreamedJobState> states(jobs.size());
+  std::vector<gbwt::GBWT> partial_indexes(jobs.size());
+  size_t spilled_jobs = 0, spilled_nodes = 0;
+
+  auto spill = [&](StreamedJobState& state)
+  {
+    if(state.spill_name.empty())
+    {
+      #pragma omp critical (temp_file)
+      {
+        state.spill_name = gbwt::TempFile::getName("gfa-job");
+      }
+    }
+    std::ofstream out(state.spill_name, std::ios_base::binary | std::ios_base::app);
+    for(const gbwt::vector_type& path : state.pending)
+    {
+      std::uint64_t length = path.size();
+      out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+      out.write(reinterpret_cast<const char*>(path.data()), path.size() * sizeof(gbwt::node_type));
+    }
+    if(!out)
+    {
+      ABSL_LOG(FATAL) << "Cannot write paths to temporary file " + state.spill_name;
+    }
+    state.spilled_nodes += state.pending_nodes;
+    state.pending = std::vector<gbwt::vector_type>();
+    state.pending_nodes = 0;
+  };
+  auto add_path = [&](StreamedJobState& state, gbwt::vector_type& path)
+  {
+    state.pending_nodes += 2 * (path.size() + 1);
+    state.pending.emplace_back(std::move(path));
+    path = gbwt::vector_type();
+    if(state.pending_nodes >= spill_limit) { spill(state); }
+  };
+  auto finish_job = [&](size_t job_id)
+  {
+    StreamedJobState& state = states[job_id];
+    if(state.start == 0.0) { state.start = gbwt::readTimer(); }
+    gbwt::size_type total_nodes = state.spilled_nodes + state.pending_nodes;
+    gbwt::GBWTBuilder builder(node_width, std::max(std::min(batch_size, total_nodes), gbwt::size_type(1)), parameters.sample_interval);
+    if(!(state.spill_name.empty()))
+    {
+      #pragma omp critical (spill_stats)
+      {
+        spilled_jobs++; spilled_nodes += state.spilled_nodes;
+      }
+      std::ifstream in(state.spill_name, std::ios_base::binary);
+      std::uint64_t length = 0;
+      gbwt::vector_type path;
+      while(in.read(reinterpret_cast<char*>(&length), sizeof(length)))
+      {
+        path.resize(length);
+        if(!in.read(reinterpret_cast<char*>(path.data()), path.size() * sizeof(gbwt::node_type)))
+        {
+          ABSL_LOG(FATAL) << "Cannot read paths from temporary file " + state.spill_name;
+        }
+        builder.insert(path, true);
+      }
+      in.close();
+      gbwt::TempFile::remove(state.spill_name);
+    }
+    for(gbwt::vector_type& path : state.pending) { builder.insert(path, true); }
+    state.pending = std::vector<gbwt::vector_type>();
+    state.pending_nodes = 0;
+    builder.finish();
+    partial_indexes[job_id] = gbwt::GBWT(builder.index);
+    state.finished = true;
+    if(parameters.metrics != nullptr)
+    {
+      parameters.metrics->add_phase("gfa_to_gbwt/job", gbwt::readTimer() - state.start, 0.0);
+      parameters.metrics->add_to_histogram("gfa_to_gbwt/job_nodes", jobs[job_id].num_nodes);
+    }
+    if(parameters.show_progress)
+    {
+      double seconds = gbwt::readTimer() - state.start;
+      #pragma omp critical
+      {
+        std::cerr << "Finished job " << job_id << " (" << jobs[job_id].num_nodes << " nodes, " << jobs[job_id].paths << " paths, " << jobs[job_id].walks << " walks) in " << seconds << " seconds" << std::endl;
+      }
+    }
+  };
+
+  // Spooled lines have already been validated, so their line numbers do not matter.
+  const std::string& input = (gfa.spool_name.empty() ? filename : gfa.spool_name);
+  GFAStream stream(input, omp_get_max_threads(), parameters.stream_block_size);
+  std::vector<char> buffer;
+  size_t line_num = 0, path_rank = 0;
+  std::vector<std::pair<size_t, std::vector<std::pair<const char*, bool>>>> tasks;
+  std::unordered_map<size_t, size_t> task_for_job;
+  while(stream.next_block(buffer))
+  {
+    GFAFile block(buffer.data(), buffer.size(), line_num, parameters.chunk_size);
+    line_num += std::count(buffer.begin(), buffer.end(), '\n');
+
+    // Group the lines in the block by job, preserving their order.
+    tasks.clear(); task_for_job.clear();
+    std::vector<std::pair<const char*, bool>> lines = path_lines_in_order(block);
+    if(path_rank + lines.size() > line_jobs.size())
+    {
+      ABSL_LOG(FATAL) << "GFAStream: " + input + " changed between passes";
+    }
+    size_t first_rank = path_rank;
+    for(std::pair<const char*, bool> line : lines)
+    {
+      size_t job_id = line_jobs[path_rank];
+      auto iter = task_for_job.find(job_id);
+      if(iter == task_for_job.end())
+      {
+        iter = task_for_job.emplace(job_id, tasks.size()).first;
+        tasks.emplace_back(job_id, std::vector<std::pair<const char*, bool>>());
+      }
+      tasks[iter->second].second.push_back(line);
+      path_rank++;
+    }
+    size_t last_rank = path_rank;
+
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_t i = 0; i < tasks.size(); i++)
+    {
+      size_t job_id = tasks[i].first;
+      StreamedJobState& state = states[job_id];
+      if(state.start == 0.0) { state.start = gbwt::readTimer(); }
+      gbwt::vector_type current_path;
+      auto add_segment = [&](const std::string& name, bool is_reverse)
+      {
+        append_segment(source, name, is_reverse, current_path);
+      };
+      auto insert_path = [&]()
+      {
+        add_path(state, current_path);
+        current_path.clear();
+      };
+      std::vector<const char*> line(1);
+      try
+      {
+        for(std::pair<const char*, bool> path_line : tasks[i].second)
+        {
+          line[0] = path_line.first;
+          if(path_line.second)
+          {
+            block.for_these_walks(line, [&](const std::string&, const std::string&, const std::string&, const std::string&) {}, add_segment, insert_path);
+          }
+          else
+          {
+            block.for_these_paths(line, [&](const std::string&) {}, add_segment, insert_path);
+          }
+        }
+      }
+      catch(const std::runtime_error& e)
+      {
+        #pragma omp critical
+        {
+          std::cerr << "Error: " << e.what() << std::endl;
+        }
+        std::exit(EXIT_FAILURE);
+      }
+      if(jobs[job_id].last_line >= first_rank && jobs[job_id].last_line < last_rank) { finish_job(job_id); }
+    }
+  }
+  if(path_rank != line_jobs.size())
+  {
+    ABSL_LOG(FATAL) << "GFAStream: " + input + " changed between passes";
+  }
+  if(!(gfa.spool_name.empty()))
+  {
+    std::string spool_name = gfa.spool_name;
+    gbwt::TempFile::remove(spool_name);
+  }
+
+  // Jobs without paths still need a partial index.
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_t job_id = 0; job_id < jobs.size(); job_id++)
+  {
+    if(!(states[job_id].finished)) { finish_job(job_id); }
+  }
+  states.clear();
+  if(parameters.metrics != nullptr)
+  {
+    parameters.metrics->add_counter("gfa_to_gbwt/spilled_jobs", spilled_jobs);
+    parameters.metrics->add_counter("gfa_to_gbwt/spilled_nodes", spilled_nodes);
+  }
+
+  // Merge the indexes.
+  if(parameters.show_progress)
+  {
+    std::cerr << "Merging partial indexes" << std::endl;
+  }
+  Metrics::Timer merge_timer(parameters.metrics, "gfa_to_gbwt/merge");
+  std::unique_ptr<gbwt::GBWT> result(new gbwt::GBWT(partial_indexes));
+  merge_timer.stop();
+  if(parameters.show_progress)
+  {
+    double seconds = gbwt::readTimer() - start;
+    std::cerr << "Indexed " << gfa.paths() << " paths and " << gfa.walks << " walks in " << seconds << " seconds" << std::endl;
+  }
+
+  return result;
+}
+
+std::pair<std::unique_ptr<gbwt::GBWT>, std::unique_ptr<SequenceSource>>
+gfa_stream_to_gbwt(const std::string& gfa_filename, MetadataBuilder& metadata, const GFAParsingParameters& parameters)
+{
+  Metrics* metrics = parameters.metrics;
+  StreamedGFA gfa;
+  {
+    Metrics::Timer timer(metrics, "gfa_to_gbwt/validate");
+    scan_gfa_stream(gfa_filename, gfa, parameters);
+    check_gfa_file(gfa.segments(), gfa.paths(), gfa.walks, parameters);
+  }
+  if(metrics != nullptr)
+  {
+    metrics->add_counter("gfa_to_gbwt/bytes", gfa.bytes);
+    metrics->add_counter("gfa_to_gbwt/blocks", gfa.blocks);
+    metrics->add_counter("gfa_to_gbwt/segments", gfa.segments());
+    metrics->add_counter("gfa_to_gbwt/links", gfa.links.size());
+    metrics->add_counter("gfa_to_gbwt/paths", gfa.paths());
+    metrics->add_counter("gfa_to_gbwt/walks", gfa.walks);
+  }
+
+  // Adjust batch size by decompressed GFA size and maximum path length.
+  gbwt::size_type batch_size = determine_batch_size(gfa.max_path_length, gfa.bytes, parameters);
+
+  // Parse segments and determine node width for buffers.
+  std::unique_ptr<SequenceSource> source;
+  std::unique_ptr<EmptyGraph> graph;
+  {
+    Metrics::Timer segment_timer(metrics, "gfa_to_gbwt/segments");
+    std::tie(source, graph) = parse_streamed_segments(gfa, parameters);
+  }
+  gbwt::size_type node_width = sdsl::bits::length(gbwt::Node::encode(graph->max_node_id(), true));
+  if(metrics != nullptr) { metrics->add_counter("gfa_to_gbwt/nodes", graph->get_node_count()); }
+
+  // Parse links and create jobs.
+  {
+    Metrics::Timer link_timer(metrics, "gfa_to_gbwt/links");
+    parse_streamed_links(gfa, *source, *graph, parameters);
+  }
+  std::vector<StreamedJob> jobs;
+  std::vector<size_t> line_jobs;
+  {
+    Metrics::Timer job_timer(metrics, "gfa_to_gbwt/jobs");
+    std::tie(jobs, line_jobs) = determine_streamed_jobs(gfa, *source, graph, parameters);
+  }
+  if(metrics != nullptr) { metrics->add_counter("gfa_to_gbwt/jobs", jobs.size()); }
+
+  // Build the GBWT index.
+  gbwt::Metadata final_metadata;
+  {
+    Metrics::Timer metadata_timer(metrics, "gfa_to_gbwt/metadata");
+    final_metadata = parse_streamed_metadata(gfa, line_jobs, metadata, parameters);
+  }
+  std::unique_ptr<gbwt::GBWT> gbwt_index;
+  {
+    Metrics::Timer path_timer(metrics, "gfa_to_gbwt/paths");
+    gbwt_index = parse_streamed_paths(gfa_filename, gfa, jobs, line_jobs, *source, parameters, node_width, batch_size);
+  }
+  gbwt_index->addMetadata();
+  gbwt_index->metadata = final_metadata;
+  for(auto& kv : gfa.header_tags)
+  {
+    gbwt_index->tags.set(kv.first, kv.second);
+  }
+
+  return std::make_pair(std::move(gbwt_index), std::move(source));
+}
+
+//------------------------------------------------------------------------------
+
 std::pair<std::unique_ptr<gbwt::GBWT>, std::unique_ptr<SequenceSource>>
 gfa_to_gbwt(const std::string& gfa_filename, const GFAParsingParameters& parameters)
 {
@@ -1243,9 +2559,29 @@ gfa_to_gbwt(const std::string& gfa_filename, const GFAParsingParameters& paramet
     metadata.add_path_name_format(format.regex, format.fields, format.sense);
   }
 
-  // GFA parsing.
-  GFAFile gfa_file(gfa_filename, parameters.show_progress);
+  // GFA parsing uses the same number of threads as GBWT construction.
+  omp_set_num_threads(std::max(parameters.parallel_jobs, size_t(1)));
+  Metrics* metrics = parameters.metrics;
+  Metrics::Timer total_timer(metrics, "gfa_to_gbwt");
+
+  // Input that cannot be memory mapped is always streamed.
+  if(parameters.streaming || !GFAStream::is_regular_file(gfa_filename) || GFAStream::compression(gfa_filename) != GFAStream::uncompressed)
+  {
+    return gfa_stream_to_gbwt(gfa_filename, metadata, parameters);
+  }
+
+  Metrics::Timer timer(metrics, "gfa_to_gbwt/validate");
+  GFAFile gfa_file(gfa_filename, parameters.show_progress, parameters.chunk_size);
   check_gfa_file(gfa_file, parameters);
+  timer.stop();
+  if(metrics != nullptr)
+  {
+    metrics->add_counter("gfa_to_gbwt/bytes", gfa_file.size());
+    metrics->add_counter("gfa_to_gbwt/segments", gfa_file.segments());
+    metrics->add_counter("gfa_to_gbwt/links", gfa_file.links());
+    metrics->add_counter("gfa_to_gbwt/paths", gfa_file.paths());
+    metrics->add_counter("gfa_to_gbwt/walks", gfa_file.walks());
+  }
 
   // Adjust batch size by GFA size and maximum path length.
   gbwt::size_type batch_size = determine_batch_size(gfa_file, parameters);
@@ -1253,16 +2589,36 @@ gfa_to_gbwt(const std::string& gfa_filename, const GFAParsingParameters& paramet
   // Parse segments and determine node width for buffers.
   std::unique_ptr<SequenceSource> source;
   std::unique_ptr<EmptyGraph> graph;
-  std::tie(source, graph) = parse_segments(gfa_file, parameters);
+  {
+    Metrics::Timer segment_timer(metrics, "gfa_to_gbwt/segments");
+    std::tie(source, graph) = parse_segments(gfa_file, parameters);
+  }
   gbwt::size_type node_width = sdsl::bits::length(gbwt::Node::encode(graph->max_node_id(), true));
+  if(metrics != nullptr) { metrics->add_counter("gfa_to_gbwt/nodes", graph->get_node_count()); }
 
   // Parse links and create jobs.
-  parse_links(gfa_file, *source, *graph, parameters);
-  std::vector<ConstructionJob> jobs = determine_jobs(gfa_file, *source, graph, parameters);
+  {
+    Metrics::Timer link_timer(metrics, "gfa_to_gbwt/links");
+    parse_links(gfa_file, *source, *graph, parameters);
+  }
+  std::vector<ConstructionJob> jobs;
+  {
+    Metrics::Timer job_timer(metrics, "gfa_to_gbwt/jobs");
+    jobs = determine_jobs(gfa_file, *source, graph, parameters);
+  }
+  if(metrics != nullptr) { metrics->add_counter("gfa_to_gbwt/jobs", jobs.size()); }
 
   // Build the GBWT index.
-  gbwt::Metadata final_metadata = parse_metadata(gfa_file, jobs, metadata, parameters);
-  std::unique_ptr<gbwt::GBWT> gbwt_index = parse_paths(gfa_file, jobs, *source, parameters, node_width, batch_size);
+  gbwt::Metadata final_metadata;
+  {
+    Metrics::Timer metadata_timer(metrics, "gfa_to_gbwt/metadata");
+    final_metadata = parse_metadata(gfa_file, jobs, metadata, parameters);
+  }
+  std::unique_ptr<gbwt::GBWT> gbwt_index;
+  {
+    Metrics::Timer path_timer(metrics, "gfa_to_gbwt/paths");
+    gbwt_index = parse_paths(gfa_file, jobs, *source, parameters, node_width, batch_size);
+  }
   gbwt_index->addMetadata();
   gbwt_index->metadata = final_metadata;
   
@@ -1324,6 +2680,7 @@ struct SegmentCache
           this->segments[i] = std::pair<size_t, size_t>(this->names.size(), length);
         }
         this->names.emplace_back(name);
+        this->ranges.push_back(nodes);
         return true;
       });
     }
@@ -1358,10 +2715,71 @@ struct SegmentCache
   // is offset in `names` and the second is the length of the segment in nodes.
   std::vector<std::pair<size_t, size_t>> segments;
   std::vector<std::string> names;
+
+  // Semiopen node id ranges for the segments in `names`, if translation is used.
+  std::vector<std::pair<nid_t, nid_t>> ranges;
 };
 
 //------------------------------------------------------------------------------
 
+// Items [0, n) are written in blocks of `block_size` items using `threads`
+// threads. Each thread writes the items to its own buffer, and the buffers
+// are flushed in block order. Hence the output is identical to writing the
+// items sequentially. `write_item(writer, i)` writes item `i` and returns the
+// number of GFA lines it wrote. Returns the total number of lines.
+template<class Function>
+size_t
+write_in_order(std::ostream& out, size_t n, size_t block_size, size_t threads, const Function& write_item)
+{
+  std::vector<ManualTSVWriter> writers(threads, ManualTSVWriter(out));
+  std::vector<size_t> lines(threads, 0);
+  size_t blocks = (n + block_size - 1) / block_size;
+
+  #pragma omp parallel for ordered schedule(dynamic, 1)
+  for(size_t block = 0; block < blocks; block++)
+  {
+    size_t thread_id = omp_get_thread_num();
+    ManualTSVWriter& writer = writers[thread_id];
+    size_t limit = std::min((block + 1) * block_size, n);
+    for(size_t i = block * block_size; i < limit; i++)
+    {
+      lines[thread_id] += write_item(writer, i);
+    }
+    #pragma omp ordered
+    {
+      writer.flush();
+    }
+  }
+
+  size_t total = 0;
+  for(size_t count : lines) { total += count; }
+  return total;
+}
+
+// Calls `edge()` for the edges `HandleGraph::for_each_edge()` reports when it
+// visits the given handle, in the same order.
+void
+for_each_edge_from(const GBWTGraph& graph, const handle_t& handle, const std::function<void(const edge_t&)>& edge)
+{
+  nid_t id = graph.get_id(handle);
+  // Edges to nodes with greater ids and rightward self-loops.
+  graph.follow_edges(handle, false, [&](const handle_t& next)
+  {
+    if(id <= graph.get_id(next)) { edge(graph.edge_handle(handle, next)); }
+  });
+  // Edges from nodes with greater ids and leftward reversing self-loops.
+  graph.follow_edges(handle, true, [&](const handle_t& prev)
+  {
+    nid_t prev_id = graph.get_id(prev);
+    if(id < prev_id || (id == prev_id && !(graph.get_is_reverse(prev)))) { edge(graph.edge_handle(prev, handle)); }
+  });
+}
+
+// Write paths / walks in blocks of this many.
+constexpr size_t GFA_WRITING_PATH_BLOCK_SIZE = 1;
+
+//------------------------------------------------------------------------------
+
 void
 write_segments(const GBWTGraph& graph, const SegmentCache& cache, TSVWriter& writer, bool show_progress)
 {
@@ -1404,62 +2822,48 @@ write_links(const GBWTGraph& graph, const SegmentCache& cache, std::ostream& out
     std::cerr << "Writing links" << std::endl;
   }
 
-  size_t threads = parameters.threads();
-  std::vector<ManualTSVWriter> writers(threads, ManualTSVWriter(out));
-  std::vector<size_t> links(threads, 0);
+  auto write_link = [&](ManualTSVWriter& writer, const edge_t& edge, view_type from, view_type to)
+  {
+    writer.put('L'); writer.newfield();
+    writer.write(from); writer.newfield();
+    writer.put((graph.get_is_reverse(edge.first) ? '-' : '+')); writer.newfield();
+    writer.write(to); writer.newfield();
+    writer.put((graph.get_is_reverse(edge.second) ? '-' : '+')); writer.newfield();
+    writer.write("0M"); writer.newline();
+  };
 
+  // We generate the links in the same order as the sequential versions of
+  // `for_each_link()` and `for_each_edge()`.
+  size_t total_links = 0;
   if(parameters.use_translation && graph.has_segment_names())
   {
-    graph.for_each_link([&](const edge_t& edge, const std::string& from, const std::string& to) -> bool
-    {
-      size_t thread_id = 0;//omp_get_thread_num();
-      ManualTSVWriter& writer = writers[thread_id];
-      writer.put('L'); writer.newfield();
-      writer.write(from); writer.newfield();
-      writer.put((graph.get_is_reverse(edge.first) ? '-' : '+')); writer.newfield();
-      writer.write(to); writer.newfield();
-      writer.put((graph.get_is_reverse(edge.second) ? '-' : '+')); writer.newfield();
-      writer.write("0M"); writer.newline();
-      links[thread_id]++;
-      if(writer.full())
+    total_links = write_in_order(out, cache.ranges.size(), GBWTGraph::CHUNK_SIZE, parameters.threads(), [&](ManualTSVWriter& writer, size_t i) -> size_t
+    {
+      size_t links = 0;
+      graph.for_each_link_from(cache.names[i], cache.ranges[i], [&](const edge_t& edge, const std::string& from, const std::string& to) -> bool
       {
-        //#pragma omp critical
-        {
-          writer.flush();
-        }
-      }
-      return true;
-    }, (threads > 1));
+        write_link(writer, edge, str_to_view(from), str_to_view(to));
+        links++;
+        return true;
+      });
+      return links;
+    });
   }
   else
   {
-    graph.for_each_edge([&](const edge_t& edge)
-    {
-      size_t thread_id = 0;//omp_get_thread_num();
-      ManualTSVWriter& writer = writers[thread_id];
-      writer.put('L'); writer.newfield();
-      writer.write(cache.get(edge.first).first); writer.newfield();
-      writer.put((graph.get_is_reverse(edge.first) ? '-' : '+')); writer.newfield();
-      writer.write(cache.get(edge.second).first); writer.newfield();
-      writer.put((graph.get_is_reverse(edge.second) ? '-' : '+')); writer.newfield();
-      writer.write("0M"); writer.newline();
-      links[thread_id]++;
-      if(writer.full())
+    size_t nodes = (graph.index->sigma() - graph.index->firstNode()) / 2;
+    total_links = write_in_order(out, nodes, GBWTGraph::CHUNK_SIZE, parameters.threads(), [&](ManualTSVWriter& writer, size_t i) -> size_t
+    {
+      handle_t handle = GBWTGraph::node_to_handle(graph.index->firstNode() + 2 * i);
+      if(!(graph.has_node(graph.get_id(handle)))) { return 0; }
+      size_t links = 0;
+      for_each_edge_from(graph, handle, [&](const edge_t& edge)
       {
-        //#pragma omp critical
-        {
-          writer.flush();
-        }
-      }
-    }, (threads > 1));
-  }
-
-  // Flush the writers and count the total number of links.
-  size_t total_links = 0;
-  for(size_t i = 0; i < threads; i++)
-  {
-    writers[i].flush();
-    total_links += links[i];
+        write_link(writer, edge, cache.get(edge.first).first, cache.get(edge.second).first);
+        links++;
+      });
+      return links;
+    });
   }
 
   if(parameters.show_progress)
@@ -1507,10 +2911,6 @@ write_pan_sn_path(const gbwt::GBWT& index, const SegmentCache& segment_cache, co
   writer.newfield();
   writer.put('*');
   writer.newline();
-  //#pragma omp critical
-  {
-    writer.flush();
-  }
 }
 
 void
@@ -1521,21 +2921,15 @@ write_paths(const GBWTGraph& graph, const SegmentCache& segment_cache, const Lar
   {
     std::cerr << "Writing named paths" << std::endl;
   }
-  std::atomic<size_t> paths(0);
+  size_t paths = 0;
 
   const gbwt::GBWT& index = *(graph.index);
 
   {
     std::vector<gbwt::size_type> generic_paths = index.metadata.pathsForSample(ref_sample);
-    std::vector<ManualTSVWriter> writers(parameters.threads(), ManualTSVWriter(out));
-
-    // Some compilers default to older versions of OpenMP that do not support range-based for loops.
-    //#pragma omp parallel for schedule(dynamic, 1)
-    for(size_t i = 0; i < generic_paths.size(); i++)
+    paths += write_in_order(out, generic_paths.size(), GFA_WRITING_PATH_BLOCK_SIZE, parameters.threads(), [&](ManualTSVWriter& writer, size_t i) -> size_t
     {
       gbwt::size_type path_id = generic_paths[i];
-      size_t thread_id = 0;//omp_get_thread_num();
-      ManualTSVWriter& writer = writers[thread_id];
       const gbwt::PathName& path_name = index.metadata.path(path_id);
       gbwt::vector_type path = record_cache.extract(gbwt::Path::encode(path_id, false));
       writer.put('P'); writer.newfield();
@@ -1561,13 +2955,8 @@ write_paths(const GBWTGraph& graph, const SegmentCache& segment_cache, const Lar
       writer.newfield();
       writer.put('*');
       writer.newline();
-      //#pragma omp critical
-      {
-        writer.flush();
-      }
-    }
-
-    paths += generic_paths.size();
+      return 1;
+    });
   }
   
   // We don't write reference paths as P lines, just generic paths.
@@ -1598,14 +2987,8 @@ write_pan_sn(const GBWTGraph& graph, const SegmentCache& segment_cache, const La
       break;
     }
   }
-  std::vector<ManualTSVWriter> writers(parameters.threads(), ManualTSVWriter(out));
-
-  // Some compilers default to older versions of OpenMP that do not support range-based for loops.
-  //#pragma omp parallel for schedule(dynamic, 1)
-  for(gbwt::size_type path_id = 0; path_id < index.metadata.paths(); path_id++)
+  write_in_order(out, index.metadata.paths(), GFA_WRITING_PATH_BLOCK_SIZE, parameters.threads(), [&](ManualTSVWriter& writer, size_t path_id) -> size_t
   {
-    size_t thread_id = 0;//omp_get_thread_num();
-    ManualTSVWriter& writer = writers[thread_id];
     const gbwt::PathName& path_name = index.metadata.path(path_id);
     std::string sample_name;
     if(index.metadata.hasSampleNames()) {
@@ -1616,7 +2999,8 @@ write_pan_sn(const GBWTGraph& graph, const SegmentCache& segment_cache, const La
       sample_name = std::to_string(path_name.sample);
     }
     write_pan_sn_path(index, segment_cache, record_cache, writer, path_id, sample_name);
-  }
+    return 1;
+  });
 
   if(parameters.show_progress && index.metadata.paths() > 0)
   {
@@ -1630,23 +3014,16 @@ void
 write_walks(const GBWTGraph& graph, const SegmentCache& segment_cache, const LargeRecordCache& record_cache, std::ostream& out, gbwt::size_type ref_sample, const GFAExtractionParameters& parameters)
 {
   double start = gbwt::readTimer();
-  std::atomic<size_t> walks(0);
   if(parameters.show_progress)
   {
     std::cerr << "Writing walks" << std::endl;
   }
 
   const gbwt::GBWT& index = *(graph.index);
-  std::vector<ManualTSVWriter> writers(parameters.threads(), ManualTSVWriter(out));
-
-  //#pragma omp parallel for schedule(dynamic, 1)
-  for(gbwt::size_type path_id = 0; path_id < index.metadata.paths(); path_id++)
+  size_t walks = write_in_order(out, index.metadata.paths(), GFA_WRITING_PATH_BLOCK_SIZE, parameters.threads(), [&](ManualTSVWriter& writer, size_t path_id) -> size_t
   {
     const gbwt::PathName& path_name = index.metadata.path(path_id);
-    if(path_name.sample == ref_sample) { continue; }
-    walks++;
-    size_t thread_id = 0;//omp_get_thread_num();
-    ManualTSVWriter& writer = writers[thread_id];
+    if(path_name.sample == ref_sample) { return 0; }
     gbwt::vector_type path = record_cache.extract(gbwt::Path::encode(path_id, false));
     size_t length = 0;
     for(auto node : path) { length += graph.get_length(GBWTGraph::node_to_handle(node)); }
@@ -1670,11 +3047,8 @@ write_walks(const GBWTGraph& graph, const SegmentCache& segment_cache, const Lar
       offset += segment.second;
     }
     writer.newline();
-    //#pragma omp critical
-    {
-      writer.flush();
-    }
-  }
+    return 1;
+  });
 
   if(parameters.show_progress && walks > 0)
   {
@@ -1693,14 +3067,9 @@ write_all_paths(const GBWTGraph& graph, const SegmentCache& segment_cache, const
   }
 
   const gbwt::GBWT& index = *(graph.index);
-  std::vector<ManualTSVWriter> writers(parameters.threads(), ManualTSVWriter(out));
-
-  for(gbwt::size_type seq_id = 0; seq_id < index.sequences(); seq_id += 2)
+  write_in_order(out, index.sequences() / 2, GFA_WRITING_PATH_BLOCK_SIZE, parameters.threads(), [&](ManualTSVWriter& writer, size_t path_id) -> size_t
   {
-    size_t thread_id = 0;//omp_get_thread_num();
-    ManualTSVWriter& writer = writers[thread_id];
-    gbwt::size_type path_id = seq_id / 2;
-    gbwt::vector_type path = record_cache.extract(seq_id);
+    gbwt::vector_type path = record_cache.extract(gbwt::Path::encode(path_id, false));
     writer.put('P'); writer.newfield();
     writer.write(path_id); writer.newfield();
     size_t offset = 0;
@@ -1715,11 +3084,8 @@ write_all_paths(const GBWTGraph& graph, const SegmentCache& segment_cache, const
     writer.newfield();
     writer.put('*');
     writer.newline();
-    //#pragma omp critical
-    {
-      writer.flush();
-    }
-  }
+    return 1;
+  });
 
   if(parameters.show_progress)
   {
@@ -1748,18 +3114,8 @@ gbwt_to_gfa(const GBWTGraph& graph, std::ostream& out, const GFAExtractionParame
     std::cerr << "Cached " << segment_cache.size() << " segments in " << seconds << " seconds" << std::endl;
   }
 
-  // Cache large GBWT records.
-  start = gbwt::readTimer();
-  if(parameters.show_progress)
-  {
-    std::cerr << "Caching large GBWT records" << std::endl;
-  }
-  LargeRecordCache record_cache(*(graph.index), parameters.large_record_bytes);
-  if(parameters.show_progress)
-  {
-    double seconds = gbwt::readTimer() - start;
-    std::cerr << "Cached " << record_cache.size() << " GBWT records larger than " << parameters.large_record_bytes << " bytes in " << seconds << " seconds" << std::endl;
-  }
+  // GBWT records larger than the threshold are cached on demand.
+  LargeRecordCache record_cache(*(graph.index), parameters.large_record_bytes, parameters.record_cache_bytes);
 
   // Cache and write the segments using a single writer.
   TSVWriter writer(out);
@@ -1781,8 +3137,7 @@ gbwt_to_gfa(const GBWTGraph& graph, std::ostream& out, const GFAExtractionParame
   writer.flush();
 
   // Write the links and paths using multiple threads.
-  //size_t threads = 1;//parameters.threads();
-  //omp_set_num_threads(threads);
+  omp_set_num_threads(parameters.threads());
   write_links(graph, segment_cache, out, parameters);
   if(sufficient_metadata)
   {
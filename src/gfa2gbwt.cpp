@@ -24,6 +24,13 @@ struct Config
   GFAExtractionParameters output_parameters;
   std::string basename;
 
+  // Read GFA from this file instead of `basename + GFA_EXTENSION`.
+  std::string gfa_file;
+
+  // Metrics for GFA parsing.
+  Metrics metrics;
+  std::string metrics_file;
+
   input_type input = input_gfa;
   output_type output = output_gbz;
 
@@ -67,11 +74,20 @@ main(int argc, char** argv)
       gbwt::printHeader("--path-regex", std::cerr) << config.parameters.path_name_formats.front().regex << std::endl;
       gbwt::printHeader("--path-fields", std::cerr) << config.parameters.path_name_formats.front().fields << std::endl;
       gbwt::printHeader("--path-sense", std::cerr) << (int)config.parameters.path_name_formats.front().sense << std::endl;
+      if(!(config.gfa_file.empty()))
+      {
+        gbwt::printHeader("--gfa", std::cerr) << config.gfa_file << std::endl;
+      }
+      if(config.parameters.streaming)
+      {
+        std::cerr << "--streaming" << std::endl;
+      }
     }
     if(config.output == output_gfa)
     {
       gbwt::printHeader("--parallel-jobs", std::cerr) << config.output_parameters.num_threads << std::endl;
       gbwt::printHeader("--cache-records", std::cerr) << config.output_parameters.large_record_bytes << std::endl;
+      gbwt::printHeader("--cache-budget", std::cerr) << gbwt::inMegabytes(config.output_parameters.record_cache_bytes) << " MiB" << std::endl;
       gbwt::printHeader("--paths", std::cerr) << GFAExtractionParameters::mode_name(config.output_parameters.mode) << std::endl;
       if(!(config.output_parameters.use_translation))
       {
@@ -131,6 +147,18 @@ main(int argc, char** argv)
     std::exit(EXIT_FAILURE);
   }
 
+  if(!(config.metrics_file.empty()))
+  {
+    std::ofstream out(config.metrics_file, std::ios_base::binary);
+    if(!out)
+    {
+      std::cerr << "gfa2gbwt: Cannot open metrics file " << config.metrics_file << " for writing" << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+    config.metrics.write_json(out);
+    out << std::endl;
+  }
+
   if(config.show_progress)
   {
     std::cerr << std::endl;
@@ -166,13 +194,15 @@ printUsage(int exit_code)
   std::cerr << "General options:" << std::endl;
   std::cerr << "  -p, --progress          show progress information" << std::endl;
   std::cerr << "  -t, --translation       write translation table into a " << SequenceSource::TRANSLATION_EXTENSION << " file" << std::endl;
+  std::cerr << "      --metrics FILE      write GFA parsing metrics to FILE in JSON format" << std::endl;
   std::cerr << std::endl;
   std::cerr << "Parallel options:" << std::endl;
   std::cerr << "  -j, --approx-jobs N     create approximately N GBWT construction jobs (default " << GFAParsingParameters::APPROXIMATE_NUM_JOBS << ")" << std::endl;
-  std::cerr << "  -P, --parallel-jobs N   run N construction / extraction jobs in parallel (default 1)" << std::endl;
+  std::cerr << "  -P, --parallel-jobs N   run N construction / extraction / output jobs in parallel (default 1)" << std::endl;
   std::cerr << std::endl;
   std::cerr << "Output options:" << std::endl;
   std::cerr << "  -R, --cache-records N   cache > N-byte GBWT records for " << GFA_EXTENSION << " output (default " << GFAExtractionParameters::LARGE_RECORD_BYTES << ")" << std::endl;
+  std::cerr << "      --cache-budget N    use at most N MiB for cached GBWT records (default " << (GFAExtractionParameters::RECORD_CACHE_BYTES >> 20) << ")" << std::endl;
   std::cerr << "  -s, --simple-sds-graph  serialize " << GBWTGraph::EXTENSION << " in simple-sds format instead of libhandlegraph format" << std::endl;
   std::cerr << "                          (this tool cannot read simple-sds graphs)" << std::endl;
   std::cerr << "      --paths STR         extract paths as STR (default, pan-sn, ref-only)" << std::endl;
@@ -188,6 +218,9 @@ printUsage(int exit_code)
   std::cerr << "                          (the first submatch is the entire path name)" << std::endl;
   std::cerr << "      --path-sense INT    assign paths the sense INT (default " << (int)GFAParsingParameters::DEFAULT_SENSE << ")" << std::endl;
   std::cerr << "      --pan-sn            parse PanSN path names (sets --path-regex, --path-fields, and --path-sense)" << std::endl;
+  std::cerr << "      --gfa FILE          read GFA from FILE instead of basename" << GFA_EXTENSION << std::endl;
+  std::cerr << "                          (- for stdin; gzip / zstd input and pipes are streamed)" << std::endl;
+  std::cerr << "      --streaming         stream the GFA in two passes instead of memory mapping it" << std::endl;
   std::cerr << std::endl;
   std::cerr << "Fields (case insensitive):" << std::endl;
   std::cerr << "  S      sample name" << std::endl;
@@ -211,6 +244,10 @@ Config::Config(int argc, char** argv)
   constexpr int OPT_REF_ONLY = 1002;
   constexpr int OPT_NO_TRANSLATION = 1003;
   constexpr int OPT_PATH_SENSE = 1004;
+  constexpr int OPT_CACHE_BUDGET = 1005;
+  constexpr int OPT_METRICS = 1006;
+  constexpr int OPT_GFA = 1007;
+  constexpr int OPT_STREAMING = 1008;
 
   // Data for `getopt_long()`.
   int c = 0, option_index = 0;
@@ -226,9 +263,11 @@ Config::Config(int argc, char** argv)
     { "bitvectors", no_argument, 0, 'B' }, // Hidden.
     { "progress", no_argument, 0, 'p' },
     { "translation", no_argument, 0, 't' },
+    { "metrics", required_argument, 0, OPT_METRICS },
     { "approx-jobs", required_argument, 0, 'j' },
     { "parallel-jobs", required_argument, 0, 'P' },
     { "cache-records", required_argument, 0, 'R' },
+    { "cache-budget", required_argument, 0, OPT_CACHE_BUDGET },
     { "simple-sds-graph", no_argument, 0, 's' },
     { "paths", required_argument, 0, OPT_PATHS },
     { "pan-sn", no_argument, 0, OPT_PAN_SN },
@@ -238,6 +277,8 @@ Config::Config(int argc, char** argv)
     { "path-regex", required_argument, 0, 'r' },
     { "path-fields", required_argument, 0, 'f' },
     { "path-sense", required_argument, 0, OPT_PATH_SENSE },
+    { "gfa", required_argument, 0, OPT_GFA },
+    { "streaming", no_argument, 0, OPT_STREAMING },
     { 0, 0, 0, 0 }
   };
 
@@ -284,6 +325,10 @@ Config::Config(int argc, char** argv)
       this->parameters.show_progress = true;
       this->output_parameters.show_progress = true;
       break;
+    case OPT_METRICS:
+      this->metrics_file = optarg;
+      this->parameters.metrics = &(this->metrics);
+      break;
     case 't':
       this->translation = true;
       break;
@@ -314,6 +359,14 @@ Config::Config(int argc, char** argv)
         std::exit(EXIT_FAILURE);
       }
       break;
+    case OPT_CACHE_BUDGET:
+      try { this->output_parameters.record_cache_bytes = std::stoul(optarg) << 20; }
+      catch(const std::invalid_argument&)
+      {
+        std::cerr << "gfa2gbwt: Invalid record cache budget: " << optarg << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      break;
     case 's':
       this->simple_sds_graph = true;
       break;
@@ -368,6 +421,13 @@ Config::Config(int argc, char** argv)
         std::exit(EXIT_FAILURE);
       }
       break;
+    case OPT_GFA:
+      this->gfa_file = optarg;
+      break;
+    case OPT_STREAMING:
+      this->parameters.streaming = true;
+      break;
+
     case '?':
       std::exit(EXIT_FAILURE);
     default:
@@ -385,7 +445,7 @@ Config::Config(int argc, char** argv)
 void
 parse_gfa(GBZ& gbz, const Config& config)
 {
-  std::string gfa_name = config.basename + GFA_EXTENSION;
+  std::string gfa_name = (config.gfa_file.empty() ? config.basename + GFA_EXTENSION : config.gfa_file);
 
   if(config.show_progress)
   {
@@ -450,7 +510,7 @@ write_gbz(const GBZ& gbz, const Config& config)
   {
     std::cerr << "Compressing GBWT and GBWTGraph to " << gbz_name << std::endl;
   }
-  sdsl::simple_sds::serialize_to(gbz, gbz_name);
+  gbz.serialize_to(gbz_name, config.parameters.parallel_jobs);
 }
 
 void
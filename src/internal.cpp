@@ -3,8 +3,13 @@
 #include <gbwtgraph/gbwtgraph.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <exception>
 #include <functional>
+#include <future>
+#include <sstream>
+#include <thread>
 
 namespace gbwtgraph
 {
@@ -109,11 +114,16 @@ EmptyGraph::create_edge(const handle_t& from, const handle_t& to)
 void
 EmptyGraph::remove_duplicate_edges()
 {
-  this->for_each_handle([&](const handle_t& handle) {
-    auto iter = this->get_node_mut(handle);
-    gbwt::removeDuplicates(iter->second.predecessors, false);
-    gbwt::removeDuplicates(iter->second.successors, false);
-  });
+  // Nodes are independent of each other, so we can process them in parallel.
+  std::vector<Node*> node_list;
+  node_list.reserve(this->nodes.size());
+  for(auto iter = this->nodes.begin(); iter != this->nodes.end(); ++iter) { node_list.push_back(&(iter->second)); }
+  #pragma omp parallel for schedule(dynamic, 1024)
+  for(size_t i = 0; i < node_list.size(); i++)
+  {
+    gbwt::removeDuplicates(node_list[i]->predecessors, false);
+    gbwt::removeDuplicates(node_list[i]->successors, false);
+  }
 }
 
 bool
@@ -223,17 +233,10 @@ EmptyGraph::get_degree(const handle_t& handle, bool go_left) const
 
 //------------------------------------------------------------------------------
 
-LargeRecordCache::LargeRecordCache(const gbwt::GBWT& index, size_t bytes) :
-  index(index)
+LargeRecordCache::LargeRecordCache(const gbwt::GBWT& index, size_t bytes, size_t budget) :
+  index(index),
+  cache(index, SharedRecordCache::DEFAULT_CAPACITY, budget, bytes)
 {
-  for(gbwt::node_type node = this->index.firstNode(); node < this->index.sigma(); node++)
-  {
-    std::pair<gbwt::size_type, gbwt::size_type> range = this->index.bwt.getRange(this->index.toComp(node));
-    if(range.second - range.first > bytes && !(this->index.empty(node)))
-    {
-      this->cache[node] = gbwt::DecompressedRecord(this->index.record(node));
-    }
-  }
 }
 
 gbwt::vector_type
@@ -246,9 +249,7 @@ LargeRecordCache::extract(gbwt::size_type sequence) const
   while(pos.first != gbwt::ENDMARKER)
   {
     result.push_back(pos.first);
-    auto iter = this->cache.find(pos.first);
-    if(iter != this->cache.end()) { pos = iter->second.LF(pos.second); }
-    else { pos = this->index.LF(pos); }
+    pos = this->cache.LF(pos);
   }
 
   return result;
@@ -256,6 +257,91 @@ LargeRecordCache::extract(gbwt::size_type sequence) const
 
 //------------------------------------------------------------------------------
 
+constexpr size_t NodeRanks::MAX_SPARSITY;
+
+NodeRanks::NodeRanks(std::vector<nid_t> nodes) :
+  ids(std::move(nodes))
+{
+  if(!std::is_sorted(this->ids.begin(), this->ids.end())) { std::sort(this->ids.begin(), this->ids.end()); }
+  this->ids.erase(std::unique(this->ids.begin(), this->ids.end()), this->ids.end());
+  if(this->ids.empty()) { return; }
+  this->first_id = this->ids.front();
+  size_t range = this->ids.back() - this->first_id + 1;
+  if(range > MAX_SPARSITY * this->ids.size()) { return; }
+  this->dense = std::vector<size_t>(range, 0);
+  for(size_t i = 0; i < this->ids.size(); i++) { this->dense[this->ids[i] - this->first_id] = i + 1; }
+}
+
+//------------------------------------------------------------------------------
+
+void
+serialize_sections(std::ostream& out, const std::vector<std::function<void(std::ostream&)>>& sections, size_t threads, size_t direct)
+{
+  direct = std::max(direct, size_t(1));
+  threads = (direct < sections.size() ? std::min(threads, sections.size() - direct + 1) : 1);
+  if(threads <= 1)
+  {
+    for(const auto& section : sections) { section(out); }
+    return;
+  }
+
+  // The calling thread writes the first sections directly to the output, while
+  // the workers take the next unclaimed section and signal when it is ready.
+  std::vector<std::stringstream> buffers(sections.size());
+  std::vector<std::promise<void>> ready(sections.size());
+  std::vector<std::future<void>> encoded;
+  for(std::promise<void>& promise : ready) { encoded.push_back(promise.get_future()); }
+  std::atomic<size_t> next(direct);
+  std::vector<std::thread> workers;
+  for(size_t thread = 1; thread < threads; thread++)
+  {
+    workers.emplace_back([&]()
+    {
+      for(size_t i = next++; i < sections.size(); i = next++)
+      {
+        try
+        {
+          sections[i](buffers[i]);
+          ready[i].set_value();
+        }
+        catch(...) { ready[i].set_exception(std::current_exception()); }
+      }
+    });
+  }
+
+  // Write the sections in order and release the buffers. If no worker has
+  // claimed the next section, we write it directly without buffering. After an
+  // error, we still wait for the workers but stop writing.
+  std::exception_ptr error;
+  for(size_t i = 0; i < sections.size(); i++)
+  {
+    size_t expected = i;
+    bool write_directly = (i < direct || next.compare_exchange_strong(expected, i + 1));
+    try
+    {
+      if(write_directly)
+      {
+        if(!error) { sections[i](out); }
+      }
+      else
+      {
+        encoded[i].get();
+        // Inserting an empty buffer would set failbit.
+        if(!error && buffers[i].tellp() > 0) { out << buffers[i].rdbuf(); }
+      }
+    }
+    catch(...)
+    {
+      if(!error) { error = std::current_exception(); }
+    }
+    buffers[i].str(std::string());
+  }
+  for(std::thread& worker : workers) { worker.join(); }
+  if(error) { std::rethrow_exception(error); }
+}
+
+//------------------------------------------------------------------------------
+
 std::vector<std::pair<size_t, gbwt::edge_type>>
 sample_path_positions(const GBZ& gbz, path_handle_t path, size_t sample_interval, size_t* length)
 {
@@ -279,4 +365,115 @@ sample_path_positions(const GBZ& gbz, path_handle_t path, size_t sample_interval
 
 //------------------------------------------------------------------------------
 
+std::vector<std::pair<size_t, size_t>>
+longest_common_subsequence(const gbwt::vector_type& reference, const gbwt::vector_type& path)
+{
+  std::vector<std::pair<size_t, size_t>> result;
+
+  // The traceback always matches the common suffix.
+  size_t path_end = path.size(), ref_end = reference.size();
+  while(path_end > 0 && ref_end > 0 && path[path_end - 1] == reference[ref_end - 1])
+  {
+    path_end--; ref_end--;
+    result.push_back(std::make_pair(path_end, ref_end));
+  }
+  if(path_end == 0 || ref_end == 0)
+  {
+    std::reverse(result.begin(), result.end());
+    return result;
+  }
+
+  // Reference positions for each node.
+  std::unordered_map<gbwt::node_type, std::vector<size_t>> occurrences;
+  for(size_t i = 0; i < ref_end; i++) { occurrences[reference[i]].push_back(i); }
+
+  // Row `i` stores the LCS table row for path prefix of length `i + 1` as a
+  // bitvector, where bit `j` is 0 if the LCS length increases at reference
+  // offset `j`. Row for the empty prefix has all bits set.
+  constexpr size_t WORD_BITS = 64;
+  size_t words = (ref_end + WORD_BITS - 1) / WORD_BITS;
+  std::vector<std::uint64_t> rows(path_end * words);
+  std::vector<std::uint64_t> matches(words, 0);
+  const std::uint64_t* prev = nullptr;
+  for(size_t i = 0; i < path_end; i++)
+  {
+    auto iter = occurrences.find(path[i]);
+    if(iter != occurrences.end())
+    {
+      for(size_t j : iter->second) { matches[j / WORD_BITS] |= std::uint64_t(1) << (j % WORD_BITS); }
+    }
+    std::uint64_t* curr = rows.data() + i * words;
+    std::uint64_t carry = 0;
+    for(size_t w = 0; w < words; w++)
+    {
+      std::uint64_t v = (prev == nullptr ? ~std::uint64_t(0) : prev[w]);
+      std::uint64_t u = v & matches[w];
+      std::uint64_t sum = v + u;
+      std::uint64_t next_carry = (sum < v);
+      sum += carry;
+      next_carry |= (sum < carry);
+      carry = next_carry;
+      curr[w] = sum | (v & ~u);
+    }
+    if(iter != occurrences.end())
+    {
+      for(size_t j : iter->second) { matches[j / WORD_BITS] = 0; }
+    }
+    prev = curr;
+  }
+
+  // LCS length for a path prefix of length `i` and a reference prefix of length `j`.
+  auto lcs_length = [&](size_t i, size_t j) -> size_t
+  {
+    if(i == 0) { return 0; }
+    const std::uint64_t* row = rows.data() + (i - 1) * words;
+    size_t length = 0;
+    for(size_t w = 0; w < j / WORD_BITS; w++) { length += sdsl::bits::cnt(~row[w]); }
+    if(j % WORD_BITS != 0)
+    {
+      std::uint64_t mask = (std::uint64_t(1) << (j % WORD_BITS)) - 1;
+      length += sdsl::bits::cnt(~row[j / WORD_BITS] & mask);
+    }
+    return length;
+  };
+  // Does the LCS length increase at reference offset `j` for a path prefix of length `i`.
+  auto increases = [&](size_t i, size_t j) -> size_t
+  {
+    if(i == 0) { return 0; }
+    return ((rows[(i - 1) * words + j / WORD_BITS] >> (j % WORD_BITS)) & 1) ^ 1;
+  };
+
+  // Trace back the LCS. We maintain the values of the table cells at the
+  // current position and just above it.
+  size_t path_offset = path_end, ref_offset = ref_end;
+  size_t curr = lcs_length(path_offset, ref_offset), up = lcs_length(path_offset - 1, ref_offset);
+  while(path_offset > 0 && ref_offset > 0)
+  {
+    if(path[path_offset - 1] == reference[ref_offset - 1])
+    {
+      result.push_back(std::make_pair(path_offset - 1, ref_offset - 1));
+      path_offset--; ref_offset--;
+      curr--;
+      if(path_offset > 0) { up = lcs_length(path_offset - 1, ref_offset); }
+    }
+    else if(up > curr - increases(path_offset, ref_offset - 1))
+    {
+      path_offset--;
+      curr = up;
+      if(path_offset > 0) { up = lcs_length(path_offset - 1, ref_offset); }
+    }
+    else
+    {
+      curr -= increases(path_offset, ref_offset - 1);
+      up -= increases(path_offset - 1, ref_offset - 1);
+      ref_offset--;
+    }
+  }
+  std::reverse(result.begin(), result.end());
+
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace gbwtgraph
@@ -25,10 +25,15 @@ struct Config
   bool distribution = false;
   size_t threshold = 0;
   size_t threads = 1;
+  size_t shards = DEFAULT_KMER_SHARDS;
   size_t hash_table_size = KmerIndex<Key64, Position>::INITIAL_CAPACITY;
 
   bool space_efficient = false;
 
+  bool external = false;
+  size_t buckets = DEFAULT_KMER_BUCKETS;
+  size_t memory_budget = DEFAULT_KMER_MEMORY;
+
   bool verbose = true; // TODO: Do we need an option to silence this?
 
   std::string filename;
@@ -45,7 +50,7 @@ main(int argc, char** argv)
 
   double start = gbwt::readTimer();
   Config config(argc, argv);
-  //omp_set_num_threads(config.threads);
+  omp_set_num_threads(config.threads);
 
   // Load the graph.
   GBZ gbz;
@@ -57,19 +62,30 @@ main(int argc, char** argv)
 
   // (number of hits, number of kmers)
   std::map<size_t, size_t> distribution;
-  auto update_distribution = [&](const index_type& index)
+  auto update_distribution = [](const index_type& index, std::map<size_t, size_t>& result)
   {
     index.for_each_kmer([&](const index_type::cell_type& cell)
     {
-      if(cell.first.is_pointer()) { distribution[cell.second.pointer->size()]++; }
-      else { distribution[1]++; }
+      result[index.occurrences(cell).second]++;
     });
   };
 
   // Build the kmer indexes and extract the kmer frequency distribution.
   double checkpoint = gbwt::readTimer();
   size_t total_kmers = 0, total_unique = 0, total_values = 0;
-  if(config.space_efficient)
+  if(config.external)
+  {
+    if(config.verbose)
+    {
+      std::cerr << "Counting " << config.k << "-mers using " << config.buckets << " buckets in external memory" << std::endl;
+    }
+    count_kmers_external<Key64>(gbz.graph, config.k, [&](Key64, size_t hits)
+    {
+      total_kmers++; total_unique += (hits == 1); total_values += hits;
+      distribution[hits]++;
+    }, config.memory_budget, config.buckets);
+  }
+  else if(config.space_efficient)
   {
     for(char base : { 'A', 'C', 'G', 'T' })
     {
@@ -84,30 +100,37 @@ main(int argc, char** argv)
         std::cerr << index.size() << " kmers (" << index.unique_keys() << " unique) with " << index.number_of_values() << " hits" << std::endl;
       }
       total_kmers += index.size(); total_unique += index.unique_keys(); total_values += index.number_of_values();
-      update_distribution(index);
+      update_distribution(index, distribution);
     }
   }
   else
   {
     if(config.verbose)
     {
-      std::cerr << "Building all " << config.k << "-mer indexes in parallel" << std::endl;
+      std::cerr << "Building " << config.shards << " " << config.k << "-mer indexes in parallel using " << config.threads << " threads" << std::endl;
     }
-    std::array<index_type, 4> indexes
-    {
-      index_type(config.hash_table_size), index_type(config.hash_table_size), index_type(config.hash_table_size), index_type(config.hash_table_size)
-    };
+    std::vector<index_type> indexes(config.shards, index_type(config.hash_table_size));
     build_kmer_indexes(gbz.graph, indexes, config.k);
-    for(auto& index : indexes)
+    std::vector<std::map<size_t, size_t>> distributions(indexes.size());
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(size_t shard = 0; shard < indexes.size(); shard++)
+    {
+      update_distribution(indexes[shard], distributions[shard]);
+    }
+    for(size_t shard = 0; shard < indexes.size(); shard++)
     {
+      const index_type& index = indexes[shard];
       total_kmers += index.size(); total_unique += index.unique_keys(); total_values += index.number_of_values();
-      update_distribution(index);
+      for(auto iter = distributions[shard].begin(); iter != distributions[shard].end(); ++iter)
+      {
+        distribution[iter->first] += iter->second;
+      }
     }
   }
   if(config.verbose)
   {
     double seconds = gbwt::readTimer() - checkpoint;
-    std::cerr << "Built the kmer indexes in " << seconds << " seconds" << std::endl;
+    std::cerr << "Counted the kmers in " << seconds << " seconds" << std::endl;
     std::cerr << total_kmers << " kmers (" << total_unique << " unique) with " << total_values << " hits" << std::endl;
   }
 
@@ -151,8 +174,13 @@ printUsage(int exit_code)
   std::cerr << "  -f, --frequent N     count the number of kmers with frequency > N" << std::endl;
   std::cerr << "  -k, --kmer-length N  count N-mers (default: " << Config::DEFAULT_K << ")" << std::endl;
   std::cerr << "  -s, --save-memory    use the slower space-efficient algorithm" << std::endl;
-  std::cerr << "  -t, --threads N      use N parallel threads" << std::endl;
-  std::cerr << "  -H, --hash-table N   initialize the hash table with 2^N cells" << std::endl;
+  std::cerr << "  -e, --external       count the kmers in external memory" << std::endl;
+  std::cerr << "  -b, --buckets N      use N temporary files with --external (default: " << DEFAULT_KMER_BUCKETS << ")" << std::endl;
+  std::cerr << "  -M, --memory N       count at most N MiB of kmers at once with --external (default: " << (DEFAULT_KMER_MEMORY >> 20) << ")" << std::endl;
+  std::cerr << "  -T, --temp-dir DIR   use DIR for temporary files" << std::endl;
+  std::cerr << "  -t, --threads N      use N parallel threads (default: 1)" << std::endl;
+  std::cerr << "  -S, --shards N       partition the kmers between N indexes (default: " << DEFAULT_KMER_SHARDS << ")" << std::endl;
+  std::cerr << "  -H, --hash-table N   initialize each hash table with 2^N cells" << std::endl;
   std::cerr << std::endl;
 
   std::exit(exit_code);
@@ -164,7 +192,7 @@ Config::Config(int argc, char** argv)
 {
   if(argc < 2) { printUsage(EXIT_SUCCESS); }
 
-  size_t max_threads = 1;//omp_get_max_threads();
+  size_t max_threads = omp_get_max_threads();
   size_t min_width = 10;
   size_t max_width = 36;
 
@@ -176,13 +204,18 @@ Config::Config(int argc, char** argv)
     { "frequent", required_argument, 0, 'f' },
     { "kmer-length", required_argument, 0, 'k' },
     { "save-memory", no_argument, 0, 's' },
+    { "external", no_argument, 0, 'e' },
+    { "buckets", required_argument, 0, 'b' },
+    { "memory", required_argument, 0, 'M' },
+    { "temp-dir", required_argument, 0, 'T' },
     { "threads", required_argument, 0, 't' },
+    { "shards", required_argument, 0, 'S' },
     { "hash-tables", required_argument, 0, 'H' },
     { 0, 0, 0, 0 }
   };
 
   // Process options.
-  while((c = getopt_long(argc, argv, "df:k:st:H:", long_options, &option_index)) != -1)
+  while((c = getopt_long(argc, argv, "df:k:seb:M:T:t:S:H:", long_options, &option_index)) != -1)
   {
     switch(c)
     {
@@ -213,6 +246,33 @@ Config::Config(int argc, char** argv)
     case 's':
       this->space_efficient = true;
       break;
+    case 'e':
+      this->external = true;
+      break;
+    case 'b':
+      try { this->buckets = std::stoul(optarg); }
+      catch(const std::invalid_argument&)
+      {
+        std::cerr << "kmer_freq: Invalid number of buckets: " << optarg << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      if(this->buckets == 0)
+      {
+        std::cerr << "kmer_freq: Number of buckets must be positive" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+    case 'M':
+      try { this->memory_budget = std::stoul(optarg) << 20; }
+      catch(const std::invalid_argument&)
+      {
+        std::cerr << "kmer_freq: Invalid memory budget: " << optarg << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      break;
+    case 'T':
+      gbwt::TempFile::setDirectory(optarg);
+      break;
     case 't':
       try { this->threads = std::stoul(optarg); }
       catch(const std::invalid_argument&)
@@ -226,6 +286,19 @@ Config::Config(int argc, char** argv)
         std::exit(EXIT_FAILURE);
       }
       break;
+    case 'S':
+      try { this->shards = std::stoul(optarg); }
+      catch(const std::invalid_argument&)
+      {
+        std::cerr << "kmer_freq: Invalid number of shards: " << optarg << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      if(this->shards == 0)
+      {
+        std::cerr << "kmer_freq: Number of shards must be positive" << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      break;
     case 'H':
       size_t width;
       try { width = std::stoul(optarg); }
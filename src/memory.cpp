@@ -0,0 +1,311 @@
+#include <gbwtgraph/memory.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace gbwtgraph
+{
+
+//------------------------------------------------------------------------------
+
+// Class constants.
+
+constexpr size_t MemoryPolicy::MIN_BYTES;
+
+//------------------------------------------------------------------------------
+
+// Memory policy state.
+
+namespace
+{
+
+MemoryPolicy global_policy;
+thread_local const MemoryPolicy* thread_policy = nullptr;
+
+// Mappings created by allocate_memory() as (start, length). The counter lets
+// release_memory() skip the lock when there are no mappings.
+std::mutex mapping_mutex;
+std::unordered_map<std::uintptr_t, size_t> mappings;
+std::atomic<size_t> mapping_count(0);
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1048576;
+constexpr size_t GIGANTIC_PAGE_SIZE = 1024 * 1048576;
+
+// Linux memory policy modes and flags from <linux/mempolicy.h>.
+constexpr int MPOL_PREFERRED_MODE = 1;
+constexpr int MPOL_INTERLEAVE_MODE = 3;
+constexpr unsigned MPOL_MF_MOVE_FLAG = 1 << 1;
+
+size_t
+round_up(size_t value, size_t multiple)
+{
+  return ((value + multiple - 1) / multiple) * multiple;
+}
+
+size_t
+page_size()
+{
+  long result = ::sysconf(_SC_PAGESIZE);
+  return (result > 0 ? result : 4096);
+}
+
+// Sets the NUMA policy for the range, which must be page-aligned.
+bool
+bind_memory(void* ptr, size_t bytes, const MemoryPolicy& policy, unsigned flags)
+{
+  if(policy.numa == MemoryPolicy::numa_default || bytes == 0) { return true; }
+#if defined(__linux__) && defined(SYS_mbind)
+  std::vector<int> nodes;
+  int mode = MPOL_INTERLEAVE_MODE;
+  if(policy.numa == MemoryPolicy::numa_interleave)
+  {
+    nodes = numa_nodes();
+    if(nodes.size() <= 1) { return true; }
+  }
+  else
+  {
+    if(policy.node < 0) { return false; }
+    nodes.push_back(policy.node);
+    mode = MPOL_PREFERRED_MODE;
+  }
+
+  constexpr size_t WORD_BITS = 8 * sizeof(unsigned long);
+  int max_node = 0;
+  for(int node : nodes) { max_node = std::max(max_node, node); }
+  std::vector<unsigned long> mask(max_node / WORD_BITS + 1, 0);
+  for(int node : nodes) { mask[node / WORD_BITS] |= 1UL << (node % WORD_BITS); }
+  long result = ::syscall(SYS_mbind, ptr, bytes, mode, mask.data(), mask.size() * WORD_BITS + 1, flags);
+  return (result == 0);
+#else
+  (void)ptr; (void)flags;
+  return false;
+#endif
+}
+
+void
+register_mapping(void* ptr, size_t length)
+{
+  std::lock_guard<std::mutex> lock(mapping_mutex);
+  mappings[reinterpret_cast<std::uintptr_t>(ptr)] = length;
+  mapping_count++;
+}
+
+} // anonymous namespace
+
+//------------------------------------------------------------------------------
+
+const MemoryPolicy&
+MemoryPolicy::current()
+{
+  return (thread_policy != nullptr ? *thread_policy : global_policy);
+}
+
+void
+MemoryPolicy::set_global(const MemoryPolicy& policy)
+{
+  global_policy = policy;
+}
+
+bool
+MemoryPolicy::parse(const std::string& str, MemoryPolicy& policy)
+{
+  MemoryPolicy result;
+  size_t start = 0;
+  while(start <= str.length())
+  {
+    size_t limit = std::min(str.find(',', start), str.length());
+    std::string token = str.substr(start, limit - start);
+    start = limit + 1;
+    if(token == "default") { result.pages = pages_default; }
+    else if(token == "thp") { result.pages = pages_transparent; }
+    else if(token == "2m") { result.pages = pages_2m; }
+    else if(token == "1g") { result.pages = pages_1g; }
+    else if(token == "interleave") { result.numa = numa_interleave; }
+    else if(token.compare(0, 5, "node=") == 0)
+    {
+      try { result.node = std::stoi(token.substr(5)); }
+      catch(const std::logic_error&) { return false; }
+      if(result.node < 0) { return false; }
+      result.numa = numa_prefer;
+    }
+    else { return false; }
+  }
+  result.min_bytes = policy.min_bytes;
+  policy = result;
+  return true;
+}
+
+std::string
+MemoryPolicy::to_string() const
+{
+  std::string result;
+  switch(this->pages)
+  {
+  case pages_default:
+    result = "default"; break;
+  case pages_transparent:
+    result = "thp"; break;
+  case pages_2m:
+    result = "2m"; break;
+  case pages_1g:
+    result = "1g"; break;
+  }
+  if(this->numa == numa_interleave) { result += ",interleave"; }
+  else if(this->numa == numa_prefer) { result += ",node=" + std::to_string(this->node); }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+ScopedMemoryPolicy::ScopedMemoryPolicy(const MemoryPolicy& policy) :
+  policy(policy), previous(thread_policy)
+{
+  thread_policy = &(this->policy);
+}
+
+ScopedMemoryPolicy::~ScopedMemoryPolicy()
+{
+  thread_policy = this->previous;
+}
+
+//------------------------------------------------------------------------------
+
+std::vector<int>
+numa_nodes()
+{
+  // The file contains a list of ranges such as "0-1,4".
+  std::vector<int> result;
+  std::ifstream in("/sys/devices/system/node/online");
+  std::string range;
+  while(in && std::getline(in, range, ','))
+  {
+    try
+    {
+      size_t separator = range.find('-');
+      int first = std::stoi(range.substr(0, separator));
+      int last = (separator == std::string::npos ? first : std::stoi(range.substr(separator + 1)));
+      for(int node = first; node <= last; node++) { result.push_back(node); }
+    }
+    catch(const std::logic_error&) { break; }
+  }
+  if(result.empty()) { result.push_back(0); }
+  return result;
+}
+
+int
+current_numa_node()
+{
+#if defined(__linux__) && defined(SYS_getcpu)
+  unsigned cpu = 0, node = 0;
+  if(::syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) { return node; }
+#endif
+  return -1;
+}
+
+//------------------------------------------------------------------------------
+
+void*
+allocate_memory(size_t bytes, const MemoryPolicy& policy)
+{
+  if(bytes == 0) { bytes = 1; }
+  int prot = PROT_READ | PROT_WRITE;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#if defined(MAP_HUGETLB)
+  // Explicit huge pages must be reserved in advance, so we fall back to
+  // transparent huge pages if there are none.
+  if(policy.pages == MemoryPolicy::pages_2m || policy.pages == MemoryPolicy::pages_1g)
+  {
+    size_t huge = (policy.pages == MemoryPolicy::pages_2m ? HUGE_PAGE_SIZE : GIGANTIC_PAGE_SIZE);
+    int shift = (policy.pages == MemoryPolicy::pages_2m ? 21 : 30);
+    size_t length = round_up(bytes, huge);
+    void* ptr = ::mmap(nullptr, length, prot, flags | MAP_HUGETLB | (shift << 26), -1, 0); // MAP_HUGE_SHIFT
+    if(ptr != MAP_FAILED)
+    {
+      bind_memory(ptr, length, policy, 0);
+      register_mapping(ptr, length);
+      return ptr;
+    }
+  }
+#endif
+
+  // Map extra memory for aligning the start to a huge page and unmap the excess.
+  size_t alignment = (policy.pages == MemoryPolicy::pages_default ? page_size() : HUGE_PAGE_SIZE);
+  size_t length = round_up(bytes, alignment);
+  size_t mapped = length + alignment - page_size();
+  void* ptr = ::mmap(nullptr, mapped, prot, flags, -1, 0);
+  if(ptr == MAP_FAILED) { return nullptr; }
+  std::uintptr_t start = reinterpret_cast<std::uintptr_t>(ptr);
+  std::uintptr_t aligned = round_up(start, alignment);
+  if(aligned > start) { ::munmap(ptr, aligned - start); }
+  if(start + mapped > aligned + length)
+  {
+    ::munmap(reinterpret_cast<void*>(aligned + length), (start + mapped) - (aligned + length));
+  }
+  ptr = reinterpret_cast<void*>(aligned);
+
+#if defined(MADV_HUGEPAGE)
+  if(policy.pages != MemoryPolicy::pages_default) { ::madvise(ptr, length, MADV_HUGEPAGE); }
+#endif
+  bind_memory(ptr, length, policy, 0);
+  register_mapping(ptr, length);
+  return ptr;
+}
+
+bool
+release_memory(void* ptr)
+{
+  if(ptr == nullptr || mapping_count == 0) { return false; }
+  size_t length = 0;
+  {
+    std::lock_guard<std::mutex> lock(mapping_mutex);
+    auto iter = mappings.find(reinterpret_cast<std::uintptr_t>(ptr));
+    if(iter == mappings.end()) { return false; }
+    length = iter->second;
+    mappings.erase(iter);
+    mapping_count--;
+  }
+  ::munmap(ptr, length);
+  return true;
+}
+
+bool
+apply_memory_policy(const void* ptr, size_t bytes, const MemoryPolicy& policy)
+{
+  if(ptr == nullptr || bytes == 0 || policy.is_default()) { return true; }
+  bool ok = true;
+  std::uintptr_t start = reinterpret_cast<std::uintptr_t>(ptr), limit = start + bytes;
+
+#if defined(MADV_HUGEPAGE)
+  if(policy.pages != MemoryPolicy::pages_default)
+  {
+    std::uintptr_t huge_start = round_up(start, HUGE_PAGE_SIZE);
+    std::uintptr_t huge_limit = (limit / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+    if(huge_start < huge_limit)
+    {
+      ok &= (::madvise(reinterpret_cast<void*>(huge_start), huge_limit - huge_start, MADV_HUGEPAGE) == 0);
+    }
+  }
+#endif
+
+  // Only whole pages within the range can be migrated.
+  std::uintptr_t page_start = round_up(start, page_size());
+  std::uintptr_t page_limit = (limit / page_size()) * page_size();
+  if(page_start < page_limit)
+  {
+    ok &= bind_memory(reinterpret_cast<void*>(page_start), page_limit - page_start, policy, MPOL_MF_MOVE_FLAG);
+  }
+  return ok;
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace gbwtgraph
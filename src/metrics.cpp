@@ -0,0 +1,230 @@
+#include <gbwtgraph/metrics.h>
+
+#include <algorithm>
+#include <ctime>
+#include <sstream>
+
+#include <gbwt/utils.h>
+
+namespace gbwtgraph
+{
+
+//------------------------------------------------------------------------------
+
+void
+Metrics::Histogram::add(size_t value, size_t n)
+{
+  if(n == 0) { return; }
+  size_t b = bucket(value);
+  if(b >= this->buckets.size()) { this->buckets.resize(b + 1, 0); }
+  this->buckets[b] += n;
+  this->count += n;
+  this->sum += value * n;
+  this->max = std::max(this->max, value);
+}
+
+void
+Metrics::Histogram::merge(const Histogram& another)
+{
+  if(another.buckets.size() > this->buckets.size()) { this->buckets.resize(another.buckets.size(), 0); }
+  for(size_t i = 0; i < another.buckets.size(); i++) { this->buckets[i] += another.buckets[i]; }
+  this->count += another.count;
+  this->sum += another.sum;
+  this->max = std::max(this->max, another.max);
+}
+
+size_t
+Metrics::Histogram::bucket(size_t value)
+{
+  size_t result = 0;
+  while(value > 0) { result++; value >>= 1; }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+Metrics::Timer::Timer(Metrics* metrics, const char* name) :
+  metrics(metrics), name(name), start(0.0), cpu_start(0.0)
+{
+  if(this->metrics != nullptr)
+  {
+    this->start = gbwt::readTimer();
+    this->cpu_start = cpu_time();
+  }
+}
+
+void
+Metrics::Timer::stop()
+{
+  if(this->metrics == nullptr) { return; }
+  this->metrics->add_phase(this->name, gbwt::readTimer() - this->start, cpu_time() - this->cpu_start);
+  this->metrics = nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+void
+Metrics::add_phase(const std::string& name, double seconds, double cpu_seconds)
+{
+  size_t memory = gbwt::memoryUsage();
+  std::lock_guard<std::mutex> lock(this->mtx);
+  Phase& phase = this->phases[name];
+  phase.count++;
+  phase.seconds += seconds;
+  phase.cpu_seconds += cpu_seconds;
+  phase.peak_memory = memory;
+}
+
+void
+Metrics::add_counter(const std::string& name, size_t value)
+{
+  std::lock_guard<std::mutex> lock(this->mtx);
+  this->counters[name] += value;
+}
+
+void
+Metrics::add_to_histogram(const std::string& name, size_t value, size_t n)
+{
+  std::lock_guard<std::mutex> lock(this->mtx);
+  this->histograms[name].add(value, n);
+}
+
+void
+Metrics::merge_histogram(const std::string& name, const Histogram& histogram)
+{
+  std::lock_guard<std::mutex> lock(this->mtx);
+  this->histograms[name].merge(histogram);
+}
+
+Metrics::Phase
+Metrics::phase(const std::string& name) const
+{
+  std::lock_guard<std::mutex> lock(this->mtx);
+  auto iter = this->phases.find(name);
+  return (iter == this->phases.end() ? Phase() : iter->second);
+}
+
+size_t
+Metrics::counter(const std::string& name) const
+{
+  std::lock_guard<std::mutex> lock(this->mtx);
+  auto iter = this->counters.find(name);
+  return (iter == this->counters.end() ? 0 : iter->second);
+}
+
+Metrics::Histogram
+Metrics::histogram(const std::string& name) const
+{
+  std::lock_guard<std::mutex> lock(this->mtx);
+  auto iter = this->histograms.find(name);
+  return (iter == this->histograms.end() ? Histogram() : iter->second);
+}
+
+bool
+Metrics::empty() const
+{
+  std::lock_guard<std::mutex> lock(this->mtx);
+  return (this->phases.empty() && this->counters.empty() && this->histograms.empty());
+}
+
+void
+Metrics::clear()
+{
+  std::lock_guard<std::mutex> lock(this->mtx);
+  this->phases.clear();
+  this->counters.clear();
+  this->histograms.clear();
+}
+
+double
+Metrics::cpu_time()
+{
+  return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+//------------------------------------------------------------------------------
+
+namespace
+{
+
+void
+write_json_string(std::ostream& out, const std::string& str)
+{
+  out << "\"";
+  for(char c : str)
+  {
+    switch(c)
+    {
+    case '"':
+      out << "\\\""; break;
+    case '\\':
+      out << "\\\\"; break;
+    case '\n':
+      out << "\\n"; break;
+    case '\t':
+      out << "\\t"; break;
+    default:
+      if(static_cast<unsigned char>(c) < 0x20)
+      {
+        const char* hex = "0123456789abcdef";
+        out << "\\u00" << hex[(c >> 4) & 0xF] << hex[c & 0xF];
+      }
+      else { out << c; }
+    }
+  }
+  out << "\"";
+}
+
+} // anonymous namespace
+
+void
+Metrics::write_json(std::ostream& out) const
+{
+  std::lock_guard<std::mutex> lock(this->mtx);
+
+  out << "{\"phases\":{";
+  for(auto iter = this->phases.begin(); iter != this->phases.end(); ++iter)
+  {
+    if(iter != this->phases.begin()) { out << ","; }
+    write_json_string(out, iter->first);
+    const Phase& phase = iter->second;
+    out << ":{\"count\":" << phase.count << ",\"seconds\":" << phase.seconds << ",\"cpu_seconds\":" << phase.cpu_seconds;
+    out << ",\"peak_memory\":" << phase.peak_memory << "}";
+  }
+
+  out << "},\"counters\":{";
+  for(auto iter = this->counters.begin(); iter != this->counters.end(); ++iter)
+  {
+    if(iter != this->counters.begin()) { out << ","; }
+    write_json_string(out, iter->first);
+    out << ":" << iter->second;
+  }
+
+  out << "},\"histograms\":{";
+  for(auto iter = this->histograms.begin(); iter != this->histograms.end(); ++iter)
+  {
+    if(iter != this->histograms.begin()) { out << ","; }
+    write_json_string(out, iter->first);
+    const Histogram& histogram = iter->second;
+    out << ":{\"count\":" << histogram.count << ",\"sum\":" << histogram.sum << ",\"max\":" << histogram.max << ",\"buckets\":[";
+    for(size_t i = 0; i < histogram.buckets.size(); i++)
+    {
+      if(i > 0) { out << ","; }
+      out << histogram.buckets[i];
+    }
+    out << "]}";
+  }
+  out << "}}";
+}
+
+std::string
+Metrics::to_json() const
+{
+  std::ostringstream out;
+  this->write_json(out);
+  return out.str();
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace gbwtgraph
@@ -2,6 +2,12 @@
 #include <gbwtgraph/minimizer.h>
 #include <string>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 namespace gbwtgraph
 {
 
@@ -203,6 +209,7 @@ constexpr std::uint64_t MinimizerHeader::FLAG_SYNCMERS;
 
 constexpr std::uint32_t MinimizerHeader::V8_VERSION;
 constexpr std::uint64_t MinimizerHeader::V8_FLAG_MASK;
+constexpr std::uint32_t MinimizerHeader::V9_VERSION;
 
 //------------------------------------------------------------------------------
 
@@ -408,6 +415,46 @@ Key64::reverse_complement(size_t k) const
   return Key64(result);
 }
 
+void
+Key64::hash_batch(const Key64* keys, size_t n, size_t* hashes)
+{
+  static_assert(sizeof(Key64) == sizeof(code_type), "Key64::hash_batch(): Keys must be tightly packed");
+  size_t i = 0;
+
+  // This is wang_hash_64() using only lane-wise shifts, additions, and xors.
+#if defined(__AVX2__)
+  const __m256i mask = _mm256_set1_epi64x(KEY_MASK), ones = _mm256_set1_epi64x(-1);
+  for(; i + 4 <= n; i += 4)
+  {
+    __m256i key = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i)), mask);
+    key = _mm256_add_epi64(_mm256_xor_si256(key, ones), _mm256_slli_epi64(key, 21));
+    key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 24));
+    key = _mm256_add_epi64(_mm256_add_epi64(key, _mm256_slli_epi64(key, 3)), _mm256_slli_epi64(key, 8));
+    key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 14));
+    key = _mm256_add_epi64(_mm256_add_epi64(key, _mm256_slli_epi64(key, 2)), _mm256_slli_epi64(key, 4));
+    key = _mm256_xor_si256(key, _mm256_srli_epi64(key, 28));
+    key = _mm256_add_epi64(key, _mm256_slli_epi64(key, 31));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(hashes + i), key);
+  }
+#elif defined(__ARM_NEON)
+  const uint64x2_t mask = vdupq_n_u64(KEY_MASK), ones = vdupq_n_u64(NO_KEY);
+  for(; i + 2 <= n; i += 2)
+  {
+    uint64x2_t key = vandq_u64(vld1q_u64(reinterpret_cast<const std::uint64_t*>(keys + i)), mask);
+    key = vaddq_u64(veorq_u64(key, ones), vshlq_n_u64(key, 21));
+    key = veorq_u64(key, vshrq_n_u64(key, 24));
+    key = vaddq_u64(vaddq_u64(key, vshlq_n_u64(key, 3)), vshlq_n_u64(key, 8));
+    key = veorq_u64(key, vshrq_n_u64(key, 14));
+    key = vaddq_u64(vaddq_u64(key, vshlq_n_u64(key, 2)), vshlq_n_u64(key, 4));
+    key = veorq_u64(key, vshrq_n_u64(key, 28));
+    key = vaddq_u64(key, vshlq_n_u64(key, 31));
+    vst1q_u64(reinterpret_cast<std::uint64_t*>(hashes + i), key);
+  }
+#endif
+
+  for(; i < n; i++) { hashes[i] = keys[i].hash(); }
+}
+
 std::ostream&
 operator<<(std::ostream& out, Key64 value)
 {
@@ -477,6 +524,12 @@ Key128::reverse_complement(size_t k) const
   return Key128(high, low);
 }
 
+void
+Key128::hash_batch(const Key128* keys, size_t n, size_t* hashes)
+{
+  for(size_t i = 0; i < n; i++) { hashes[i] = keys[i].hash(); }
+}
+
 std::ostream&
 operator<<(std::ostream& out, Key128 value)
 {
@@ -559,4 +612,148 @@ hits_in_subgraph(size_t hit_count, const PositionPayload* hits, const std::vecto
 
 //------------------------------------------------------------------------------
 
+constexpr size_t SubgraphFilter::RUN_BITS;
+
+SubgraphFilter::SubgraphFilter() :
+  first(0), universe(0), nodes(0)
+{
+}
+
+SubgraphFilter::SubgraphFilter(const std::vector<nid_t>& subgraph) :
+  first(0), universe(0), nodes(0)
+{
+  if(subgraph.empty()) { return; }
+
+  // Determine the runs.
+  for(nid_t node : subgraph)
+  {
+    if(!(this->runs.empty()) && node < this->runs.back().second) { continue; } // Duplicate.
+    if(!(this->runs.empty()) && node == this->runs.back().second) { this->runs.back().second++; }
+    else { this->runs.emplace_back(node, node + 1); }
+    this->nodes++;
+  }
+
+  // Use a bitmap if it is not larger than the runs.
+  this->first = this->runs.front().first;
+  this->universe = this->runs.back().second - this->first;
+  if(this->universe <= this->runs.size() * RUN_BITS)
+  {
+    this->bitmap = std::vector<std::uint64_t>((this->universe + 63) / 64, 0);
+    for(auto run : this->runs)
+    {
+      for(nid_t node = run.first; node < run.second; node++)
+      {
+        size_t offset = node - this->first;
+        this->bitmap[offset / 64] |= std::uint64_t(1) << (offset % 64);
+      }
+    }
+    this->runs = std::vector<std::pair<nid_t, nid_t>>();
+  }
+}
+
+std::vector<nid_t>
+sorted_nodes(const std::unordered_set<nid_t>& subgraph)
+{
+  std::vector<nid_t> result(subgraph.begin(), subgraph.end());
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+SubgraphFilter::SubgraphFilter(const std::unordered_set<nid_t>& subgraph) :
+  SubgraphFilter(sorted_nodes(subgraph))
+{
+}
+
+//------------------------------------------------------------------------------
+
+// Appends the hits in the subgraph to the output using the bitmap.
+void
+bitmap_hits(const PositionPayload* hits, size_t hit_count, const SubgraphFilter& subgraph, std::vector<std::pair<pos_t, Payload>>& output)
+{
+  size_t i = 0;
+
+#if defined(__AVX2__)
+  static_assert(sizeof(PositionPayload) == 3 * sizeof(std::uint64_t), "bitmap_hits(): Unexpected PositionPayload size");
+  // Node identifiers fit in 53 bits, so signed comparisons are safe.
+  const __m256i stride = _mm256_setr_epi64x(0, 3, 6, 9);
+  const __m256i first = _mm256_set1_epi64x(subgraph.first), universe = _mm256_set1_epi64x(subgraph.universe);
+  const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi64x(1), low_bits = _mm256_set1_epi64x(63);
+  const long long* bitmap = reinterpret_cast<const long long*>(subgraph.bitmap.data());
+  for(; i + 4 <= hit_count; i += 4)
+  {
+    __m256i codes = _mm256_i64gather_epi64(reinterpret_cast<const long long*>(hits + i), stride, 8);
+    __m256i offsets = _mm256_sub_epi64(_mm256_srli_epi64(codes, Position::ID_OFFSET), first);
+    __m256i in_range = _mm256_andnot_si256(_mm256_cmpgt_epi64(zero, offsets), _mm256_cmpgt_epi64(universe, offsets));
+    __m256i words = _mm256_mask_i64gather_epi64(zero, bitmap, _mm256_srli_epi64(offsets, 6), in_range, 8);
+    __m256i bits = _mm256_and_si256(_mm256_srlv_epi64(words, _mm256_and_si256(offsets, low_bits)), one);
+    bits = _mm256_and_si256(_mm256_cmpeq_epi64(bits, one), in_range);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(bits));
+    while(mask != 0)
+    {
+      size_t j = i + __builtin_ctz(mask);
+      output.emplace_back(hits[j].position.decode(), hits[j].payload);
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for(; i < hit_count; i++)
+  {
+    if(subgraph.contains(hits[i].position.id())) { output.emplace_back(hits[i].position.decode(), hits[i].payload); }
+  }
+}
+
+// Appends the hits in the subgraph to the output using the runs.
+void
+run_hits(const PositionPayload* hits, size_t hit_count, const SubgraphFilter& subgraph, std::vector<std::pair<pos_t, Payload>>& output)
+{
+  const std::vector<std::pair<nid_t, nid_t>>& runs = subgraph.runs;
+  size_t hit_offset = 0, run_offset = 0;
+  while(hit_offset < hit_count && run_offset < runs.size())
+  {
+    nid_t node = hits[hit_offset].position.id();
+    if(node < runs[run_offset].first)
+    {
+      hit_offset = exponential_search(hit_offset, hit_count, runs[run_offset].first, [&](size_t offset) -> nid_t
+      {
+        return hits[offset].position.id();
+      });
+    }
+    else if(node >= runs[run_offset].second)
+    {
+      // Find the first run ending after the node.
+      run_offset = exponential_search(run_offset, runs.size(), node + 1, [&](size_t offset) -> nid_t
+      {
+        return runs[offset].second;
+      });
+    }
+    else
+    {
+      output.emplace_back(hits[hit_offset].position.decode(), hits[hit_offset].payload);
+      ++hit_offset;
+    }
+  }
+}
+
+void
+hits_in_subgraph(const std::vector<std::pair<const PositionPayload*, size_t>>& hits, const SubgraphFilter& subgraph,
+                 std::vector<std::pair<pos_t, Payload>>& output, std::vector<size_t>& boundaries)
+{
+  output.clear();
+  boundaries.clear();
+  boundaries.reserve(hits.size() + 1);
+  boundaries.push_back(0);
+  for(auto list : hits)
+  {
+    if(list.second > 0 && !(subgraph.empty()))
+    {
+      if(subgraph.is_bitmap()) { bitmap_hits(list.first, list.second, subgraph, output); }
+      else { run_hits(list.first, list.second, subgraph, output); }
+    }
+    boundaries.push_back(output.size());
+  }
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace gbwtgraph
@@ -6,8 +6,11 @@
 #include <algorithm>
 #include <deque>
 #include <limits>
-#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+
+#include <omp.h>
 
 namespace gbwtgraph
 {
@@ -31,38 +34,62 @@ find_first(std::vector<NodeCoverage>& array, nid_t id)
   return first;
 }
 
-std::vector<handle_t>
-reverse_complement(const HandleGraph& graph, std::vector<handle_t>& forward)
+// Hash for k-node windows.
+struct WindowHash
 {
-  std::vector<handle_t> result = forward;
-  std::reverse(result.begin(), result.end());
-  for(handle_t& handle : result) { handle = graph.flip(handle); }
-  return result;
+  size_t operator()(const std::vector<handle_t>& window) const
+  {
+    size_t result = 0;
+    for(const handle_t& handle : window)
+    {
+      result ^= wang_hash_64(handlegraph::as_integer(handle)) + 0x9e3779b9 + (result << 6) + (result >> 2);
+    }
+    return result;
+  }
+};
+
+// Coverage for k-node windows in the canonical orientation.
+template<class coverage_t>
+using window_coverage = std::unordered_map<std::vector<handle_t>, coverage_t, WindowHash>;
+
+// Replaces the window with its reverse complement if that is lexicographically
+// smaller.
+void
+canonical_window(const HandleGraph& graph, std::vector<handle_t>& window)
+{
+  size_t k = window.size();
+  for(size_t i = 0; i < k; i++)
+  {
+    handle_t reverse = graph.flip(window[k - 1 - i]);
+    if(window[i] < reverse) { return; }
+    if(reverse < window[i])
+    {
+      std::reverse(window.begin(), window.end());
+      for(handle_t& handle : window) { handle = graph.flip(handle); }
+      return;
+    }
+  }
 }
 
-std::vector<handle_t>
-forward_window(const HandleGraph& graph, const std::deque<handle_t>& path, const handle_t& successor, size_t k)
+// Stores the canonical window ending with the successor in `window`.
+void
+forward_window(const HandleGraph& graph, const std::deque<handle_t>& path, const handle_t& successor, size_t k, std::vector<handle_t>& window)
 {
   if(path.size() + 1 < k) { k = path.size() + 1; } // Handle the short initial paths in DAGs.
-  std::vector<handle_t> forward;
-  forward.reserve(k);
-  forward.insert(forward.end(), path.end() - (k - 1), path.end());
-  forward.push_back(successor);
-
-  std::vector<handle_t> reverse = reverse_complement(graph, forward);
-  return (forward < reverse ? forward : reverse);
+  window.clear();
+  window.insert(window.end(), path.end() - (k - 1), path.end());
+  window.push_back(successor);
+  canonical_window(graph, window);
 }
 
-std::vector<handle_t>
-backward_window(const HandleGraph& graph, const std::deque<handle_t>& path, const handle_t& predecessor, size_t k)
+// Stores the canonical window starting with the predecessor in `window`.
+void
+backward_window(const HandleGraph& graph, const std::deque<handle_t>& path, const handle_t& predecessor, size_t k, std::vector<handle_t>& window)
 {
-  std::vector<handle_t> forward;
-  forward.reserve(k);
-  forward.push_back(predecessor);
-  forward.insert(forward.end(), path.begin(), path.begin() + (k - 1));
-
-  std::vector<handle_t> reverse = reverse_complement(graph, forward);
-  return (forward < reverse ? forward : reverse);
+  window.clear();
+  window.push_back(predecessor);
+  window.insert(window.end(), path.begin(), path.begin() + (k - 1));
+  canonical_window(graph, window);
 }
 
 template<class Coverage>
@@ -112,10 +139,11 @@ struct SimpleCoverage
     return node_coverage;
   }
 
-  static bool extend_forward(const graph_t& graph, std::deque<handle_t>& path, size_t k, std::vector<node_coverage_t>& node_coverage, std::map<std::vector<handle_t>, coverage_t>& path_coverage, bool acyclic)
+  static bool extend_forward(const graph_t& graph, std::deque<handle_t>& path, size_t k, std::vector<node_coverage_t>& node_coverage, window_coverage<coverage_t>& path_coverage, bool acyclic)
   {
     bool success = false;
     BestCoverage<SimpleCoverage> best;
+    std::vector<handle_t> window;
     graph.follow_edges(path.back(), false, [&](const handle_t& next)
     {
       success = true;
@@ -126,7 +154,7 @@ struct SimpleCoverage
       }
       else
       {
-        std::vector<handle_t> window = forward_window(graph, path, next, k);
+        forward_window(graph, path, next, k, window);
         best.update(path_coverage[window], next);
       }
     });
@@ -135,7 +163,7 @@ struct SimpleCoverage
     {
       if(acyclic || path.size() + 1 >= k)
       {
-        std::vector<handle_t> window = forward_window(graph, path, best.handle, k);
+        forward_window(graph, path, best.handle, k, window);
         increase_coverage(path_coverage[window]);
       }
       if(!acyclic)
@@ -149,10 +177,11 @@ struct SimpleCoverage
     return success;
   }
 
-  static bool extend_backward(const graph_t& graph, std::deque<handle_t>& path, size_t k, std::vector<node_coverage_t>& node_coverage, std::map<std::vector<handle_t>, coverage_t>& path_coverage)
+  static bool extend_backward(const graph_t& graph, std::deque<handle_t>& path, size_t k, std::vector<node_coverage_t>& node_coverage, window_coverage<coverage_t>& path_coverage)
   {
     bool success = false;
     BestCoverage<SimpleCoverage> best;
+    std::vector<handle_t> window;
     graph.follow_edges(path.front(), true, [&](const handle_t& prev)
     {
       success = true;
@@ -163,7 +192,7 @@ struct SimpleCoverage
       }
       else
       {
-        std::vector<handle_t> window = backward_window(graph, path, prev, k);
+        backward_window(graph, path, prev, k, window);
         best.update(path_coverage[window], prev);
       }
     });
@@ -172,7 +201,7 @@ struct SimpleCoverage
     {
       if(path.size() + 1 >= k)
       {
-        std::vector<handle_t> window = backward_window(graph, path, best.handle, k);
+        backward_window(graph, path, best.handle, k, window);
         increase_coverage(path_coverage[window]);
       }
       size_t first = find_first(node_coverage, graph.get_id(best.handle));
@@ -250,10 +279,11 @@ struct LocalHaplotypes
     return node_coverage;
   }
 
-  static bool extend_forward(const graph_t& graph, std::deque<handle_t>& path, size_t k, std::vector<node_coverage_t>& node_coverage, std::map<std::vector<handle_t>, coverage_t>& path_coverage, bool acyclic)
+  static bool extend_forward(const graph_t& graph, std::deque<handle_t>& path, size_t k, std::vector<node_coverage_t>& node_coverage, window_coverage<coverage_t>& path_coverage, bool acyclic)
   {
     bool success = false;
     BestCoverage<LocalHaplotypes> best;
+    std::vector<handle_t> window;
     auto start = (path.size() + 1 < k ? path.begin() : path.end() - (k - 1));
     std::vector<handle_t> context(start, path.end());
     gbwt::BidirectionalState state = graph.bd_find(context);
@@ -268,10 +298,11 @@ struct LocalHaplotypes
       }
       else
       {
-        std::vector<handle_t> window = forward_window(graph, path, handle, k);
+        forward_window(graph, path, handle, k, window);
         // Insert empty coverage or find the existing coverage.
-        auto result = path_coverage.insert({ window, coverage_t(next.size()) });
-        best.update(result.first->second, handle);
+        auto iter = path_coverage.find(window);
+        if(iter == path_coverage.end()) { iter = path_coverage.emplace(window, coverage_t(next.size())).first; }
+        best.update(iter->second, handle);
       }
       return true;
     });
@@ -280,7 +311,7 @@ struct LocalHaplotypes
     {
       if(acyclic || path.size() + 1 >= k)
       {
-        std::vector<handle_t> window = forward_window(graph, path, best.handle, k);
+        forward_window(graph, path, best.handle, k, window);
         increase_coverage(path_coverage[window]);
       }
       if(!acyclic)
@@ -294,10 +325,11 @@ struct LocalHaplotypes
     return success;
   }
 
-  static bool extend_backward(const graph_t& graph, std::deque<handle_t>& path, size_t k, std::vector<node_coverage_t>& node_coverage, std::map<std::vector<handle_t>, coverage_t>& path_coverage)
+  static bool extend_backward(const graph_t& graph, std::deque<handle_t>& path, size_t k, std::vector<node_coverage_t>& node_coverage, window_coverage<coverage_t>& path_coverage)
   {
     bool success = false;
     BestCoverage<LocalHaplotypes> best;
+    std::vector<handle_t> window;
     auto limit = (path.size() + 1 < k ? path.end() : path.begin() + (k - 1));
     std::vector<handle_t> context(path.begin(), limit);
     gbwt::BidirectionalState state = graph.bd_find(context);
@@ -313,10 +345,11 @@ struct LocalHaplotypes
       }
       else
       {
-        std::vector<handle_t> window = backward_window(graph, path, handle, k);
+        backward_window(graph, path, handle, k, window);
         // Insert empty coverage or find the existing coverage.
-        auto result = path_coverage.insert({ window, coverage_t(prev.size()) });
-        best.update(result.first->second, handle);
+        auto iter = path_coverage.find(window);
+        if(iter == path_coverage.end()) { iter = path_coverage.emplace(window, coverage_t(prev.size())).first; }
+        best.update(iter->second, handle);
       }
       return true;
     });
@@ -325,7 +358,7 @@ struct LocalHaplotypes
     {
       if(path.size() + 1 >= k)
       {
-        std::vector<handle_t> window = backward_window(graph, path, best.handle, k);
+        backward_window(graph, path, best.handle, k, window);
         increase_coverage(path_coverage[window]);
       }
       size_t first = find_first(node_coverage, graph.get_id(best.handle));
@@ -389,6 +422,10 @@ component_path_cover(
 
   std::vector<nid_t> head_nodes = is_nice_and_acyclic(graph, component);
   bool acyclic = !(head_nodes.empty());
+  if(parameters.metrics != nullptr && acyclic)
+  {
+    parameters.metrics->add_counter("path_cover/acyclic_components");
+  }
   if(parameters.show_progress)
   {
     std::string msg =
@@ -396,7 +433,7 @@ component_path_cover(
       ", component " + std::to_string(component_id) +
       ": " + Coverage::name();
     if(acyclic) { msg += " (acyclic)"; }
-    //#pragma omp critical
+    #pragma omp critical
     {
       std::cerr << msg << std::endl;
     }
@@ -404,7 +441,7 @@ component_path_cover(
 
   // Node coverage for the potential starting nodes.
   std::vector<node_coverage_t> node_coverage = Coverage::init_node_coverage(graph, (acyclic ? head_nodes : component));
-  std::map<std::vector<handle_t>, coverage_t> path_coverage; // Path and its reverse complement are equivalent.
+  window_coverage<coverage_t> path_coverage; // Path and its reverse complement are equivalent.
 
   // Node coverage will be empty if we cannot create this type of path cover for the component.
   // For example, if there are no haplotypes for LocalHaplotypes.
@@ -412,7 +449,7 @@ component_path_cover(
   {
     if(parameters.show_progress)
     {
-      //#pragma omp critical
+      #pragma omp critical
       {
         std::cerr << Coverage::name() << ": Cannot find this type of path cover for component " << component_id << std::endl;
       }
@@ -579,7 +616,15 @@ path_cover_gbwt(
   size_t size_bound = graph.get_node_count() / std::max(size_t(1), parameters.approximate_num_jobs);
 
   // Determine GBWT construction jobs.
+  Metrics::Timer total_timer(parameters.metrics, "path_cover");
+  Metrics::Timer timer(parameters.metrics, "path_cover/jobs");
   ConstructionJobs jobs = gbwt_construction_jobs(graph, size_bound);
+  timer.stop();
+  if(parameters.metrics != nullptr)
+  {
+    parameters.metrics->add_counter("path_cover/components", jobs.components());
+    parameters.metrics->add_counter("path_cover/jobs", jobs.size());
+  }
   MetadataBuilder metadata;
 
   // Assign the paths we want to include to construction jobs.
@@ -612,11 +657,12 @@ path_cover_gbwt(
   // Create the actual path cover.
   std::vector<gbwt::GBWT> partial_indexes(jobs.size());
   std::vector<std::vector<size_t>> components_per_job = jobs.components_per_job();
-  //int old_threads = omp_get_max_threads();
-  //omp_set_num_threads(parameters.parallel_jobs);
-  //#pragma omp parallel for schedule(dynamic, 1)
+  int old_threads = omp_get_max_threads();
+  omp_set_num_threads(std::max(parameters.parallel_jobs, size_t(1)));
+  #pragma omp parallel for schedule(dynamic, 1)
   for(size_t job = 0; job < jobs.size(); job++)
   {
+    double job_start = gbwt::readTimer();
     gbwt::GBWTBuilder builder(node_width, parameters.batch_size, parameters.sample_interval);
 
     insert_paths(graph, paths_to_include[job], builder, job, parameters.show_progress);
@@ -630,15 +676,23 @@ path_cover_gbwt(
 
     builder.finish();
     partial_indexes[job] = gbwt::GBWT(builder.index);
+    if(parameters.metrics != nullptr)
+    {
+      // CPU time is not meaningful for a single job, as it includes all threads.
+      parameters.metrics->add_phase("path_cover/job", gbwt::readTimer() - job_start, 0.0);
+      parameters.metrics->add_to_histogram("path_cover/job_components", components_per_job[job].size());
+    }
   }
-  //omp_set_num_threads(old_threads);
+  omp_set_num_threads(old_threads);
 
   // Merge the GBWTs and add metadata.
   if(parameters.show_progress)
   {
     std::cerr << "Merging " << partial_indexes.size() << " partial GBWTs" << std::endl;
   }
+  Metrics::Timer merge_timer(parameters.metrics, "path_cover/merge");
   gbwt::GBWT result(partial_indexes);
+  merge_timer.stop();
   result.addMetadata();
   result.metadata = metadata.get_metadata();
 
@@ -667,7 +721,15 @@ local_haplotypes(
   size_t size_bound = graph.get_node_count() / std::max(size_t(1), parameters.approximate_num_jobs);
 
   // Determine GBWT construction jobs.
+  Metrics::Timer total_timer(parameters.metrics, "path_cover");
+  Metrics::Timer timer(parameters.metrics, "path_cover/jobs");
   ConstructionJobs jobs = gbwt_construction_jobs(graph, size_bound);
+  timer.stop();
+  if(parameters.metrics != nullptr)
+  {
+    parameters.metrics->add_counter("path_cover/components", jobs.components());
+    parameters.metrics->add_counter("path_cover/jobs", jobs.size());
+  }
   MetadataBuilder metadata;
 
   // Assign the paths we want to include to construction jobs.
@@ -719,11 +781,12 @@ local_haplotypes(
   // Create the actual path cover.
   std::vector<gbwt::GBWT> partial_indexes(jobs.size());
   std::vector<std::vector<size_t>> components_per_job = jobs.components_per_job();
-  int old_threads = 1;//omp_get_max_threads();
-  //omp_set_num_threads(parameters.parallel_jobs);
-  //#pragma omp parallel for schedule(dynamic, 1)
+  int old_threads = omp_get_max_threads();
+  omp_set_num_threads(std::max(parameters.parallel_jobs, size_t(1)));
+  #pragma omp parallel for schedule(dynamic, 1)
   for(size_t job = 0; job < jobs.size(); job++)
   {
+    double job_start = gbwt::readTimer();
     gbwt::GBWTBuilder builder(node_width, parameters.batch_size, parameters.sample_interval);
 
     insert_paths(graph, paths_to_include[job], builder, job, parameters.show_progress);
@@ -741,15 +804,23 @@ local_haplotypes(
 
     builder.finish();
     partial_indexes[job] = gbwt::GBWT(builder.index);
+    if(parameters.metrics != nullptr)
+    {
+      // CPU time is not meaningful for a single job, as it includes all threads.
+      parameters.metrics->add_phase("path_cover/job", gbwt::readTimer() - job_start, 0.0);
+      parameters.metrics->add_to_histogram("path_cover/job_components", components_per_job[job].size());
+    }
   }
-  //omp_set_num_threads(old_threads);
+  omp_set_num_threads(old_threads);
 
   // Merge the GBWTs and add metadata.
   if(parameters.show_progress)
   {
     std::cerr << "Merging " << partial_indexes.size() << " partial GBWTs" << std::endl;
   }
+  Metrics::Timer merge_timer(parameters.metrics, "path_cover/merge");
   gbwt::GBWT result(partial_indexes);
+  merge_timer.stop();
   result.addMetadata();
   result.metadata = metadata.get_metadata();
 
@@ -796,7 +867,8 @@ augment_gbwt(
   std::vector<std::vector<nid_t>> components = weakly_connected_components(graph);
 
   // Handle each component separately, but only if there are no GBWT paths in it.
-  size_t augmented_components = 0;
+  std::vector<size_t> to_augment;
+  size_t total_nodes = 0;
   for(size_t component = 0; component < components.size(); component++)
   {
     bool has_paths = false;
@@ -810,19 +882,71 @@ augment_gbwt(
       }
     }
     if(has_paths) { continue; }
-    component_path_cover<SimpleCoverage>(
-      graph, builder, components[component],
-      0, component, parameters
-    );
+    to_augment.push_back(component);
+    total_nodes += components[component].size();
     for(size_t i = 0; i < parameters.num_paths; i++)
     {
       metadata.add_haplotype("path_cover_" + std::to_string(i), "component_" + std::to_string(component), 0, 0, 0);
     }
-    augmented_components++;
   }
 
-  // Finish the construction and add the updated metadata.
+  // Partition the components into contiguous jobs of approximately equal size.
+  // Job 0 inserts into the existing index, while the other jobs build partial
+  // indexes that are merged in order. This keeps the paths in metadata order.
+  size_t parallel_jobs = std::max(std::min(parameters.parallel_jobs, to_augment.size()), size_t(1));
+  std::vector<size_t> job_start(1, 0);
+  {
+    size_t job_nodes = 0;
+    for(size_t i = 0; i < to_augment.size(); i++)
+    {
+      if(job_start.size() < parallel_jobs && job_nodes * parallel_jobs >= total_nodes)
+      {
+        job_start.push_back(i);
+        job_nodes = 0;
+      }
+      job_nodes += components[to_augment[i]].size();
+    }
+    job_start.push_back(to_augment.size());
+  }
+  size_t jobs = job_start.size() - 1;
+
+  std::vector<gbwt::GBWT> partial_indexes(jobs);
+  int old_threads = omp_get_max_threads();
+  omp_set_num_threads(parallel_jobs);
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_t job = 0; job < jobs; job++)
+  {
+    std::unique_ptr<gbwt::GBWTBuilder> partial_builder;
+    if(job > 0) { partial_builder.reset(new gbwt::GBWTBuilder(node_width, parameters.batch_size, parameters.sample_interval)); }
+    gbwt::GBWTBuilder& job_builder = (job > 0 ? *partial_builder : builder);
+    for(size_t i = job_start[job]; i < job_start[job + 1]; i++)
+    {
+      size_t component = to_augment[i];
+      component_path_cover<SimpleCoverage>(
+        graph, job_builder, components[component],
+        job, component, parameters
+      );
+    }
+    if(job > 0)
+    {
+      partial_builder->finish();
+      partial_indexes[job] = gbwt::GBWT(partial_builder->index);
+    }
+  }
+  omp_set_num_threads(old_threads);
+  size_t augmented_components = to_augment.size();
+
+  // Finish the construction, merge the partial indexes, and add the updated metadata.
+  // Merging inserts the partial paths in batches of sequences rather than nodes,
+  // so we convert the batch size using the average length of the partial paths.
   builder.finish();
+  for(size_t job = 1; job < jobs; job++)
+  {
+    const gbwt::GBWT& partial = partial_indexes[job];
+    gbwt::size_type merge_batch = parameters.batch_size * partial.sequences() / std::max(partial.size(), gbwt::size_type(1));
+    builder.index.merge(partial, std::max(merge_batch, gbwt::size_type(1)), parameters.sample_interval);
+  }
+  builder.index.addMetadata(); // Merging may drop the metadata.
   builder.index.metadata = metadata.get_metadata();
   builder.swapIndex(index);
 
@@ -3,8 +3,9 @@
 #include <gbwtgraph/internal.h>
 
 
+#include <algorithm>
 #include <queue>
-#include <map>
+#include <unordered_map>
 
 namespace gbwtgraph
 {
@@ -13,13 +14,70 @@ namespace gbwtgraph
 
 // Numerical class constants.
 constexpr size_t PathIndex::DEFAULT_SAMPLE_INTERVAL;
+constexpr std::uint32_t PathIndex::Header::TAG;
+constexpr std::uint32_t PathIndex::Header::VERSION;
+constexpr std::uint64_t PathIndex::Header::FLAG_MASK;
+
+// Other class variables.
+const std::string PathIndex::EXTENSION = ".pathindex";
+
+//------------------------------------------------------------------------------
+
+PathIndex::Header::Header() :
+  tag(TAG), version(VERSION),
+  paths(0), sample_interval(DEFAULT_SAMPLE_INTERVAL),
+  checksum(0), flags(0)
+{
+}
+
+void
+PathIndex::Header::check() const
+{
+  if(this->tag != TAG)
+  {
+    throw sdsl::simple_sds::InvalidData("PathIndex: Invalid tag");
+  }
+
+  if(this->version != VERSION)
+  {
+    std::string msg = "PathIndex: Expected v" + std::to_string(VERSION) + ", got v" + std::to_string(this->version);
+    throw sdsl::simple_sds::InvalidData(msg);
+  }
+
+  std::uint64_t mask = 0;
+  switch(this->version)
+  {
+  case VERSION:
+    mask = FLAG_MASK; break;
+  }
+  if((this->flags & mask) != this->flags)
+  {
+    throw sdsl::simple_sds::InvalidData("PathIndex: Invalid flags");
+  }
+}
+
+bool
+PathIndex::Header::operator==(const Header& another) const
+{
+  return (this->tag == another.tag && this->version == another.version &&
+    this->paths == another.paths && this->sample_interval == another.sample_interval &&
+    this->checksum == another.checksum && this->flags == another.flags);
+}
 
 //------------------------------------------------------------------------------
 
+PathIndex::PathIndex()
+{
+}
+
 PathIndex::PathIndex(const GBZ& gbz, size_t sample_interval) :
   sequence_positions(gbz.graph.named_paths.size()), gbwt_positions(gbz.graph.named_paths.size())
 {
-  //#pragma omp parallel for schedule(dynamic, 1)
+  this->header.paths = gbz.graph.named_paths.size();
+  this->header.sample_interval = sample_interval;
+  this->header.checksum = checksum(gbz);
+
+  #pragma omp parallel for schedule(dynamic, 1)
   for(size_t i = 0; i < gbz.graph.named_paths.size(); i++)
   {
     size_t length = 0;
@@ -44,6 +102,114 @@ PathIndex::sampled_position(path_handle_t handle, size_t offset) const
   return std::make_pair(iter->second, this->gbwt_positions[path_id][iter->first]);
 }
 
+void
+PathIndex::simple_sds_serialize(std::ostream& out) const
+{
+  sdsl::simple_sds::serialize_value(this->header, out);
+  for(const sdsl::sd_vector<>& positions : this->sequence_positions) { positions.simple_sds_serialize(out); }
+
+  // The GBWT positions are concatenated and stored as pairs of words.
+  std::vector<std::uint64_t> words, lengths;
+  lengths.reserve(this->gbwt_positions.size());
+  for(const std::vector<gbwt::edge_type>& positions : this->gbwt_positions)
+  {
+    for(const gbwt::edge_type& pos : positions) { words.push_back(pos.first); words.push_back(pos.second); }
+    lengths.push_back(positions.size());
+  }
+  sdsl::simple_sds::serialize_vector(words, out);
+  sdsl::simple_sds::serialize_vector(lengths, out);
+}
+
+void
+PathIndex::simple_sds_load(std::istream& in)
+{
+  this->header = sdsl::simple_sds::load_value<Header>(in);
+  this->header.check();
+
+  this->sequence_positions = std::vector<sdsl::sd_vector<>>(this->header.paths);
+  for(sdsl::sd_vector<>& positions : this->sequence_positions) { positions.simple_sds_load(in); }
+
+  std::vector<std::uint64_t> words = sdsl::simple_sds::load_vector<std::uint64_t>(in);
+  std::vector<std::uint64_t> lengths = sdsl::simple_sds::load_vector<std::uint64_t>(in);
+  if(lengths.size() != this->header.paths)
+  {
+    throw sdsl::simple_sds::InvalidData("PathIndex: Invalid number of GBWT position lists");
+  }
+  this->gbwt_positions = std::vector<std::vector<gbwt::edge_type>>(this->header.paths);
+  size_t offset = 0;
+  for(size_t i = 0; i < lengths.size(); i++)
+  {
+    if(lengths[i] != this->sequence_positions[i].ones() || offset + 2 * lengths[i] > words.size())
+    {
+      throw sdsl::simple_sds::InvalidData("PathIndex: Invalid number of GBWT positions for path " + std::to_string(i));
+    }
+    this->gbwt_positions[i].reserve(lengths[i]);
+    for(size_t j = 0; j < lengths[i]; j++, offset += 2)
+    {
+      this->gbwt_positions[i].push_back(gbwt::edge_type(words[offset], words[offset + 1]));
+    }
+  }
+  if(offset != words.size())
+  {
+    throw sdsl::simple_sds::InvalidData("PathIndex: Invalid number of GBWT positions");
+  }
+}
+
+size_t
+PathIndex::simple_sds_size() const
+{
+  size_t result = sdsl::simple_sds::value_size(this->header);
+  size_t positions = 0;
+  for(size_t i = 0; i < this->paths(); i++)
+  {
+    result += this->sequence_positions[i].simple_sds_size();
+    positions += this->gbwt_positions[i].size();
+  }
+  size_t empty_vector = sdsl::simple_sds::vector_size(std::vector<std::uint64_t>());
+  result += empty_vector + 2 * positions; // GBWT positions.
+  result += empty_vector + this->paths(); // Lengths.
+  return result;
+}
+
+bool
+PathIndex::compatible(const GBZ& gbz, size_t sample_interval) const
+{
+  if(this->header.sample_interval != sample_interval || this->header.checksum != checksum(gbz)) { return false; }
+  if(this->paths() != gbz.graph.named_paths.size()) { return false; }
+  for(size_t i = 0; i < this->paths(); i++)
+  {
+    const NamedPath& path = gbz.graph.named_paths[i];
+    gbwt::edge_type first = (this->gbwt_positions[i].empty() ? gbwt::invalid_edge() : this->gbwt_positions[i].front());
+    if(first != path.from) { return false; }
+    // NamedPath::length is in nodes and the stored length in bp, and each node
+    // has at least one base.
+    if((path.length == 0) != (this->sequence_positions[i].size() == 0) || this->sequence_positions[i].size() < path.length) { return false; }
+  }
+  return true;
+}
+
+std::uint64_t
+PathIndex::checksum(const GBZ& gbz)
+{
+  std::uint64_t result = 0;
+  auto combine = [&](std::uint64_t value)
+  {
+    result ^= wang_hash_64(value) + 0x9e3779b9 + (result << 6) + (result >> 2);
+  };
+
+  combine(gbz.index.size()); combine(gbz.index.sequences()); combine(gbz.index.sigma());
+  combine(gbz.graph.get_node_count()); combine(gbz.graph.sequences.length());
+  combine(gbz.graph.named_paths.size());
+  for(const NamedPath& path : gbz.graph.named_paths)
+  {
+    combine(path.id);
+    combine(path.from.first); combine(path.from.second);
+    combine(path.to.first); combine(path.to.second);
+    combine(path.length);
+  }
+  return result;
+}
+
 //------------------------------------------------------------------------------
 
 SubgraphQuery
@@ -159,10 +325,45 @@ find_position(const GBZ& gbz, const PathIndex& path_index, const SubgraphQuery&
   }
 }
 
-std::set<nid_t>
-find_subgraph(const GBWTGraph& graph, pos_t position, size_t context)
+/*
+  The nodes of a subgraph in sorted order with their node lengths and
+  decompressed GBWT records. Record `2 * i + is_reverse` belongs to node
+  `nodes.ids[i]`, so the records are in GBWT node order. Each record is
+  decompressed once and shared by subgraph search and path extraction.
+*/
+struct Subgraph::LocalGraph
 {
-  std::set<nid_t> result;
+  NodeRanks nodes;
+  std::vector<size_t> lengths;
+  std::vector<gbwt::DecompressedRecord> records;
+
+  size_t size() const { return this->nodes.size(); }
+
+  // Returns the offset of the record for the GBWT node or `records.size()` if
+  // the node is not in the subgraph.
+  size_t find_record(gbwt::node_type node) const
+  {
+    if(node == gbwt::ENDMARKER) { return this->records.size(); }
+    size_t rank = this->nodes.find(gbwt::Node::id(node));
+    return (rank < this->size() ? 2 * rank + gbwt::Node::is_reverse(node) : this->records.size());
+  }
+
+  gbwt::node_type record_node(size_t record) const
+  {
+    return gbwt::Node::encode(this->nodes.ids[record / 2], record & 1);
+  }
+};
+
+void
+find_subgraph(const GBZ& gbz, pos_t position, size_t context, Subgraph::LocalGraph& subgraph)
+{
+  const GBWTGraph& graph = gbz.graph;
+
+  // The nodes in the order they were visited, with their offsets in that order.
+  std::unordered_map<nid_t, size_t> visited;
+  std::vector<nid_t> ids;
+  std::vector<size_t> lengths;
+  std::vector<gbwt::DecompressedRecord> records;
 
   struct Comparator
   {
@@ -179,25 +380,45 @@ find_subgraph(const GBWTGraph& graph, pos_t position, size_t context)
   while(!queue.empty())
   {
     std::pair<size_t, pos_t> current = queue.top(); queue.pop();
-    if(result.find(id(current.second)) != result.end()) { continue; }
-    result.insert(id(current.second));
+    nid_t node_id = id(current.second);
+    if(!(visited.emplace(node_id, ids.size()).second)) { continue; }
+    size_t node_len = graph.get_sequence_view(GBWTGraph::node_to_handle(gbwt::Node::encode(node_id, false))).second;
+    ids.push_back(node_id);
+    lengths.push_back(node_len);
     for(bool is_reverse : { false, true })
     {
-      handle_t handle = graph.get_handle(id(current.second), is_reverse);
+      records.emplace_back(gbz.index.record(gbwt::Node::encode(node_id, is_reverse)));
+      const gbwt::DecompressedRecord& record = records.back();
       size_t distance = current.first;
-      if(is_reverse == is_rev(current.second)) { distance += graph.get_length(handle) - offset(current.second); }
+      if(is_reverse == is_rev(current.second)) { distance += node_len - offset(current.second); }
       else { distance += offset(current.second) + 1; }
       if(distance <= context)
       {
-        graph.follow_edges(handle, false, [&](const handle_t& next)
+        for(gbwt::rank_type outrank = 0; outrank < record.outdegree(); outrank++)
         {
-          queue.push(std::make_pair(distance, make_pos_t(graph.get_id(next), graph.get_is_reverse(next), 0)));
-        });
+          gbwt::node_type next = record.successor(outrank);
+          if(next == gbwt::ENDMARKER) { continue; }
+          queue.push(std::make_pair(distance, make_pos_t(gbwt::Node::id(next), gbwt::Node::is_reverse(next), 0)));
+        }
       }
     }
   }
 
-  return result;
+  // Sort the nodes by id.
+  std::vector<size_t> order(ids.size());
+  for(size_t i = 0; i < order.size(); i++) { order[i] = i; }
+  std::sort(order.begin(), order.end(), [&](size_t a, size_t b) -> bool { return (ids[a] < ids[b]); });
+  std::vector<nid_t> sorted_ids; sorted_ids.reserve(ids.size());
+  subgraph.lengths.clear(); subgraph.lengths.reserve(ids.size());
+  subgraph.records.clear(); subgraph.records.reserve(records.size());
+  for(size_t i : order)
+  {
+    sorted_ids.push_back(ids[i]);
+    subgraph.lengths.push_back(lengths[i]);
+    subgraph.records.push_back(std::move(records[2 * i]));
+    subgraph.records.push_back(std::move(records[2 * i + 1]));
+  }
+  subgraph.nodes = NodeRanks(std::move(sorted_ids));
 }
 
 void
@@ -249,49 +470,11 @@ append_edits(
 std::string
 align_paths(const GBWTGraph& graph, const gbwt::vector_type& reference, const gbwt::vector_type& path)
 {
-  // TODO: This uses the basic quadratic longest common subsequence algorithm
-  // over the node sequences. If the subgraph is large, we could use something
-  // more efficient.
-  std::vector<std::vector<std::uint32_t>> dp(path.size() + 1, std::vector<std::uint32_t>(reference.size() + 1, 0));
-  for(size_t path_offset = 0; path_offset < path.size(); path_offset++)
-  {
-    for(size_t ref_offset = 0; ref_offset < reference.size(); ref_offset++)
-    {
-      if(path[path_offset] == reference[ref_offset])
-      {
-        dp[path_offset + 1][ref_offset + 1] = dp[path_offset][ref_offset] + 1;
-      }
-      else
-      {
-        dp[path_offset + 1][ref_offset + 1] = std::max(dp[path_offset][ref_offset + 1], dp[path_offset + 1][ref_offset]);
-      }
-    }
-  }
-
-  // Trace back the LCS.
-  std::vector<std::pair<size_t, size_t>> lcs;
-  size_t path_offset = path.size(), ref_offset = reference.size();
-  while(path_offset > 0 && ref_offset > 0)
-  {
-    if(path[path_offset - 1] == reference[ref_offset - 1])
-    {
-      lcs.push_back(std::make_pair(path_offset - 1, ref_offset - 1));
-      path_offset--; ref_offset--;
-    }
-    else if(dp[path_offset - 1][ref_offset] > dp[path_offset][ref_offset - 1])
-    {
-      path_offset--;
-    }
-    else
-    {
-      ref_offset--;
-    }
-  }
-  std::reverse(lcs.begin(), lcs.end());
+  std::vector<std::pair<size_t, size_t>> lcs = longest_common_subsequence(reference, path);
 
   // Convert the LCS a sequence of edits.
   std::vector<std::pair<char, size_t>> edits;
-  path_offset = 0; ref_offset = 0;
+  size_t path_offset = 0, ref_offset = 0;
   for(const std::pair<size_t, size_t>& match : lcs)
   {
     append_edits(edits, graph, reference, std::make_pair(ref_offset, match.second), path, std::make_pair(path_offset, match.first));
@@ -317,56 +500,38 @@ align_paths(const GBWTGraph& graph, const gbwt::vector_type& reference, const gb
 */
 
 void
-Subgraph::extract_paths(const GBZ& gbz, const SubgraphQuery& query, const std::pair<pos_t, gbwt::edge_type>& ref_pos)
+Subgraph::extract_paths(const GBZ& gbz, const LocalGraph& subgraph, const SubgraphQuery& query, const std::pair<pos_t, gbwt::edge_type>& ref_pos)
 {
-  const GBWTGraph& graph = gbz.graph;
-  const gbwt::GBWT& index = gbz.index;
+  const std::vector<gbwt::DecompressedRecord>& records = subgraph.records;
 
   // For each GBWT node in the subgraph, mark which GBWT offsets have a
   // predecessor in the subgraph.
-  std::map<gbwt::node_type, sdsl::bit_vector> has_predecessor;
-  for(nid_t node : this->nodes)
+  std::vector<sdsl::bit_vector> has_predecessor;
+  has_predecessor.reserve(records.size());
+  for(const gbwt::DecompressedRecord& record : records) { has_predecessor.emplace_back(record.size(), 0); }
+  for(const gbwt::DecompressedRecord& record : records)
   {
-    for(bool is_reverse : { false, true })
+    for(size_t i = 0; i < record.size(); i++)
     {
-      gbwt::node_type gbwt_node = gbwt::Node::encode(node, is_reverse);
-      gbwt::CompressedRecord record = index.record(gbwt_node);
-      has_predecessor[gbwt_node] = sdsl::bit_vector(record.size(), 0);
-    }
-  }
-
-  // Mark the positions that have predecessors in the subgraph.
-  for(nid_t node : this->nodes)
-  {
-    for(bool is_reverse : { false, true })
-    {
-      gbwt::node_type gbwt_node = gbwt::Node::encode(node, is_reverse);
-      gbwt::CompressedRecord record = index.record(gbwt_node);
-      gbwt::DecompressedRecord decompressed(record);
-      for(size_t i = 0; i < decompressed.size(); i++)
-      {
-        gbwt::edge_type successor = decompressed.LF(i);
-        auto iter = has_predecessor.find(successor.first);
-        if(iter != has_predecessor.end())
-        {
-          iter->second[successor.second] = true;
-        }
-      }
+      gbwt::edge_type successor = record.LF(i);
+      size_t next = subgraph.find_record(successor.first);
+      if(next < records.size()) { has_predecessor[next][successor.second] = true; }
     }
   }
 
   // FIXME: If the GBWT index is invalid, we could have infinite loops.
   // Extract all paths and determine reference path information if necessary.
-  for(const auto& start_node : has_predecessor)
+  for(size_t start = 0; start < records.size(); start++)
   {
-    for(size_t gbwt_offset = 0; gbwt_offset < start_node.second.size(); gbwt_offset++)
+    for(size_t gbwt_offset = 0; gbwt_offset < has_predecessor[start].size(); gbwt_offset++)
     {
-      if(start_node.second[gbwt_offset]) { continue; } // There is a predecessor.
-      gbwt::edge_type curr(start_node.first, gbwt_offset);
+      if(has_predecessor[start][gbwt_offset]) { continue; } // There is a predecessor.
+      gbwt::edge_type curr(subgraph.record_node(start), gbwt_offset);
+      size_t curr_record = start;
       bool is_ref = false;
       gbwt::vector_type path;
       size_t path_length = 0;
-      while(curr.first != gbwt::ENDMARKER && has_predecessor.find(curr.first) != has_predecessor.end())
+      while(curr_record < records.size())
       {
         if(curr == ref_pos.second)
         {
@@ -375,8 +540,9 @@ Subgraph::extract_paths(const GBZ& gbz, const SubgraphQuery& query, const std::p
           is_ref = true;
         }
         path.push_back(curr.first);
-        path_length += graph.get_length(GBWTGraph::node_to_handle(curr.first));
-        curr = index.LF(curr);
+        path_length += subgraph.lengths[curr_record / 2];
+        curr = records[curr_record].LF(curr.second);
+        curr_record = subgraph.find_record(curr.first);
       }
       if(is_ref)
       {
@@ -447,11 +613,13 @@ Subgraph::update_paths(const SubgraphQuery& query)
 
 //------------------------------------------------------------------------------
 
-Subgraph::Subgraph(const GBZ& gbz, const PathIndex* path_index, const SubgraphQuery& query) :
+Subgraph::Subgraph(const GBZ& gbz, const PathIndex* path_index, const SubgraphQuery& query, Metrics* metrics) :
   reference_path(std::numeric_limits<size_t>::max()),
   reference_handle(handlegraph::as_path_handle(std::numeric_limits<size_t>::max())),
   reference_start(0)
 {
+  Metrics::Timer total_timer(metrics, "subgraph");
+  Metrics::Timer timer(metrics, "subgraph/position");
   std::pair<pos_t, gbwt::edge_type> position;
   size_t context = query.context;
 
@@ -484,16 +652,34 @@ Subgraph::Subgraph(const GBZ& gbz, const PathIndex* path_index, const SubgraphQu
     }
   }
 
-  this->nodes = find_subgraph(gbz.graph, position.first, context);
-  this->extract_paths(gbz, query, position);
-  this->update_paths(query);
+  timer.stop();
+
+  LocalGraph subgraph;
+  {
+    Metrics::Timer extract_timer(metrics, "subgraph/extract");
+    find_subgraph(gbz, position.first, context, subgraph);
+    this->nodes = std::set<nid_t>(subgraph.nodes.ids.begin(), subgraph.nodes.ids.end());
+  }
+  {
+    Metrics::Timer path_timer(metrics, "subgraph/paths");
+    this->extract_paths(gbz, subgraph, query, position);
+    this->update_paths(query);
+  }
+  if(metrics != nullptr)
+  {
+    metrics->add_to_histogram("subgraph/nodes", this->nodes.size());
+    metrics->add_to_histogram("subgraph/paths", this->paths.size());
+  }
 
   if(this->reference_path < this->paths.size())
   {
+    Metrics::Timer cigar_timer(metrics, "subgraph/cigars");
+    this->path_cigars = std::vector<std::string>(this->paths.size());
+    #pragma omp parallel for schedule(dynamic, 1)
     for(size_t i = 0; i < this->paths.size(); i++)
     {
-      if(i == this->reference_path) { this->path_cigars.push_back(""); }
-      else { this->path_cigars.push_back(align_paths(gbz.graph, this->paths[this->reference_path], this->paths[i])); }
+      if(i == this->reference_path) { continue; }
+      this->path_cigars[i] = align_paths(gbz.graph, this->paths[this->reference_path], this->paths[i]);
     }
   }
 }
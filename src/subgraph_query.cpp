@@ -1,10 +1,16 @@
 #include "absl/log/absl_log.h"
+#include <cstdio>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include <getopt.h>
+#include <omp.h>
+#include <unistd.h>
 
 #include <gbwtgraph/gbz.h>
 #include <gbwtgraph/subgraph.h>
@@ -29,21 +35,84 @@ struct Config
   size_t offset = 0, limit = 0;
   nid_t node_id = 0;
   size_t context = 100;
+
+  // Batch mode.
+  std::string batch_file, output_dir;
+  size_t threads = 1;
+
+  // Load the path index from / save it to this file if not empty.
+  std::string index_file;
+};
+
+// Number of queries read from the batch file at once.
+constexpr size_t QUERY_BATCH_SIZE = 256;
+
+struct BatchQuery
+{
+  std::string   name;
+  SubgraphQuery query;
 };
 
-std::unique_ptr<PathIndex> create_path_index(const GBZ& gbz, const SubgraphQuery& query)
+// Builds the path index in memory, unless an index file was given. Then loads
+// the index from the file if it exists and matches the graph. Otherwise builds
+// the index and tries to write it to the file. The index is first written to a
+// temporary file, which then replaces the index file, so other processes never
+// see a partially written index.
+std::unique_ptr<PathIndex> load_path_index(const GBZ& gbz, const Config& config)
+{
+  const std::string& filename = config.index_file;
+  if(!(filename.empty()))
+  {
+    std::ifstream in(filename, std::ios_base::binary);
+    if(in)
+    {
+      std::unique_ptr<PathIndex> result = std::make_unique<PathIndex>();
+      try
+      {
+        result->simple_sds_load(in);
+        if(result->compatible(gbz)) { return result; }
+        std::cerr << "subgraph_query: Path index " << filename << " does not match the graph; rebuilding" << std::endl;
+      }
+      catch(const sdsl::simple_sds::InvalidData& e)
+      {
+        std::cerr << "subgraph_query: Cannot load path index " << filename << ": " << e.what() << "; rebuilding" << std::endl;
+      }
+    }
+  }
+
+  std::unique_ptr<PathIndex> result = std::make_unique<PathIndex>(gbz);
+  if(!(filename.empty()))
+  {
+    std::string temp_file = filename + ".tmp" + std::to_string(getpid());
+    std::ofstream out(temp_file, std::ios_base::binary);
+    if(out) { result->simple_sds_serialize(out); out.close(); }
+    if(!out || std::rename(temp_file.c_str(), filename.c_str()) != 0)
+    {
+      std::cerr << "subgraph_query: Cannot write path index " << filename << std::endl;
+      std::remove(temp_file.c_str());
+    }
+  }
+  return result;
+}
+
+std::unique_ptr<PathIndex> create_path_index(const GBZ& gbz, const SubgraphQuery& query, const Config& config)
 {
   if(query.type == SubgraphQuery::QueryType::path_offset_query || query.type == SubgraphQuery::QueryType::path_interval_query)
   {
-    return std::make_unique<PathIndex>(gbz);
+    return load_path_index(gbz, config);
   }
   return nullptr;
 }
 
-path_handle_t find_reference_path(const GBZ& gbz, const Config& config)
+std::vector<gbwt::size_type> reference_paths(const GBZ& gbz, const std::string& sample_name, const std::string& contig_name)
 {
   const gbwt::Metadata& metadata = gbz.index.metadata;
-  std::vector<gbwt::size_type> path_ids = metadata.findPaths(metadata.sample(config.sample_name), metadata.contig(config.contig_name));
+  return metadata.findPaths(metadata.sample(sample_name), metadata.contig(contig_name));
+}
+
+path_handle_t find_reference_path(const GBZ& gbz, const Config& config)
+{
+  std::vector<gbwt::size_type> path_ids = reference_paths(gbz, config.sample_name, config.contig_name);
   if(path_ids.size() != 1)
   {
     std::string msg = "Found " + std::to_string(path_ids.size()) + " reference paths for sample " + config.sample_name + ", contig " + config.contig_name;
@@ -73,6 +142,15 @@ SubgraphQuery create_query(const GBZ& gbz, const Config& config)
   }
 }
 
+// Reads and validates up to QUERY_BATCH_SIZE queries. Returns false if there
+// are no more queries. With an output directory, `names` contains the names of
+// earlier queries, and queries with the same name are skipped.
+bool read_batch(std::istream& in, const GBZ& gbz, const PathIndex& path_index, const Config& config,
+                size_t& line_num, std::unordered_set<std::string>& names, std::vector<BatchQuery>& batch);
+
+// Extracts the subgraphs in parallel and writes them in input order.
+void process_batch(const GBZ& gbz, const PathIndex& path_index, const std::vector<BatchQuery>& batch, const Config& config);
+
 //------------------------------------------------------------------------------
 
 int
@@ -86,8 +164,38 @@ main(int argc, char** argv)
 
     GBZ gbz;
     sdsl::simple_sds::load_from(gbz, config.graph_file);
+    omp_set_num_threads(config.threads);
+    if(!(config.batch_file.empty()))
+    {
+      std::unique_ptr<PathIndex> index = load_path_index(gbz, config);
+      const PathIndex& path_index = *index;
+      std::ifstream file;
+      if(config.batch_file != "-")
+      {
+        file.open(config.batch_file);
+        if(!file)
+        {
+          std::string msg = "Cannot open batch file " + config.batch_file;
+          ABSL_LOG(FATAL) << msg;
+        }
+      }
+      std::istream& in = (config.batch_file == "-" ? std::cin : file);
+      size_t line_num = 0, queries = 0;
+      std::unordered_set<std::string> names;
+      std::vector<BatchQuery> batch;
+      while(read_batch(in, gbz, path_index, config, line_num, names, batch))
+      {
+        process_batch(gbz, path_index, batch, config);
+        queries += batch.size();
+      }
+      std::cout.flush();
+      std::cerr << "Processed " << queries << " queries from " << line_num << " lines" << std::endl;
+      double seconds = gbwt::readTimer() - start;
+      std::cerr << "Used " << seconds << " seconds, " << gbwt::inGigabytes(gbwt::memoryUsage()) << " GiB" << std::endl;
+      return 0;
+    }
     SubgraphQuery query = create_query(gbz, config);
-    std::unique_ptr<PathIndex> path_index = create_path_index(gbz, query);
+    std::unique_ptr<PathIndex> path_index = create_path_index(gbz, query, config);
 
     Subgraph subgraph(gbz, path_index.get(), query);
     subgraph.to_gfa(gbz, std::cout);
@@ -122,6 +230,19 @@ printUsage(int exit_code)
   std::cerr << "  --context N       context length around the query position in bp (default: 100)" << std::endl;
   std::cerr << "  --distinct        output distinct haplotypes only" << std::endl;
   std::cerr << "  --reference-only  only output the reference path" << std::endl;
+  std::cerr << "  --threads N       use N parallel threads (default: 1)" << std::endl;
+  std::cerr << "  --index-file FILE load the path index from / save it to FILE (e.g. graph.gbz" << PathIndex::EXTENSION << ")" << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "Batch mode:" << std::endl;
+  std::cerr << "  --batch FILE      read path interval queries from FILE (- for stdin)" << std::endl;
+  std::cerr << "  --output-dir DIR  write each subgraph to DIR/NAME.gfa instead of stdout" << std::endl;
+  std::cerr << std::endl;
+  std::cerr << "Batch files are BED-like with lines \"contig start end [name]\" and use the" << std::endl;
+  std::cerr << "sample name from --sample. Invalid queries are reported and skipped. The name" << std::endl;
+  std::cerr << "defaults to contig:start-end. Without --output-dir, each subgraph is written to" << std::endl;
+  std::cerr << "stdout in input order as a line \"#query<TAB>name<TAB>bytes\" followed by the" << std::endl;
+  std::cerr << "given number of bytes of GFA. With --output-dir, queries with the name of an" << std::endl;
+  std::cerr << "earlier query are skipped." << std::endl;
   std::cerr << std::endl;
 
   std::exit(exit_code);
@@ -141,6 +262,10 @@ Config::Config(int argc, char** argv)
   constexpr int OPT_CONTEXT = 1005;
   constexpr int OPT_DISTINCT = 1006;
   constexpr int OPT_REFERENCE_ONLY = 1007;
+  constexpr int OPT_BATCH = 1008;
+  constexpr int OPT_OUTPUT_DIR = 1009;
+  constexpr int OPT_THREADS = 1010;
+  constexpr int OPT_INDEX_FILE = 1011;
 
   // Data for `getopt_long()`.
   int c = 0, option_index = 0;
@@ -154,6 +279,10 @@ Config::Config(int argc, char** argv)
     { "context", required_argument, 0, OPT_CONTEXT },
     { "distinct", no_argument, 0, OPT_DISTINCT },
     { "reference-only", no_argument, 0, OPT_REFERENCE_ONLY },
+    { "batch", required_argument, 0, OPT_BATCH },
+    { "output-dir", required_argument, 0, OPT_OUTPUT_DIR },
+    { "threads", required_argument, 0, OPT_THREADS },
+    { "index-file", required_argument, 0, OPT_INDEX_FILE },
     { 0, 0, 0, 0 }
   };
 
@@ -199,6 +328,18 @@ Config::Config(int argc, char** argv)
     case OPT_REFERENCE_ONLY:
       this->haplotype_output = SubgraphQuery::HaplotypeOutput::reference_only;
       break;
+    case OPT_BATCH:
+      this->batch_file = optarg;
+      break;
+    case OPT_OUTPUT_DIR:
+      this->output_dir = optarg;
+      break;
+    case OPT_THREADS:
+      this->threads = std::stoul(optarg);
+      break;
+    case OPT_INDEX_FILE:
+      this->index_file = optarg;
+      break;
 
     case '?':
       std::exit(EXIT_FAILURE);
@@ -214,6 +355,25 @@ Config::Config(int argc, char** argv)
     ABSL_LOG(FATAL) << msg;
   }
   this->graph_file = argv[optind]; optind++;
+  if(this->threads == 0)
+  {
+    std::string msg = "Number of threads must be positive";
+    ABSL_LOG(FATAL) << msg;
+  }
+  if(!(this->batch_file.empty()))
+  {
+    if(this->query_type != SubgraphQuery::QueryType::invalid_query)
+    {
+      std::string msg = "Batch mode cannot be combined with a path offset or interval or node id";
+      ABSL_LOG(FATAL) << msg;
+    }
+    return;
+  }
+  if(!(this->output_dir.empty()))
+  {
+    std::string msg = "Output directory requires batch mode";
+    ABSL_LOG(FATAL) << msg;
+  }
   if(this->query_type == SubgraphQuery::QueryType::invalid_query)
   {
     std::string msg = "Path offset or interval or node id is required";
@@ -227,3 +387,83 @@ Config::Config(int argc, char** argv)
 }
 
 //------------------------------------------------------------------------------
+
+bool
+read_batch(std::istream& in, const GBZ& gbz, const PathIndex& path_index, const Config& config,
+           size_t& line_num, std::unordered_set<std::string>& names, std::vector<BatchQuery>& batch)
+{
+  batch.clear();
+  std::string line;
+  while(batch.size() < QUERY_BATCH_SIZE && std::getline(in, line))
+  {
+    line_num++;
+    std::istringstream fields(line);
+    std::string contig, start, end, name;
+    if(!(fields >> contig) || contig.front() == '#' || contig == "track" || contig == "browser") { continue; }
+    fields >> start >> end >> name;
+    auto skip = [&](const std::string& reason)
+    {
+      std::cerr << "subgraph_query: Skipping line " << line_num << ": " << reason << std::endl;
+    };
+
+    size_t from = 0, to = 0;
+    try
+    {
+      size_t from_len = 0, to_len = 0;
+      from = std::stoul(start, &from_len); to = std::stoul(end, &to_len);
+      if(from_len != start.length() || to_len != end.length()) { throw std::invalid_argument(line); }
+    }
+    catch(const std::logic_error&)
+    {
+      skip("Invalid interval"); continue;
+    }
+    if(from >= to) { skip("Empty interval"); continue; }
+    std::vector<gbwt::size_type> path_ids = reference_paths(gbz, config.sample_name, contig);
+    if(path_ids.size() != 1)
+    {
+      skip("Found " + std::to_string(path_ids.size()) + " reference paths for contig " + contig); continue;
+    }
+    path_handle_t path = gbz.graph.path_to_handle(path_ids.front());
+    if(to > path_index.path_length(path)) { skip("Interval extends past the end of contig " + contig); continue; }
+    if(name.empty()) { name = contig + ":" + start + "-" + end; }
+    else if(!(config.output_dir.empty()) && name.find('/') != std::string::npos) { skip("Invalid query name " + name); continue; }
+    if(!(config.output_dir.empty()) && !(names.insert(name).second)) { skip("Duplicate query name " + name); continue; }
+
+    batch.push_back({ name, SubgraphQuery::path_interval(path, from, to, config.context, config.haplotype_output) });
+  }
+  return !(batch.empty());
+}
+
+void
+process_batch(const GBZ& gbz, const PathIndex& path_index, const std::vector<BatchQuery>& batch, const Config& config)
+{
+  #pragma omp parallel for ordered schedule(dynamic, 1)
+  for(size_t i = 0; i < batch.size(); i++)
+  {
+    Subgraph subgraph(gbz, &path_index, batch[i].query);
+    if(config.output_dir.empty())
+    {
+      std::ostringstream gfa;
+      subgraph.to_gfa(gbz, gfa);
+      std::string data = gfa.str();
+      #pragma omp ordered
+      {
+        std::cout << "#query\t" << batch[i].name << "\t" << data.length() << "\n";
+        std::cout.write(data.data(), data.length());
+      }
+    }
+    else
+    {
+      std::string filename = config.output_dir + "/" + batch[i].name + ".gfa";
+      std::ofstream out(filename, std::ios_base::binary);
+      if(!out)
+      {
+        std::string msg = "Cannot open output file " + filename;
+        ABSL_LOG(FATAL) << msg;
+      }
+      subgraph.to_gfa(gbz, out);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
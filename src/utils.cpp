@@ -5,8 +5,19 @@
 #include <algorithm>
 #include <sstream>
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <gbwt/utils.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 namespace gbwtgraph
 {
 
@@ -20,6 +31,7 @@ constexpr size_t Version::PATCH_VERSION;
 constexpr size_t Version::GBZ_VERSION;
 constexpr size_t Version::GRAPH_VERSION;
 constexpr size_t Version::MINIMIZER_VERSION;
+constexpr size_t Version::PATH_INDEX_VERSION;
 
 constexpr size_t MetadataBuilder::NO_FIELD;
 
@@ -392,20 +404,126 @@ reverse_complement(const std::string& seq)
   return result;
 }
 
+#if defined(__AVX2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+
+/*
+  Vectorized reverse complement handles blocks consisting of A, C, G, T, and N
+  in either case. The low nibbles of these characters are distinct, and the
+  complement keeps the case bit. Blocks containing other characters use the
+  table.
+*/
+
+const char RC_FORWARD_LOWER[16] =
+{
+  0, 'a', 0, 'c', 't', 0, 0, 'g',   0, 0, 0, 0, 0, 0, 'n', 0
+};
+
+const char RC_COMPLEMENT_UPPER[16] =
+{
+  0, 'T', 0, 'G', 'A', 0, 0, 'C',   0, 0, 0, 0, 0, 0, 'N', 0
+};
+
+#endif
+
+#if defined(__AVX2__)
+
+constexpr size_t RC_BLOCK_SIZE = 32;
+
+// Stores the reverse complement of the block in `result` and returns true if
+// the block can be handled with vector instructions.
+inline bool
+rc_block(__m256i block, __m256i& result)
+{
+  const __m256i forward = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(RC_FORWARD_LOWER)));
+  const __m256i complemented = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(RC_COMPLEMENT_UPPER)));
+  const __m256i reverse = _mm256_setr_epi8(
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+    15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  const __m256i low_mask = _mm256_set1_epi8(0x0F), case_bit = _mm256_set1_epi8(0x20);
+
+  __m256i low = _mm256_and_si256(block, low_mask);
+  __m256i valid = _mm256_cmpeq_epi8(_mm256_or_si256(block, case_bit), _mm256_shuffle_epi8(forward, low));
+  if(_mm256_movemask_epi8(valid) != -1) { return false; }
+
+  result = _mm256_or_si256(_mm256_shuffle_epi8(complemented, low), _mm256_and_si256(block, case_bit));
+  result = _mm256_shuffle_epi8(result, reverse);
+  result = _mm256_permute2x128_si256(result, result, 0x01);
+  return true;
+}
+
+inline __m256i rc_load(const char* ptr) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr)); }
+inline void rc_store(char* ptr, __m256i block) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr), block); }
+typedef __m256i rc_vector;
+
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+
+constexpr size_t RC_BLOCK_SIZE = 16;
+
+// Stores the reverse complement of the block in `result` and returns true if
+// the block can be handled with vector instructions.
+inline bool
+rc_block(uint8x16_t block, uint8x16_t& result)
+{
+  const uint8x16_t forward = vld1q_u8(reinterpret_cast<const std::uint8_t*>(RC_FORWARD_LOWER));
+  const uint8x16_t complemented = vld1q_u8(reinterpret_cast<const std::uint8_t*>(RC_COMPLEMENT_UPPER));
+  const uint8x16_t low_mask = vdupq_n_u8(0x0F), case_bit = vdupq_n_u8(0x20);
+
+  uint8x16_t low = vandq_u8(block, low_mask);
+  uint8x16_t valid = vceqq_u8(vorrq_u8(block, case_bit), vqtbl1q_u8(forward, low));
+  if(vminvq_u8(valid) != 0xFF) { return false; }
+
+  result = vorrq_u8(vqtbl1q_u8(complemented, low), vandq_u8(block, case_bit));
+  result = vrev64q_u8(result);
+  result = vextq_u8(result, result, 8);
+  return true;
+}
+
+inline uint8x16_t rc_load(const char* ptr) { return vld1q_u8(reinterpret_cast<const std::uint8_t*>(ptr)); }
+inline void rc_store(char* ptr, uint8x16_t block) { vst1q_u8(reinterpret_cast<std::uint8_t*>(ptr), block); }
+typedef uint8x16_t rc_vector;
+
+#endif
+
 void
 reverse_complement_in_place(std::string& seq)
 {
-  size_t swap_size = seq.size() / 2;
-  for(size_t i = 0, j = seq.size() - 1; i < swap_size; i++, j--)
+  if(seq.empty()) { return; }
+  char* data = &(seq[0]);
+  size_t i = 0, j = seq.size();
+
+#if defined(__AVX2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+  // Swap and complement blocks from both ends.
+  while(j - i >= 2 * RC_BLOCK_SIZE)
   {
-    char tmp = seq[i];
-    seq[i] = complement[seq[j]];
-    seq[j] = complement[tmp];
+    rc_vector left = rc_load(data + i), right = rc_load(data + j - RC_BLOCK_SIZE);
+    rc_vector left_rc, right_rc;
+    if(rc_block(left, left_rc) && rc_block(right, right_rc))
+    {
+      rc_store(data + i, right_rc);
+      rc_store(data + j - RC_BLOCK_SIZE, left_rc);
+      i += RC_BLOCK_SIZE; j -= RC_BLOCK_SIZE;
+    }
+    else
+    {
+      for(size_t k = 0; k < RC_BLOCK_SIZE; k++, i++, j--)
+      {
+        char tmp = data[i];
+        data[i] = complement[static_cast<unsigned char>(data[j - 1])];
+        data[j - 1] = complement[static_cast<unsigned char>(tmp)];
+      }
+    }
   }
+#endif
 
-  if(seq.size() % 2 != 0)
+  for(; j - i >= 2; i++, j--)
+  {
+    char tmp = data[i];
+    data[i] = complement[static_cast<unsigned char>(data[j - 1])];
+    data[j - 1] = complement[static_cast<unsigned char>(tmp)];
+  }
+  if(j - i == 1)
   {
-    seq[swap_size] = complement[seq[swap_size]];
+    data[i] = complement[static_cast<unsigned char>(data[i])];
   }
 }
 
@@ -428,6 +546,56 @@ bool path_is_canonical(const gbwt::vector_type& path)
 
 //------------------------------------------------------------------------------
 
+MappedFile::MappedFile(const std::string& filename) :
+  fd(-1), file_size(0), ptr(nullptr)
+{
+  this->fd = ::open(filename.c_str(), O_RDONLY);
+  if(this->fd < 0)
+  {
+    std::cerr << "MappedFile::MappedFile(): Cannot open file " << filename << std::endl;
+    return;
+  }
+
+  struct stat st;
+  if(::fstat(this->fd, &st) < 0 || st.st_size == 0)
+  {
+    std::cerr << "MappedFile::MappedFile(): Cannot stat file " << filename << " or the file is empty" << std::endl;
+    return;
+  }
+
+  void* temp_ptr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_FILE | MAP_SHARED, this->fd, 0);
+  if(temp_ptr == MAP_FAILED)
+  {
+    std::cerr << "MappedFile::MappedFile(): Cannot memory map file " << filename << std::endl;
+    return;
+  }
+  this->file_size = st.st_size;
+  this->ptr = static_cast<char*>(temp_ptr);
+}
+
+MappedFile::~MappedFile()
+{
+  if(this->ptr != nullptr)
+  {
+    ::munmap(static_cast<void*>(this->ptr), this->file_size);
+    this->file_size = 0;
+    this->ptr = nullptr;
+  }
+  if(this->fd >= 0)
+  {
+    ::close(this->fd);
+    this->fd = -1;
+  }
+}
+
+void
+MappedFile::advise(int advice) const
+{
+  if(this->ptr != nullptr) { ::madvise(static_cast<void*>(this->ptr), this->file_size, advice); }
+}
+
+//------------------------------------------------------------------------------
+
 void
 SequenceSource::swap(SequenceSource& another)
 {
@@ -217,4 +217,233 @@ TEST_F(GraphOperations, ForEachHandle)
 
 //------------------------------------------------------------------------------
 
+class SharedCache : public ::testing::Test
+{
+public:
+  typedef std::pair<gbwt::node_type, gbwt::node_type> gbwt_edge;
+
+  gbwt::GBWT index;
+  SequenceSource source;
+  GBWTGraph graph;
+
+  SharedCache()
+  {
+  }
+
+  void SetUp() override
+  {
+    this->index = build_gbwt_index();
+    build_source(this->source);
+    this->graph = GBWTGraph(this->index, this->source);
+  }
+
+  void check_graph(const CachedGBWTGraph& cached_graph) const
+  {
+    for(nid_t id = this->graph.min_node_id(); id <= this->graph.max_node_id(); id++)
+    {
+      if(!(this->graph.has_node(id))) { continue; }
+      for(bool is_reverse : { false, true })
+      {
+        handle_t handle = this->graph.get_handle(id, is_reverse);
+        for(bool go_left : { false, true })
+        {
+          std::vector<handle_t> correct, found;
+          this->graph.follow_edges(handle, go_left, [&](const handle_t& next) { correct.push_back(next); });
+          cached_graph.follow_edges(handle, go_left, [&](const handle_t& next) { found.push_back(next); });
+          EXPECT_EQ(found, correct) << "Wrong edges from (" << id << ", " << is_reverse << "), go_left = " << go_left;
+          EXPECT_EQ(cached_graph.get_degree(handle, go_left), correct.size()) << "Wrong degree for (" << id << ", " << is_reverse << "), go_left = " << go_left;
+        }
+        this->graph.follow_edges(handle, false, [&](const handle_t& next) {
+          EXPECT_TRUE(cached_graph.has_edge(handle, next)) << "Missing edge from (" << id << ", " << is_reverse << ")";
+        });
+
+        gbwt::SearchState state = this->graph.get_state(handle);
+        EXPECT_EQ(cached_graph.get_state(handle), state) << "Wrong state for (" << id << ", " << is_reverse << ")";
+        std::vector<gbwt::SearchState> correct_states, found_states;
+        this->graph.follow_paths(state, [&](const gbwt::SearchState& next) -> bool
+        {
+          correct_states.push_back(next);
+          EXPECT_EQ(cached_graph.find({ handle, GBWTGraph::node_to_handle(next.node) }), next) << "Wrong state for a path from (" << id << ", " << is_reverse << ")";
+          return true;
+        });
+        cached_graph.follow_paths(state, [&](const gbwt::SearchState& next) -> bool
+        {
+          found_states.push_back(next);
+          return true;
+        });
+        EXPECT_EQ(found_states, correct_states) << "Wrong successor states for (" << id << ", " << is_reverse << ")";
+      }
+    }
+  }
+};
+
+TEST_F(SharedCache, Traversal)
+{
+  SharedRecordCache shared(this->index);
+  CachedGBWTGraph cached_graph(this->graph, shared);
+  this->check_graph(cached_graph);
+  EXPECT_GT(shared.hits(), size_t(0)) << "No cache hits";
+  EXPECT_EQ(shared.misses(), shared.size()) << "Cached records were decompressed again";
+}
+
+TEST_F(SharedCache, Visit)
+{
+  SharedRecordCache shared(this->index);
+  for(gbwt::node_type node = this->index.firstNode(); node < this->index.sigma(); node++)
+  {
+    if(!(this->index.contains(node))) { continue; }
+    gbwt::DecompressedRecord correct = this->index.record(node);
+    for(size_t round = 0; round < 2; round++)
+    {
+      size_t outdegree = 0, size = 0;
+      bool found = shared.visit(node, [&](const gbwt::DecompressedRecord& record)
+      {
+        outdegree = record.outdegree(); size = record.size();
+      });
+      ASSERT_TRUE(found) << "Could not visit node " << node << " in round " << round;
+      EXPECT_EQ(outdegree, correct.outdegree()) << "Wrong outdegree for node " << node << " in round " << round;
+      EXPECT_EQ(size, correct.size()) << "Wrong record size for node " << node << " in round " << round;
+    }
+  }
+  EXPECT_EQ(shared.hits(), shared.misses()) << "Visiting a cached record was not a hit";
+
+  bool called = false;
+  EXPECT_FALSE(shared.visit(this->index.sigma(), [&](const gbwt::DecompressedRecord&) { called = true; })) << "Visited a node that is not in the index";
+  EXPECT_FALSE(called) << "The function was called for a node that is not in the index";
+}
+
+TEST_F(SharedCache, Eviction)
+{
+  SharedRecordCache shared(this->index, 1);
+  ASSERT_EQ(shared.capacity(), SharedRecordCache::SHARDS) << "Wrong cache capacity";
+  CachedGBWTGraph cached_graph(this->graph, shared);
+  this->check_graph(cached_graph);
+  EXPECT_LE(shared.size(), shared.capacity()) << "The cache exceeded its capacity";
+
+  shared.clear();
+  EXPECT_EQ(shared.size(), size_t(0)) << "The cache is not empty after clear()";
+  EXPECT_EQ(shared.hits() + shared.misses(), size_t(0)) << "Statistics were not reset";
+}
+
+TEST_F(SharedCache, Budget)
+{
+  SharedRecordCache shared(this->index, SharedRecordCache::DEFAULT_CAPACITY, 0);
+  CachedGBWTGraph cached_graph(this->graph, shared);
+  this->check_graph(cached_graph);
+  EXPECT_EQ(shared.size(), size_t(0)) << "Records were cached with no memory budget";
+  EXPECT_EQ(shared.bytes(), size_t(0)) << "The cache uses memory with no memory budget";
+
+  size_t budget = SharedRecordCache::SHARDS * 256;
+  SharedRecordCache bounded(this->index, SharedRecordCache::DEFAULT_CAPACITY, budget);
+  CachedGBWTGraph bounded_graph(this->graph, bounded);
+  this->check_graph(bounded_graph);
+  EXPECT_LE(bounded.bytes(), bounded.budget()) << "The cache exceeded its memory budget";
+}
+
+TEST_F(SharedCache, LF)
+{
+  std::vector<size_t> thresholds = { 0, 1, 1024 };
+  for(size_t threshold : thresholds)
+  {
+    SharedRecordCache shared(this->index, SharedRecordCache::DEFAULT_CAPACITY, SharedRecordCache::DEFAULT_BUDGET, threshold);
+    for(gbwt::node_type node = this->index.firstNode(); node < this->index.sigma(); node++)
+    {
+      for(gbwt::size_type i = 0; i < this->index.nodeSize(node); i++)
+      {
+        gbwt::edge_type pos(node, i);
+        EXPECT_EQ(shared.LF(pos), this->index.LF(pos)) << "Wrong LF(" << node << ", " << i << ") with threshold " << threshold;
+      }
+    }
+    if(threshold == 0) { EXPECT_GT(shared.hits(), size_t(0)) << "No cache hits"; }
+    else { EXPECT_EQ(shared.size(), size_t(0)) << "Small records were cached with threshold " << threshold; }
+  }
+}
+
+TEST_F(SharedCache, UncachableRecords)
+{
+  // Records that do not fit in the cache are not decompressed for every LF() step.
+  size_t budget = SharedRecordCache::SHARDS;
+  for(size_t b : { size_t(0), budget })
+  {
+    SharedRecordCache shared(this->index, SharedRecordCache::DEFAULT_CAPACITY, b);
+    size_t nodes = 0;
+    for(gbwt::node_type node = this->index.firstNode(); node < this->index.sigma(); node++)
+    {
+      if(this->index.contains(node)) { nodes++; }
+      for(size_t round = 0; round < 2; round++)
+      {
+        for(gbwt::size_type i = 0; i < this->index.nodeSize(node); i++)
+        {
+          gbwt::edge_type pos(node, i);
+          EXPECT_EQ(shared.LF(pos), this->index.LF(pos)) << "Wrong LF(" << node << ", " << i << ") with budget " << b;
+        }
+      }
+    }
+    EXPECT_EQ(shared.size(), size_t(0)) << "Records were cached with budget " << b;
+    EXPECT_LE(shared.misses(), (b == 0 ? size_t(0) : nodes)) << "Uncachable records were decompressed repeatedly with budget " << b;
+  }
+}
+
+TEST_F(SharedCache, PathTraversal)
+{
+  // Following paths with a record cache should produce the same steps.
+  gbwt::GBWT named_index = build_gbwt_index_with_named_paths();
+  GBWTGraph graph(named_index, this->source);
+  SharedRecordCache shared(named_index, SharedRecordCache::DEFAULT_CAPACITY, SharedRecordCache::DEFAULT_BUDGET);
+  GBWTGraph cached_graph = graph;
+  cached_graph.set_record_cache(&shared);
+  ASSERT_GT(graph.get_path_count(), size_t(0)) << "The graph has no paths to follow";
+  graph.for_each_path_handle([&](const path_handle_t& path)
+  {
+    std::vector<handle_t> correct, found;
+    for(step_handle_t step = graph.path_begin(path); step != graph.path_end(path); step = graph.get_next_step(step))
+    {
+      correct.push_back(graph.get_handle_of_step(step));
+    }
+    for(step_handle_t step = cached_graph.path_begin(path); step != cached_graph.path_end(path); step = cached_graph.get_next_step(step))
+    {
+      found.push_back(cached_graph.get_handle_of_step(step));
+    }
+    EXPECT_EQ(found, correct) << "Wrong steps on path " << graph.get_path_name(path);
+    EXPECT_EQ(cached_graph.path_back(path), graph.path_back(path)) << "Wrong last step on path " << graph.get_path_name(path);
+  });
+  EXPECT_GT(shared.hits() + shared.misses(), size_t(0)) << "The record cache was not used";
+
+  cached_graph.set_record_cache(nullptr);
+  shared.clear();
+  graph.for_each_path_handle([&](const path_handle_t& path)
+  {
+    cached_graph.path_back(path);
+  });
+  EXPECT_EQ(shared.hits() + shared.misses(), size_t(0)) << "The record cache was used after removing it";
+}
+
+TEST_F(SharedCache, MultipleThreads)
+{
+  SharedRecordCache shared(this->index, 4);
+  std::vector<CachedGBWTGraph> cached_graphs(4);
+  for(CachedGBWTGraph& cached_graph : cached_graphs) { cached_graph = CachedGBWTGraph(this->graph, shared); }
+
+  std::vector<size_t> failures(cached_graphs.size(), 0);
+  #pragma omp parallel for schedule(static, 1) num_threads(4)
+  for(size_t i = 0; i < cached_graphs.size(); i++)
+  {
+    for(size_t round = 0; round < 100; round++)
+    {
+      for(nid_t id = this->graph.min_node_id(); id <= this->graph.max_node_id(); id++)
+      {
+        if(!(this->graph.has_node(id))) { continue; }
+        handle_t handle = this->graph.get_handle(id, round & 1);
+        if(cached_graphs[i].get_degree(handle, false) != this->graph.get_degree(handle, false)) { failures[i]++; }
+      }
+    }
+  }
+  for(size_t i = 0; i < failures.size(); i++)
+  {
+    EXPECT_EQ(failures[i], size_t(0)) << "Wrong degrees in thread " << i;
+  }
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace
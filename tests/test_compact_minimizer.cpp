@@ -0,0 +1,257 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+
+#include <gbwtgraph/compact_minimizer.h>
+
+#include "shared.h"
+
+using namespace gbwtgraph;
+
+namespace
+{
+
+//------------------------------------------------------------------------------
+
+using KeyTypes = ::testing::Types<Key64, Key128>;
+using MinimizerIndexes = ::testing::Types<MinimizerIndex<Key64, Position>, MinimizerIndex<Key64, PositionPayload>, MinimizerIndex<Key128, Position>, MinimizerIndex<Key128, PositionPayload>>;
+
+template<class ValueType>
+ValueType
+create_value(pos_t pos, Payload payload) = delete;
+
+template<>
+Position
+create_value<Position>(pos_t pos, Payload)
+{
+  return Position::encode(pos);
+}
+
+template<>
+PositionPayload
+create_value<PositionPayload>(pos_t pos, Payload payload)
+{
+  return { Position::encode(pos), payload };
+}
+
+//------------------------------------------------------------------------------
+
+TEST(PackedBits, SetAndGet)
+{
+  std::mt19937_64 rng(0xC0FFEE);
+  std::vector<std::pair<size_t, std::uint64_t>> fields;
+  size_t total_bits = 0;
+  for(size_t i = 0; i < 1000; i++)
+  {
+    size_t width = rng() % (PackedBits::WORD_BITS + 1);
+    fields.emplace_back(width, rng() & PackedBits::mask(width));
+    total_bits += width;
+  }
+
+  PackedBits bits(total_bits);
+  size_t offset = 0;
+  for(auto field : fields) { bits.set(offset, field.first, field.second); offset += field.first; }
+  offset = 0;
+  for(size_t i = 0; i < fields.size(); i++)
+  {
+    EXPECT_EQ(bits.get(offset, fields[i].first), fields[i].second) << "Wrong value for field " << i << " of width " << fields[i].first;
+    offset += fields[i].first;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+template<class IndexType>
+class CompactIndexConstruction : public ::testing::Test
+{
+public:
+  typedef IndexType source_type;
+  typedef typename IndexType::key_type key_type;
+  typedef typename IndexType::value_type value_type;
+  typedef typename IndexType::minimizer_type minimizer_type;
+  typedef CompactMinimizerIndex<key_type, value_type> compact_type;
+  typedef std::map<key_type, std::set<value_type>> result_type;
+
+  // Inserts random keys with 1 to 4 occurrences into the index.
+  void fill(source_type& index, result_type& correct, size_t keys)
+  {
+    std::mt19937_64 rng(0xDEADBEEF);
+    while(correct.size() < keys)
+    {
+      key_type key(rng() & 0xFFFFFFFFFF);
+      minimizer_type minimizer = get_minimizer<key_type>(key);
+      size_t occurrences = 1 + (rng() & 3);
+      for(size_t i = 0; i < occurrences; i++)
+      {
+        pos_t pos = make_pos_t(1 + (rng() & 0xFFFFF), rng() & 1, rng() & Position::OFF_MASK);
+        value_type value = create_value<value_type>(pos, Payload::create(rng() & 0xFFFFFFFF));
+        index.insert(minimizer, value);
+        correct[key].insert(value);
+      }
+    }
+  }
+
+  void check(const compact_type& compact, const result_type& correct, size_t values)
+  {
+    ASSERT_EQ(compact.size(), correct.size()) << "Wrong number of keys";
+    ASSERT_EQ(compact.number_of_values(), values) << "Wrong number of values";
+
+    std::vector<value_type> buffer;
+    std::vector<minimizer_type> queries;
+    for(auto iter = correct.begin(); iter != correct.end(); ++iter)
+    {
+      minimizer_type minimizer = get_minimizer<key_type>(iter->first);
+      queries.push_back(minimizer);
+      std::vector<value_type> truth(iter->second.begin(), iter->second.end());
+      EXPECT_TRUE(compact.contains(minimizer)) << "Key " << iter->first << " is missing";
+      EXPECT_EQ(compact.count(minimizer), truth.size()) << "Wrong number of occurrences for key " << iter->first;
+      std::pair<const value_type*, size_t> result = compact.find(minimizer, buffer);
+      std::vector<value_type> found(result.first, result.first + result.second);
+      EXPECT_EQ(found, truth) << "Wrong occurrences for key " << iter->first;
+    }
+
+    // Keys that are not in the index.
+    std::mt19937_64 rng(0xACDC);
+    for(size_t i = 0; i < correct.size(); i++)
+    {
+      key_type key((rng() & 0xFFFFFFFFFF) | 0x10000000000);
+      minimizer_type minimizer = get_minimizer<key_type>(key);
+      queries.push_back(minimizer);
+      std::pair<const value_type*, size_t> result = compact.find(minimizer, buffer);
+      EXPECT_EQ(result.second, size_t(0)) << "Found occurrences for missing key " << key;
+      EXPECT_FALSE(compact.contains(minimizer)) << "Found missing key " << key;
+    }
+    queries.push_back(minimizer_type());
+
+    // Batched find.
+    std::vector<std::pair<const value_type*, size_t>> results;
+    std::vector<value_type> batch_buffer;
+    compact.find(queries, results, batch_buffer);
+    ASSERT_EQ(results.size(), queries.size()) << "Wrong number of batched results";
+    for(size_t i = 0; i < queries.size(); i++)
+    {
+      std::pair<const value_type*, size_t> result = compact.find(queries[i], buffer);
+      std::vector<value_type> expected(result.first, result.first + result.second);
+      std::vector<value_type> found(results[i].first, results[i].first + results[i].second);
+      EXPECT_EQ(found, expected) << "Wrong batched result for query " << i;
+    }
+  }
+};
+
+TYPED_TEST_CASE(CompactIndexConstruction, MinimizerIndexes);
+
+TYPED_TEST(CompactIndexConstruction, EmptyIndex)
+{
+  typedef typename TestFixture::source_type source_type;
+  typedef typename TestFixture::compact_type compact_type;
+
+  source_type source(15, 6);
+  compact_type compact(source);
+  typename TestFixture::result_type correct;
+  this->check(compact, correct, 0);
+  EXPECT_EQ(compact.k(), source.k()) << "Wrong kmer length";
+  EXPECT_EQ(compact.w(), source.w()) << "Wrong window length";
+}
+
+TYPED_TEST(CompactIndexConstruction, Contents)
+{
+  typedef typename TestFixture::source_type source_type;
+  typedef typename TestFixture::compact_type compact_type;
+
+  source_type source(15, 6);
+  typename TestFixture::result_type correct;
+  this->fill(source, correct, 5000);
+  compact_type compact(source);
+  this->check(compact, correct, source.number_of_values());
+}
+
+TYPED_TEST(CompactIndexConstruction, Memory)
+{
+  typedef typename TestFixture::source_type source_type;
+  typedef typename TestFixture::compact_type compact_type;
+  typedef typename TestFixture::value_type value_type;
+  typedef typename TestFixture::key_type key_type;
+
+  source_type source(15, 6);
+  typename TestFixture::result_type correct;
+  this->fill(source, correct, 5000);
+  compact_type compact(source);
+
+  size_t source_bytes = source.hash_table_size() * sizeof(std::pair<key_type, value_type>);
+  source_bytes += (source.number_of_values() - source.unique_keys()) * sizeof(value_type);
+  EXPECT_LE(2 * compact.bytes(), source_bytes) << "The compact index is not small enough";
+  EXPECT_LT(compact.bits_per_value(), 8 * sizeof(value_type)) << "Values were not bit-packed";
+}
+
+TYPED_TEST(CompactIndexConstruction, Minimizers)
+{
+  typedef typename TestFixture::source_type source_type;
+  typedef typename TestFixture::compact_type compact_type;
+  typedef typename TestFixture::key_type key_type;
+
+  std::string str = "CGAATACAATACTGATTACACATGATTATATTAGATTACATTAGGCACCA";
+  source_type source(15, 6);
+  source.add_frequent_kmers({ key_type::encode("GATTACACATGATTA"), key_type::encode("TATTAGATTACATTA") }, 3);
+  compact_type compact(source);
+  EXPECT_TRUE(compact.uses_weighted_minimizers()) << "Weighted minimizers are not in use";
+  EXPECT_EQ(compact.minimizers(str), source.minimizers(str)) << "Wrong minimizers";
+
+  source_type syncmer_source(15, 6, true);
+  compact_type syncmer_compact(syncmer_source);
+  EXPECT_TRUE(syncmer_compact.uses_syncmers()) << "Closed syncmers are not in use";
+  EXPECT_EQ(syncmer_compact.syncmers(str), syncmer_source.syncmers(str)) << "Wrong closed syncmers";
+}
+
+//------------------------------------------------------------------------------
+
+template<class KeyType>
+class CompactIndexSerialization : public ::testing::Test
+{
+};
+
+TYPED_TEST_CASE(CompactIndexSerialization, KeyTypes);
+
+TYPED_TEST(CompactIndexSerialization, Serialize)
+{
+  typedef TypeParam key_type;
+  typedef PositionPayload value_type;
+  typedef MinimizerIndex<key_type, value_type> source_type;
+  typedef CompactMinimizerIndex<key_type, value_type> compact_type;
+
+  source_type source(15, 6);
+  source.add_frequent_kmers({ key_type::encode("GATTACACATGATTA") }, 3);
+  for(size_t i = 1; i <= 100; i++)
+  {
+    for(size_t j = 0; j < 1 + (i % 3); j++)
+    {
+      source.insert(get_minimizer<key_type>(i), create_value<value_type>(make_pos_t(i + j, false, 3), Payload::create(hash(i, false, j))));
+    }
+  }
+  compact_type compact(source);
+
+  std::string filename = gbwt::TempFile::getName("compact-minimizer");
+  std::ofstream out(filename, std::ios_base::binary);
+  std::pair<size_t, bool> result = compact.serialize(out);
+  out.close();
+  ASSERT_TRUE(result.second) << "Serialization failed";
+
+  compact_type copy;
+  std::ifstream in(filename, std::ios_base::binary);
+  bool ok = copy.deserialize(in);
+  in.close();
+  gbwt::TempFile::remove(filename);
+
+  ASSERT_TRUE(ok) << "Loading the index failed";
+  EXPECT_EQ(copy, compact) << "Loaded index is not identical to the original";
+  std::vector<value_type> buffer;
+  auto found = copy.find(get_minimizer<key_type>(2), buffer);
+  EXPECT_EQ(found.second, size_t(3)) << "Wrong number of occurrences in the loaded index";
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace
@@ -591,6 +591,37 @@ TEST_F(GraphOperations, ForEachHandle)
   }
 }
 
+TEST_F(GraphOperations, BatchedLocate)
+{
+  for(nid_t id : this->correct_nodes)
+  {
+    for(bool is_reverse : { false, true })
+    {
+      gbwt::SearchState state = this->graph.get_state(this->graph.get_handle(id, is_reverse));
+      std::vector<gbwt::size_type> correct;
+      for(gbwt::size_type i = state.range.first; i <= state.range.second; i++)
+      {
+        correct.push_back(this->index.locate(gbwt::edge_type(state.node, i)));
+      }
+      EXPECT_EQ(this->graph.locate(state), correct) << "Wrong sequence identifiers for node (" << id << ", " << is_reverse << ")";
+
+      // Also test a subrange.
+      if(state.size() > 1)
+      {
+        gbwt::SearchState subrange(state.node, state.range.first + 1, state.range.second);
+        correct.erase(correct.begin());
+        EXPECT_EQ(this->graph.locate(subrange), correct) << "Wrong sequence identifiers for a subrange of node (" << id << ", " << is_reverse << ")";
+      }
+    }
+  }
+  EXPECT_TRUE(this->graph.locate(gbwt::SearchState()).empty()) << "Found sequence identifiers for an empty state";
+
+  // Visits to the endmarker cannot be located.
+  gbwt::SearchState endmarker(gbwt::ENDMARKER, 0, 1);
+  std::vector<gbwt::size_type> invalid(endmarker.size(), gbwt::invalid_sequence());
+  EXPECT_EQ(this->graph.locate(endmarker), invalid) << "Found sequence identifiers for the endmarker";
+}
+
 TEST_F(GraphOperations, ForwardTraversal)
 {
   typedef std::pair<gbwt::SearchState, gbwt::vector_type> state_type;
@@ -958,6 +989,81 @@ TEST_F(ForEachWindow, NonRedundantKmers)
   }
 }
 
+TEST_F(ForEachWindow, ViewTraversal)
+{
+  // Extract the windows with the allocation-free interface.
+  std::set<kmer_type> found_kmers;
+  auto collect = [&found_kmers](const std::vector<handle_t>& traversal, view_type seq)
+  {
+    found_kmers.insert(kmer_type(traversal, std::string(seq.first, seq.second)));
+  };
+  for_each_haplotype_window_view(this->graph, 3, collect, false);
+  EXPECT_EQ(found_kmers, this->correct_kmers) << "Wrong haplotype windows";
+
+  found_kmers.clear();
+  for_each_nonredundant_window_view(this->graph, 3, collect, false);
+  EXPECT_EQ(found_kmers, this->correct_nonredundant) << "Wrong nonredundant windows";
+}
+
+TEST_F(ForEachWindow, ParallelTraversal)
+{
+  // The parallel traversal should report the same windows the same number of times.
+  typedef void (*traversal_type)(const GBWTGraph&, size_t, const std::function<void(const std::vector<handle_t>&, const std::string&)>&, bool);
+  std::vector<traversal_type> traversals = { for_each_haplotype_window, for_each_nonredundant_window };
+  for(size_t i = 0; i < traversals.size(); i++)
+  {
+    std::multiset<kmer_type> serial_kmers, parallel_kmers;
+    traversals[i](this->graph, 3, [&](const std::vector<handle_t>& traversal, const std::string& seq)
+    {
+      serial_kmers.insert(kmer_type(traversal, seq));
+    }, false);
+    traversals[i](this->graph, 3, [&](const std::vector<handle_t>& traversal, const std::string& seq)
+    {
+      #pragma omp critical
+      {
+        parallel_kmers.insert(kmer_type(traversal, seq));
+      }
+    }, true);
+    EXPECT_EQ(parallel_kmers, serial_kmers) << "Parallel traversal " << i << " found different windows";
+  }
+}
+
+TEST_F(ForEachWindow, SplitTraversal)
+{
+  // With a low split threshold, the parallel traversal moves pending extensions
+  // to new tasks whenever there are any at a shallower depth. Long windows make
+  // the traversals deep enough for that to happen.
+  std::vector<size_t> thresholds = { 1, 2, 4 };
+  for(size_t window_size = 3; window_size <= 8; window_size++)
+  {
+    for(bool nonredundant : { false, true })
+    {
+      std::multiset<kmer_type> serial_kmers;
+      auto serial = [&](const std::vector<handle_t>& traversal, view_type seq)
+      {
+        serial_kmers.insert(kmer_type(traversal, std::string(seq.first, seq.second)));
+      };
+      if(nonredundant) { for_each_nonredundant_window_view(this->graph, window_size, serial, false); }
+      else { for_each_haplotype_window_view(this->graph, window_size, serial, false); }
+
+      for(size_t threshold : thresholds)
+      {
+        std::multiset<kmer_type> parallel_kmers;
+        auto parallel = [&](const std::vector<handle_t>& traversal, view_type seq)
+        {
+          #pragma omp critical
+          {
+            parallel_kmers.insert(kmer_type(traversal, std::string(seq.first, seq.second)));
+          }
+        };
+        if(nonredundant) { for_each_nonredundant_window_view(this->graph, window_size, parallel, true, threshold); }
+        else { for_each_haplotype_window_view(this->graph, window_size, parallel, true, threshold); }
+        EXPECT_EQ(parallel_kmers, serial_kmers) << "Wrong windows with window size " << window_size << ", nonredundant " << nonredundant << ", split threshold " << threshold;
+      }
+    }
+  }
+}
+
 //------------------------------------------------------------------------------
 
 } // namespace
@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 
 #include <gbwtgraph/gbz.h>
+#include <gbwtgraph/internal.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <vector>
 
 #include "shared.h"
 
@@ -11,6 +16,28 @@ namespace
 
 //------------------------------------------------------------------------------
 
+// A string buffer that records the size of each write.
+class WriteRecorder : public std::stringbuf
+{
+public:
+  std::vector<std::streamsize> writes;
+
+protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override
+  {
+    this->writes.push_back(n);
+    return std::stringbuf::xsputn(s, n);
+  }
+
+  int_type overflow(int_type c) override
+  {
+    if(!traits_type::eq_int_type(c, traits_type::eof())) { this->writes.push_back(1); }
+    return std::stringbuf::overflow(c);
+  }
+};
+
+//------------------------------------------------------------------------------
+
 class GBZSerialization : public ::testing::Test
 {
 public:
@@ -147,6 +174,123 @@ TEST_F(GBZSerialization, SwapAndSerialize)
   gbwt::TempFile::remove(filename);
 }
 
+TEST_F(GBZSerialization, Parallel)
+{
+  std::unique_ptr<GBZ> original = this->create_gbz();
+  std::ostringstream sequential;
+  original->simple_sds_serialize(sequential);
+
+  for(size_t threads : { 2, 4, 8 })
+  {
+    std::ostringstream parallel;
+    original->simple_sds_serialize(parallel, threads);
+    ASSERT_EQ(parallel.str(), sequential.str()) << "Different output with " << threads << " threads";
+
+    std::ostringstream external;
+    GBZ::simple_sds_serialize(original->index, original->graph, external, threads);
+    std::ostringstream external_sequential;
+    GBZ::simple_sds_serialize(original->index, original->graph, external_sequential);
+    ASSERT_EQ(external.str(), external_sequential.str()) << "Different output for external objects with " << threads << " threads";
+  }
+
+  std::string filename = gbwt::TempFile::getName("gbz");
+  original->serialize_to(filename, 4);
+  GBZ loaded; sdsl::simple_sds::load_from(loaded, filename);
+  this->check_gbz(loaded, *original);
+  gbwt::TempFile::remove(filename);
+}
+
+TEST_F(GBZSerialization, DirectGBWT)
+{
+  std::unique_ptr<GBZ> original = this->create_gbz();
+  std::ostringstream sequential;
+  original->simple_sds_serialize(sequential);
+  std::ostringstream gbwt_only;
+  original->index.simple_sds_serialize(gbwt_only);
+  std::streamsize gbwt_size = gbwt_only.str().length();
+  ASSERT_GT(gbwt_size, 0) << "Empty GBWT section";
+
+  // A buffered section would be copied to the output in a single write.
+  WriteRecorder recorder;
+  std::ostream out(&recorder);
+  original->simple_sds_serialize(out, 4);
+  ASSERT_EQ(recorder.str(), sequential.str()) << "Different output with 4 threads";
+  for(std::streamsize write : recorder.writes)
+  {
+    ASSERT_LT(write, gbwt_size) << "The GBWT section was buffered";
+  }
+}
+
+TEST(SerializeSections, Order)
+{
+  std::vector<std::function<void(std::ostream&)>> sections;
+  std::string truth;
+  for(size_t i = 0; i < 20; i++)
+  {
+    std::string data(i * 1000, 'A' + i);
+    truth += data;
+    sections.push_back([data](std::ostream& out) { out << data; });
+  }
+  for(size_t threads : { 1, 2, 3, 32 })
+  {
+    std::ostringstream out;
+    serialize_sections(out, sections, threads);
+    EXPECT_TRUE(out.good()) << "Output failed with " << threads << " threads";
+    EXPECT_EQ(out.str(), truth) << "Wrong output with " << threads << " threads";
+  }
+}
+
+TEST(SerializeSections, DirectHead)
+{
+  std::ostringstream out;
+  bool head_direct = false;
+  std::vector<std::function<void(std::ostream&)>> sections;
+  sections.push_back([&](std::ostream& section_out)
+  {
+    head_direct = (&section_out == &out);
+    section_out << "head";
+  });
+  sections.push_back([](std::ostream& section_out) { section_out << "tail"; });
+  serialize_sections(out, sections, 2);
+  EXPECT_TRUE(head_direct) << "The first section was buffered";
+  EXPECT_EQ(out.str(), "headtail") << "Wrong output";
+}
+
+TEST(SerializeSections, DirectSections)
+{
+  std::ostringstream out;
+  std::vector<bool> direct(4, false);
+  std::vector<std::function<void(std::ostream&)>> sections;
+  for(size_t i = 0; i < direct.size(); i++)
+  {
+    sections.push_back([&, i](std::ostream& section_out)
+    {
+      direct[i] = (&section_out == &out);
+      section_out << i;
+    });
+  }
+  serialize_sections(out, sections, 4, 2);
+  EXPECT_TRUE(direct[0]) << "The first section was buffered";
+  EXPECT_TRUE(direct[1]) << "The second section was buffered";
+  EXPECT_EQ(out.str(), "0123") << "Wrong output";
+
+  // All sections are written directly if there is nothing left for the workers.
+  std::ostringstream all_direct;
+  serialize_sections(all_direct, sections, 4, sections.size());
+  EXPECT_EQ(all_direct.str(), "0123") << "Wrong output when all sections are direct";
+}
+
+TEST(SerializeSections, Exceptions)
+{
+  std::vector<std::function<void(std::ostream&)>> sections;
+  sections.push_back([](std::ostream& out) { out << "first"; });
+  sections.push_back([](std::ostream&) { throw std::runtime_error("failed"); });
+  sections.push_back([](std::ostream& out) { out << "last"; });
+  std::ostringstream out;
+  EXPECT_THROW(serialize_sections(out, sections, 2), std::runtime_error) << "The exception was not rethrown";
+  EXPECT_EQ(out.str(), "first") << "Sections after the failure were written";
+}
+
 //------------------------------------------------------------------------------
 
 } // namespace
@@ -1,5 +1,14 @@
 #include <gtest/gtest.h>
 
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include <gbwtgraph/gbwtgraph.h>
 #include <gbwtgraph/gfa.h>
 
@@ -368,6 +377,197 @@ TEST_F(GFAConstruction, SegmentChopping)
   this->check_links(graph, links);
 }
 
+TEST_F(GFAConstruction, ParallelParsing)
+{
+  GFAParsingParameters parameters;
+  parameters.max_node_length = 3;
+  auto serial_parse = gfa_to_gbwt("gfas/example_chopping.gfa", parameters);
+  parameters.parallel_jobs = 4;
+  auto parallel_parse = gfa_to_gbwt("gfas/example_chopping.gfa", parameters);
+
+  this->check_gbwt(*(parallel_parse.first), serial_parse.first.get());
+  EXPECT_EQ(parallel_parse.second->sequences, serial_parse.second->sequences) << "Wrong node sequences";
+  EXPECT_EQ(parallel_parse.second->nodes, serial_parse.second->nodes) << "Wrong nodes";
+  EXPECT_EQ(parallel_parse.second->segment_translation, serial_parse.second->segment_translation) << "Wrong segment translation";
+}
+
+TEST_F(GFAConstruction, MultipleChunks)
+{
+  std::vector<std::string> filenames
+  {
+    "gfas/example.gfa", "gfas/example_str-names.gfa", "gfas/example_chopping.gfa",
+    "gfas/example_walks.gfa", "gfas/components_walks.gfa", "gfas/reversal_walks.gfa"
+  };
+  for(const std::string& filename : filenames)
+  {
+    GFAParsingParameters parameters;
+    parameters.max_node_length = 3;
+    auto serial_parse = gfa_to_gbwt(filename, parameters);
+    for(size_t chunk_size : { size_t(1), size_t(16), size_t(100) })
+    {
+      parameters.chunk_size = chunk_size;
+      auto chunked_parse = gfa_to_gbwt(filename, parameters);
+      this->check_gbwt(*(chunked_parse.first), serial_parse.first.get());
+      EXPECT_EQ(chunked_parse.second->sequences, serial_parse.second->sequences) << "Wrong node sequences for " << filename << " with chunk size " << chunk_size;
+      EXPECT_EQ(chunked_parse.second->nodes, serial_parse.second->nodes) << "Wrong nodes for " << filename << " with chunk size " << chunk_size;
+      EXPECT_EQ(chunked_parse.second->segment_translation, serial_parse.second->segment_translation) << "Wrong segment translation for " << filename << " with chunk size " << chunk_size;
+    }
+  }
+}
+
+TEST_F(GFAConstruction, ChunkLineNumbers)
+{
+  // An invalid P-line after many lines that end up in different chunks.
+  std::string filename = gbwt::TempFile::getName("gfa-chunks");
+  size_t bad_line = 0;
+  {
+    std::ifstream in("gfas/example.gfa", std::ios_base::binary);
+    std::ofstream out(filename, std::ios_base::binary);
+    std::string line;
+    while(std::getline(in, line)) { out << line << "\n"; bad_line++; }
+    for(size_t i = 0; i < 100; i++) { out << "# Comment line " << i << "\n"; bad_line++; }
+    out << "P\tbad\t1+,x\t*\n";
+  }
+
+  GFAParsingParameters parameters;
+  parameters.chunk_size = 64;
+  std::string message = "on line " + std::to_string(bad_line);
+  EXPECT_DEATH(gfa_to_gbwt(filename, parameters), message) << "Wrong line number in the error message";
+  gbwt::TempFile::remove(filename);
+}
+
+TEST_F(GFAConstruction, Streaming)
+{
+  std::vector<std::string> filenames
+  {
+    "gfas/example.gfa", "gfas/example_str-names.gfa", "gfas/example_chopping.gfa",
+    "gfas/example_walks.gfa", "gfas/components_walks.gfa", "gfas/reversal_walks.gfa"
+  };
+  for(const std::string& filename : filenames)
+  {
+    GFAParsingParameters parameters;
+    parameters.max_node_length = 3;
+    auto truth = gfa_to_gbwt(filename, parameters);
+    parameters.streaming = true;
+    for(size_t block_size : { size_t(1), size_t(64), GFAParsingParameters::STREAM_BLOCK_SIZE })
+    {
+      parameters.stream_block_size = block_size;
+      auto streamed = gfa_to_gbwt(filename, parameters);
+      this->check_gbwt(*(streamed.first), truth.first.get());
+      EXPECT_EQ(streamed.second->sequences, truth.second->sequences) << "Wrong node sequences for " << filename << " with block size " << block_size;
+      EXPECT_EQ(streamed.second->nodes, truth.second->nodes) << "Wrong nodes for " << filename << " with block size " << block_size;
+      EXPECT_EQ(streamed.second->segment_translation, truth.second->segment_translation) << "Wrong segment translation for " << filename << " with block size " << block_size;
+    }
+  }
+}
+
+TEST_F(GFAConstruction, StreamingSpilledJobs)
+{
+  // Interleave the walks of the two components.
+  std::string filename = gbwt::TempFile::getName("gfa-interleaved");
+  {
+    std::ifstream in("gfas/components_walks.gfa", std::ios_base::binary);
+    std::ofstream out(filename, std::ios_base::binary);
+    std::string line;
+    std::vector<std::string> walks;
+    while(std::getline(in, line))
+    {
+      if(!(line.empty()) && line[0] == 'W') { walks.push_back(line); }
+      else { out << line << "\n"; }
+    }
+    ASSERT_EQ(walks.size(), size_t(4)) << "Wrong number of walks in the input";
+    for(size_t i : { 0, 2, 1, 3 }) { out << walks[i] << "\n"; }
+  }
+
+  GFAParsingParameters parameters;
+  auto truth = gfa_to_gbwt(filename, parameters);
+  parameters.streaming = true;
+  parameters.stream_block_size = 1;
+  for(bool small_batches : { false, true })
+  {
+    parameters.automatic_batch_size = !small_batches;
+    parameters.batch_size = (small_batches ? 1 : GFAParsingParameters().batch_size);
+    for(size_t parallel_jobs : { size_t(1), size_t(2) })
+    {
+      Metrics metrics;
+      parameters.parallel_jobs = parallel_jobs;
+      parameters.metrics = &metrics;
+      auto streamed = gfa_to_gbwt(filename, parameters);
+      this->check_gbwt(*(streamed.first), truth.first.get());
+      EXPECT_EQ(metrics.counter("gfa_to_gbwt/jobs"), size_t(2)) << "Wrong number of jobs with " << parallel_jobs << " parallel jobs";
+      size_t expected_spills = (small_batches ? 2 : 0);
+      EXPECT_EQ(metrics.counter("gfa_to_gbwt/spilled_jobs"), expected_spills) << "Wrong number of spilled jobs with " << parallel_jobs << " parallel jobs (small batches: " << small_batches << ")";
+    }
+  }
+  gbwt::TempFile::remove(filename);
+}
+
+TEST_F(GFAConstruction, CompressedInput)
+{
+  std::string filename = "gfas/example_str-names.gfa";
+  auto truth = gfa_to_gbwt(filename);
+
+  std::string compressed = gbwt::TempFile::getName("gfa-gzip");
+  std::string command = "gzip -c " + filename + " > " + compressed;
+  ASSERT_EQ(std::system(command.c_str()), 0) << "Cannot compress " << filename;
+  auto streamed = gfa_to_gbwt(compressed);
+  gbwt::TempFile::remove(compressed);
+
+  this->check_gbwt(*(streamed.first), truth.first.get());
+  EXPECT_EQ(streamed.second->sequences, truth.second->sequences) << "Wrong node sequences";
+  EXPECT_EQ(streamed.second->nodes, truth.second->nodes) << "Wrong nodes";
+  EXPECT_EQ(streamed.second->segment_translation, truth.second->segment_translation) << "Wrong segment translation";
+}
+
+TEST_F(GFAConstruction, PipeInput)
+{
+  std::string filename = "gfas/example_walks.gfa";
+  auto truth = gfa_to_gbwt(filename);
+
+  // A named pipe cannot be read twice, so the paths are spooled to a temporary file.
+  std::string pipe = gbwt::TempFile::getName("gfa-pipe");
+  ASSERT_EQ(::mkfifo(pipe.c_str(), 0600), 0) << "Cannot create named pipe " << pipe;
+  std::thread writer([&]()
+  {
+    std::ifstream in(filename, std::ios_base::binary);
+    std::ofstream out(pipe, std::ios_base::binary);
+    out << in.rdbuf();
+  });
+  auto streamed = gfa_to_gbwt(pipe);
+  writer.join();
+  gbwt::TempFile::remove(pipe);
+
+  this->check_gbwt(*(streamed.first), truth.first.get());
+  EXPECT_EQ(streamed.second->sequences, truth.second->sequences) << "Wrong node sequences";
+  EXPECT_EQ(streamed.second->nodes, truth.second->nodes) << "Wrong nodes";
+}
+
+TEST_F(GFAConstruction, CompressedStandardInput)
+{
+  std::string filename = "gfas/example_walks.gfa";
+  auto truth = gfa_to_gbwt(filename);
+
+  std::string compressed = gbwt::TempFile::getName("gfa-gzip");
+  std::string command = "gzip -c " + filename + " > " + compressed;
+  ASSERT_EQ(std::system(command.c_str()), 0) << "Cannot compress " << filename;
+
+  // Replace standard input with the compressed file.
+  int saved_stdin = ::dup(STDIN_FILENO);
+  int fd = ::open(compressed.c_str(), O_RDONLY);
+  ASSERT_GE(fd, 0) << "Cannot open " << compressed;
+  ASSERT_EQ(::dup2(fd, STDIN_FILENO), STDIN_FILENO) << "Cannot redirect standard input";
+  ::close(fd);
+  auto streamed = gfa_to_gbwt("-");
+  ::dup2(saved_stdin, STDIN_FILENO);
+  ::close(saved_stdin);
+  std::clearerr(stdin);
+  gbwt::TempFile::remove(compressed);
+
+  this->check_gbwt(*(streamed.first), truth.first.get());
+  EXPECT_EQ(streamed.second->sequences, truth.second->sequences) << "Wrong node sequences";
+  EXPECT_EQ(streamed.second->nodes, truth.second->nodes) << "Wrong nodes";
+}
+
 class GFAConstructionReversal : public GFAConstruction
 {
 public:
@@ -660,6 +860,46 @@ TEST_F(GFAExtraction, CacheRecords)
   }
 }
 
+TEST_F(GFAExtraction, CacheBudget)
+{
+  std::string input = "gfas/components_walks.gfa";
+  auto gfa_parse = gfa_to_gbwt(input);
+  GBWTGraph graph(*(gfa_parse.first), *(gfa_parse.second));
+
+  std::vector<size_t> budgets = { 0, 1024, 65536 };
+  for(size_t budget : budgets)
+  {
+    std::string output = gbwt::TempFile::getName("gfa-extraction");
+    GFAExtractionParameters parameters;
+    parameters.large_record_bytes = 0;
+    parameters.record_cache_bytes = budget;
+    this->extract_gfa(graph, output, parameters);
+    std::string name = "Cache budget " + std::to_string(budget);
+    this->compare_gfas(output, input, name);
+    gbwt::TempFile::remove(output);
+  }
+}
+
+TEST_F(GFAExtraction, MultipleThreads)
+{
+  std::vector<std::string> inputs = { "gfas/components_walks.gfa", "gfas/example_walks.gfa" };
+  for(const std::string& input : inputs)
+  {
+    auto gfa_parse = gfa_to_gbwt(input);
+    GBWTGraph graph(*(gfa_parse.first), *(gfa_parse.second));
+    for(size_t threads = 1; threads <= 4; threads++)
+    {
+      std::string output = gbwt::TempFile::getName("gfa-extraction");
+      GFAExtractionParameters parameters;
+      parameters.num_threads = threads;
+      this->extract_gfa(graph, output, parameters);
+      std::string name = input + " with " + std::to_string(threads) + " threads";
+      this->compare_gfas(output, input, name);
+      gbwt::TempFile::remove(output);
+    }
+  }
+}
+
 TEST_F(GFAExtraction, PathModes)
 {
   std::string input = "gfas/default.gfa";
@@ -234,6 +234,161 @@ TYPED_TEST(IndexConstruction, WithPayload)
   this->check_index(index, correct_values);
 }
 
+TYPED_TEST(IndexConstruction, WithMetrics)
+{
+  // Determine the correct minimizer occurrences.
+  MinimizerIndex<TypeParam, Position> index(3, 2);
+  std::map<TypeParam, std::set<Position>> correct_values;
+  this->insert_values(index, alt_path, correct_values, index.k());
+  this->insert_values(index, short_path, correct_values, index.k());
+
+  // Check that we managed to index them and that the statistics are correct.
+  Metrics metrics;
+  index_haplotypes(this->graph, index, &metrics);
+  this->check_index(index, correct_values);
+  EXPECT_EQ(metrics.phase("index_haplotypes").count, size_t(1)) << "Construction was not recorded";
+  EXPECT_GT(metrics.counter("index_haplotypes/windows"), size_t(0)) << "No windows were recorded";
+  EXPECT_EQ(metrics.counter("index_haplotypes/keys"), index.size()) << "Wrong number of keys";
+  EXPECT_EQ(metrics.counter("index_haplotypes/values"), index.number_of_values()) << "Wrong number of values";
+  EXPECT_EQ(metrics.counter("index_haplotypes/rehashes"), size_t(0)) << "Wrong number of rehashes";
+  EXPECT_EQ(metrics.histogram("index_haplotypes/probe_length").count, index.size()) << "Wrong number of probe lengths";
+}
+
+TYPED_TEST(IndexConstruction, BulkWithoutPayload)
+{
+  // Determine the correct minimizer occurrences.
+  MinimizerIndex<TypeParam, Position> index(3, 2);
+  std::map<TypeParam, std::set<Position>> correct_values;
+  this->insert_values(index, alt_path, correct_values, index.k());
+  this->insert_values(index, short_path, correct_values, index.k());
+
+  // Check that we managed to index them.
+  bulk_index_haplotypes(this->graph, index);
+  this->check_index(index, correct_values);
+}
+
+TYPED_TEST(IndexConstruction, BulkWithPayload)
+{
+  // Determine the correct minimizer occurrences.
+  MinimizerIndex<TypeParam, PositionPayload> index(3, 2);
+  std::map<TypeParam, std::set<PositionPayload>> correct_values;
+  this->insert_values(index, alt_path, correct_values, index.k());
+  this->insert_values(index, short_path, correct_values, index.k());
+
+  // Check that we managed to index them.
+  bulk_index_haplotypes(this->graph, index, [](const pos_t& pos) -> Payload
+  {
+    return Payload::create(hash(pos));
+  });
+  this->check_index(index, correct_values);
+}
+
+TYPED_TEST(IndexConstruction, Sharded)
+{
+  // Determine the correct minimizer occurrences.
+  MinimizerIndex<TypeParam, PositionPayload> index(3, 2);
+  std::map<TypeParam, std::set<PositionPayload>> correct_values;
+  this->insert_values(index, alt_path, correct_values, index.k());
+  this->insert_values(index, short_path, correct_values, index.k());
+  auto get_payload = [](const pos_t& pos) -> Payload
+  {
+    return Payload::create(hash(pos));
+  };
+
+  // Build all shards at once and a single shard on its own.
+  size_t shards = 3;
+  ShardedMinimizerIndex<TypeParam> sharded(index, shards), single(index, shards);
+  index_haplotypes(this->graph, sharded, get_payload);
+  for(size_t shard = 0; shard < shards; shard++)
+  {
+    if(shard != 1) { single.unload_shard(shard); }
+  }
+  index_haplotypes(this->graph, single, get_payload);
+
+  for(size_t shard = 0; shard < shards; shard++)
+  {
+    std::map<TypeParam, std::set<PositionPayload>> shard_values;
+    for(auto iter = correct_values.begin(); iter != correct_values.end(); ++iter)
+    {
+      if(sharded.shard(iter->first) == shard) { shard_values[iter->first] = iter->second; }
+    }
+    this->check_index(sharded.shard_index(shard), shard_values);
+    if(shard == 1) { this->check_index(single.shard_index(shard), shard_values); }
+    else { EXPECT_TRUE(single.shard_index(shard).empty()) << "Shard " << shard << " was built but it is not loaded"; }
+  }
+}
+
+TYPED_TEST(IndexConstruction, NewHaplotypes)
+{
+  // Start with the minimizers in the first path.
+  MinimizerIndex<TypeParam, PositionPayload> index(3, 2);
+  std::map<TypeParam, std::set<PositionPayload>> old_values;
+  this->insert_values(index, short_path, old_values, index.k());
+  for(auto iter = old_values.begin(); iter != old_values.end(); ++iter)
+  {
+    for(const PositionPayload& value : iter->second)
+    {
+      index.insert({ iter->first, iter->first.hash(), 0, false }, value);
+    }
+  }
+
+  // Determine the correct minimizer occurrences in all paths.
+  std::map<TypeParam, std::set<PositionPayload>> correct_values;
+  this->insert_values(index, alt_path, correct_values, index.k());
+  this->insert_values(index, short_path, correct_values, index.k());
+
+  // Check that we managed to index the new paths.
+  index_new_haplotypes(this->graph, index, 1, [](const pos_t& pos) -> Payload
+  {
+    return Payload::create(hash(pos));
+  });
+  this->check_index(index, correct_values);
+}
+
+TYPED_TEST(IndexConstruction, NewHaplotypesWithoutPayload)
+{
+  // Start with an empty index and treat all paths as new.
+  MinimizerIndex<TypeParam, Position> index(3, 2);
+  std::map<TypeParam, std::set<Position>> correct_values;
+  this->insert_values(index, alt_path, correct_values, index.k());
+  this->insert_values(index, short_path, correct_values, index.k());
+
+  // Check that we managed to index them.
+  index_new_haplotypes(this->graph, index, 0);
+  this->check_index(index, correct_values);
+}
+
+TYPED_TEST(IndexConstruction, UnchangedPathWindows)
+{
+  // Collect the chunks in the paths with identifiers `first_path` onwards.
+  auto collect_chunks = [&](gbwt::size_type first_path, size_t window_bp) -> std::vector<std::vector<nid_t>>
+  {
+    std::vector<std::vector<nid_t>> result;
+    detail::for_each_path_window(this->graph, first_path, window_bp, [&](const std::vector<handle_t>& traversal, const std::string&)
+    {
+      std::vector<nid_t> nodes;
+      for(handle_t handle : traversal) { nodes.push_back(this->graph.get_id(handle)); }
+      result.push_back(nodes);
+    }, false);
+    return result;
+  };
+
+  // The last path is a copy of the first one.
+  for(size_t window_bp = 1; window_bp <= 4; window_bp++)
+  {
+    EXPECT_TRUE(collect_chunks(2, window_bp).empty()) << "Found windows of length " << window_bp << " in a copy of an earlier path";
+  }
+
+  // Only the windows around the new nodes 2 and 8 in the alternate path are new.
+  std::vector<std::vector<nid_t>> expected { { 1, 2, 4 }, { 6, 8, 9 } };
+  EXPECT_EQ(collect_chunks(1, 2), expected) << "Invalid chunks for two-node windows in the alternate path";
+
+  // When all paths are new, the windows shared with the first path are only
+  // reported once, and the copy of the first path does not contribute anything.
+  std::vector<std::vector<nid_t>> all_new { { 1, 4, 5, 6, 7, 9 }, { 2 }, { 8 } };
+  EXPECT_EQ(collect_chunks(0, 1), all_new) << "Invalid chunks for single-node windows when all paths are new";
+}
+
 TYPED_TEST(IndexConstruction, CanonicalKmers)
 {
   // Determine the correct canonical kmers.
@@ -281,6 +436,33 @@ TYPED_TEST(IndexConstruction, MultipleKmerIndexes)
   }
 }
 
+TYPED_TEST(IndexConstruction, ShardedKmerIndexes)
+{
+  // Determine the correct canonical kmers.
+  KmerIndex<TypeParam, Position> index;
+  std::map<TypeParam, std::set<Position>> all_values;
+  this->insert_values(index, alt_path, all_values, 3);
+  this->insert_values(index, short_path, all_values, 3);
+
+  for(size_t shards : { size_t(1), size_t(3), size_t(16) })
+  {
+    // Build the indexes.
+    std::vector<KmerIndex<TypeParam, Position>> indexes(shards);
+    build_kmer_indexes(this->graph, indexes, 3);
+
+    // Check that the kmers were partitioned correctly.
+    for(size_t shard = 0; shard < shards; shard++)
+    {
+      std::map<TypeParam, std::set<Position>> correct_values;
+      for(auto iter = all_values.begin(); iter != all_values.end(); ++iter)
+      {
+        if(kmer_shard(iter->first.hash(), shards) == shard) { correct_values[iter->first] = iter->second; }
+      }
+      this->check_index(indexes[shard], correct_values);
+    }
+  }
+}
+
 //------------------------------------------------------------------------------
 
 template<class KeyType>
@@ -322,6 +504,45 @@ TYPED_TEST(KmerCounting, FrequentKmers)
 
   auto space_efficient = frequent_kmers<TypeParam>(this->graph, k, 1, true);
   ASSERT_EQ(space_efficient, kmers) << "Invalid frequent kmers using the space-efficient algorithm";
+
+  for(size_t shards : { size_t(1), size_t(7) })
+  {
+    auto sharded = frequent_kmers<TypeParam>(this->graph, k, 1, false, KmerIndex<TypeParam, Position>::INITIAL_CAPACITY, shards);
+    EXPECT_EQ(sharded, kmers) << "Invalid frequent kmers with " << shards << " shards";
+  }
+}
+
+TYPED_TEST(KmerCounting, ExternalMemory)
+{
+  size_t k = 3;
+  auto kmers = frequent_kmers<TypeParam>(this->graph, k, 1, false);
+
+  // Default parameters, a single bucket, and a budget small enough to force repartitioning.
+  auto external = frequent_kmers_external<TypeParam>(this->graph, k, 1);
+  EXPECT_EQ(external, kmers) << "Invalid frequent kmers using external memory";
+  auto single_bucket = frequent_kmers_external<TypeParam>(this->graph, k, 1, DEFAULT_KMER_MEMORY, 1);
+  EXPECT_EQ(single_bucket, kmers) << "Invalid frequent kmers using a single bucket";
+  auto repartitioned = frequent_kmers_external<TypeParam>(this->graph, k, 1, 0, 3);
+  EXPECT_EQ(repartitioned, kmers) << "Invalid frequent kmers with repartitioned buckets";
+
+  // All kmers and their hit counts.
+  std::array<KmerIndex<TypeParam, Position>, 4> indexes;
+  build_kmer_indexes(this->graph, indexes, k);
+  std::map<TypeParam, size_t> correct, counts;
+  for(auto& index : indexes)
+  {
+    index.for_each_kmer([&](const typename KmerIndex<TypeParam, Position>::cell_type& cell)
+    {
+      TypeParam key = cell.first; key.clear_pointer();
+      correct[key] = index.occurrences(cell).second;
+    });
+  }
+  count_kmers_external<TypeParam>(this->graph, k, [&](TypeParam key, size_t hits)
+  {
+    EXPECT_EQ(counts.find(key), counts.end()) << "Kmer " << key.decode(k) << " was reported multiple times";
+    counts[key] = hits;
+  }, 0, 2);
+  EXPECT_EQ(counts, correct) << "Invalid kmer counts";
 }
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,215 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#include <gbwtgraph/gbwtgraph.h>
+#include <gbwtgraph/memory.h>
+#include <gbwtgraph/minimizer.h>
+
+#include "shared.h"
+
+using namespace gbwtgraph;
+
+namespace
+{
+
+//------------------------------------------------------------------------------
+
+constexpr size_t SMALL_ALLOCATION = 4096;
+constexpr size_t HUGE_PAGE = 2 * 1048576;
+
+typedef std::vector<std::uint64_t, PolicyAllocator<std::uint64_t>> policy_vector;
+
+MemoryPolicy
+small_policy(MemoryPolicy::page_type pages, MemoryPolicy::numa_type numa)
+{
+  MemoryPolicy policy;
+  policy.pages = pages;
+  policy.numa = numa;
+  policy.min_bytes = SMALL_ALLOCATION;
+  return policy;
+}
+
+policy_vector
+sequential_values(size_t n)
+{
+  policy_vector result(n);
+  for(size_t i = 0; i < n; i++) { result[i] = i * i; }
+  return result;
+}
+
+//------------------------------------------------------------------------------
+
+TEST(MemoryPolicy, Parse)
+{
+  std::vector<std::string> valid { "default", "thp", "2m", "1g", "interleave", "thp,interleave", "1g,node=1" };
+  for(const std::string& str : valid)
+  {
+    MemoryPolicy policy;
+    ASSERT_TRUE(MemoryPolicy::parse(str, policy)) << "Could not parse " << str;
+    MemoryPolicy copy;
+    ASSERT_TRUE(MemoryPolicy::parse(policy.to_string(), copy)) << "Could not parse " << policy.to_string();
+    EXPECT_EQ(copy.to_string(), policy.to_string()) << "Policy " << str << " did not survive a round trip";
+  }
+
+  MemoryPolicy policy;
+  ASSERT_TRUE(MemoryPolicy::parse("2m,node=3", policy)) << "Could not parse a policy with a node";
+  EXPECT_EQ(policy.pages, MemoryPolicy::pages_2m) << "Wrong page type";
+  EXPECT_EQ(policy.numa, MemoryPolicy::numa_prefer) << "Wrong NUMA placement";
+  EXPECT_EQ(policy.node, 3) << "Wrong preferred node";
+  EXPECT_EQ(policy.min_bytes, MemoryPolicy::MIN_BYTES) << "Minimum allocation size changed";
+
+  std::vector<std::string> invalid { "huge", "thp,", "node=", "node=-1", "node=x", "THP" };
+  for(const std::string& str : invalid)
+  {
+    EXPECT_FALSE(MemoryPolicy::parse(str, policy)) << "Parsed an invalid policy " << str;
+  }
+}
+
+TEST(MemoryPolicy, Scopes)
+{
+  EXPECT_TRUE(MemoryPolicy::current().is_default()) << "The initial policy is not the default";
+  {
+    ScopedMemoryPolicy outer(small_policy(MemoryPolicy::pages_transparent, MemoryPolicy::numa_default));
+    EXPECT_EQ(MemoryPolicy::current().pages, MemoryPolicy::pages_transparent) << "Outer scope was not used";
+    {
+      ScopedMemoryPolicy inner(small_policy(MemoryPolicy::pages_default, MemoryPolicy::numa_interleave));
+      EXPECT_EQ(MemoryPolicy::current().numa, MemoryPolicy::numa_interleave) << "Inner scope was not used";
+      EXPECT_EQ(MemoryPolicy::current().pages, MemoryPolicy::pages_default) << "Inner scope inherited the outer page type";
+    }
+    EXPECT_EQ(MemoryPolicy::current().pages, MemoryPolicy::pages_transparent) << "Outer scope was not restored";
+  }
+  EXPECT_TRUE(MemoryPolicy::current().is_default()) << "The default policy was not restored";
+
+  MemoryPolicy policy = small_policy(MemoryPolicy::pages_transparent, MemoryPolicy::numa_default);
+  EXPECT_FALSE(policy.applies_to(SMALL_ALLOCATION - 1)) << "Policy applies to small allocations";
+  EXPECT_TRUE(policy.applies_to(SMALL_ALLOCATION)) << "Policy does not apply to large allocations";
+  EXPECT_FALSE(MemoryPolicy().applies_to(size_t(1) << 40)) << "The default policy applies to allocations";
+}
+
+//------------------------------------------------------------------------------
+
+TEST(Allocation, MappedMemory)
+{
+  std::vector<MemoryPolicy> policies
+  {
+    small_policy(MemoryPolicy::pages_default, MemoryPolicy::numa_interleave),
+    small_policy(MemoryPolicy::pages_transparent, MemoryPolicy::numa_default),
+    small_policy(MemoryPolicy::pages_2m, MemoryPolicy::numa_default),
+  };
+  for(const MemoryPolicy& policy : policies)
+  {
+    size_t bytes = HUGE_PAGE + 1;
+    char* ptr = static_cast<char*>(allocate_memory(bytes, policy));
+    ASSERT_NE(ptr, nullptr) << "Allocation failed with policy " << policy.to_string();
+    if(policy.pages != MemoryPolicy::pages_default)
+    {
+      EXPECT_EQ(reinterpret_cast<std::uintptr_t>(ptr) % HUGE_PAGE, std::uintptr_t(0)) << "Memory is not aligned to huge pages with policy " << policy.to_string();
+    }
+    bool zero = true;
+    for(size_t i = 0; i < bytes; i++) { zero &= (ptr[i] == 0); ptr[i] = i; }
+    EXPECT_TRUE(zero) << "Memory is not zero-initialized with policy " << policy.to_string();
+    EXPECT_TRUE(release_memory(ptr)) << "Could not release memory with policy " << policy.to_string();
+    EXPECT_FALSE(release_memory(ptr)) << "Memory was released twice with policy " << policy.to_string();
+  }
+
+  std::vector<char> heap(SMALL_ALLOCATION);
+  EXPECT_FALSE(release_memory(heap.data())) << "Released heap memory";
+  EXPECT_FALSE(release_memory(nullptr)) << "Released a null pointer";
+  EXPECT_TRUE(apply_memory_policy(heap.data(), heap.size(), MemoryPolicy())) << "Could not apply the default policy";
+}
+
+TEST(Allocation, Containers)
+{
+  constexpr size_t N = 100000;
+  policy_vector original = sequential_values(N);
+
+  policy_vector mapped;
+  {
+    ScopedMemoryPolicy scope(small_policy(MemoryPolicy::pages_transparent, MemoryPolicy::numa_interleave));
+    mapped = original;
+    ASSERT_EQ(mapped, original) << "Copy made with a policy is not identical";
+  }
+
+  // Memory allocated with a policy can be released without it.
+  original.swap(mapped);
+  EXPECT_EQ(mapped, original) << "Swapped vectors are not identical";
+  original.resize(2 * N, 0);
+  original.shrink_to_fit();
+  original.resize(N);
+  EXPECT_EQ(original, sequential_values(N)) << "Vector contents changed after resizing";
+}
+
+TEST(Allocation, Replicas)
+{
+  constexpr size_t N = 10000;
+  policy_vector original = sequential_values(N);
+  NUMAReplicas<policy_vector> replicas(original, small_policy(MemoryPolicy::pages_transparent, MemoryPolicy::numa_default));
+  ASSERT_EQ(replicas.size(), numa_nodes().size()) << "Wrong number of replicas";
+  for(size_t i = 0; i < replicas.size(); i++)
+  {
+    EXPECT_EQ(replicas[i], original) << "Replica " << i << " is not identical to the original";
+  }
+  EXPECT_EQ(replicas.local(), original) << "Local replica is not identical to the original";
+  EXPECT_TRUE(MemoryPolicy::current().is_default()) << "The default policy was not restored";
+}
+
+//------------------------------------------------------------------------------
+
+TEST(Allocation, MinimizerIndex)
+{
+  typedef MinimizerIndex<Key64, PositionPayload> index_type;
+  constexpr size_t LENGTH = 100000;
+
+  std::mt19937_64 rng(0xACDC);
+  std::string sequence(LENGTH, 'A');
+  for(size_t i = 0; i < LENGTH; i++) { sequence[i] = "ACGT"[rng() & 3]; }
+  auto build = [&](index_type& index)
+  {
+    for(auto& minimizer : index.minimizers(sequence))
+    {
+      pos_t pos = make_pos_t(1 + minimizer.offset / 1024, false, minimizer.offset % 1024);
+      index.insert(minimizer, { Position::encode(pos), Payload::create(minimizer.offset) });
+    }
+  };
+
+  index_type truth;
+  build(truth);
+  std::ostringstream out;
+  truth.serialize(out);
+
+  MemoryPolicy policy = small_policy(MemoryPolicy::pages_transparent, MemoryPolicy::numa_interleave);
+  ScopedMemoryPolicy scope(policy);
+  index_type built;
+  build(built);
+  EXPECT_EQ(built, truth) << "Index built with a policy is not identical";
+
+  index_type loaded;
+  std::istringstream in(out.str());
+  loaded.deserialize(in);
+  EXPECT_EQ(loaded, truth) << "Index loaded with a policy is not identical";
+
+  NUMAReplicas<index_type> replicas(loaded, policy);
+  EXPECT_EQ(replicas.local(), truth) << "Local index replica is not identical";
+}
+
+TEST(Allocation, GBWTGraph)
+{
+  gbwt::GBWT index = build_gbwt_index();
+  SequenceSource source;
+  build_source(source);
+  GBWTGraph graph(index, source);
+  GBWTGraph copy(graph);
+
+  EXPECT_TRUE(graph.apply_memory_policy(MemoryPolicy())) << "Could not apply the default policy to the graph";
+  EXPECT_TRUE(graph.apply_memory_policy(small_policy(MemoryPolicy::pages_transparent, MemoryPolicy::numa_interleave))) << "Could not apply a policy to the graph";
+  EXPECT_EQ(graph.sequences, copy.sequences) << "Node sequences changed after applying a policy";
+  EXPECT_EQ(graph.index->bwt.data, copy.index->bwt.data) << "The BWT changed after applying a policy";
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace
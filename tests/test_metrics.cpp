@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include <omp.h>
+
+#include <gbwtgraph/metrics.h>
+#include <gbwtgraph/gfa.h>
+
+#include "shared.h"
+
+using namespace gbwtgraph;
+
+namespace
+{
+
+//------------------------------------------------------------------------------
+
+TEST(Metrics, Empty)
+{
+  Metrics metrics;
+  EXPECT_TRUE(metrics.empty()) << "New metrics object is not empty";
+  EXPECT_EQ(metrics.phase("missing").count, size_t(0)) << "Missing phase has executions";
+  EXPECT_EQ(metrics.counter("missing"), size_t(0)) << "Missing counter is not zero";
+  EXPECT_EQ(metrics.histogram("missing").count, size_t(0)) << "Missing histogram is not empty";
+  EXPECT_EQ(metrics.to_json(), "{\"phases\":{},\"counters\":{},\"histograms\":{}}") << "Wrong JSON for empty metrics";
+}
+
+TEST(Metrics, Timers)
+{
+  {
+    Metrics::Timer timer(nullptr, "disabled");
+    timer.stop();
+  }
+
+  Metrics metrics;
+  {
+    Metrics::Timer timer(&metrics, "phase");
+  }
+  {
+    Metrics::Timer timer(&metrics, "phase");
+    timer.stop();
+    timer.stop();
+  }
+  Metrics::Phase phase = metrics.phase("phase");
+  EXPECT_EQ(phase.count, size_t(2)) << "Wrong number of executions";
+  EXPECT_GE(phase.seconds, 0.0) << "Negative wall-clock time";
+  EXPECT_GE(phase.cpu_seconds, 0.0) << "Negative CPU time";
+  EXPECT_GT(phase.peak_memory, size_t(0)) << "Peak memory was not recorded";
+
+  metrics.clear();
+  EXPECT_TRUE(metrics.empty()) << "Metrics not empty after clear()";
+}
+
+TEST(Metrics, Counters)
+{
+  Metrics metrics;
+  metrics.add_counter("a");
+  metrics.add_counter("a", 41);
+  metrics.add_counter("b", 0);
+  EXPECT_EQ(metrics.counter("a"), size_t(42)) << "Wrong value for counter a";
+  EXPECT_EQ(metrics.counter("b"), size_t(0)) << "Wrong value for counter b";
+  EXPECT_FALSE(metrics.empty()) << "Metrics with counters are empty";
+}
+
+TEST(Metrics, Histograms)
+{
+  std::vector<std::pair<size_t, size_t>> buckets { { 0, 0 }, { 1, 1 }, { 2, 2 }, { 3, 2 }, { 4, 3 }, { 7, 3 }, { 8, 4 }, { 1024, 11 } };
+  for(auto value : buckets)
+  {
+    EXPECT_EQ(Metrics::Histogram::bucket(value.first), value.second) << "Wrong bucket for value " << value.first;
+  }
+
+  Metrics metrics;
+  metrics.add_to_histogram("h", 0);
+  metrics.add_to_histogram("h", 3, 2);
+  metrics.add_to_histogram("h", 5, 0);
+  Metrics::Histogram other;
+  other.add(100);
+  metrics.merge_histogram("h", other);
+
+  Metrics::Histogram histogram = metrics.histogram("h");
+  std::vector<size_t> correct { 1, 0, 2, 0, 0, 0, 0, 1 };
+  EXPECT_EQ(histogram.buckets, correct) << "Wrong buckets";
+  EXPECT_EQ(histogram.count, size_t(4)) << "Wrong number of values";
+  EXPECT_EQ(histogram.sum, size_t(106)) << "Wrong sum of values";
+  EXPECT_EQ(histogram.max, size_t(100)) << "Wrong maximum value";
+}
+
+TEST(Metrics, ConcurrentUpdates)
+{
+  constexpr size_t N = 1000;
+  Metrics metrics;
+  #pragma omp parallel for
+  for(size_t i = 0; i < N; i++)
+  {
+    metrics.add_counter("counter", 2);
+    metrics.add_to_histogram("histogram", i);
+  }
+  EXPECT_EQ(metrics.counter("counter"), 2 * N) << "Wrong counter value";
+  EXPECT_EQ(metrics.histogram("histogram").count, N) << "Wrong number of values in the histogram";
+}
+
+TEST(Metrics, JSON)
+{
+  Metrics metrics;
+  metrics.add_counter("count\"er", 3);
+  metrics.add_to_histogram("histogram", 2);
+  metrics.add_phase("phase", 1.5, 2.0);
+  std::string json = metrics.to_json();
+
+  EXPECT_NE(json.find("\"counters\":{\"count\\\"er\":3}"), std::string::npos) << "Counter not found in " << json;
+  EXPECT_NE(json.find("\"histogram\":{\"count\":1,\"sum\":2,\"max\":2,\"buckets\":[0,0,1]}"), std::string::npos) << "Histogram not found in " << json;
+  EXPECT_NE(json.find("\"phase\":{\"count\":1,\"seconds\":1.5,\"cpu_seconds\":2,"), std::string::npos) << "Phase not found in " << json;
+}
+
+//------------------------------------------------------------------------------
+
+TEST(Metrics, GFAParsing)
+{
+  Metrics metrics;
+  GFAParsingParameters parameters;
+  parameters.metrics = &metrics;
+  auto result = gfa_to_gbwt("gfas/example_walks.gfa", parameters);
+  ASSERT_TRUE(result.first != nullptr) << "GFA parsing failed";
+
+  EXPECT_EQ(metrics.phase("gfa_to_gbwt").count, size_t(1)) << "Total time was not recorded";
+  EXPECT_EQ(metrics.phase("gfa_to_gbwt/segments").count, size_t(1)) << "Segment parsing was not recorded";
+  EXPECT_EQ(metrics.phase("gfa_to_gbwt/paths").count, size_t(1)) << "Path parsing was not recorded";
+  size_t jobs = metrics.counter("gfa_to_gbwt/jobs");
+  EXPECT_EQ(metrics.phase("gfa_to_gbwt/job").count, jobs) << "Wrong number of recorded jobs";
+  EXPECT_EQ(metrics.histogram("gfa_to_gbwt/job_nodes").count, jobs) << "Wrong number of job sizes";
+  EXPECT_EQ(metrics.counter("gfa_to_gbwt/paths"), size_t(3)) << "Wrong number of paths";
+  EXPECT_EQ(metrics.counter("gfa_to_gbwt/walks"), size_t(3)) << "Wrong number of walks";
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace
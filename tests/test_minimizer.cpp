@@ -2,9 +2,11 @@
 
 #include <algorithm>
 #include <fstream>
+#include <iterator>
 #include <map>
 #include <random>
 #include <set>
+#include <sstream>
 #include <tuple>
 #include <unordered_set>
 #include <vector>
@@ -122,6 +124,10 @@ public:
     ASSERT_EQ(index.size(), keys) << "Wrong number of keys";
     ASSERT_EQ(index.number_of_values(), values) << "Wrong number of values";
     EXPECT_EQ(index.unique_keys(), unique) << "Wrong number of unique keys";
+    std::vector<size_t> probe_lengths = index.probe_lengths();
+    size_t probed_keys = 0;
+    for(size_t count : probe_lengths) { probed_keys += count; }
+    EXPECT_EQ(probed_keys, keys) << "Wrong number of keys in the probe length histogram";
 
     for(auto iter = correct_values.begin(); iter != correct_values.end(); ++iter)
     {
@@ -289,6 +295,69 @@ TYPED_TEST(CorrectKmers, DuplicateValues)
   this->check_kmer_index_index(index, correct_values, keys, values, unique);
 }
 
+TYPED_TEST(CorrectKmers, BatchedFind)
+{
+  typedef TypeParam index_type;
+  typedef typename index_type::key_type key_type;
+  typedef typename index_type::value_type value_type;
+
+  // Insert every other key with one to three values.
+  index_type index;
+  size_t total_keys = 1000;
+  for(size_t i = 1; i <= total_keys; i += 2)
+  {
+    for(size_t j = 0; j <= i % 3; j++)
+    {
+      pos_t pos = make_pos_t(i + j, j & 1, i & Position::OFF_MASK);
+      index.insert(key_type(i), create_value<value_type>(pos, Payload::create(hash(pos))));
+    }
+  }
+
+  // Query with present, missing, and empty kmers.
+  std::vector<Kmer<key_type>> kmers;
+  for(size_t i = 1; i <= total_keys; i++)
+  {
+    key_type key(i);
+    kmers.push_back({ key, key.hash(), offset_type(i), false });
+    if(i % 5 == 0) { kmers.push_back({ key_type::no_key(), 0, offset_type(i), false }); }
+  }
+  std::vector<std::pair<const value_type*, size_t>> results(kmers.size());
+  index.find(kmers.data(), kmers.size(), results.data());
+  for(size_t i = 0; i < kmers.size(); i++)
+  {
+    auto expected = index.find(kmers[i].key);
+    EXPECT_EQ(results[i], expected) << "Wrong result for kmer " << i;
+  }
+}
+
+TYPED_TEST(CorrectKmers, GrowingOccurrenceLists)
+{
+  typedef TypeParam index_type;
+  typedef typename index_type::key_type key_type;
+  typedef typename index_type::value_type value_type;
+
+  // Interleaved insertions with values in decreasing order force the
+  // occurrence lists to move within the arena.
+  index_type index;
+  size_t keys = 16, per_key = 100;
+  typename TestFixture::result_type correct_values;
+  for(size_t j = per_key; j > 0; j--)
+  {
+    for(size_t i = 1; i <= keys; i++)
+    {
+      key_type key(i);
+      pos_t pos = make_pos_t(i * per_key + j, j & 1, j & Position::OFF_MASK);
+      value_type value = create_value<value_type>(pos, Payload::create(hash(pos)));
+      index.insert(key, value);
+      correct_values[key].insert(value);
+    }
+  }
+  this->check_kmer_index_index(index, correct_values, keys, keys * per_key, 0);
+
+  index.compact();
+  this->check_kmer_index_index(index, correct_values, keys, keys * per_key, 0);
+}
+
 TYPED_TEST(CorrectKmers, Rehashing)
 {
   typedef TypeParam index_type;
@@ -327,6 +396,126 @@ TYPED_TEST(CorrectKmers, Rehashing)
   this->check_kmer_index_index(index, correct_values, keys, values, unique);
 }
 
+TYPED_TEST(CorrectKmers, ConcurrentInsertion)
+{
+  typedef TypeParam index_type;
+  typedef typename index_type::key_type key_type;
+  typedef typename index_type::value_type value_type;
+  typedef typename index_type::Insertion insertion_type;
+
+  // Enough keys to force rehashing several times, with each key inserted
+  // by multiple batches.
+  index_type index;
+  typename index_type::InsertionLocks locks;
+  size_t total_keys = 8 * index.capacity(), batches = 64;
+  size_t keys = 0, values = 0, unique = 0;
+  typename TestFixture::result_type correct_values;
+  for(size_t i = 1; i <= total_keys; i++)
+  {
+    key_type key(i);
+    for(size_t j = 0; j <= i % 3; j++)
+    {
+      pos_t pos = make_pos_t(i + j, j & 1, i & Position::OFF_MASK);
+      correct_values[key].insert(create_value<value_type>(pos, Payload::create(hash(pos))));
+    }
+    keys++; values += correct_values[key].size();
+    if(correct_values[key].size() == 1) { unique++; }
+  }
+
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_t batch_id = 0; batch_id < batches; batch_id++)
+  {
+    std::vector<insertion_type> batch;
+    for(size_t i = batch_id + 1; i <= total_keys; i += batches / 2)
+    {
+      key_type key(i);
+      for(value_type value : correct_values.at(key)) { batch.push_back({ key, key.hash(), value }); }
+    }
+    index.insert_concurrent(batch, locks);
+  }
+
+  this->check_kmer_index_index(index, correct_values, keys, values, unique);
+}
+
+TYPED_TEST(CorrectKmers, ConcurrentFrequentKeys)
+{
+  typedef TypeParam index_type;
+  typedef typename index_type::key_type key_type;
+  typedef typename index_type::value_type value_type;
+  typedef typename index_type::Insertion insertion_type;
+
+  // A few keys with many occurrences, so that the occurrence lists are
+  // appended to and grown from many batches at the same time.
+  index_type index;
+  typename index_type::InsertionLocks locks;
+  size_t total_keys = 16, occurrences = 300, batches = 64;
+  size_t keys = 0, values = 0, unique = 0;
+  typename TestFixture::result_type correct_values;
+  for(size_t i = 1; i <= total_keys; i++)
+  {
+    key_type key(i);
+    for(size_t j = 0; j < occurrences; j++)
+    {
+      pos_t pos = make_pos_t(j + 1, j & 1, i & Position::OFF_MASK);
+      correct_values[key].insert(create_value<value_type>(pos, Payload::create(hash(pos))));
+    }
+    keys++; values += correct_values[key].size();
+  }
+
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(size_t batch_id = 0; batch_id < batches; batch_id++)
+  {
+    std::vector<insertion_type> batch;
+    for(size_t i = 1; i <= total_keys; i++)
+    {
+      key_type key(i);
+      size_t j = 0;
+      for(value_type value : correct_values.at(key))
+      {
+        if(j % batches == batch_id) { batch.push_back({ key, key.hash(), value }); }
+        j++;
+      }
+    }
+    index.insert_concurrent(batch, locks);
+  }
+
+  this->check_kmer_index_index(index, correct_values, keys, values, unique);
+}
+
+TYPED_TEST(CorrectKmers, BulkLoad)
+{
+  typedef TypeParam index_type;
+  typedef typename index_type::key_type key_type;
+  typedef typename index_type::value_type value_type;
+  typedef typename index_type::Insertion insertion_type;
+
+  // Enough keys to require a larger hash table, with duplicate items.
+  index_type index;
+  size_t total_keys = 8 * index.capacity();
+  size_t keys = 0, values = 0, unique = 0;
+  typename TestFixture::result_type correct_values;
+  std::vector<insertion_type> items;
+  for(size_t i = 1; i <= total_keys; i++)
+  {
+    key_type key(i);
+    for(size_t j = 0; j <= i % 3; j++)
+    {
+      pos_t pos = make_pos_t(i + j, j & 1, i & Position::OFF_MASK);
+      value_type value = create_value<value_type>(pos, Payload::create(hash(pos)));
+      correct_values[key].insert(value);
+      items.push_back({ key, key.hash(), value });
+      if(j == 0) { items.push_back({ key, key.hash(), value }); }
+    }
+    keys++; values += correct_values[key].size();
+    if(correct_values[key].size() == 1) { unique++; }
+  }
+  std::reverse(items.begin(), items.end());
+
+  index.bulk_load(items);
+  ASSERT_EQ(index.hash_table_size(), index_type::minimum_size(total_keys)) << "Wrong hash table size";
+  this->check_kmer_index_index(index, correct_values, keys, values, unique);
+}
+
 //------------------------------------------------------------------------------
 
 template<class IndexType>
@@ -462,6 +651,78 @@ TYPED_TEST(Serialization, WeightedMinimizers)
   EXPECT_EQ(copy, index) << "Loaded index is not identical to the original";
 }
 
+TYPED_TEST(Serialization, MemoryMapping)
+{
+  typedef TypeParam key_type;
+  typedef PositionPayload value_type;
+  typedef MinimizerIndex<key_type, value_type> index_type;
+
+  // Keys with one to three values over a number of hash table blocks.
+  index_type index(15, 6);
+  index.add_frequent_kmers({ key_type::encode("GATTACACATGATTA"), key_type::encode("TATTAGATTACATTA") }, 3);
+  size_t total_keys = 2 * index.capacity();
+  for(size_t i = 1; i <= total_keys; i++)
+  {
+    for(size_t j = 0; j <= i % 3; j++)
+    {
+      pos_t pos = make_pos_t(i + j, j & 1, i & Position::OFF_MASK);
+      index.insert(get_minimizer<key_type>(i), create_value<value_type>(pos, Payload::create(hash(pos))));
+    }
+  }
+
+  std::string filename = gbwt::TempFile::getName("minimizer");
+  std::ofstream out(filename, std::ios_base::binary);
+  index.serialize(out);
+  out.close();
+
+  index_type mapped;
+  ASSERT_TRUE(mapped.load_mapped(filename)) << "Could not memory map the index";
+  EXPECT_TRUE(mapped.is_mapped()) << "The index is not memory-mapped";
+  EXPECT_EQ(mapped, index) << "Mapped index is not identical to the original";
+  for(size_t i = 1; i <= total_keys; i++)
+  {
+    auto minimizer = get_minimizer<key_type>(i);
+    auto expected = index.find(minimizer), result = mapped.find(minimizer);
+    ASSERT_EQ(result.second, expected.second) << "Wrong number of occurrences for key " << i;
+    EXPECT_TRUE(std::equal(expected.first, expected.first + expected.second, result.first)) << "Wrong occurrences for key " << i;
+    EXPECT_EQ(mapped.count(minimizer), expected.second) << "Wrong occurrence count for key " << i;
+  }
+
+  // Batched lookups in the mapped index.
+  std::vector<typename index_type::minimizer_type> minimizers;
+  for(size_t i = 1; i <= total_keys + 10; i++) { minimizers.push_back(get_minimizer<key_type>(i)); }
+  std::vector<std::pair<const value_type*, size_t>> results;
+  mapped.find(minimizers, results);
+  ASSERT_EQ(results.size(), minimizers.size()) << "Wrong number of batched results";
+  for(size_t i = 0; i < minimizers.size(); i++)
+  {
+    EXPECT_EQ(results[i], mapped.find(minimizers[i])) << "Wrong batched result for minimizer " << i;
+  }
+
+  // A truncated file cannot be mapped.
+  {
+    std::ifstream in(filename, std::ios_base::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::string truncated_name = gbwt::TempFile::getName("minimizer");
+    std::ofstream truncated(truncated_name, std::ios_base::binary);
+    truncated.write(bytes.data(), bytes.size() / 2);
+    truncated.close();
+    index_type failed;
+    EXPECT_FALSE(failed.load_mapped(truncated_name)) << "Mapped a truncated index";
+    EXPECT_FALSE(failed.is_mapped()) << "A failed mapping left the index mapped";
+    gbwt::TempFile::remove(truncated_name);
+  }
+
+  // A copy shares the mapping, and serializing it produces the same file.
+  index_type copy(mapped);
+  gbwt::TempFile::remove(filename);
+  EXPECT_TRUE(copy.is_mapped()) << "The copy is not memory-mapped";
+  std::ostringstream original_bytes, mapped_bytes;
+  index.serialize(original_bytes);
+  copy.serialize(mapped_bytes);
+  EXPECT_EQ(mapped_bytes.str(), original_bytes.str()) << "Serializing the mapped index changed the file";
+}
+
 //------------------------------------------------------------------------------
 
 template<class KeyType>
@@ -1018,6 +1279,146 @@ TYPED_TEST(MinimizerExtraction, BothOrientations)
   }
 }
 
+TYPED_TEST(MinimizerExtraction, BatchHashing)
+{
+  typedef TypeParam key_type;
+
+  std::mt19937_64 rng(0xDEADBEEF);
+  std::string bases = "ACGT";
+  size_t k = key_type::KMER_MAX_LENGTH;
+  for(size_t n : { size_t(0), size_t(1), size_t(3), size_t(4), size_t(37), size_t(64) })
+  {
+    std::vector<key_type> keys(n);
+    key_type key; size_t valid_chars = 0;
+    for(size_t i = 0; i < n; i++)
+    {
+      for(size_t j = 0; j < 7; j++) { key.forward(k, bases[rng() & 3], valid_chars); }
+      keys[i] = key;
+      if(i % 5 == 0) { keys[i].set_pointer(); }
+    }
+    std::vector<size_t> hashes(n + 1, 0); // Avoid data() == nullptr.
+    key_type::hash_batch(keys.data(), n, hashes.data());
+    for(size_t i = 0; i < n; i++)
+    {
+      EXPECT_EQ(hashes[i], keys[i].hash()) << "Wrong batched hash for key " << i << " / " << n;
+    }
+  }
+}
+
+/*
+  Reference implementations that find minimizers / closed syncmers by
+  considering each window / kmer independently. They assume that there are
+  no hash collisions between different kmers.
+*/
+
+template<class IndexType>
+std::vector<typename IndexType::minimizer_type>
+naive_minimizers(const IndexType& index, const std::string& str)
+{
+  typedef typename IndexType::key_type key_type;
+  typedef typename IndexType::minimizer_type minimizer_type;
+
+  std::vector<minimizer_type> candidates(str.length());
+  std::vector<bool> valid(str.length(), false);
+  key_type forward_key, reverse_key;
+  size_t valid_chars = 0;
+  for(size_t i = 0; i < str.length(); i++)
+  {
+    forward_key.forward(index.k(), str[i], valid_chars);
+    reverse_key.reverse(index.k(), str[i]);
+    if(valid_chars < index.k()) { continue; }
+    size_t forward_hash = forward_key.hash(), reverse_hash = reverse_key.hash();
+    size_t start = i + 1 - index.k();
+    valid[start] = true;
+    if(reverse_hash < forward_hash) { candidates[start] = { reverse_key, reverse_hash, static_cast<offset_type>(i), true }; }
+    else { candidates[start] = { forward_key, forward_hash, static_cast<offset_type>(start), false }; }
+  }
+
+  std::set<size_t> selected;
+  for(size_t start = 0; start + index.window_bp() <= str.length(); start++)
+  {
+    size_t best = std::numeric_limits<size_t>::max();
+    for(size_t i = start; i < start + index.w(); i++)
+    {
+      if(valid[i]) { best = std::min(best, candidates[i].hash); }
+    }
+    for(size_t i = start; i < start + index.w(); i++)
+    {
+      if(valid[i] && candidates[i].hash == best) { selected.insert(i); }
+    }
+  }
+
+  std::vector<minimizer_type> result;
+  for(size_t i : selected) { result.push_back(candidates[i]); }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+template<class IndexType>
+std::vector<typename IndexType::minimizer_type>
+naive_syncmers(const IndexType& index, const std::string& str)
+{
+  typedef typename IndexType::key_type key_type;
+  typedef typename IndexType::minimizer_type minimizer_type;
+
+  std::vector<minimizer_type> result;
+  for(size_t start = 0; start + index.k() <= str.length(); start++)
+  {
+    std::vector<size_t> smer_hashes;
+    key_type forward_key, reverse_key;
+    size_t valid_chars = 0;
+    for(size_t i = start; i < start + index.k(); i++)
+    {
+      forward_key.forward(index.s(), str[i], valid_chars);
+      reverse_key.reverse(index.s(), str[i]);
+      if(valid_chars >= index.s()) { smer_hashes.push_back(std::min(forward_key.hash(), reverse_key.hash())); }
+    }
+    if(valid_chars < index.k()) { continue; }
+    size_t best = *std::min_element(smer_hashes.begin(), smer_hashes.end());
+    if(smer_hashes.front() != best && smer_hashes.back() != best) { continue; }
+
+    forward_key = key_type(); reverse_key = key_type(); valid_chars = 0;
+    for(size_t i = start; i < start + index.k(); i++)
+    {
+      forward_key.forward(index.k(), str[i], valid_chars);
+      reverse_key.reverse(index.k(), str[i]);
+    }
+    size_t forward_hash = forward_key.hash(), reverse_hash = reverse_key.hash();
+    if(reverse_hash < forward_hash) { result.push_back({ reverse_key, reverse_hash, static_cast<offset_type>(start + index.k() - 1), true }); }
+    else { result.push_back({ forward_key, forward_hash, static_cast<offset_type>(start), false }); }
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+TYPED_TEST(MinimizerExtraction, LongSequence)
+{
+  typedef TypeParam key_type;
+  typedef MinimizerIndex<key_type, Position> index_type;
+
+  // Long enough to span multiple blocks of kmers, with occasional invalid characters.
+  std::mt19937_64 rng(0xACDC);
+  std::string str(1000, 'A');
+  for(size_t i = 0; i < str.length(); i++) { str[i] = (rng() % 97 == 0 ? 'N' : "ACGT"[rng() & 3]); }
+
+  index_type minimizer_index(15, 7);
+  auto minimizers = minimizer_index.minimizers(str);
+  auto correct_minimizers = naive_minimizers(minimizer_index, str);
+  EXPECT_EQ(minimizers, correct_minimizers) << "Did not find the correct minimizers";
+
+  auto regions = minimizer_index.minimizer_regions(str);
+  ASSERT_EQ(regions.size(), minimizers.size()) << "Wrong number of minimizers with regions";
+  for(size_t i = 0; i < regions.size(); i++)
+  {
+    EXPECT_EQ(std::get<0>(regions[i]), minimizers[i]) << "Wrong minimizer " << i << " with regions";
+  }
+
+  index_type syncmer_index(15, 7, true);
+  auto syncmers = syncmer_index.syncmers(str);
+  auto correct_syncmers = naive_syncmers(syncmer_index, str);
+  EXPECT_EQ(syncmers, correct_syncmers) << "Did not find the correct closed syncmers";
+}
+
 //------------------------------------------------------------------------------
 
 class HitsInSubgraphTest : public ::testing::Test
@@ -1044,6 +1445,42 @@ public:
       result.emplace_back(pos, payload);
     });
     ASSERT_EQ(result, expected_result) << test_case << ": Incorrect results with exponential search";
+
+    // Batched version with all hits in a single list, and with the hits split
+    // into multiple lists including empty ones.
+    SubgraphFilter filter(subgraph);
+    EXPECT_EQ(filter.size(), subgraph.size()) << test_case << ": Wrong filter size";
+    for(nid_t node : sorted_subgraph)
+    {
+      ASSERT_TRUE(filter.contains(node)) << test_case << ": Filter does not contain node " << node;
+      ASSERT_FALSE(filter.contains(node + 1) && subgraph.find(node + 1) == subgraph.end()) << test_case << ": Filter contains node " << (node + 1);
+    }
+    std::vector<size_t> boundaries;
+    std::vector<std::pair<const PositionPayload*, size_t>> lists { { hits.data(), hits.size() } };
+    hits_in_subgraph(lists, filter, result, boundaries);
+    ASSERT_EQ(result, expected_result) << test_case << ": Incorrect results with a single batch";
+    ASSERT_EQ(boundaries, std::vector<size_t>({ 0, expected_result.size() })) << test_case << ": Incorrect boundaries for a single batch";
+
+    lists.clear();
+    size_t list_start = 0;
+    for(size_t i = 0; list_start < hits.size(); i++)
+    {
+      size_t length = std::min(hits.size() - list_start, (i % 3 == 0 ? size_t(0) : i));
+      lists.emplace_back(hits.data() + list_start, length);
+      list_start += length;
+    }
+    hits_in_subgraph(lists, filter, result, boundaries);
+    ASSERT_EQ(result, expected_result) << test_case << ": Incorrect results with multiple batches";
+    ASSERT_EQ(boundaries.size(), lists.size() + 1) << test_case << ": Wrong number of boundaries";
+    for(size_t i = 0; i < lists.size(); i++)
+    {
+      size_t expected = 0;
+      for(size_t j = 0; j < lists[i].second; j++)
+      {
+        if(subgraph.find(lists[i].first[j].position.id()) != subgraph.end()) { expected++; }
+      }
+      ASSERT_EQ(boundaries[i + 1] - boundaries[i], expected) << test_case << ": Wrong number of hits for list " << i;
+    }
   }
 
   std::tuple<std::unordered_set<nid_t>, std::vector<PositionPayload>, result_type>
@@ -1106,6 +1543,23 @@ TEST_F(HitsInSubgraphTest, EmptySets)
   this->check_results(subgraph, hits, expected_result, "Empty subgraph");
 }
 
+TEST_F(HitsInSubgraphTest, FilterRepresentation)
+{
+  std::vector<nid_t> dense { 10, 11, 12, 14, 20, 20 };
+  SubgraphFilter dense_filter(dense);
+  EXPECT_TRUE(dense_filter.is_bitmap()) << "Dense subgraph is not a bitmap";
+  EXPECT_EQ(dense_filter.size(), size_t(5)) << "Wrong size for dense subgraph";
+
+  std::vector<nid_t> sparse { 10, 11, 1000000, 1000001, 1000002 };
+  SubgraphFilter sparse_filter(sparse);
+  EXPECT_FALSE(sparse_filter.is_bitmap()) << "Sparse subgraph is a bitmap";
+  EXPECT_EQ(sparse_filter.size(), sparse.size()) << "Wrong size for sparse subgraph";
+  for(nid_t node : { 9, 12, 999999, 1000003 })
+  {
+    EXPECT_FALSE(sparse_filter.contains(node)) << "Sparse subgraph contains node " << node;
+  }
+}
+
 TEST_F(HitsInSubgraphTest, SmallSets)
 {
   constexpr size_t UNIVERSE_SIZE = 1024;
@@ -939,6 +939,56 @@ TEST_F(AugmentTest, PathNames)
   }
 }
 
+TEST_F(AugmentTest, MultipleJobs)
+{
+  PathCoverParameters params;
+  params.num_paths = 4; params.context = 3;
+  PathCoverParameters parallel_params = params;
+  parallel_params.parallel_jobs = 2;
+  std::vector<std::set<size_t>> component_sets
+  {
+    { }, { 0 }, { 1 }, { 0, 1 }
+  };
+
+  for(const std::set<size_t>& components_present : component_sets)
+  {
+    gbwt::DynamicGBWT serial = this->create_gbwt(components_present);
+    gbwt::DynamicGBWT parallel = serial;
+    std::string name = this->set_name(components_present);
+
+    size_t serial_components = augment_gbwt(this->graph, serial, params);
+    size_t parallel_components = augment_gbwt(this->graph, parallel, parallel_params);
+    ASSERT_EQ(parallel_components, serial_components) << "Wrong number of covered components for components " << name;
+    ASSERT_EQ(parallel.sequences(), serial.sequences()) << "Wrong number of sequences for components " << name;
+    for(gbwt::size_type i = 0; i < serial.sequences(); i++)
+    {
+      EXPECT_EQ(parallel.extract(i), serial.extract(i)) << "Wrong sequence " << i << " for components " << name;
+    }
+    ASSERT_TRUE(parallel.hasMetadata()) << "No metadata for components " << name;
+    EXPECT_EQ(parallel.metadata, serial.metadata) << "Wrong metadata for components " << name;
+  }
+}
+
+TEST_F(AugmentTest, MultipleJobsSampleInterval)
+{
+  // With sample interval 1, every position of the merged partial indexes should be sampled.
+  PathCoverParameters params;
+  params.num_paths = 4; params.context = 3;
+  params.parallel_jobs = 2; params.sample_interval = 1;
+
+  gbwt::DynamicGBWT augmented = this->create_gbwt({ });
+  size_t covered_components = augment_gbwt(this->graph, augmented, params);
+  ASSERT_GT(covered_components, size_t(1)) << "Not enough components for multiple jobs";
+  gbwt::GBWT compressed(augmented);
+  for(gbwt::node_type node = compressed.firstNode(); node < compressed.sigma(); node++)
+  {
+    for(gbwt::size_type i = 0; i < compressed.nodeSize(node); i++)
+    {
+      EXPECT_NE(compressed.tryLocate(node, i), gbwt::invalid_sequence()) << "Position (" << node << ", " << i << ") is not sampled";
+    }
+  }
+}
+
 TEST_F(AugmentTest, SamplesAndContigs)
 {
   PathCoverParameters params;
@@ -0,0 +1,245 @@
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+
+#include <gbwtgraph/sharded_minimizer.h>
+
+#include "shared.h"
+
+using namespace gbwtgraph;
+
+namespace
+{
+
+//------------------------------------------------------------------------------
+
+using KeyTypes = ::testing::Types<Key64, Key128>;
+
+constexpr size_t SHARDS = 5;
+
+template<class KeyType>
+class ShardedIndex : public ::testing::Test
+{
+public:
+  typedef KeyType key_type;
+  typedef ShardedMinimizerIndex<key_type> sharded_type;
+  typedef typename sharded_type::index_type index_type;
+  typedef typename sharded_type::minimizer_type minimizer_type;
+  typedef std::map<key_type, std::set<PositionPayload>> result_type;
+
+  // Inserts random keys with 1 to 4 occurrences into the index and the shards.
+  void fill(index_type& index, sharded_type& sharded, result_type& correct, size_t keys)
+  {
+    std::mt19937_64 rng(0xDEADBEEF);
+    while(correct.size() < keys)
+    {
+      key_type key(rng() & 0xFFFFFFFFFF);
+      minimizer_type minimizer = get_minimizer<key_type>(key);
+      size_t occurrences = 1 + (rng() & 3);
+      for(size_t i = 0; i < occurrences; i++)
+      {
+        pos_t pos = make_pos_t(1 + (rng() & 0xFFFFF), rng() & 1, rng() & Position::OFF_MASK);
+        PositionPayload value { Position::encode(pos), Payload::create(rng() & 0xFFFFFFFF) };
+        index.insert(minimizer, value);
+        sharded.shard_index(sharded.shard(minimizer)).insert(minimizer, value);
+        correct[key].insert(value);
+      }
+    }
+  }
+
+  void check(const sharded_type& sharded, const result_type& correct) const
+  {
+    std::vector<minimizer_type> queries;
+    for(auto iter = correct.begin(); iter != correct.end(); ++iter)
+    {
+      minimizer_type minimizer = get_minimizer<key_type>(iter->first);
+      queries.push_back(minimizer);
+      size_t shard = sharded.shard(minimizer);
+      EXPECT_EQ(shard, sharded.shard(iter->first)) << "Minimizer and key routed differently for key " << iter->first;
+      if(!(sharded.is_loaded(shard))) { queries.pop_back(); continue; }
+      std::pair<const PositionPayload*, size_t> result;
+      EXPECT_TRUE(sharded.find(minimizer, result)) << "Checked query failed for key " << iter->first;
+      EXPECT_EQ(sharded.find(minimizer), result) << "Checked and unchecked queries differ for key " << iter->first;
+      std::vector<PositionPayload> truth(iter->second.begin(), iter->second.end());
+      std::vector<PositionPayload> found(result.first, result.first + result.second);
+      EXPECT_EQ(found, truth) << "Wrong occurrences for key " << iter->first;
+    }
+
+    std::vector<std::pair<const PositionPayload*, size_t>> results;
+    EXPECT_TRUE(sharded.find(queries, results)) << "Batched queries failed";
+    ASSERT_EQ(results.size(), queries.size()) << "Wrong number of batched results";
+    for(size_t i = 0; i < queries.size(); i++)
+    {
+      auto result = sharded.find(queries[i]);
+      EXPECT_EQ(results[i], result) << "Wrong batched result for query " << i;
+    }
+  }
+};
+
+TYPED_TEST_CASE(ShardedIndex, KeyTypes);
+
+TYPED_TEST(ShardedIndex, Contents)
+{
+  typedef typename TestFixture::index_type index_type;
+  typedef typename TestFixture::sharded_type sharded_type;
+
+  index_type index(15, 6);
+  sharded_type sharded(index, SHARDS);
+  typename TestFixture::result_type correct;
+  this->fill(index, sharded, correct, 1000);
+
+  ASSERT_EQ(sharded.shards(), SHARDS) << "Wrong number of shards";
+  EXPECT_EQ(sharded.size(), index.size()) << "Wrong number of keys";
+  EXPECT_EQ(sharded.number_of_values(), index.number_of_values()) << "Wrong number of values";
+  for(size_t shard = 0; shard < sharded.shards(); shard++)
+  {
+    EXPECT_TRUE(sharded.is_loaded(shard)) << "Shard " << shard << " is not loaded";
+    EXPECT_GT(sharded.keys(shard), size_t(0)) << "Shard " << shard << " is empty";
+  }
+  this->check(sharded, correct);
+}
+
+TYPED_TEST(ShardedIndex, Minimizers)
+{
+  typedef typename TestFixture::key_type key_type;
+  typedef typename TestFixture::index_type index_type;
+  typedef typename TestFixture::sharded_type sharded_type;
+
+  std::string str = "CGAATACAATACTGATTACACATGATTATATTAGATTACATTAGGCACCA";
+  index_type index(15, 6);
+  index.add_frequent_kmers({ key_type::encode("GATTACACATGATTA"), key_type::encode("TATTAGATTACATTA") }, 3);
+  sharded_type sharded(index, SHARDS);
+  EXPECT_EQ(sharded.minimizers(str), index.minimizers(str)) << "Wrong minimizers";
+  for(size_t shard = 0; shard < sharded.shards(); shard++)
+  {
+    EXPECT_EQ(sharded.shard_index(shard).minimizers(str), index.minimizers(str)) << "Wrong minimizers in shard " << shard;
+  }
+}
+
+TYPED_TEST(ShardedIndex, Serialize)
+{
+  typedef typename TestFixture::key_type key_type;
+  typedef typename TestFixture::minimizer_type minimizer_type;
+  typedef typename TestFixture::index_type index_type;
+  typedef typename TestFixture::sharded_type sharded_type;
+
+  index_type index(15, 6);
+  sharded_type sharded(index, SHARDS);
+  typename TestFixture::result_type correct;
+  this->fill(index, sharded, correct, 1000);
+
+  std::string prefix = gbwt::TempFile::getName("sharded-minimizer");
+  ASSERT_TRUE(sharded.write(prefix)) << "Serialization failed";
+
+  // The manifest can be identified by its tag.
+  {
+    std::ifstream in(sharded_type::manifest_name(prefix), std::ios_base::binary);
+    std::uint32_t tag = 0, version = 0;
+    in.read(reinterpret_cast<char*>(&tag), sizeof(tag));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    ASSERT_TRUE(in.good()) << "Cannot read the manifest header";
+    EXPECT_EQ(tag, sharded_type::TAG) << "Invalid manifest tag";
+    EXPECT_EQ(version, sharded_type::VERSION) << "Invalid manifest version";
+  }
+
+  // Load everything.
+  for(bool mapped : { false, true })
+  {
+    sharded_type copy;
+    ASSERT_TRUE(copy.read(prefix, mapped)) << "Loading the index failed (mapped: " << mapped << ")";
+    ASSERT_EQ(copy.shards(), sharded.shards()) << "Wrong number of shards (mapped: " << mapped << ")";
+    EXPECT_EQ(copy.size(), sharded.size()) << "Wrong number of keys (mapped: " << mapped << ")";
+    this->check(copy, correct);
+  }
+
+  // Load the manifest and some of the shards.
+  {
+    sharded_type partial;
+    ASSERT_TRUE(partial.read_manifest(prefix)) << "Loading the manifest failed";
+    EXPECT_EQ(partial.size(), sharded.size()) << "Wrong number of keys in the manifest";
+    EXPECT_EQ(partial.number_of_values(), sharded.number_of_values()) << "Wrong number of values in the manifest";
+    ASSERT_TRUE(partial.read_shard(prefix, 1)) << "Loading shard 1 failed";
+    ASSERT_TRUE(partial.read_shard(prefix, 3)) << "Loading shard 3 failed";
+    EXPECT_FALSE(partial.read_shard(prefix, SHARDS)) << "Loaded a shard that does not exist";
+    for(size_t shard = 0; shard < partial.shards(); shard++)
+    {
+      EXPECT_EQ(partial.is_loaded(shard), (shard == 1 || shard == 3)) << "Wrong load status for shard " << shard;
+      EXPECT_EQ(partial.keys(shard), sharded.keys(shard)) << "Wrong number of keys in shard " << shard;
+    }
+    this->check(partial, correct);
+    for(auto iter = correct.begin(); iter != correct.end(); ++iter)
+    {
+      minimizer_type minimizer = get_minimizer<key_type>(iter->first);
+      if(!(partial.is_loaded(partial.shard(minimizer))))
+      {
+        std::pair<const PositionPayload*, size_t> result(nullptr, 1);
+        EXPECT_FALSE(partial.find(minimizer, result)) << "Queried a shard that is not loaded for key " << iter->first;
+        EXPECT_EQ(result.second, size_t(0)) << "Non-empty result from a shard that is not loaded for key " << iter->first;
+        EXPECT_EQ(partial.find(minimizer).second, size_t(0)) << "Non-empty unchecked result from a shard that is not loaded for key " << iter->first;
+        std::vector<std::pair<const PositionPayload*, size_t>> results;
+        EXPECT_FALSE(partial.find(std::vector<minimizer_type>(1, minimizer), results)) << "Batched query succeeded with a shard that is not loaded";
+        break;
+      }
+    }
+    partial.unload_shard(1);
+    EXPECT_FALSE(partial.is_loaded(1)) << "Shard 1 is still loaded";
+    EXPECT_EQ(partial.keys(1), sharded.keys(1)) << "Wrong number of keys in an unloaded shard";
+  }
+
+  // Rebuild the manifest from the shards.
+  {
+    sharded_type scanned;
+    ASSERT_TRUE(scanned.scan_shards(prefix, SHARDS)) << "Scanning the shards failed";
+    EXPECT_EQ(scanned.size(), sharded.size()) << "Wrong number of keys in scanned shards";
+    EXPECT_EQ(scanned.parameter_index(), sharded.parameter_index()) << "Wrong parameters in scanned shards";
+    EXPECT_FALSE(scanned.scan_shards(prefix, SHARDS + 1)) << "Scanned a shard that does not exist";
+  }
+
+  std::string manifest = sharded_type::manifest_name(prefix);
+  gbwt::TempFile::remove(manifest);
+  for(size_t shard = 0; shard < sharded.shards(); shard++)
+  {
+    std::string filename = sharded_type::shard_name(prefix, shard);
+    gbwt::TempFile::remove(filename);
+  }
+}
+
+TYPED_TEST(ShardedIndex, MismatchedShard)
+{
+  typedef typename TestFixture::index_type index_type;
+  typedef typename TestFixture::sharded_type sharded_type;
+
+  index_type index(15, 6);
+  sharded_type sharded(index, 2);
+  typename TestFixture::result_type correct;
+  this->fill(index, sharded, correct, 100);
+  std::string prefix = gbwt::TempFile::getName("sharded-minimizer");
+  ASSERT_TRUE(sharded.write(prefix)) << "Serialization failed";
+
+  // Overwrite shard 1 with a shard using different parameters.
+  index_type other(13, 6);
+  sharded_type other_sharded(other, 2);
+  ASSERT_TRUE(other_sharded.write_shard(prefix, 1)) << "Serialization failed";
+
+  sharded_type copy;
+  ASSERT_TRUE(copy.read_manifest(prefix)) << "Loading the manifest failed";
+  EXPECT_TRUE(copy.read_shard(prefix, 0)) << "Loading shard 0 failed";
+  EXPECT_FALSE(copy.read_shard(prefix, 1)) << "Loaded a shard with the wrong parameters";
+  EXPECT_FALSE(copy.is_loaded(1)) << "Shard with the wrong parameters is loaded";
+
+  std::string manifest = sharded_type::manifest_name(prefix);
+  gbwt::TempFile::remove(manifest);
+  for(size_t shard = 0; shard < sharded.shards(); shard++)
+  {
+    std::string filename = sharded_type::shard_name(prefix, shard);
+    gbwt::TempFile::remove(filename);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+} // namespace
@@ -4,6 +4,8 @@
 #include <gbwtgraph/gfa.h>
 #include <gbwtgraph/internal.h>
 
+#include <random>
+
 #include "shared.h"
 
 using namespace gbwtgraph;
@@ -100,6 +102,63 @@ TEST_F(PathIndexTest, NonIndexedPaths)
   }
 }
 
+TEST_F(PathIndexTest, Serialization)
+{
+  for(auto& graph_name : this->graphs)
+  {
+    GBZ gbz = build_gbz(graph_name);
+    PathIndex original(gbz, 3);
+    size_t expected_size = original.simple_sds_size() * sizeof(sdsl::simple_sds::element_type);
+    std::string filename = gbwt::TempFile::getName("pathindex");
+    sdsl::simple_sds::serialize_to(original, filename);
+
+    PathIndex duplicate;
+    std::ifstream in(filename, std::ios_base::binary);
+    size_t bytes = gbwt::fileSize(in);
+    ASSERT_EQ(bytes, expected_size) << "Invalid file size for graph " << graph_name;
+    duplicate.simple_sds_load(in);
+    in.close();
+    gbwt::TempFile::remove(filename);
+
+    EXPECT_EQ(duplicate.header, original.header) << "Invalid header for graph " << graph_name;
+    ASSERT_EQ(duplicate.paths(), original.paths()) << "Invalid number of paths for graph " << graph_name;
+    EXPECT_EQ(duplicate.gbwt_positions, original.gbwt_positions) << "Invalid GBWT positions for graph " << graph_name;
+    EXPECT_TRUE(duplicate.compatible(gbz, 3)) << "The loaded index is not compatible with graph " << graph_name;
+    for(size_t path_id = 0; path_id < original.paths(); path_id++)
+    {
+      path_handle_t handle = handlegraph::as_path_handle(path_id);
+      ASSERT_EQ(duplicate.path_length(handle), original.path_length(handle)) << "Invalid length for path " << path_id << " in graph " << graph_name;
+      for(size_t seq_offset = 0; seq_offset <= original.path_length(handle); seq_offset++)
+      {
+        ASSERT_EQ(duplicate.sampled_position(handle, seq_offset), original.sampled_position(handle, seq_offset)) << "Invalid sampled position for path " << path_id << ", offset " << seq_offset << " in graph " << graph_name;
+      }
+    }
+  }
+}
+
+TEST_F(PathIndexTest, Compatibility)
+{
+  GBZ gbz = build_gbz(this->graphs[0]);
+  PathIndex index(gbz);
+  EXPECT_TRUE(index.compatible(gbz)) << "The index is not compatible with its own graph";
+  EXPECT_FALSE(PathIndex().compatible(gbz)) << "An empty index is compatible with a non-empty graph";
+  EXPECT_FALSE(index.compatible(gbz, PathIndex::DEFAULT_SAMPLE_INTERVAL + 1)) << "The index is compatible with a different sample interval";
+
+  PathIndex modified = index;
+  modified.gbwt_positions.back().front().second++;
+  EXPECT_FALSE(modified.compatible(gbz)) << "The index is compatible with a graph with different path starts";
+
+  modified = index;
+  modified.header.checksum++;
+  EXPECT_FALSE(modified.compatible(gbz)) << "The index is compatible with a graph with a different checksum";
+
+  // A graph with the same path starts but different path lengths.
+  GBZ other = gbz;
+  other.graph.named_paths.back().length++;
+  EXPECT_NE(PathIndex::checksum(other), PathIndex::checksum(gbz)) << "The checksum does not depend on path lengths";
+  EXPECT_FALSE(index.compatible(other)) << "The index is compatible with a graph with different path lengths";
+}
+
 //------------------------------------------------------------------------------
 
 class SubgraphQueryTest : public ::testing::Test
@@ -395,4 +454,71 @@ TEST_F(SubgraphQueryTest, ContigB)
 
 //------------------------------------------------------------------------------
 
+// The quadratic LCS algorithm that used to be in align_paths().
+std::vector<std::pair<size_t, size_t>>
+quadratic_lcs(const gbwt::vector_type& reference, const gbwt::vector_type& path)
+{
+  std::vector<std::vector<std::uint32_t>> dp(path.size() + 1, std::vector<std::uint32_t>(reference.size() + 1, 0));
+  for(size_t path_offset = 0; path_offset < path.size(); path_offset++)
+  {
+    for(size_t ref_offset = 0; ref_offset < reference.size(); ref_offset++)
+    {
+      if(path[path_offset] == reference[ref_offset]) { dp[path_offset + 1][ref_offset + 1] = dp[path_offset][ref_offset] + 1; }
+      else { dp[path_offset + 1][ref_offset + 1] = std::max(dp[path_offset][ref_offset + 1], dp[path_offset + 1][ref_offset]); }
+    }
+  }
+
+  std::vector<std::pair<size_t, size_t>> result;
+  size_t path_offset = path.size(), ref_offset = reference.size();
+  while(path_offset > 0 && ref_offset > 0)
+  {
+    if(path[path_offset - 1] == reference[ref_offset - 1])
+    {
+      result.push_back(std::make_pair(path_offset - 1, ref_offset - 1));
+      path_offset--; ref_offset--;
+    }
+    else if(dp[path_offset - 1][ref_offset] > dp[path_offset][ref_offset - 1]) { path_offset--; }
+    else { ref_offset--; }
+  }
+  std::reverse(result.begin(), result.end());
+  return result;
+}
+
+TEST(LongestCommonSubsequence, EdgeCases)
+{
+  gbwt::vector_type empty, sequence { 2, 4, 6, 4, 2 };
+  EXPECT_TRUE(longest_common_subsequence(empty, empty).empty()) << "Non-empty LCS for empty sequences";
+  EXPECT_TRUE(longest_common_subsequence(sequence, empty).empty()) << "Non-empty LCS for an empty path";
+  EXPECT_TRUE(longest_common_subsequence(empty, sequence).empty()) << "Non-empty LCS for an empty reference";
+  EXPECT_EQ(longest_common_subsequence(sequence, sequence), quadratic_lcs(sequence, sequence)) << "Invalid LCS for identical sequences";
+}
+
+TEST(LongestCommonSubsequence, RandomSequences)
+{
+  std::mt19937_64 rng(0xACDC);
+  for(size_t test = 0; test < 2000; test++)
+  {
+    size_t ref_len = rng() % 300, path_len = rng() % 300, alphabet = 1 + rng() % 16;
+    gbwt::vector_type reference(ref_len), path;
+    for(auto& node : reference) { node = 2 + 2 * (rng() % alphabet); }
+    if(test & 1)
+    {
+      // A haplotype that mostly follows the reference.
+      path = reference;
+      for(size_t i = 0; i < 5; i++)
+      {
+        if(!(path.empty())) { path.erase(path.begin() + rng() % path.size()); }
+        path.insert(path.begin() + rng() % (path.size() + 1), 2 + 2 * (rng() % alphabet));
+      }
+    }
+    else
+    {
+      for(size_t i = 0; i < path_len; i++) { path.push_back(2 + 2 * (rng() % alphabet)); }
+    }
+    ASSERT_EQ(longest_common_subsequence(reference, path), quadratic_lcs(reference, path)) << "Invalid LCS in test " << test;
+  }
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace
@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <random>
+
 #include <gbwtgraph/utils.h>
 #include <gbwtgraph/gfa.h>
 
@@ -431,4 +433,62 @@ TEST_F(MetadataBuilderTest, MultipleJobs)
 
 //------------------------------------------------------------------------------
 
+std::string
+naive_reverse_complement(const std::string& seq)
+{
+  std::string result;
+  for(auto iter = seq.rbegin(); iter != seq.rend(); ++iter)
+  {
+    switch(*iter)
+    {
+    case 'A': result.push_back('T'); break;
+    case 'C': result.push_back('G'); break;
+    case 'G': result.push_back('C'); break;
+    case 'T': result.push_back('A'); break;
+    case 'a': result.push_back('t'); break;
+    case 'c': result.push_back('g'); break;
+    case 'g': result.push_back('c'); break;
+    case 't': result.push_back('a'); break;
+    case 'n': result.push_back('n'); break;
+    case 'R': result.push_back('Y'); break;
+    case 'Y': result.push_back('R'); break;
+    default: result.push_back('N'); break;
+    }
+  }
+  return result;
+}
+
+TEST(ReverseComplement, EdgeCases)
+{
+  std::vector<std::string> sequences = { "", "A", "AC", "GATTACA", "gattaca", "NNAN", "ACGTRY" };
+  for(const std::string& seq : sequences)
+  {
+    EXPECT_EQ(reverse_complement(seq), naive_reverse_complement(seq)) << "Wrong reverse complement for " << seq;
+  }
+}
+
+TEST(ReverseComplement, RandomSequences)
+{
+  std::mt19937_64 rng(0xACDC);
+  std::string alphabet = "ACGTNacgtnRY";
+  for(size_t length = 0; length <= 300; length++)
+  {
+    for(bool simple : { true, false })
+    {
+      std::string seq(length, 'A');
+      for(size_t i = 0; i < length; i++)
+      {
+        // Mostly simple characters with some IUPAC codes.
+        size_t limit = (simple || rng() % 8 != 0 ? 10 : alphabet.length());
+        seq[i] = alphabet[rng() % limit];
+      }
+      std::string in_place = seq;
+      reverse_complement_in_place(in_place);
+      EXPECT_EQ(in_place, naive_reverse_complement(seq)) << "Wrong reverse complement for a sequence of length " << length << ", simple = " << simple;
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+
 } // namespace